@@ -0,0 +1,144 @@
+/* auditar.c — Auditoría del libro mayor de SecureBank
+ *   ● Con shm_id se adjunta al banco en marcha y recorre la tabla con todas
+ *     las franjas bloqueadas: la foto es coherente y las operaciones sólo
+ *     esperan lo que dura el recorrido.  Sin shm_id carga cuentas.dat en
+ *     una tabla propia; con foto= carga una instantánea (instantaneas.c)
+ *     y comprueba además el total guardado en su cabecera.
+ *   ● Invariantes: ningún saldo negativo y, si se indica total=, que la
+ *     suma coincida (las transferencias no crean ni destruyen dinero).
+ *   ● Lista las cuentas bloqueadas o en negativo (las primeras `listar`).
+ *   ● Sale con 0 si se cumplen los invariantes y 1 si no.
+ *
+ *  Ejecutar:  ./auditar [shm_id] [impl=auto|avx2|sse2|escalar]
+ *                       [total=céntimos] [listar=20] [foto=ruta]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+
+static double ahora_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static ImplAuditoria impl_de(const char *s)
+{
+    if (strcmp(s, "avx2") == 0)    return AUD_AVX2;
+    if (strcmp(s, "sse2") == 0)    return AUD_SSE2;
+    if (strcmp(s, "escalar") == 0) return AUD_ESCALAR;
+    return AUD_AUTO;
+}
+
+static void imprimir_centimos(const char *etiqueta, int64_t c)
+{
+    printf("%-22s %s%lld.%02lld €\n", etiqueta, c < 0 ? "-" : "",
+           llabs(c) / 100, llabs(c) % 100);
+}
+
+int main(int argc, char *argv[])
+{
+    Config cfg = leer_config("config.txt");
+    int shm_id = -1, listar = 20, con_total = 0;
+    int64_t total_esperado = 0;
+    ImplAuditoria impl = AUD_AUTO;
+    const char *foto = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *v = strchr(argv[i], '=');
+        if (!v) { shm_id = atoi(argv[i]); continue; }
+        ++v;
+        if      (strncmp(argv[i], "impl=", 5) == 0)   impl = impl_de(v);
+        else if (strncmp(argv[i], "total=", 6) == 0)  { total_esperado = atoll(v); con_total = 1; }
+        else if (strncmp(argv[i], "listar=", 7) == 0) listar = atoi(v);
+        else if (strncmp(argv[i], "foto=", 5) == 0)   foto = v;
+        else fprintf(stderr, "opción desconocida: %s\n", argv[i]);
+    }
+
+    /* Una instantánea trae su propio total: es el invariante a comprobar */
+    CabeceraFoto cab;
+    if (foto) {
+        if (foto_leer_cabecera(foto, &cab) == -1) return 1;
+        if (!con_total) { total_esperado = cab.total; con_total = 1; }
+        shm_id = -1;
+    }
+
+    /* Sin banco: tabla propia en MODO_SHM con el contenido de cuentas.dat
+     * o de la instantánea                                                */
+    TablaCuentas *t;
+    int propia = shm_id == -1;
+    if (propia) {
+        cfg.modo_cuentas = MODO_SHM;
+        cfg.archivo_wal[0] = '\0';
+        int capacidad = foto ? cab.num_cuentas : contar_cuentas(cfg.archivo_cuentas);
+        if (capacidad < 1) capacidad = 1;
+        shm_id = crear_shm(capacidad, &cfg);
+        t = adjuntar_shm(shm_id);
+        inicializar_tabla(t, capacidad, &cfg);
+        if (foto) foto_cargar(foto, t);
+        else      cargar_cuentas(cfg.archivo_cuentas, t);
+    } else {
+        t = adjuntar_shm(shm_id);
+    }
+
+    Auditoria a = { .max_posiciones = listar > 0 ? listar : 0 };
+    a.posiciones = malloc((a.max_posiciones + 1) * sizeof(int));
+
+    double t0 = ahora_ms();
+    if (!propia) bloquear_todo(t);
+    double t1 = ahora_ms();
+    impl = auditar_tabla(t, &a, impl);
+    double t2 = ahora_ms();
+    if (!propia) desbloquear_todo(t);
+
+    printf("%d cuentas auditadas con %s en %.2f ms", t->num_cuentas,
+           nombre_auditoria(impl), t2 - t1);
+    if (!propia) printf(" (cerrojos: %.2f ms)", t1 - t0);
+    printf("\n");
+    if (foto) {
+        char cuando[32];
+        time_t ts = (time_t)cab.ts;
+        strftime(cuando, sizeof cuando, "%Y-%m-%d %H:%M:%S", localtime(&ts));
+        printf("Instantánea v%u del %s, lsn %llu\n", cab.version, cuando,
+               (unsigned long long)cab.lsn);
+    }
+    printf("\n");
+    imprimir_centimos("Total de saldos", a.total);
+    printf("%-22s %ld\n", "Saldos negativos", a.negativas);
+    printf("%-22s %ld\n", "Cuentas bloqueadas", a.bloqueadas);
+
+    if (a.num_posiciones > 0) {
+        printf("\n%-8s %-24s %14s\n", "cuenta", "titular", "saldo");
+        for (int i = 0; i < a.num_posiciones; ++i) {
+            Cuenta c;
+            leer_cuenta(t, a.posiciones[i], &c);
+            int64_t s = saldos_tabla(t)[a.posiciones[i]];
+            char saldo[32];
+            snprintf(saldo, sizeof saldo, "%s%lld.%02lld", s < 0 ? "-" : "",
+                     llabs(s) / 100, llabs(s) % 100);
+            printf("%-8d %-24.24s %14s%s%s\n", c.numero_cuenta, c.titular, saldo,
+                   s < 0 ? " negativa" : "", c.bloqueado ? " bloqueada" : "");
+        }
+        long marcadas = a.negativas + a.bloqueadas;
+        if (marcadas > a.num_posiciones)
+            printf("… y otras (listar=%d)\n", a.max_posiciones);
+    }
+
+    int ok = a.negativas == 0;
+    if (con_total && a.total != total_esperado) {
+        imprimir_centimos("¡Total esperado!", total_esperado);
+        ok = 0;
+    }
+    puts(ok ? "\nInvariantes: OK" : "\nInvariantes: INCUMPLIDOS");
+
+    free(a.posiciones);
+    if (propia) destruir_tabla(t);
+    liberar_shm(t, propia ? shm_id : -1);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/* auditoria.c — Recorrido del libro mayor por columnas
+ *
+ *  ▸ Suma todos los saldos (céntimos), cuenta los negativos y las cuentas
+ *    bloqueadas y apunta sus posiciones, leyendo sólo las columnas saldos
+ *    y estados de la tabla (ni números ni titulares).
+ *  ▸ Tres versiones con el mismo resultado: AVX2 (4 saldos por carga),
+ *    SSE2 (2) y escalar.  AUD_AUTO elige la mejor que ofrezca la CPU en
+ *    tiempo de ejecución; fuera de x86-64 sólo existe la escalar.
+ *  ▸ Los negativos salen del bit de signo (movemask_pd), que SSE2 ya tiene
+ *    sin comparaciones de 64 bits.  Se avanza de 32 en 32 cuentas para que
+ *    cada bloque dé una máscara de 32 bits de saldos negativos y otra de
+ *    estados bloqueados.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "utils.h"
+
+#define BLOQUE 32
+
+/* Apunta las posiciones marcadas del bloque que empieza en `base`. */
+static void anotar_marcadas(Auditoria *a, int base, uint32_t negativas, uint32_t bloqueadas) {
+    a->negativas  += __builtin_popcount(negativas);
+    a->bloqueadas += __builtin_popcount(bloqueadas);
+
+    uint32_t m = negativas | bloqueadas;
+    while (m && a->num_posiciones < a->max_posiciones) {
+        a->posiciones[a->num_posiciones++] = base + __builtin_ctz(m);
+        m &= m - 1;
+    }
+}
+
+static void auditar_escalar(const int64_t *saldos, const uint8_t *estados,
+                            int desde, int n, Auditoria *a) {
+    for (int i = desde; i < n; i += BLOQUE) {
+        int fin = i + BLOQUE < n ? i + BLOQUE : n;
+        uint32_t neg = 0, bloq = 0;
+        for (int k = i; k < fin; ++k) {
+            a->total += saldos[k];
+            neg  |= (uint32_t)(saldos[k] < 0) << (k - i);
+            bloq |= (uint32_t)((estados[k] & ESTADO_BLOQUEADA) != 0) << (k - i);
+        }
+        anotar_marcadas(a, i, neg, bloq);
+    }
+}
+
+#if defined(__x86_64__)
+
+/* Devuelve cuántas cuentas cubrió (múltiplo de BLOQUE); el resto, escalar. */
+static int auditar_sse2(const int64_t *saldos, const uint8_t *estados, int n, Auditoria *a) {
+    __m128i suma = _mm_setzero_si128(), cero = _mm_setzero_si128();
+    __m128i bit  = _mm_set1_epi8(ESTADO_BLOQUEADA);
+    int i = 0;
+
+    for (; i + BLOQUE <= n; i += BLOQUE) {
+        uint32_t neg = 0;
+        for (int k = 0; k < BLOQUE; k += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(saldos + i + k));
+            suma = _mm_add_epi64(suma, v);
+            neg |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(v)) << k;
+        }
+        __m128i e0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(estados + i)), bit);
+        __m128i e1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(estados + i + 16)), bit);
+        uint32_t libres = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(e0, cero))
+                        | (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(e1, cero)) << 16;
+        if (neg | ~libres) anotar_marcadas(a, i, neg, ~libres);
+    }
+
+    int64_t p[2];
+    _mm_storeu_si128((__m128i *)p, suma);
+    a->total += p[0] + p[1];
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int auditar_avx2(const int64_t *saldos, const uint8_t *estados, int n, Auditoria *a) {
+    __m256i suma = _mm256_setzero_si256(), cero = _mm256_setzero_si256();
+    __m256i bit  = _mm256_set1_epi8(ESTADO_BLOQUEADA);
+    int i = 0;
+
+    for (; i + BLOQUE <= n; i += BLOQUE) {
+        uint32_t neg = 0;
+        for (int k = 0; k < BLOQUE; k += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(saldos + i + k));
+            suma = _mm256_add_epi64(suma, v);
+            neg |= (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(v)) << k;
+        }
+        __m256i e = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(estados + i)), bit);
+        uint32_t libres = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(e, cero));
+        if (neg | ~libres) anotar_marcadas(a, i, neg, ~libres);
+    }
+
+    int64_t p[4];
+    _mm256_storeu_si256((__m256i *)p, suma);
+    a->total += p[0] + p[1] + p[2] + p[3];
+    return i;
+}
+
+#endif
+
+/*─────────────────────────────────────────────*/
+/*                 INTERFAZ                    */
+/*─────────────────────────────────────────────*/
+
+/* La versión que se usará de verdad al pedir `impl` en esta CPU. */
+ImplAuditoria auditoria_disponible(ImplAuditoria impl) {
+#if defined(__x86_64__)
+    int avx2 = __builtin_cpu_supports("avx2");
+    if (impl == AUD_AUTO) return avx2 ? AUD_AVX2 : AUD_SSE2;
+    if (impl == AUD_AVX2 && !avx2) return AUD_SSE2;
+    return impl;
+#else
+    (void)impl;
+    return AUD_ESCALAR;
+#endif
+}
+
+const char *nombre_auditoria(ImplAuditoria impl) {
+    switch (impl) {
+    case AUD_AVX2: return "avx2";
+    case AUD_SSE2: return "sse2";
+    case AUD_ESCALAR: return "escalar";
+    default: return "auto";
+    }
+}
+
+/* Recorre las n primeras cuentas de las columnas.  a->posiciones (si
+ * max_posiciones > 0) recibe, en orden, las posiciones con saldo negativo
+ * o bloqueadas.  Devuelve la versión usada.                              */
+ImplAuditoria auditar_columnas(const int64_t *saldos, const uint8_t *estados, int n,
+                               Auditoria *a, ImplAuditoria impl) {
+    a->total = 0;
+    a->negativas = a->bloqueadas = 0;
+    a->num_posiciones = 0;
+
+    impl = auditoria_disponible(impl);
+    int hechas = 0;
+#if defined(__x86_64__)
+    if (impl == AUD_AVX2) hechas = auditar_avx2(saldos, estados, n, a);
+    if (impl == AUD_SSE2) hechas = auditar_sse2(saldos, estados, n, a);
+#endif
+    auditar_escalar(saldos, estados, hechas, n, a);
+    return impl;
+}
+
+ImplAuditoria auditar_tabla(TablaCuentas *t, Auditoria *a, ImplAuditoria impl) {
+    return auditar_columnas(saldos_tabla(t), estados_tabla(t), t->num_cuentas, a, impl);
+}
@@ -19,11 +19,23 @@
  *  ▸  Crea la SHM con la tabla de cuentas.
  *  ▸  Inicia un hilo IO que consume una cola-buffer de prioridad
  *       y sincroniza en disco sólo las cuentas modificadas.
- *  ▸  Lanza monitor + varios procesos-usuario en terminales.
+ *  ▸  Lanza el monitor y atiende las sesiones por un socket Unix
+ *       (servidor.c), o bien abre varios procesos-usuario en terminales.
+ *  ▸  Toma instantáneas de la tabla sin pararla (instantaneas.c):
+ *       periódicas, con 'f' + ENTER o con kill -USR2.
+ *  ▸  Con SOCKET_REPLICA manda la tabla y el diario a las réplicas de
+ *       lectura (replicacion.c, ./replica).
  *  ▸  Volca la tabla a disco y libera recursos al terminar.
+ *  ▸  Con PARTICIONES=N en config.txt cada `./banco particion=i` lleva
+ *       sólo las cuentas de la partición i (particiones.c), sin terminales
+ *       de usuario ni SOCKET_BANCO: las sesiones van por ./usuario
+ *       particiones.
+ *  ▸  Al cerrar rechaza las operaciones nuevas de cualquier proceso
+ *       adjunto y espera a las que estaban dentro antes del último punto
+ *       de control.
  *
  *  Compilar:   gcc -D_POSIX_C_SOURCE=200809L banco.c -o banco -pthread
- *  Ejecutar:   ./banco
+ *  Ejecutar:   ./banco   |   ./banco particion=<i>
  */
 #define _POSIX_C_SOURCE 200809L          /* nanosleep(), strdup() … */
 
@@ -43,28 +55,106 @@
 
 
 #define MAX_PROCESOS  100
-#define BUF_CAP       64                 /* capacidad de la cola */
+#define ESPERA_CIERRE_MS 2000            /* a operaciones y procesos adjuntos */
 
 
 
+/* Espera hasta `espera_ms` a que banco sea el único proceso adjunto al
+ * segmento SysV; devuelve cuántos otros quedan (0 con SEGMENTO=posix, que
+ * no lleva la cuenta: ahí sólo vale operaciones_cerrar()).              */
+static int esperar_adjuntos(int shm_id, int espera_ms)
+{
+    struct timespec pausa = {0, 10000000L};
+    struct shmid_ds ds;
+    for (int ms = 0; shm_id >= 0 && shmctl(shm_id, IPC_STAT, &ds) == 0; ms += 10) {
+        if (ds.shm_nattch <= 1 || ms >= espera_ms) return (int)ds.shm_nattch - 1;
+        nanosleep(&pausa, NULL);
+    }
+    return 0;
+}
+
+/* Deja cuentas.dat completo y sincronizado con la tabla en memoria.  -1
+ * si no se pudo: entonces el diario no se trunca, que es lo único que
+ * permite rehacerlo.                                                     */
+static int guardar_punto_control(TablaCuentas *tabla)
+{
+    if (tabla->modo == MODO_SHM)
+        return volcar_cuentas(tabla->archivo_cuentas, tabla);
+    return sincronizar_cuentas(tabla);
+}
+
+static void manejar_usr2(int sig)
+{
+    (void)sig;
+    instantanea_pedir();
+}
+
                 /*────────── 4.  Programa principal  ──────────*/
-int main(void)
+int main(int argc, char *argv[])
 {
-    /* 4.1 leer config */
+    /* 4.1 leer config; una partición usa sus propios ficheros */
     Config cfg = leer_config("config.txt");
-    setenv("SECUREBANK_FILE", cfg.archivo_cuentas, 1);   /* visible al hilo */
-
-    int shm_id = crear_shm();
-    TablaCuentas *tabla = adjuntar_shm(shm_id);
+    registro_backend(cfg.backend_es);
+    registro_historial(&cfg);
 
+    int particion = -1;
+    for (int i = 1; i < argc; ++i) sscanf(argv[i], "particion=%d", &particion);
+    if (particion >= cfg.particiones || (particion < 0 && cfg.particiones > 1)) {
+        fprintf(stderr, "Con PARTICIONES=%d: %s particion=<0..%d>\n",
+                cfg.particiones, argv[0], cfg.particiones - 1);
+        exit(EXIT_FAILURE);
+    }
+    /* servidor.c opera sobre una sola tabla: una partición aceptaría
+     * sesiones de cuentas que no son suyas.                            */
+    if (cfg.particiones > 1 && cfg.socket_banco[0]) {
+        fprintf(stderr, "SOCKET_BANCO no admite PARTICIONES=%d: quítalo de config.txt"
+                        " y abre las sesiones con ./usuario particiones\n", cfg.particiones);
+        exit(EXIT_FAILURE);
+    }
+    if (particion >= 0) config_particion(&cfg, particion);
+    if (reservar_cuentas(cfg.archivo_cuentas) == -1) {
+        fprintf(stderr, "%s está en uso por otro banco o por ./liquidar\n", cfg.archivo_cuentas);
+        exit(EXIT_FAILURE);
+    }
+    setenv("SECUREBANK_FILE", cfg.archivo_cuentas, 1);   /* visible al hilo */
+    if (particion <= 0) {                /* el historial es común a todas */
+        int migrados = historial_migrar(&cfg);
+        if (migrados > 0)
+            printf("Historial: %d apuntes importados de transacciones/\n", migrados);
+    }
 
-    tabla->num_cuentas = cargar_cuentas(cfg.archivo_cuentas, tabla->cuentas);
+    /* 4.2 SHM dimensionada según el nº de cuentas del fichero.  En
+     *     MODO_MMAP cuentas.dat se proyecta en lugar de leerse: las
+     *     columnas se cargan de ahí y ahí se guarda el punto de control. */
+    int capacidad = contar_cuentas(cfg.archivo_cuentas);
+    if (capacidad < 1) capacidad = 1;
 
-    inicializar_mutex_proceso_compartido(&tabla->mutex);
+    int shm_id = particion >= 0 ? crear_shm_particion(particion, capacidad, &cfg)
+                                : crear_shm(capacidad, &cfg);
+    TablaCuentas *tabla = adjuntar_shm(shm_id);
+    inicializar_tabla(tabla, capacidad, &cfg);
+    metricas_registrar(tabla, "banco");
 
+    cargar_cuentas(cfg.archivo_cuentas, tabla);
 
-    /* buffer prioridad vacío */
-    tabla->buffer.n = 0;
+    /* 4.3 recuperación: reaplicar el diario sobre el último punto de
+     *     control (y, en una partición, las ramas de transferencias entre
+     *     particiones que no llegaron a él), guardar uno nuevo y empezar
+     *     un diario vacío                                                */
+    int recuperados = wal_recuperar(tabla);
+    int ramas = particion >= 0 ? dosfases_resolver(tabla, &cfg, particion) : 0;
+    if (recuperados > 0 || ramas > 0) {
+        printf("Recuperadas %d operaciones del diario %s y %d ramas de %s\n",
+               recuperados, cfg.archivo_wal, ramas, cfg.archivo_2pc);
+        if (guardar_punto_control(tabla) == -1) {
+            fprintf(stderr, "%s: no se pudo guardar el punto de control; el diario %s se "
+                            "conserva\n", cfg.archivo_cuentas, cfg.archivo_wal);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (particion >= 0) dosfases_cerrar_resueltas(&cfg);
+    wal_truncar(&tabla->wal);
+    if (particion >= 0) dosfases_vigilar_diario(&cfg, particion);
 
     /* 4.4 hilo IO asíncrono */
     pthread_t hilo_io;
@@ -72,18 +162,42 @@ int main(void)
         perror("pthread_create"); exit(EXIT_FAILURE);
     }
 
+    /* 4.4b instantáneas: periódicas y a petición (SIGUSR2 o 'f') */
+    instantaneas_iniciar(tabla, &cfg);
+    if (cfg.socket_replica[0]) {
+        replicacion_iniciar(tabla, &cfg);
+        printf("Réplicas de lectura en el socket %s (./replica)\n", cfg.socket_replica);
+    }
+    struct sigaction sa = { .sa_handler = manejar_usr2 };
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, NULL);
+
     /* 4.5 lanzar monitor + usuarios */
     pid_t pids[MAX_PROCESOS];
     int   n = 0;
 
     if ((pids[n] = fork()) == 0) {             /* monitor */
-        execlp("gnome-terminal","gnome-terminal","--","bash","-c","./monitor", (char*)NULL);
+        char cmd[64];
+        snprintf(cmd, sizeof cmd, "./monitor %d", shm_id);
+        execlp("gnome-terminal","gnome-terminal","--","bash","-c",cmd,(char*)NULL);
         perror("monitor"); _exit(EXIT_FAILURE);
     }
     ++n;
 
+    /* Con SOCKET_BANCO las sesiones llegan por el socket (./cliente) y las
+     * atiende el pool de hilos de servidor.c; si no, una terminal por
+     * usuario como siempre.                                              */
+    int con_servidor = cfg.socket_banco[0] != '\0';
+    if (con_servidor) {
+        servidor_iniciar(tabla, &cfg);
+        printf("Sesiones en el socket %s (./cliente), %d hilos\n",
+               cfg.socket_banco, cfg.hilos_servidor);
+    }
+
     struct timespec pausa = {0, 200000000L};   /* 0,2 s entre terminales */
-    for (int i = 0; i < cfg.num_hilos && n < MAX_PROCESOS; ++i) {
+    int con_terminales = !con_servidor && particion < 0;
+    for (int i = 0; i < cfg.num_hilos && n < MAX_PROCESOS && con_terminales; ++i) {
         if ((pids[n] = fork()) == 0) {
             char cmd[64];
             snprintf(cmd, sizeof cmd, "./usuario %d", shm_id);
@@ -94,19 +208,58 @@ int main(void)
         nanosleep(&pausa, NULL);
     }
 
-    puts("Todos los procesos lanzados.  Pulse ENTER para cerrar…");
-    getchar();
+    printf("Segmento SHM %d (./bench carga %d genera carga sin terminales)\n",
+           shm_id, shm_id);
+    if (particion >= 0)
+        printf("Partición %d de %d (%s); sesiones con ./usuario particiones\n",
+               particion, cfg.particiones, cfg.archivo_cuentas);
+    puts("Todos los procesos lanzados.  'f' + ENTER toma una instantánea;"
+         " ENTER cierra…");
+    char linea[16];
+    while (fgets(linea, sizeof linea, stdin) && linea[0] == 'f')
+        instantanea_pedir();
 
-    /* 4.6 finalización limpia */
+    /* 4.6 finalización limpia: pids[] son las terminales, no monitor ni
+     *     usuarios; a ellos se llega por el pid de su ranura de métricas.
+     *     SIGTERM les deja vaciar sus logs; a quien siga vivo tras medio
+     *     segundo se le mata (y lo que no vació se pierde).               */
+    int senalados = metricas_senalar(tabla, "monitor", SIGTERM);
+    if (con_terminales) senalados += metricas_senalar(tabla, "usuario", SIGTERM);
+    for (int i = 0; i < n; ++i) kill(pids[i], SIGTERM);
+    struct timespec gracia = {0, 500000000L};
+    if (senalados > 0) nanosleep(&gracia, NULL);
+    metricas_senalar(tabla, "monitor", SIGKILL);
+    if (con_terminales) metricas_senalar(tabla, "usuario", SIGKILL);
     for (int i = 0; i < n; ++i) kill(pids[i], SIGKILL);
 
-    pthread_cancel(hilo_io);
-    pthread_join(hilo_io, NULL);
+    if (con_servidor) servidor_detener();
+    if (cfg.socket_replica[0]) replicacion_detener();
+    instantaneas_detener();
 
-    volcar_cuentas(cfg.archivo_cuentas, tabla->cuentas, tabla->num_cuentas);
+    /* 4.7 quien siga adjunto por su cuenta (./usuario particiones, ./lote,
+     *     ./bench carga) ya no cambia saldos: sus operaciones acaban o se
+     *     rechazan antes del último punto de control y del truncado.     */
+    int dentro = operaciones_cerrar(tabla, ESPERA_CIERRE_MS);
+    if (dentro > 0)
+        fprintf(stderr, "%d operaciones sin acabar tras %d ms (¿un proceso murió a medias?)\n",
+                dentro, ESPERA_CIERRE_MS);
+    int adjuntos = esperar_adjuntos(shm_id, ESPERA_CIERRE_MS);
+    if (adjuntos > 0)
+        printf("%d procesos siguen adjuntos al segmento; ya no pueden operar\n", adjuntos);
 
+    detener_entrada_salida(tabla);
+    pthread_join(hilo_io, NULL);
+
+    if (particion >= 0) dosfases_resolver(tabla, &cfg, particion);
+    if (guardar_punto_control(tabla) == 0) {
+        if (particion >= 0) dosfases_cerrar_resueltas(&cfg);
+        wal_truncar(&tabla->wal);
+    } else {
+        fprintf(stderr, "%s: no se pudo guardar el punto de control; el diario %s se "
+                        "conserva para el próximo arranque\n", cfg.archivo_cuentas, cfg.archivo_wal);
+    }
 
-    destruir_mutex(&tabla->mutex);
+    destruir_tabla(tabla);
     liberar_shm(tabla, shm_id);
 
 
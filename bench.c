@@ -0,0 +1,1548 @@
+/* bench.c — Banco de pruebas de SecureBank
+ *
+ *  ▸ Crea su propia tabla en SHM con cuentas sintéticas (no necesita banco).
+ *  ▸ cerrojos: para 1..NUM_HILOS procesos lanza transferencias y depósitos
+ *    aleatorios y compara un único cerrojo (equivalente al antiguo
+ *    tabla->mutex global) con los cerrojos por franja.
+ *  ▸ wal: NUM_HILOS procesos hacen depósitos con el diario activo y se mide
+ *    throughput, latencia de commit y registros por fsync para varias
+ *    ventanas de commit en grupo.
+ *  ▸ Un hilo del proceso padre vacía el buffer de E/S sin tocar disco.
+ *  ▸ carga: se adjunta al segmento de un banco en marcha (su hilo IO hace
+ *    el volcado real) y lanza procesos × hilos con una mezcla de depósitos,
+ *    retiros, transferencias y consultas sobre cuentas elegidas de forma
+ *    uniforme o Zipf.  Informa ops/s y p50/p99/p999 por tipo.
+ *  ▸ es: compara BACKEND_ES=posix con uring.  Primero el volcado real del
+ *    hilo IO sobre un cuentas.dat temporal bajo depósitos continuos (con y
+ *    sin fdatasync); después líneas por segundo repartidas en varios logs
+ *    globales.
+ *  ▸ lote: nóminas de k apuntes con el diario activo, como k-1
+ *    transferencias sueltas o como un único op_lote; apuntes/s de cada una.
+ *  ▸ auditoria: recorre num_cuentas saldos y estados sintéticos (por
+ *    defecto 10 millones) con las versiones escalar, SSE2 y AVX2 de
+ *    auditoria.c, comprueba que coinciden y da ms y GB/s de cada una.
+ *  ▸ reglas: pasa eventos sintéticos (reloj simulado a `tasa` eventos/s)
+ *    por el motor de reglas del monitor con las REGLA= de config.txt, cada
+ *    una sola y todas juntas; eventos/s, ns por evento y alertas.
+ *  ▸ monitor: los mismos eventos por la tubería del monitor (tuberia.c)
+ *    con 1, 2, 4… hilos de análisis hasta HILOS_MONITOR, escribiendo el log
+ *    en un fichero temporal; eventos/s y escrituras del sumidero.
+ *  ▸ particiones: reparte num_cuentas entre 1, 2, 4… particiones (hasta
+ *    PARTICIONES, o 4), cada una con su tabla, su diario y su vaciador, y
+ *    lanza `procesos` por partición con depósitos y transferencias por el
+ *    enrutador: primero todas dentro de una partición, después con destino
+ *    al azar (las que cruzan van en dos fases).  ops/s totales y por
+ *    partición.
+ *  ▸ replica: NUM_HILOS procesos de depósitos con el diario y hilos que
+ *    consultan saldos y auditan la tabla, primero sin lectores, después
+ *    leyendo del primario y por último de una réplica (replicacion.c) en
+ *    otro proceso.  Escrituras/s y p99 de cada caso; la réplica informa
+ *    de su retraso y de lo que tarda en ponerse al día.
+ *  ▸ segmento: carga num_cuentas en segmentos SysV y POSIX con páginas
+ *    normales, THP o hugetlb y con o sin precarga (los POSIX crecen desde
+ *    1024 cuentas) y mide búsquedas al azar desde otra proyección: la
+ *    primera pasada con sus fallos de página y otra en caliente con sus
+ *    fallos de dTLB (perf_event_open, si se deja).
+ *  ▸ liquidacion: liquida num_cuentas sintéticas (por defecto 10 millones)
+ *    con 1, 2, 4… hilos escribiendo el extracto, y compara guardar la
+ *    tabla de una vez con un apunte por cuenta por el hilo IO.
+ *  ▸ historial: escribe `apuntes` en el historial por cuenta (historial.c)
+ *    de un directorio temporal, rotando cada TAM_SEGMENTO_HISTORIAL MB, con
+ *    una de cada diez en la misma cuenta.  Apuntes/s y segmentos; después
+ *    µs por consulta (últimos 50 y un intervalo de un minuto) frente a
+ *    recorrer un log de texto con las mismas líneas de esa cuenta.
+ *
+ *  Compilar:  ver docs/COMPILATION.md
+ *  Ejecutar:  ./bench [cerrojos|wal|es|lote] [segundos] [num_cuentas]
+ *             ./bench auditoria [repeticiones=5] [num_cuentas=10000000]
+ *             ./bench reglas [eventos=10000000] [num_cuentas=100000] [tasa=100000]
+ *             ./bench segmento [busquedas=2000000] [num_cuentas=1000000]
+ *             ./bench liquidacion [num_cuentas=10000000] [hilos=CPUs]
+ *             ./bench historial [apuntes=2000000] [num_cuentas=100000]
+ *             ./bench monitor [eventos=5000000] [num_cuentas=100000] [tasa=100000]
+ *             ./bench particiones [segundos=2] [num_cuentas=100000] [procesos=2]
+ *             ./bench replica [segundos=2] [num_cuentas=100000] [lectores=2]
+ *             ./bench carga <shm_id> [segundos=5] [procesos=NUM_HILOS] [hilos=1]
+ *                   [mezcla=40,20,20,20] [zipf=0] [monto=1]
+ *             (mezcla: % de depósito, retiro, transferencia y saldo;
+ *              zipf=0 es uniforme, zipf=0.99 concentra la carga)
+ */
+#define _GNU_SOURCE                      /* MAP_ANONYMOUS */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "utils.h"
+
+#define MAX_PROC      64
+#define MAX_HILOS     256                /* procesos × hilos en modo carga */
+#define CUBETAS_LAT   160                /* log-lineal: 4 cubetas por potencia de 2 ns */
+#define TIPOS_CARGA   4
+
+/* Resultados de cada proceso o hilo (mmap compartido) */
+typedef struct {
+    long ops;
+    long fallos;                         /* saldo insuficiente, cuenta inexistente */
+    long lat[CUBETAS_LAT];
+} Medida;
+
+static const char *nombres_tipo[TIPOS_CARGA] = {
+    "deposito", "retiro", "transferencia", "saldo"
+};
+
+static Medida       *medidas;
+static volatile int  midiendo;
+
+static double ahora(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Hace de hilo IO sin disco: vacía el buffer para que la contrapresión de
+ * buffer_push() no detenga a los trabajadores.                           */
+static void *vaciador(void *arg)
+{
+    TablaCuentas *t = arg;
+    Operacion op;
+    while (midiendo)
+        if (!buffer_pop(&t->buffer, &op)) sched_yield();
+    while (buffer_pop(&t->buffer, &op)) ;
+    return NULL;
+}
+
+/* Cubetas 0..3: 0..3 ns exactos.  Después, cada potencia de 2 se parte en
+ * 4 cubetas, así el error de un percentil es como mucho del 25 %.        */
+static void anotar_latencia(Medida *m, double segundos)
+{
+    unsigned long ns = (unsigned long)(segundos * 1e9);
+    int c = (int)ns;
+    if (ns >= 4) {
+        int o = 63 - __builtin_clzl(ns);
+        c = 4 * (o - 1) + (int)((ns >> (o - 2)) & 3);
+    }
+    m->lat[c < CUBETAS_LAT ? c : CUBETAS_LAT - 1]++;
+}
+
+static double limite_cubeta(int c)
+{
+    if (c < 4) return c + 1;
+    return (double)(5 + c % 4) * (double)(1UL << (c / 4 - 1));
+}
+
+/* Cota superior (µs) del percentil p a partir del histograma agregado. */
+static double percentil(const long *lat, long total, double p)
+{
+    long acum = 0;
+    for (int c = 0; c < CUBETAS_LAT; ++c) {
+        acum += lat[c];
+        if (acum >= p * total) return limite_cubeta(c) / 1000.0;
+    }
+    return limite_cubeta(CUBETAS_LAT - 1) / 1000.0;
+}
+
+static void sumar_medida(Medida *total, const Medida *m)
+{
+    total->ops    += m->ops;
+    total->fallos += m->fallos;
+    for (int c = 0; c < CUBETAS_LAT; ++c) total->lat[c] += m->lat[c];
+}
+
+static void trabajador_cerrojos(TablaCuentas *t, Medida *m, double fin)
+{
+    unsigned semilla = (unsigned)getpid();
+
+    while (ahora() < fin) {
+        for (int k = 0; k < 256; ++k) {
+            int a = 1001 + rand_r(&semilla) % t->num_cuentas;
+            int b = 1001 + rand_r(&semilla) % t->num_cuentas;
+            if (k & 1) op_deposito(t, a, 100);
+            else       op_transferencia(t, a, b, 100);
+        }
+        m->ops += 256;
+    }
+}
+
+static void trabajador_wal(TablaCuentas *t, Medida *m, double fin)
+{
+    unsigned semilla = (unsigned)getpid();
+
+    for (double t0 = ahora(); t0 < fin; ) {
+        op_deposito(t, 1001 + rand_r(&semilla) % t->num_cuentas, 100);
+        double t1 = ahora();
+        anotar_latencia(m, t1 - t0);
+        m->ops++;
+        t0 = t1;
+    }
+}
+
+/* Nómina: una cuenta paga a tam_nomina - 1 cuentas al azar. */
+static int tam_nomina;
+
+static void trabajador_nomina_suelta(TablaCuentas *t, Medida *m, double fin)
+{
+    unsigned semilla = (unsigned)getpid();
+
+    while (ahora() < fin) {
+        int pagador = 1001 + rand_r(&semilla) % t->num_cuentas;
+        for (int k = 1; k < tam_nomina; ++k)
+            op_transferencia(t, pagador, 1001 + rand_r(&semilla) % t->num_cuentas, 1);
+        m->ops += tam_nomina;
+    }
+}
+
+static void trabajador_nomina_lote(TablaCuentas *t, Medida *m, double fin)
+{
+    unsigned semilla = (unsigned)getpid();
+    Apunte apuntes[MAX_APUNTES];
+
+    while (ahora() < fin) {
+        apuntes[0].cuenta   = 1001 + rand_r(&semilla) % t->num_cuentas;
+        apuntes[0].centimos = -(tam_nomina - 1);
+        for (int k = 1; k < tam_nomina; ++k) {
+            apuntes[k].cuenta   = 1001 + rand_r(&semilla) % t->num_cuentas;
+            apuntes[k].centimos = 1;
+        }
+        if (op_lote(t, apuntes, tam_nomina, 0, NULL) != OP_OK) m->fallos++;
+        m->ops += tam_nomina;
+    }
+}
+
+typedef void (*Trabajador)(TablaCuentas *, Medida *, double);
+
+/* Lanza `procesos` trabajadores durante `segundos` y agrega sus medidas
+ * en medidas[MAX_PROC].  Devuelve ops/s.                                 */
+static double medir(TablaCuentas *t, Trabajador fn, int procesos, double segundos)
+{
+    memset(medidas, 0, (MAX_PROC + 1) * sizeof(Medida));
+    double fin = ahora() + segundos;
+    pthread_t hilo;
+    midiendo = 1;
+    pthread_create(&hilo, NULL, vaciador, t);
+
+    for (int i = 0; i < procesos; ++i) {
+        if (fork() == 0) { fn(t, &medidas[i], fin); _exit(0); }
+    }
+    while (wait(NULL) > 0) ;
+
+    midiendo = 0;
+    pthread_join(hilo, NULL);
+
+    Medida *total = &medidas[MAX_PROC];
+    for (int i = 0; i < procesos; ++i) sumar_medida(total, &medidas[i]);
+    return total->ops / segundos;
+}
+
+static TablaCuentas *crear_tabla_sintetica(Config *cfg, int n, int *shm_id)
+{
+    *shm_id = crear_shm(n, cfg);
+    TablaCuentas *t = adjuntar_shm(*shm_id);
+    inicializar_tabla(t, n, cfg);
+
+    for (int i = 0; i < n; ++i) {
+        Cuenta c = { .numero_cuenta = 1001 + i, .formato = FORMATO_CUENTA, .saldo = 100000000 };
+        snprintf(c.titular, sizeof c.titular, "Cliente %d", 1001 + i);
+        insertar_cuenta(t, &c);
+    }
+    return t;
+}
+
+static void bench_cerrojos(TablaCuentas *t, int max_proc, double segundos)
+{
+    printf("%-9s %16s %16s %9s\n", "procesos", "global (ops/s)",
+           "franjas (ops/s)", "mejora");
+
+    for (int p = 1; p <= max_proc; ++p) {
+        t->num_cerrojos = 1;
+        double global = medir(t, trabajador_cerrojos, p, segundos);
+        t->num_cerrojos = MAX_CERROJOS;
+        double franjas = medir(t, trabajador_cerrojos, p, segundos);
+        printf("%-9d %16.0f %16.0f %8.2fx\n", p, global, franjas, franjas / global);
+    }
+}
+
+static void bench_lote(TablaCuentas *t, int procesos, double segundos)
+{
+    static const int tamanos[] = { 2, 10, 100, 1000 };
+
+    printf("%-8s %18s %18s %9s\n", "apuntes", "sueltas (ap./s)", "op_lote (ap./s)", "mejora");
+    for (size_t i = 0; i < sizeof tamanos / sizeof tamanos[0]; ++i) {
+        tam_nomina = tamanos[i];
+        wal_truncar(&t->wal);
+        double sueltas = medir(t, trabajador_nomina_suelta, procesos, segundos);
+        wal_truncar(&t->wal);
+        double lote = medir(t, trabajador_nomina_lote, procesos, segundos);
+        printf("%-8d %18.0f %18.0f %8.2fx\n", tam_nomina, sueltas, lote, lote / sueltas);
+    }
+    unlink(t->wal.archivo);
+}
+
+static void bench_wal(TablaCuentas *t, int procesos, double segundos)
+{
+    static const int ventanas[] = { 0, 50, 200, 1000, 5000 };
+
+    printf("%-12s %12s %12s %12s %16s\n", "ventana(µs)", "ops/s",
+           "p50 (µs)", "p99 (µs)", "registros/fsync");
+
+    for (size_t v = 0; v < sizeof ventanas / sizeof ventanas[0]; ++v) {
+        wal_truncar(&t->wal);
+        t->wal.ventana_us = ventanas[v];
+        atomic_store(&t->wal.fsyncs, 0);
+
+        double ops = medir(t, trabajador_wal, procesos, segundos);
+        Medida *m  = &medidas[MAX_PROC];
+        long fs    = atomic_load(&t->wal.fsyncs);
+        printf("%-12d %12.0f %12.1f %12.1f %16.1f\n", ventanas[v], ops,
+               percentil(m->lat, m->ops, 0.50), percentil(m->lat, m->ops, 0.99),
+               fs ? (double)m->ops / fs : 0.0);
+    }
+    unlink(t->wal.archivo);
+}
+
+/*─────────────────────────────────────────────*/
+/*         GENERADOR DE CARGA (banco vivo)     */
+/*─────────────────────────────────────────────*/
+
+typedef struct {
+    double segundos;
+    int    procesos, hilos;
+    int    mezcla[TIPOS_CARGA];          /* porcentajes acumulados */
+    double zipf;                         /* exponente; 0 = uniforme */
+    int64_t centimos;                    /* importe de cada operación */
+} Carga;
+
+typedef struct {
+    TablaCuentas *t;
+    const Carga  *c;
+    const double *cdf;                   /* Zipf acumulada, NULL si uniforme */
+    Medida       *m;                     /* TIPOS_CARGA medidas de este hilo */
+    double        fin;
+    uint64_t      semilla;
+} Hilo;
+
+static uint64_t aleatorio(uint64_t *s)
+{
+    *s ^= *s << 13; *s ^= *s >> 7; *s ^= *s << 17;
+    return *s;
+}
+
+/* Distribución acumulada de Zipf sobre los rangos 0..n-1.  Se calcula una
+ * vez en el padre; los hijos la heredan con fork.                        */
+static double *crear_zipf(int n, double s)
+{
+    double *cdf = malloc((size_t)n * sizeof(double));
+    if (!cdf) { perror("malloc zipf"); exit(EXIT_FAILURE); }
+    double suma = 0;
+    for (int i = 0; i < n; ++i) cdf[i] = (suma += 1.0 / pow(i + 1, s));
+    for (int i = 0; i < n; ++i) cdf[i] /= suma;
+    return cdf;
+}
+
+/* Posición en la tabla de una cuenta elegida según la distribución. */
+static int elegir_posicion(const Hilo *h, uint64_t *s)
+{
+    int n = h->t->num_cuentas;
+    if (!h->cdf) return (int)(aleatorio(s) % (uint64_t)n);
+
+    double u = (aleatorio(s) >> 11) * 0x1.0p-53;
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (h->cdf[mid] < u) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static void *hilo_carga(void *arg)
+{
+    Hilo *h = arg;
+    int32_t *num = numeros_tabla(h->t);
+    uint64_t s = h->semilla;
+
+    for (double t0 = ahora(); t0 < h->fin; ) {
+        int dado = (int)(aleatorio(&s) % 100), tipo = 0;
+        while (tipo < TIPOS_CARGA - 1 && dado >= h->c->mezcla[tipo]) ++tipo;
+
+        int a = num[elegir_posicion(h, &s)];
+        int64_t saldo;
+        ResultadoOp r;
+        switch (tipo) {
+        case 0:  r = op_deposito(h->t, a, h->c->centimos);    break;
+        case 1:  r = op_retiro(h->t, a, h->c->centimos);      break;
+        case 2: {
+            int b;
+            do b = num[elegir_posicion(h, &s)];
+            while (b == a && h->t->num_cuentas > 1);
+            r = op_transferencia(h->t, a, b, h->c->centimos);
+            break;
+        }
+        default: r = op_saldo(h->t, a, &saldo);               break;
+        }
+
+        double t1 = ahora();
+        anotar_latencia(&h->m[tipo], t1 - t0);
+        h->m[tipo].ops++;
+        if (r != OP_OK) h->m[tipo].fallos++;
+        t0 = t1;
+    }
+    return NULL;
+}
+
+static void proceso_carga(TablaCuentas *t, const Carga *c, const double *cdf,
+                          Medida (*m)[TIPOS_CARGA], int p, double fin)
+{
+    pthread_t hilos[MAX_HILOS];
+    Hilo      args[MAX_HILOS];
+
+    metricas_registrar(t, "bench");
+    for (int i = 0; i < c->hilos; ++i) {
+        int slot = p * c->hilos + i;
+        args[i] = (Hilo){ t, c, cdf, m[slot], fin,
+                          0x9E3779B97F4A7C15ULL * (uint64_t)(slot + 1) ^ (uint64_t)getpid() };
+        pthread_create(&hilos[i], NULL, hilo_carga, &args[i]);
+    }
+    for (int i = 0; i < c->hilos; ++i) pthread_join(hilos[i], NULL);
+}
+
+static void leer_opciones_carga(Carga *c, int argc, char *argv[])
+{
+    for (int i = 0; i < argc; ++i) {
+        int m[TIPOS_CARGA];
+        double euros;
+        if (sscanf(argv[i], "segundos=%lf", &c->segundos) == 1) continue;
+        if (sscanf(argv[i], "procesos=%d",  &c->procesos) == 1) continue;
+        if (sscanf(argv[i], "hilos=%d",     &c->hilos)    == 1) continue;
+        if (sscanf(argv[i], "zipf=%lf",     &c->zipf)     == 1) continue;
+        if (sscanf(argv[i], "monto=%lf",    &euros)       == 1) { c->centimos = a_centimos(euros); continue; }
+        if (sscanf(argv[i], "mezcla=%d,%d,%d,%d", &m[0], &m[1], &m[2], &m[3]) == 4) {
+            for (int k = 0, acum = 0; k < TIPOS_CARGA; ++k)
+                c->mezcla[k] = (acum += m[k]);
+            continue;
+        }
+        fprintf(stderr, "opción desconocida: %s\n", argv[i]);
+        exit(EXIT_FAILURE);
+    }
+    if (c->procesos < 1) c->procesos = 1;
+    if (c->hilos    < 1) c->hilos    = 1;
+    if (c->procesos * c->hilos > MAX_HILOS) {
+        fprintf(stderr, "procesos × hilos no puede pasar de %d\n", MAX_HILOS);
+        exit(EXIT_FAILURE);
+    }
+    if (c->mezcla[TIPOS_CARGA - 1] != 100) {
+        fprintf(stderr, "la mezcla debe sumar 100\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void imprimir_fila(const char *nombre, const Medida *m, double segundos)
+{
+    printf("%-14s %10ld %10.0f %8ld %10.1f %10.1f %10.1f\n", nombre, m->ops,
+           m->ops / segundos, m->fallos,
+           percentil(m->lat, m->ops, 0.50), percentil(m->lat, m->ops, 0.99),
+           percentil(m->lat, m->ops, 0.999));
+}
+
+static int bench_carga(const Config *cfg, int argc, char *argv[])
+{
+    if (argc < 1) {
+        fprintf(stderr, "Uso: ./bench carga <shm_id> [clave=valor ...]\n");
+        return EXIT_FAILURE;
+    }
+    TablaCuentas *t = adjuntar_shm(atoi(argv[0]));
+    if (t->num_cuentas < 1) { fprintf(stderr, "el banco no tiene cuentas\n"); return EXIT_FAILURE; }
+
+    Carga c = { .segundos = 5, .procesos = cfg->num_hilos, .hilos = 1,
+                .mezcla = { 40, 60, 80, 100 }, .zipf = 0, .centimos = 100 };
+    leer_opciones_carga(&c, argc - 1, argv + 1);
+
+    double *cdf = c.zipf > 0 ? crear_zipf(t->num_cuentas, c.zipf) : NULL;
+    int slots = c.procesos * c.hilos;
+    size_t tam = (size_t)slots * sizeof(Medida[TIPOS_CARGA]);
+    Medida (*m)[TIPOS_CARGA] = mmap(NULL, tam, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) { perror("mmap"); return EXIT_FAILURE; }
+
+    printf("%d cuentas, %d procesos × %d hilos, %.1f s, mezcla %d/%d/%d/%d, %s",
+           t->num_cuentas, c.procesos, c.hilos, c.segundos, c.mezcla[0],
+           c.mezcla[1] - c.mezcla[0], c.mezcla[2] - c.mezcla[1],
+           c.mezcla[3] - c.mezcla[2], cdf ? "zipf " : "uniforme\n");
+    if (cdf) printf("%.2f\n", c.zipf);
+
+    long esperas0 = atomic_load(&t->buffer.esperas);
+    long fsyncs0  = atomic_load(&t->wal.fsyncs);
+    double inicio = ahora(), fin = inicio + c.segundos;
+
+    for (int p = 0; p < c.procesos; ++p)
+        if (fork() == 0) { proceso_carga(t, &c, cdf, m, p, fin); _exit(0); }
+    while (wait(NULL) > 0) ;
+    double segundos = ahora() - inicio;
+
+    printf("\n%-14s %10s %10s %8s %10s %10s %10s\n", "operación", "ops",
+           "ops/s", "fallos", "p50 (µs)", "p99 (µs)", "p999 (µs)");
+    Medida total = {0};
+    for (int k = 0; k < TIPOS_CARGA; ++k) {
+        Medida tipo = {0};
+        for (int i = 0; i < slots; ++i) sumar_medida(&tipo, &m[i][k]);
+        if (tipo.ops) imprimir_fila(nombres_tipo[k], &tipo, segundos);
+        sumar_medida(&total, &tipo);
+    }
+    imprimir_fila("total", &total, segundos);
+    printf("\nbuffer lleno: %ld esperas · fsyncs del diario: %ld\n",
+           atomic_load(&t->buffer.esperas) - esperas0,
+           atomic_load(&t->wal.fsyncs) - fsyncs0);
+
+    munmap(m, tam);
+    free(cdf);
+    liberar_shm(t, -1);
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*       BACKENDS DE E/S (posix / io_uring)    */
+/*─────────────────────────────────────────────*/
+
+#define ARCHIVO_BENCH_ES  "bench_cuentas.dat"
+#define LINEAS_LOG        200000
+#define LOGS_BENCH        4              /* caben en los logs globales */
+
+static const char *nombres_backend[] = { "posix", "uring" };
+
+/* El hilo IO real (entrada_salida.c) vuelca sobre un cuentas.dat temporal
+ * mientras `procesos` trabajadores depositan sin parar.                  */
+static void bench_es_volcado(Config *cfg, int n, int procesos, double segundos)
+{
+    printf("%-8s %-8s %12s %10s %10s %14s %10s\n", "backend", "fsync", "ops/s",
+           "p99 (µs)", "lotes/s", "cuentas/lote", "esperas");
+
+    for (int f = FSYNC_NUNCA; f <= FSYNC_VOLCADO; ++f) {
+        for (int b = ES_POSIX; b <= ES_URING; ++b) {
+            cfg->politica_fsync = f;
+            cfg->backend_es     = b;
+
+            int shm_id;
+            TablaCuentas *t = crear_tabla_sintetica(cfg, n, &shm_id);
+            volcar_cuentas(ARCHIVO_BENCH_ES, t);
+            setenv("SECUREBANK_FILE", ARCHIVO_BENCH_ES, 1);
+
+            pthread_t io;
+            pthread_create(&io, NULL, gestionar_entrada_salida, t);
+
+            memset(medidas, 0, (MAX_PROC + 1) * sizeof(Medida));
+            double fin = ahora() + segundos;
+            for (int i = 0; i < procesos; ++i)
+                if (fork() == 0) { trabajador_wal(t, &medidas[i], fin); _exit(0); }
+            while (wait(NULL) > 0) ;
+
+            detener_entrada_salida(t);
+            pthread_join(io, NULL);
+
+            Medida *m = &medidas[MAX_PROC];
+            for (int i = 0; i < procesos; ++i) sumar_medida(m, &medidas[i]);
+            long lotes   = atomic_load(&t->lotes_volcados);
+            long cuentas = atomic_load(&t->cuentas_volcadas);
+            printf("%-8s %-8s %12.0f %10.1f %10.0f %14.1f %10ld\n",
+                   nombres_backend[b], f == FSYNC_VOLCADO ? "volcado" : "nunca",
+                   m->ops / segundos, percentil(m->lat, m->ops, 0.99),
+                   lotes / segundos, lotes ? (double)cuentas / lotes : 0.0,
+                   atomic_load(&t->buffer.esperas));
+
+            destruir_tabla(t);
+            liberar_shm(t, shm_id);
+        }
+    }
+    unlink(ARCHIVO_BENCH_ES);
+}
+
+/* Cada backend en un hijo propio (el escritor de registro.c es uno por
+ * proceso) y dentro de un directorio temporal para los logs.            */
+static void bench_es_registro(void)
+{
+    printf("\n%-8s %14s   (%d líneas en %d logs)\n",
+           "backend", "líneas/s", LINEAS_LOG, LOGS_BENCH);
+
+    for (int b = ES_POSIX; b <= ES_URING; ++b) {
+        fflush(stdout);
+        if (fork() == 0) {
+            char dir[] = "/tmp/bench_logXXXXXX";
+            if (!mkdtemp(dir) || chdir(dir) == -1) { perror(dir); _exit(1); }
+
+            static const char *logs[LOGS_BENCH] = { "a.log", "b.log", "c.log", "d.log" };
+            registro_backend(b);
+            registro_global(logs[0], "calentamiento");  /* crea el escritor */
+            double t0 = ahora();
+            char linea[64];
+            for (int i = 0; i < LINEAS_LOG; ++i) {
+                snprintf(linea, sizeof linea, "DEPOSITO %d %d.00", 1001 + i, i);
+                registro_global(logs[i % LOGS_BENCH], linea);
+            }
+            registro_cerrar();                      /* vacía lo pendiente */
+            double dt = ahora() - t0;
+            printf("%-8s %14.0f\n", nombres_backend[b], LINEAS_LOG / dt);
+
+            char cmd[64];
+            snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+            if (system(cmd) != 0) fprintf(stderr, "no se pudo borrar %s\n", dir);
+            fflush(stdout);
+            _exit(0);
+        }
+        wait(NULL);
+    }
+}
+
+/*─────────────────────────────────────────────*/
+/*        AUDITORÍA (escalar / SSE2 / AVX2)    */
+/*─────────────────────────────────────────────*/
+
+static int bench_auditoria(int repeticiones, int n)
+{
+    int64_t *saldos  = aligned_alloc(64, ((size_t)n * sizeof(int64_t) + 63) & ~(size_t)63);
+    uint8_t *estados = aligned_alloc(64, ((size_t)n + 63) & ~(size_t)63);
+    if (!saldos || !estados) { perror("aligned_alloc"); return 1; }
+
+    uint64_t semilla = 42;
+    for (int i = 0; i < n; ++i) {
+        uint64_t r = aleatorio(&semilla);
+        saldos[i]  = (int64_t)(r % 10000000);
+        estados[i] = 0;
+        if (r % 100003 == 0) saldos[i] = -saldos[i] - 1;
+        if (r % 100019 == 1) estados[i] = ESTADO_BLOQUEADA;
+    }
+
+    static const ImplAuditoria impls[] = { AUD_ESCALAR, AUD_SSE2, AUD_AVX2 };
+    int posiciones[64], pos_ref[64];
+    Auditoria ref = { 0 };
+    double ms_ref = 0;
+
+    printf("%d cuentas (%.0f MB de saldos y estados), mejor de %d pasadas\n\n",
+           n, n * 9.0 / 1e6, repeticiones);
+    printf("%-9s %10s %10s %9s %18s %10s %10s\n", "versión", "ms", "GB/s", "mejora",
+           "total (cént.)", "negativas", "bloqueadas");
+
+    for (size_t k = 0; k < sizeof impls / sizeof impls[0]; ++k) {
+        if (auditoria_disponible(impls[k]) != impls[k]) {
+            printf("%-9s %10s\n", nombre_auditoria(impls[k]), "(no disponible)");
+            continue;
+        }
+        Auditoria a = { .posiciones = posiciones, .max_posiciones = 64 };
+        double mejor = 1e30;
+        for (int r = 0; r < repeticiones; ++r) {
+            double t0 = ahora();
+            auditar_columnas(saldos, estados, n, &a, impls[k]);
+            double dt = (ahora() - t0) * 1e3;
+            if (dt < mejor) mejor = dt;
+        }
+        if (k == 0) {
+            ref = a; ms_ref = mejor;
+            memcpy(pos_ref, posiciones, sizeof pos_ref);
+        }
+        int igual = a.total == ref.total && a.negativas == ref.negativas &&
+                    a.bloqueadas == ref.bloqueadas && a.num_posiciones == ref.num_posiciones &&
+                    memcmp(posiciones, pos_ref, a.num_posiciones * sizeof(int)) == 0;
+        printf("%-9s %10.2f %10.2f %8.2fx %18lld %10ld %10ld%s\n",
+               nombre_auditoria(impls[k]), mejor, n * 9.0 / (mejor * 1e6),
+               ms_ref / mejor, (long long)a.total, a.negativas, a.bloqueadas,
+               igual ? "" : "  ¡DISTINTO!");
+    }
+
+    free(saldos);
+    free(estados);
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*        REGLAS DEL MONITOR (eventos/s)       */
+/*─────────────────────────────────────────────*/
+
+#define EVENTOS_BENCH (1 << 20)          /* se repiten desplazando la hora */
+
+/* Depósitos, retiros y transferencias de 1 a 2000 € sobre n cuentas.  Cada
+ * cuenta la usa casi siempre el mismo de 64 procesos; uno de cada mil
+ * eventos llega de otro, para que la regla de sesiones tenga trabajo.    */
+static Evento *crear_eventos(int n, double tasa, int64_t *periodo_ns)
+{
+    Evento *evs = malloc(EVENTOS_BENCH * sizeof(Evento));
+    if (!evs) { perror("malloc eventos"); exit(EXIT_FAILURE); }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t t0 = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    uint64_t semilla = 7;
+    for (int i = 0; i < EVENTOS_BENCH; ++i) {
+        uint64_t r = aleatorio(&semilla);
+        int cuenta = 1000 + (int)(r % (uint64_t)n);
+        int tipo   = (r >> 32) % 10;
+        evs[i] = (Evento){
+            .tipo     = tipo < 4 ? OP_DEPOSITO : tipo < 7 ? OP_RETIRO : OP_TRANSFERENCIA,
+            .cuenta   = { cuenta, tipo < 7 ? -1 : 1000 + (int)((r >> 40) % (uint64_t)n) },
+            .pid      = 10000 + ((r >> 20) % 1000 == 0 ? (int)(r >> 50) : cuenta) % 64,
+            .centimos = 100 + (int64_t)((r >> 8) % 200000),
+            .ts_ns    = t0 + (int64_t)(i * 1e9 / tasa),
+        };
+    }
+    *periodo_ns = (int64_t)(EVENTOS_BENCH * 1e9 / tasa);
+    return evs;
+}
+
+static void medir_reglas(const char *nombre, const Config *c, const Evento *evs,
+                         int64_t periodo_ns, long eventos)
+{
+    static MotorReglas m;
+    motor_iniciar(&m, c);
+    Alerta alertas[MAX_REGLAS];
+    long total = 0;
+
+    double t0 = ahora();
+    for (long i = 0; i < eventos; ++i) {
+        Evento ev = evs[i & (EVENTOS_BENCH - 1)];
+        ev.ts_ns += i / EVENTOS_BENCH * periodo_ns;
+        total += motor_evaluar(&m, &ev, alertas, MAX_REGLAS);
+    }
+    double dt = ahora() - t0;
+
+    size_t entradas = 0, bytes = 0;
+    for (int r = 0; r < m.num_reglas; ++r) {
+        EstadisticasContadores s;
+        ac_estadisticas(&m.estado[r], &s);
+        entradas += s.entradas;
+        bytes    += s.bytes;
+    }
+    printf("%-16s %12.0f %9.1f %10ld %10zu %9zu\n", nombre, eventos / dt,
+           dt * 1e9 / eventos, total, entradas, bytes >> 20);
+    motor_liberar(&m);
+}
+
+static int bench_reglas(const Config *cfg, long eventos, int n, double tasa)
+{
+    int64_t periodo_ns;
+    Evento *evs = crear_eventos(n, tasa, &periodo_ns);
+
+    printf("%ld eventos sobre %d cuentas, %.0f eventos/s de reloj simulado "
+           "(%.0f s), %d reglas\n\n", eventos, n, tasa, eventos / tasa, cfg->num_reglas);
+    printf("%-16s %12s %9s %10s %10s %9s\n", "reglas", "eventos/s", "ns/ev",
+           "alertas", "entradas", "MiB");
+
+    for (int r = 0; r < cfg->num_reglas; ++r) {
+        Config sola = *cfg;
+        sola.reglas[0]  = cfg->reglas[r];
+        sola.num_reglas = 1;
+        medir_reglas(cfg->reglas[r].nombre, &sola, evs, periodo_ns, eventos);
+    }
+    medir_reglas("todas", cfg, evs, periodo_ns, eventos);
+
+    free(evs);
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*        TUBERÍA DEL MONITOR (eventos/s)      */
+/*─────────────────────────────────────────────*/
+
+#define LOTE_MONITOR 256                 /* como el monitor con eventos_recibir */
+
+static int bench_monitor(const Config *cfg, long eventos, int n, double tasa)
+{
+    int64_t periodo_ns;
+    Evento *evs = crear_eventos(n, tasa, &periodo_ns);
+    char ruta[] = "/tmp/bench_monitorXXXXXX";
+    int fd = mkstemp(ruta);
+    if (fd == -1) { perror(ruta); return 1; }
+    close(fd);
+
+    printf("%ld eventos sobre %d cuentas, %d reglas, lotes de %d, log en %s\n\n",
+           eventos, n, cfg->num_reglas, LOTE_MONITOR, ruta);
+    printf("%6s %12s %10s %10s %12s %10s\n", "hilos", "eventos/s", "MB/s log",
+           "alertas", "escrituras", "reparto");
+
+    Evento lote[LOTE_MONITOR];
+    for (int h = 1; h <= cfg->hilos_monitor && h <= MAX_HILOS_MONITOR; h *= 2) {
+        if (truncate(ruta, 0) == -1) perror(ruta);
+        tuberia_iniciar(cfg, h, ruta, 0);
+        double t0 = ahora();
+        for (long i = 0; i < eventos; i += LOTE_MONITOR) {
+            int k = eventos - i < LOTE_MONITOR ? (int)(eventos - i) : LOTE_MONITOR;
+            for (int j = 0; j < k; ++j) {
+                lote[j] = evs[(i + j) & (EVENTOS_BENCH - 1)];
+                lote[j].ts_ns += (i + j) / EVENTOS_BENCH * periodo_ns;
+            }
+            tuberia_encolar(lote, k);
+        }
+        tuberia_detener();
+        double dt = ahora() - t0;
+
+        EstadisticasTuberia e;
+        tuberia_estadisticas(&e);
+        long minimo = e.eventos[0], maximo = e.eventos[0];
+        for (int i = 1; i < e.hilos; ++i) {
+            if (e.eventos[i] < minimo) minimo = e.eventos[i];
+            if (e.eventos[i] > maximo) maximo = e.eventos[i];
+        }
+        printf("%6d %12.0f %10.1f %10ld %12ld %9.2fx\n", h, eventos / dt,
+               e.bytes / dt / 1e6, e.alertas, e.escrituras,
+               minimo ? (double)maximo / minimo : 0.0);
+        if (h == cfg->hilos_monitor) break;
+        if (h * 2 > cfg->hilos_monitor) h = cfg->hilos_monitor / 2;
+    }
+
+    unlink(ruta);
+    free(evs);
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*      PARTICIONES (escalado y dos fases)     */
+/*─────────────────────────────────────────────*/
+
+/* Las cuentas 1001… que caen en la partición p de num. */
+static TablaCuentas *crear_particion_sintetica(Config *cfg, int n, int num, int p, int *shm_id)
+{
+    config_particion(cfg, p);
+    int propias = n / num + 1;
+    *shm_id = crear_shm(propias, cfg);
+    TablaCuentas *t = adjuntar_shm(*shm_id);
+    inicializar_tabla(t, propias, cfg);
+
+    for (int i = 0; i < n; ++i) {
+        if (particion_de(1001 + i, num) != p) continue;
+        Cuenta c = { .numero_cuenta = 1001 + i, .formato = FORMATO_CUENTA, .saldo = 100000000 };
+        snprintf(c.titular, sizeof c.titular, "Cliente %d", 1001 + i);
+        insertar_cuenta(t, &c);
+    }
+    wal_truncar(&t->wal);
+    return t;
+}
+
+/* Mitad depósitos, mitad transferencias.  Con `locales` el destino se
+ * elige en la partición del origen.                                      */
+static void trabajador_particiones(Enrutador *e, int n, int locales, Medida *m, double fin)
+{
+    unsigned semilla = (unsigned)getpid();
+
+    while (ahora() < fin) {
+        for (int k = 0; k < 64; ++k) {
+            int a = 1001 + rand_r(&semilla) % n;
+            int b = 1001 + rand_r(&semilla) % n;
+            if (locales) b -= particion_de(b, e->num) - particion_de(a, e->num);
+            if (b < 1001 || b >= 1001 + n) b = a;
+            if (k & 1) ruta_deposito(e, a, 1);
+            else if (ruta_transferencia(e, a, b, 1) != OP_OK) m->fallos++;
+        }
+        m->ops += 64;
+    }
+}
+
+static double medir_particiones(Enrutador *e, int n, int locales, int procesos, double segundos)
+{
+    memset(medidas, 0, (MAX_PROC + 1) * sizeof(Medida));
+    double fin = ahora() + segundos;
+    pthread_t hilos[MAX_PARTICIONES];
+    midiendo = 1;
+    for (int p = 0; p < e->num; ++p) pthread_create(&hilos[p], NULL, vaciador, e->tablas[p]);
+
+    for (int i = 0; i < procesos; ++i)
+        if (fork() == 0) { trabajador_particiones(e, n, locales, &medidas[i], fin); _exit(0); }
+    while (wait(NULL) > 0) ;
+
+    midiendo = 0;
+    for (int p = 0; p < e->num; ++p) pthread_join(hilos[p], NULL);
+
+    Medida *total = &medidas[MAX_PROC];
+    for (int i = 0; i < procesos; ++i) sumar_medida(total, &medidas[i]);
+    return total->ops / segundos;
+}
+
+static int bench_particiones(const Config *cfg, double segundos, int n, int procesos)
+{
+    int max = cfg->particiones > 1 ? cfg->particiones : 4;
+    if (procesos < 1) procesos = 1;
+    while (max * procesos > MAX_PROC) --max;
+
+    Config base = *cfg;
+    base.modo_cuentas = MODO_SHM;
+    snprintf(base.archivo_wal, sizeof base.archivo_wal, "bench.wal");
+    snprintf(base.archivo_2pc, sizeof base.archivo_2pc, "bench.2pc");
+
+    printf("%d cuentas, %.1f s por medida, %d procesos por partición, "
+           "diario por partición (ventana %d µs)\n\n",
+           n, segundos, procesos, base.ventana_grupo_us);
+    printf("%-12s %-10s %14s %16s %9s\n", "particiones", "destino", "ops/s",
+           "ops/s/partición", "escalado");
+
+    double referencia[2] = { 0, 0 };
+    for (int num = 1; num <= max; num = num * 2 > max && num < max ? max : num * 2) {
+        Enrutador e = { .num = num };
+        snprintf(e.archivo_2pc, sizeof e.archivo_2pc, "%s", base.archivo_2pc);
+        int ids[MAX_PARTICIONES];
+        for (int p = 0; p < num; ++p) {
+            Config c = base;
+            e.tablas[p] = crear_particion_sintetica(&c, n, num, p, &ids[p]);
+        }
+
+        for (int locales = 1; locales >= 0; --locales) {
+            unlink(base.archivo_2pc);
+            double ops = medir_particiones(&e, n, locales, num * procesos, segundos);
+            if (num == 1) referencia[locales] = ops;
+            printf("%-12d %-10s %14.0f %16.0f %8.2fx\n", num,
+                   locales ? "local" : "al azar", ops, ops / num,
+                   ops / referencia[locales]);
+        }
+
+        for (int p = 0; p < num; ++p) {
+            unlink(e.tablas[p]->wal.archivo);
+            destruir_tabla(e.tablas[p]);
+            liberar_shm(e.tablas[p], ids[p]);
+        }
+    }
+    unlink(base.archivo_2pc);
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*     RÉPLICA (lecturas fuera del primario)   */
+/*─────────────────────────────────────────────*/
+
+typedef struct {
+    TablaCuentas *t;
+    Medida       *m;
+    double        fin;
+} Lector;
+
+/* Consultas de saldo al azar y, cada 4096, un informe (auditoría de toda
+ * la tabla).  Sólo se cuentan los saldos.                                */
+static void *hilo_lector(void *arg)
+{
+    Lector  *l = arg;
+    unsigned semilla = (unsigned)getpid() ^ (unsigned)(uintptr_t)l->m;
+    int64_t  saldo;
+
+    while (ahora() < l->fin) {
+        for (int k = 0; k < 4096; ++k)
+            op_saldo(l->t, 1001 + rand_r(&semilla) % l->t->num_cuentas, &saldo);
+        Auditoria a = { 0 };
+        auditar_tabla(l->t, &a, AUD_AUTO);
+        l->m->ops += 4096;
+    }
+    return NULL;
+}
+
+static void lanzar_lectores(pthread_t *hilos, Lector *l, TablaCuentas *t,
+                            int lectores, Medida *m, double fin)
+{
+    for (int i = 0; i < lectores; ++i) {
+        l[i] = (Lector){ t, &m[i], fin };
+        pthread_create(&hilos[i], NULL, hilo_lector, &l[i]);
+    }
+}
+
+static void *recibir_replica(void *arg)
+{
+    while (replica_recibir(arg)) ;
+    return NULL;
+}
+
+/* Proceso réplica: se conecta, manda por `aviso` el fin de la medida, lee
+ * mientras tanto y muestrea su retraso cada milisegundo; después mide
+ * cuánto tarda en quedarse al día.                                       */
+static void proceso_replica(const Config *cfg, int lectores, Medida *m,
+                            double segundos, int aviso)
+{
+    static Replica r;
+    if (replica_conectar(&r, cfg) == -1) _exit(1);
+    pthread_t receptor, hilos[MAX_PROC];
+    Lector    l[MAX_PROC];
+    pthread_create(&receptor, NULL, recibir_replica, &r);
+
+    double fin = ahora() + segundos;
+    if (write(aviso, &fin, sizeof fin) != (ssize_t)sizeof fin) _exit(1);
+    close(aviso);
+    lanzar_lectores(hilos, l, r.tabla, lectores, m, fin);
+
+    struct timespec ms = { 0, 1000000L };
+    double   suma = 0, maximo = 0;
+    uint64_t max_registros = 0;
+    long     muestras = 0;
+    while (ahora() < fin) {
+        uint64_t registros;
+        double   retraso;
+        replica_retraso(&r, &registros, &retraso);
+        suma += retraso;
+        if (retraso > maximo) maximo = retraso;
+        if (registros > max_registros) max_registros = registros;
+        ++muestras;
+        nanosleep(&ms, NULL);
+    }
+    for (int i = 0; i < lectores; ++i) pthread_join(hilos[i], NULL);
+
+    /* Al día: sin registros pendientes y sin aplicar nada durante más de
+     * un latido.                                                         */
+    double   quieta = ahora(), al_dia = 0;
+    uint64_t aplicado = atomic_load(&r.aplicado);
+    while (ahora() - quieta < 0.3 && ahora() - fin < 10) {
+        uint64_t registros, ahora_aplicado = atomic_load(&r.aplicado);
+        double   retraso;
+        replica_retraso(&r, &registros, &retraso);
+        if (ahora_aplicado != aplicado || registros) {
+            aplicado = ahora_aplicado;
+            quieta   = ahora();
+            al_dia   = quieta - fin;
+        }
+        nanosleep(&ms, NULL);
+    }
+    printf("  réplica: %ld registros aplicados; retraso medio %.2f ms, máximo %.2f ms"
+           " (%llu registros); al día %.1f ms tras parar\n",
+           atomic_load(&r.registros), muestras ? suma / muestras : 0.0, maximo,
+           (unsigned long long)max_registros, al_dia > 0 ? al_dia * 1e3 : 0.0);
+    fflush(stdout);
+
+    shutdown(r.fd, SHUT_RDWR);
+    pthread_join(receptor, NULL);
+    replica_cerrar(&r);
+    _exit(0);
+}
+
+/* escritores procesos de depósitos con diario durante `segundos`, con los
+ * lectores en ninguna parte (donde 0), en el primario (1) o en una réplica
+ * (2).  Escrituras en medidas[MAX_PROC], lecturas en medidas[MAX_PROC - 1].
+ * Devuelve escrituras/s.                                                 */
+static double medir_replica(TablaCuentas *t, const Config *cfg, int escritores,
+                            int lectores, int donde, double segundos)
+{
+    memset(medidas, 0, (MAX_PROC + 1) * sizeof(Medida));
+    Medida *lecturas = &medidas[escritores];
+    wal_truncar(&t->wal);
+
+    double fin = ahora() + segundos;
+    pid_t  replica = -1;
+    if (donde == 2) {
+        int aviso[2];
+        if (pipe(aviso) == -1) { perror("pipe"); exit(EXIT_FAILURE); }
+        if ((replica = fork()) == 0) {
+            close(aviso[0]);
+            proceso_replica(cfg, lectores, lecturas, segundos, aviso[1]);
+        }
+        close(aviso[1]);
+        if (read(aviso[0], &fin, sizeof fin) != (ssize_t)sizeof fin) {
+            fprintf(stderr, "bench: la réplica no arrancó\n");
+            exit(EXIT_FAILURE);
+        }
+        close(aviso[0]);
+    }
+
+    pthread_t vacia;
+    midiendo = 1;
+    pthread_create(&vacia, NULL, vaciador, t);
+    for (int i = 0; i < escritores; ++i)
+        if (fork() == 0) { trabajador_wal(t, &medidas[i], fin); _exit(0); }
+    if (donde == 1 && fork() == 0) {
+        pthread_t hilos[MAX_PROC];
+        Lector    l[MAX_PROC];
+        lanzar_lectores(hilos, l, t, lectores, lecturas, fin);
+        for (int i = 0; i < lectores; ++i) pthread_join(hilos[i], NULL);
+        _exit(0);
+    }
+    while (wait(NULL) > 0) ;
+    midiendo = 0;
+    pthread_join(vacia, NULL);
+
+    Medida *total = &medidas[MAX_PROC], *leido = &medidas[MAX_PROC - 1];
+    for (int i = 0; i < escritores; ++i) sumar_medida(total, &medidas[i]);
+    for (int i = 0; donde && i < lectores; ++i) sumar_medida(leido, &lecturas[i]);
+    return total->ops / segundos;
+}
+
+static int bench_replica(const Config *cfg, double segundos, int n, int lectores)
+{
+    int escritores = cfg->num_hilos > 0 ? cfg->num_hilos : 1;
+    if (lectores < 1) lectores = 1;
+    while (escritores + lectores > MAX_PROC - 1) --escritores;
+
+    Config c = *cfg;
+    c.modo_cuentas    = MODO_SHM;
+    c.conservar_fotos = 1;
+    snprintf(c.archivo_wal, sizeof c.archivo_wal, "bench.wal");
+    snprintf(c.socket_replica, sizeof c.socket_replica, "bench_replica.sock");
+    snprintf(c.directorio_fotos, sizeof c.directorio_fotos, "bench_fotos");
+
+    int shm_id;
+    TablaCuentas *t = crear_tabla_sintetica(&c, n, &shm_id);
+    replicacion_iniciar(t, &c);
+
+    printf("%d cuentas, %.1f s por medida, %d procesos de depósitos con diario "
+           "(ventana %d µs), %d hilos lectores\n\n",
+           n, segundos, escritores, c.ventana_grupo_us, lectores);
+
+    static const char *donde[] = { "sin lectores", "en el primario", "en la réplica" };
+    double referencia = 0;
+    for (int d = 0; d < 3; ++d) {
+        double ops = medir_replica(t, &c, escritores, lectores, d, segundos);
+        Medida *m  = &medidas[MAX_PROC];
+        if (d == 0) referencia = ops;
+        printf("%-15s %12.0f escrituras/s  p99 %8.1f µs  %12.0f lecturas/s  %6.2fx\n",
+               donde[d], ops, percentil(m->lat, m->ops, 0.99),
+               medidas[MAX_PROC - 1].ops / segundos, ops / referencia);
+        fflush(stdout);
+    }
+
+    replicacion_detener();
+    unlink(t->wal.archivo);
+    DIR *dir = opendir(c.directorio_fotos);
+    for (struct dirent *e; dir && (e = readdir(dir)); ) {
+        char ruta[320];
+        snprintf(ruta, sizeof ruta, "%s/%s", c.directorio_fotos, e->d_name);
+        if (e->d_name[0] != '.') unlink(ruta);
+    }
+    if (dir) closedir(dir);
+    rmdir(c.directorio_fotos);
+    destruir_tabla(t);
+    liberar_shm(t, shm_id);
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*     SEGMENTO (páginas, precarga y TLB)      */
+/*─────────────────────────────────────────────*/
+
+typedef struct {
+    const char     *nombre;
+    BackendSegmento segmento;
+    PaginasSegmento paginas;
+    int             precargar;
+} CasoSegmento;
+
+/* Contador de fallos de dTLB en lectura de este proceso, o -1. */
+static int abrir_fallos_tlb(void)
+{
+    struct perf_event_attr a = {
+        .type           = PERF_TYPE_HW_CACHE,
+        .size           = sizeof a,
+        .config         = PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                          PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        .disabled       = 1,
+        .exclude_kernel = 1,
+        .exclude_hv     = 1,
+    };
+    return (int)syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+
+/* kB de este proceso en huge pages compartidas (THP de tmpfs o hugetlb). */
+static long kb_paginas_grandes(void)
+{
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return -1;
+    char ln[128];
+    long kb = 0, v;
+    while (fgets(ln, sizeof ln, f))
+        if (sscanf(ln, "ShmemPmdMapped: %ld", &v) == 1 || sscanf(ln, "Shared_Hugetlb: %ld", &v) == 1)
+            kb += v;
+    fclose(f);
+    return kb;
+}
+
+static long fallos_pagina(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt + ru.ru_majflt;
+}
+
+/* Búsquedas de cuentas al azar con su saldo, como hace cada operación.
+ * Devuelve ns por búsqueda.                                              */
+static double pasada_busquedas(TablaCuentas *t, int n, long busquedas, uint64_t semilla)
+{
+    int64_t suma = 0;
+    double  t0   = ahora();
+    for (long i = 0; i < busquedas; ++i) {
+        int idx = buscar_cuenta(t, 1001 + (int)(aleatorio(&semilla) % (uint64_t)n));
+        suma += leer_saldo(t, idx);
+    }
+    double dt = ahora() - t0;
+    if (suma == 42) puts("");             /* que no se quite el bucle */
+    return dt * 1e9 / busquedas;
+}
+
+/* Un caso en un proceso hijo (si el segmento no se puede crear, sale sin
+ * tirar el resto): carga num_cuentas, se vuelve a adjuntar como lo haría
+ * otro proceso y mide una primera pasada de búsquedas, con sus fallos de
+ * página, y otra en caliente con sus fallos de dTLB.                     */
+static void medir_segmento(const Config *base, const CasoSegmento *caso, int n, long busquedas)
+{
+    Config c = *base;
+    c.segmento        = caso->segmento;
+    c.paginas         = caso->paginas;
+    c.precargar       = caso->precargar;
+    c.reserva_cuentas = n;
+    int inicial       = caso->segmento == SEG_POSIX ? 1024 : n;
+
+    double t0 = ahora();
+    int shm_id = crear_shm(inicial, &c);
+    TablaCuentas *t = adjuntar_shm(shm_id);
+    inicializar_tabla(t, inicial, &c);
+    int crecimientos = 0;
+    for (int i = 0; i < n; ++i) {
+        Cuenta cu = { .numero_cuenta = 1001 + i, .formato = FORMATO_CUENTA, .saldo = 10000 };
+        int capacidad = t->capacidad;
+        if (insertar_cuenta(t, &cu) == -1) { fprintf(stderr, "tabla llena en %d\n", i); _exit(1); }
+        crecimientos += t->capacidad != capacidad;
+    }
+    double carga_ms = (ahora() - t0) * 1e3;
+
+    TablaCuentas *otra = adjuntar_shm(shm_id);
+    liberar_shm(t, -1);
+    long   kb      = kb_paginas_grandes();
+    long   fallos  = fallos_pagina();
+    double primera = pasada_busquedas(otra, n, busquedas, 1);
+    fallos = fallos_pagina() - fallos;
+
+    int    tlb = abrir_fallos_tlb();
+    long long fallos_tlb = -1;
+    if (tlb != -1) { ioctl(tlb, PERF_EVENT_IOC_RESET, 0); ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0); }
+    double caliente = pasada_busquedas(otra, n, busquedas, 2);
+    if (tlb != -1) {
+        ioctl(tlb, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(tlb, &fallos_tlb, sizeof fallos_tlb) != (ssize_t)sizeof fallos_tlb) fallos_tlb = -1;
+        close(tlb);
+    }
+
+    char tlb_txt[16] = "n/d";
+    if (fallos_tlb >= 0) snprintf(tlb_txt, sizeof tlb_txt, "%.3f", (double)fallos_tlb / busquedas);
+    printf("%-20s %9.0f %6d %9.1f %11.1f %9ld %11.1f %12s\n", caso->nombre, carga_ms,
+           crecimientos, kb / 1024.0, primera, fallos, caliente, tlb_txt);
+    fflush(stdout);
+
+    destruir_tabla(otra);
+    liberar_shm(otra, shm_id);
+}
+
+static int bench_segmento(const Config *cfg, long busquedas, int n)
+{
+    static const CasoSegmento casos[] = {
+        { "sysv",                SEG_SYSV,  PAG_NORMALES, 0 },
+        { "sysv precarga",       SEG_SYSV,  PAG_NORMALES, 1 },
+        { "sysv hugetlb",        SEG_SYSV,  PAG_HUGETLB,  1 },
+        { "posix precarga",      SEG_POSIX, PAG_NORMALES, 1 },
+        { "posix thp precarga",  SEG_POSIX, PAG_THP,      1 },
+        { "posix hugetlb",       SEG_POSIX, PAG_HUGETLB,  1 },
+    };
+    Config base = *cfg;
+    base.modo_cuentas   = MODO_SHM;
+    base.archivo_wal[0] = '\0';
+
+    printf("%d cuentas (segmento de %.0f MB), %ld búsquedas al azar por pasada; "
+           "los posix empiezan con 1024 cuentas y crecen\n\n",
+           n, tam_tabla(n, &base) / 1e6, busquedas);
+    printf("%-20s %9s %6s %9s %11s %9s %11s %12s\n", "segmento", "carga ms", "crec.",
+           "MB grand.", "1ª pas. ns", "fallos pág", "ns/búsq.", "dTLB/búsq.");
+    for (size_t k = 0; k < sizeof casos / sizeof casos[0]; ++k) {
+        fflush(stdout);
+        pid_t hijo = fork();
+        if (hijo == 0) {
+            medir_segmento(&base, &casos[k], n, busquedas);
+            _exit(0);
+        }
+        int estado;
+        waitpid(hijo, &estado, 0);
+        if (!WIFEXITED(estado) || WEXITSTATUS(estado) != 0)
+            printf("%-20s %9s\n", casos[k].nombre, "(no disponible)");
+    }
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*     LIQUIDACIÓN DE FIN DE DÍA (cuentas/s)   */
+/*─────────────────────────────────────────────*/
+
+#define ARCHIVO_BENCH_LIQ  "bench_liquidacion.dat"
+#define EXTRACTO_BENCH     "bench_extracto.txt"
+
+/* Liquida n cuentas sintéticas con 1, 2, 4… hilos hasta max_hilos (por
+ * defecto, uno por CPU) escribiendo el extracto entero, y compara el
+ * punto de control único con la alternativa de un depósito por cuenta por
+ * el buffer de E/S y el hilo IO (sobre min(n, 1M) cuentas, extrapolado). */
+static int bench_liquidacion(Config *cfg, int n, int max_hilos)
+{
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_hilos <= 0) max_hilos = cpus;
+    cfg->modo_cuentas   = MODO_SHM;
+    cfg->archivo_wal[0] = '\0';
+    if (cfg->interes_pb == 0 && cfg->descubierto_pb == 0 && cfg->comision_diaria == 0) {
+        cfg->interes_pb = 150; cfg->descubierto_pb = 1200;
+        cfg->comision_diaria = 10; cfg->saldo_exento = 100000;
+    }
+
+    double t0 = ahora();
+    int shm_id;
+    TablaCuentas *t = crear_tabla_sintetica(cfg, n, &shm_id);
+    int64_t *saldos  = saldos_tabla(t);
+    uint8_t *estados = estados_tabla(t);
+    uint64_t semilla = 42;
+    for (int i = 0; i < n; ++i) {
+        uint64_t r = aleatorio(&semilla);
+        saldos[i] = (int64_t)(r % 50000000);            /* hasta 500 000 € */
+        if (r % 7 == 0)      saldos[i] = -(int64_t)(r % 200000);
+        if (r % 1009 == 0)   estados[i] |= ESTADO_BLOQUEADA;
+    }
+    int64_t *original = malloc((size_t)n * sizeof(int64_t));
+    if (!original) { perror("malloc"); return 1; }
+    memcpy(original, saldos, (size_t)n * sizeof(int64_t));
+
+    printf("%d cuentas sintéticas (%.1f s en cargarlas), %d CPU; interés %.2f %%, "
+           "descubierto %.2f %%, comisión %.2f € bajo %.2f €\n\n",
+           n, ahora() - t0, cpus, cfg->interes_pb / 100.0, cfg->descubierto_pb / 100.0,
+           cfg->comision_diaria / 100.0, cfg->saldo_exento / 100.0);
+    printf("%-6s %10s %14s %12s %9s %16s\n", "hilos", "ms", "cuentas/s",
+           "extr. MB/s", "mejora", "total nuevo");
+
+    double ms_uno = 0;
+    for (int h = 1; ; h = h * 2 > max_hilos && h < max_hilos ? max_hilos : h * 2) {
+        memcpy(saldos, original, (size_t)n * sizeof(int64_t));
+        int fd = open(EXTRACTO_BENCH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) { perror(EXTRACTO_BENCH); return 1; }
+        ResumenLiquidacion r;
+        double a = ahora();
+        int error = liquidar_tabla(t, cfg, 1, h, fd, &r);
+        double ms = (ahora() - a) * 1e3;
+        close(fd);
+        if (h == 1) ms_uno = ms;
+        printf("%-6d %10.1f %14.0f %12.0f %8.2fx %16lld%s\n", h, ms, n / (ms / 1e3),
+               (n + 2.0) * LARGO_EXTRACTO / 1e6 / (ms / 1e3), ms_uno / ms,
+               (long long)r.total_despues, error ? "  ¡error de escritura!" : "");
+        if (h >= max_hilos) break;
+    }
+    unlink(EXTRACTO_BENCH);
+
+    /* Punto de control único frente a un apunte por cuenta */
+    double a = ahora();
+    volcar_cuentas(ARCHIVO_BENCH_LIQ, t);
+    double ms_volcado = (ahora() - a) * 1e3;
+
+    int m = n < 1000000 ? n : 1000000;
+    setenv("SECUREBANK_FILE", ARCHIVO_BENCH_LIQ, 1);
+    pthread_t io;
+    pthread_create(&io, NULL, gestionar_entrada_salida, t);
+    a = ahora();
+    for (int i = 0; i < m; ++i) op_deposito(t, 1001 + i, 1);
+    detener_entrada_salida(t);
+    pthread_join(io, NULL);
+    double ms_sueltas = (ahora() - a) * 1e3 * n / m;
+
+    printf("\nGuardar la tabla: un volcado de %.0f MB en %.1f ms; un apunte por cuenta "
+           "por el hilo IO, %.1f ms (%d medidas, %ld lotes): %.1fx\n",
+           (double)n * sizeof(Cuenta) / 1e6, ms_volcado, ms_sueltas, m,
+           atomic_load(&t->lotes_volcados), ms_sueltas / ms_volcado);
+    unlink(ARCHIVO_BENCH_LIQ);
+
+    free(original);
+    destruir_tabla(t);
+    liberar_shm(t, shm_id);
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*      HISTORIAL POR CUENTA (segmentos)       */
+/*─────────────────────────────────────────────*/
+
+#define CUENTA_PESADA   1001             /* una de cada diez operaciones */
+#define ULTIMOS_HIST    50
+#define CONSULTAS_HIST  1000
+#define PASADAS_TEXTO   20
+
+/* Lo que hacía el cajero con transacciones/<n>/transacciones.log: leerlo
+ * entero y quedarse con las últimas líneas (del intervalo, si se da).   */
+static int escanear_texto(const char *ruta, const char *desde, const char *hasta)
+{
+    FILE *f = fopen(ruta, "r");
+    if (!f) return 0;
+    static char ultimas[MAX_HISTORIAL_CONSULTA][128];
+    char linea[128];
+    int n = 0;
+    while (fgets(linea, sizeof linea, f)) {
+        if (desde && (memcmp(linea + 1, desde, 19) < 0 || memcmp(linea + 1, hasta, 19) > 0))
+            continue;
+        memcpy(ultimas[n++ % MAX_HISTORIAL_CONSULTA], linea, sizeof linea);
+    }
+    fclose(f);
+    return n;
+}
+
+static void marca_hist(char *dst, size_t n, int64_t ns)
+{
+    time_t s = (time_t)(ns / 1000000000);
+    struct tm tm;
+    localtime_r(&s, &tm);
+    strftime(dst, n, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static int bench_historial(const Config *cfg, long m, int cuentas)
+{
+    char dir[] = "/tmp/bench_histXXXXXX";
+    if (!mkdtemp(dir)) { perror(dir); return 1; }
+    Config c = *cfg;
+    snprintf(c.directorio_historial, sizeof c.directorio_historial, "%s/h", dir);
+    c.rotacion_historial_s = 0;
+    if (cuentas < 1) cuentas = 1;
+
+    Historial h;
+    if (historial_abrir(&h, &c, 1) == -1) return 1;
+    char texto[64];
+    snprintf(texto, sizeof texto, "%s/%d.log", dir, CUENTA_PESADA);
+    FILE *log = fopen(texto, "w");
+    if (!log) { perror(texto); return 1; }
+
+    /* 1. Ingesta: un apunte por ms de reloj simulado, en lotes como los
+     *    del escritor de registro.c */
+    RegistroHistorial lote[256];
+    char linea[128];
+    uint64_t semilla = 42;
+    int64_t inicio = historial_ahora() - (int64_t)m * 1000000;
+    double escribir = 0;
+    for (long i = 0; i < m; ) {
+        int k = 0;
+        for (; k < 256 && i < m; ++k, ++i) {
+            uint64_t r = aleatorio(&semilla);
+            RegistroHistorial *x = &lote[k];
+            memset(x, 0, sizeof *x);
+            x->ts       = inicio + i * 1000000;
+            x->cuenta   = i % 10 == 0 ? CUENTA_PESADA : 1001 + (int)(r % (uint64_t)cuentas);
+            x->otra     = -1;
+            x->tipo     = r % 3 ? OP_DEPOSITO : OP_RETIRO;
+            x->centimos = (int64_t)(r >> 40) % 100000 * (x->tipo == OP_RETIRO ? -1 : 1);
+            if (x->cuenta == CUENTA_PESADA) {
+                historial_describir(x, linea, sizeof linea);
+                fprintf(log, "%s\n", linea);
+            }
+        }
+        double a = ahora();
+        historial_escribir(&h, lote, k);
+        escribir += ahora() - a;
+    }
+    fclose(log);
+    uint32_t *nums;
+    int segs = historial_listar(c.directorio_historial, &nums);
+    free(nums);
+    printf("%ld apuntes en %d cuentas: %.2f s, %.0f apuntes/s; %d segmentos de %d MB\n",
+           m, cuentas, escribir, m / (escribir > 0 ? escribir : 1e-9), segs,
+           c.tam_segmento_historial);
+    printf("cuenta %d: %ld apuntes; su log de texto equivalente, %s\n\n",
+           CUENTA_PESADA, (m + 9) / 10, texto);
+
+    /* 2. Consultas: historial frente al log de texto entero */
+    RegistroHistorial out[MAX_HISTORIAL_CONSULTA];
+    int64_t desde = inicio + m / 2 * 1000000, hasta = desde + 60000000000LL;
+    char d1[32], d2[32];
+    marca_hist(d1, sizeof d1, desde);
+    marca_hist(d2, sizeof d2, hasta);
+
+    printf("%-28s %12s %12s %9s\n", "consulta", "µs historial", "µs texto", "mejora");
+    for (int caso = 0; caso < 3; ++caso) {
+        const char *nombre = caso == 0 ? "últimos 50, cuenta pesada"
+                           : caso == 1 ? "últimos 50, cuentas al azar"
+                                       : "un minuto, cuenta pesada";
+        int n = 0;
+        double a = ahora();
+        for (int q = 0; q < CONSULTAS_HIST; ++q) {
+            int cuenta = caso == 1 ? 1001 + (int)(aleatorio(&semilla) % (uint64_t)cuentas)
+                                   : CUENTA_PESADA;
+            n = caso == 2 ? historial_consultar(&h, cuenta, desde, hasta, out, MAX_HISTORIAL_CONSULTA)
+                          : historial_consultar(&h, cuenta, 0, INT64_MAX, out, ULTIMOS_HIST);
+        }
+        double us = (ahora() - a) / CONSULTAS_HIST * 1e6;
+        if (caso == 1) { printf("%-28s %12.1f %12s\n", nombre, us, "-"); continue; }
+
+        a = ahora();
+        for (int q = 0; q < PASADAS_TEXTO; ++q)
+            escanear_texto(texto, caso == 2 ? d1 : NULL, d2);
+        double us_texto = (ahora() - a) / PASADAS_TEXTO * 1e6;
+        printf("%-28s %12.1f %12.0f %8.0fx   (%d apuntes)\n", nombre, us, us_texto,
+               us_texto / us, n);
+    }
+
+    historial_cerrar(&h);
+    char cmd[64];
+    snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+    if (system(cmd) != 0) fprintf(stderr, "no se pudo borrar %s\n", dir);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Config cfg = leer_config("config.txt");
+    const char *modo = argc > 1 ? argv[1] : "cerrojos";
+    if (strcmp(modo, "carga") == 0) return bench_carga(&cfg, argc - 2, argv + 2);
+    if (strcmp(modo, "auditoria") == 0)
+        return bench_auditoria(argc > 2 ? atoi(argv[2]) : 5,
+                               argc > 3 ? atoi(argv[3]) : 10000000);
+    if (strcmp(modo, "reglas") == 0)
+        return bench_reglas(&cfg, argc > 2 ? atol(argv[2]) : 10000000,
+                            argc > 3 ? atoi(argv[3]) : 100000,
+                            argc > 4 ? atof(argv[4]) : 100000);
+    if (strcmp(modo, "segmento") == 0)
+        return bench_segmento(&cfg, argc > 2 ? atol(argv[2]) : 2000000,
+                              argc > 3 ? atoi(argv[3]) : 1000000);
+    if (strcmp(modo, "liquidacion") == 0)
+        return bench_liquidacion(&cfg, argc > 2 ? atoi(argv[2]) : 10000000,
+                                 argc > 3 ? atoi(argv[3]) : 0);
+    if (strcmp(modo, "historial") == 0)
+        return bench_historial(&cfg, argc > 2 ? atol(argv[2]) : 2000000,
+                               argc > 3 ? atoi(argv[3]) : 100000);
+    if (strcmp(modo, "monitor") == 0)
+        return bench_monitor(&cfg, argc > 2 ? atol(argv[2]) : 5000000,
+                             argc > 3 ? atoi(argv[3]) : 100000,
+                             argc > 4 ? atof(argv[4]) : 100000);
+
+    double segundos  = argc > 2 ? atof(argv[2]) : 2.0;
+    int    n         = argc > 3 ? atoi(argv[3]) : 100000;
+    int    max_proc  = cfg.num_hilos > 0 ? cfg.num_hilos : 1;
+    if (max_proc > MAX_PROC) max_proc = MAX_PROC;
+
+    int es_wal  = strcmp(modo, "wal") == 0;
+    int es_lote = strcmp(modo, "lote") == 0;
+    cfg.modo_cuentas = MODO_SHM;
+    snprintf(cfg.archivo_wal, sizeof cfg.archivo_wal, "%s",
+             es_wal || es_lote ? "bench.wal" : "");
+
+    medidas = mmap(NULL, (MAX_PROC + 1) * sizeof(Medida), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (medidas == MAP_FAILED) { perror("mmap"); exit(EXIT_FAILURE); }
+    if (strcmp(modo, "particiones") == 0)
+        return bench_particiones(&cfg, segundos, n, argc > 4 ? atoi(argv[4]) : 2);
+    if (strcmp(modo, "replica") == 0)
+        return bench_replica(&cfg, segundos, n, argc > 4 ? atoi(argv[4]) : 2);
+
+    printf("%d cuentas, %.1f s por medida, hasta %d procesos (NUM_HILOS)\n\n",
+           n, segundos, max_proc);
+
+    if (strcmp(modo, "es") == 0) {
+        bench_es_volcado(&cfg, n, max_proc, segundos);
+        bench_es_registro();
+        munmap(medidas, (MAX_PROC + 1) * sizeof(Medida));
+        return 0;
+    }
+
+    int shm_id;
+    TablaCuentas *t = crear_tabla_sintetica(&cfg, n, &shm_id);
+
+    if (es_wal)       bench_wal(t, max_proc, segundos);
+    else if (es_lote) bench_lote(t, max_proc, segundos);
+    else              bench_cerrojos(t, max_proc, segundos);
+
+    munmap(medidas, (MAX_PROC + 1) * sizeof(Medida));
+    destruir_tabla(t);
+    liberar_shm(t, shm_id);
+    return 0;
+}
@@ -0,0 +1,214 @@
+/* cliente.c — Cajero de SecureBank por socket
+ *   ● Se conecta al socket Unix de banco (SOCKET_BANCO en config.txt)
+ *   ● Mismo menú que usuario.c; cada opción es una Peticion de 16 bytes
+ *     y su Respuesta (ver utils.h).  Toda la lógica vive en banco.
+ *   ● El historial llega tras su Respuesta como RegistroHistorial, que se
+ *     muestran aquí con historial_describir.
+ *
+ *  Ejecutar:  ./cliente [ruta_socket]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "utils.h"
+
+/* ──────────  Variables globales  ────────── */
+static Config cfg;
+static int    sock = -1;
+static int    cuenta_sesion = -1;
+
+/* ───────────────────────────────────────────── */
+/*                 UTILIDADES                   */
+/* ───────────────────────────────────────────── */
+
+static int conectar(const char *ruta)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) { perror("socket"); exit(EXIT_FAILURE); }
+
+    struct sockaddr_un dir = { .sun_family = AF_UNIX };
+    snprintf(dir.sun_path, sizeof dir.sun_path, "%s", ruta);
+    if (connect(fd, (struct sockaddr *)&dir, sizeof dir) == -1) {
+        perror(ruta);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/* Envía una petición.  Si banco cierra, termina. */
+static void enviar(const Peticion *p)
+{
+    if (write(sock, p, sizeof *p) != (ssize_t)sizeof *p) {
+        perror("banco"); exit(EXIT_FAILURE);
+    }
+}
+
+/* Lee exactamente `tam` bytes.  Si banco cierra, termina. */
+static void recibir(void *dst, size_t tam)
+{
+    for (size_t leidos = 0; leidos < tam; ) {
+        ssize_t n = read(sock, (char *)dst + leidos, tam - leidos);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) { puts("Conexión con banco cerrada."); exit(EXIT_FAILURE); }
+        leidos += (size_t)n;
+    }
+}
+
+/* Envía una petición y espera su respuesta. */
+static Respuesta pedir(TipoPeticion tipo, int cuenta, double monto)
+{
+    Peticion p = { .tipo = tipo, .cuenta = cuenta, .centimos = a_centimos(monto) };
+    Respuesta r;
+    enviar(&p);
+    recibir(&r, sizeof r);
+    return r;
+}
+
+static void informar(const Respuesta *r)
+{
+    switch (r->estado) {
+    case RES_OK:
+        printf("Saldo actual = %s%lld.%02lld €\n", r->centimos < 0 ? "-" : "",
+               llabs(r->centimos) / 100, llabs(r->centimos) % 100);
+        break;
+    case RES_SALDO_INSUFICIENTE: puts("Saldo insuficiente.");        break;
+    case RES_CUENTA_NO_EXISTE:   puts("Cuenta destino no existe.");  break;
+    case RES_INVALIDA:           puts("Importe no válido.");         break;
+    case RES_SIN_SESION:         puts("Sesión no iniciada.");        break;
+    case RES_CERRANDO:           puts("El banco está cerrando.");    break;
+    default:                     puts("Operación rechazada.");
+    }
+}
+
+/* Los últimos `max` apuntes entre desde y hasta (s; 0 = sin límite).
+ * Los apuntes siguen a la Respuesta: se leen en cuanto se sabe cuántos. */
+static void pedir_historial(int max, uint32_t desde, uint32_t hasta)
+{
+    Peticion p = { .tipo = PET_HISTORIAL, .cuenta = max,
+                   .centimos = (int64_t)((uint64_t)desde << 32 | hasta) };
+    Respuesta r;
+    RegistroHistorial regs[MAX_HISTORIAL_CONSULTA];
+
+    enviar(&p);
+    recibir(&r, sizeof r);
+    int k = r.reservado < 0 ? 0 : r.reservado;
+    if (k > MAX_HISTORIAL_CONSULTA) { puts("Respuesta de banco no válida."); exit(EXIT_FAILURE); }
+    recibir(regs, (size_t)k * sizeof *regs);
+    if (r.estado != RES_OK) { informar(&r); return; }
+
+    char linea[128];
+    for (int i = 0; i < k; ++i) {
+        historial_describir(&regs[i], linea, sizeof linea);
+        puts(linea);
+    }
+    if (k == 0) puts("Sin movimientos.");
+}
+
+static void menu_historial(void)
+{
+    int sub, n;
+    char d1[16], d2[16];
+    printf("1. Últimos N   2. Entre dos fechas: ");
+    if (scanf("%d", &sub) != 1) exit(0);
+    if (sub == 1) {
+        printf("N (hasta %d): ", MAX_HISTORIAL_CONSULTA); scanf("%d", &n);
+        pedir_historial(n, 0, 0);
+        return;
+    }
+    printf("Desde (AAAA-MM-DD): "); scanf("%15s", d1);
+    printf("Hasta (AAAA-MM-DD): "); scanf("%15s", d2);
+    int64_t desde = historial_fecha(d1, 0), hasta = historial_fecha(d2, 1);
+    if (desde == -1 || hasta == -1) { puts("Fecha no válida."); return; }
+    pedir_historial(MAX_HISTORIAL_CONSULTA, (uint32_t)(desde / 1000000000),
+                    (uint32_t)(hasta / 1000000000));
+}
+
+/* ───────────────────────────────────────────── */
+/*                  INTERFAZ TEXTO               */
+/* ───────────────────────────────────────────── */
+static void menu_operaciones(void)
+{
+    for (;;) {
+        printf("\n╔════════════════════════════╗\n");
+        printf("║   CAJERO  |  CUENTA %-6d ║\n", cuenta_sesion);
+        printf("╠════════════════════════════╣\n");
+        printf("║ 1. Depósito                ║\n");
+        printf("║ 2. Retiro                  ║\n");
+        printf("║ 3. Transferencia           ║\n");
+        printf("║ 4. Consultar saldo         ║\n");
+        printf("║ 5. Historial               ║\n");
+        printf("║ 6. Salir                   ║\n");
+        printf("╚════════════════════════════╝\n");
+        printf("Seleccione: ");
+
+        int op; if (scanf("%d",&op)!=1) exit(0);
+        if (op==6) break;
+
+        double monto; int dest;
+        Respuesta r;
+        switch (op) {
+        case 1:
+            printf("Monto a depositar: "); scanf("%lf",&monto);
+            r = pedir(PET_DEPOSITO, 0, monto);
+            informar(&r);
+            break;
+        case 2:
+            printf("Monto a retirar: ");   scanf("%lf",&monto);
+            r = pedir(PET_RETIRO, 0, monto);
+            if (r.estado == RES_LIMITE)
+                printf("Límite de retiro: %d\n", cfg.limite_retiro);
+            else informar(&r);
+            break;
+        case 3:
+            printf("Cuenta destino: ");     scanf("%d",&dest);
+            printf("Monto a transferir: "); scanf("%lf",&monto);
+            r = pedir(PET_TRANSFERENCIA, dest, monto);
+            if (r.estado == RES_LIMITE)
+                printf("Límite de transferencia: %d\n",
+                       cfg.limite_transferencia);
+            else informar(&r);
+            break;
+        case 4:
+            r = pedir(PET_SALDO, 0, 0);
+            informar(&r);
+            break;
+        case 5:
+            menu_historial();
+            break;
+        default:
+            puts("Opción inválida.");
+        }
+    }
+}
+
+/* ───────────────────────────────────────────── */
+/*                     main                      */
+/* ───────────────────────────────────────────── */
+int main(int argc, char *argv[])
+{
+    cfg  = leer_config("config.txt");
+    sock = conectar(argc > 1 ? argv[1] : cfg.socket_banco);
+
+    while (1) {
+        printf("\n╔═════════════════════════════╗\n");
+        printf("║ INICIO DE SESIÓN DE USUARIO ║\n");
+        printf("╚═════════════════════════════╝\n");
+        printf("Introduce tu número de cuenta: ");
+        if (scanf("%d",&cuenta_sesion)!=1) exit(0);
+
+        if (pedir(PET_SESION, cuenta_sesion, 0).estado == RES_OK) break;
+        puts("Cuenta no válida o bloqueada.");
+    }
+
+    menu_operaciones();
+
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,180 @@
+/* contadores.c — Almacén acotado de contadores para el monitor
+ *
+ *  ▸ Tabla hash de direccionamiento abierto (sondeo lineal) con capacidad
+ *    fija: la memoria no depende del rango de números de cuenta.
+ *  ▸ Cada entrada guarda su clave (cuenta, o par origen/destino), el valor,
+ *    la hora de la última actualización y un reloj lógico de uso.
+ *  ▸ Una entrada sin tocar durante más de `ttl` segundos cuenta como cero.
+ *    Si la tabla llega a 3/4 de su capacidad se purgan las caducadas y, si
+ *    no basta, el cuarto de entradas menos usado (LRU aproximado).
+ *  ▸ Los borrados desplazan hacia atrás (sin lápidas), así las cadenas de
+ *    sondeo no crecen con el tiempo.
+ *  ▸ Con ac_iniciar_datos() cada entrada lleva además un bloque de bytes
+ *    propio (las ventanas de reglas.c), que se mueve con ella y vuelve a
+ *    cero igual que el contador.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+static size_t hash_clave(uint64_t clave, size_t mascara) {
+    clave ^= clave >> 33;
+    clave *= 0xff51afd7ed558ccdULL;
+    clave ^= clave >> 33;
+    return (size_t)clave & mascara;
+}
+
+static int libre(const EntradaContador *e) {
+    return e->ts == 0;
+}
+
+void ac_iniciar_datos(AlmacenContadores *a, size_t capacidad, int ttl_s, size_t tam_dato) {
+    size_t cap = 16;
+    while (cap < capacidad) cap <<= 1;
+
+    a->e          = calloc(cap, sizeof(EntradaContador));
+    a->datos      = tam_dato ? calloc(cap, tam_dato) : NULL;
+    if (!a->e || (tam_dato && !a->datos)) { perror("calloc contadores"); exit(EXIT_FAILURE); }
+    a->tam_dato   = tam_dato;
+    a->capacidad  = cap;
+    a->mascara    = cap - 1;
+    a->max_usados = cap - cap / 4;
+    a->usados     = 0;
+    a->ttl        = ttl_s;
+    a->reloj      = 0;
+    a->desalojos  = a->busquedas = a->sondeos = 0;
+}
+
+void ac_iniciar(AlmacenContadores *a, size_t capacidad, int ttl_s) {
+    ac_iniciar_datos(a, capacidad, ttl_s, 0);
+}
+
+void ac_liberar(AlmacenContadores *a) {
+    free(a->e);
+    free(a->datos);
+    a->e = NULL;
+    a->datos = NULL;
+}
+
+static unsigned char *dato(const AlmacenContadores *a, size_t i) {
+    return a->datos + i * a->tam_dato;
+}
+
+/* Borrado con desplazamiento hacia atrás: cada entrada posterior del
+ * mismo racimo que pueda ocupar el hueco se mueve a él.                  */
+static void borrar_en(AlmacenContadores *a, size_t i) {
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & a->mascara;
+        if (libre(&a->e[j])) break;
+
+        size_t k = hash_clave(a->e[j].clave, a->mascara);
+        int mover = (i <= j) ? (k <= i || k > j) : (k <= i && k > j);
+        if (mover) {
+            a->e[i] = a->e[j];
+            if (a->datos) memcpy(dato(a, i), dato(a, j), a->tam_dato);
+            i = j;
+        }
+    }
+    memset(&a->e[i], 0, sizeof a->e[i]);
+    if (a->datos) memset(dato(a, i), 0, a->tam_dato);
+    a->usados--;
+}
+
+static long buscar_pos(AlmacenContadores *a, uint64_t clave) {
+    size_t i = hash_clave(clave, a->mascara);
+    a->busquedas++;
+    while (!libre(&a->e[i])) {
+        a->sondeos++;
+        if (a->e[i].clave == clave) return (long)i;
+        i = (i + 1) & a->mascara;
+    }
+    return -1;
+}
+
+void ac_borrar(AlmacenContadores *a, uint64_t clave) {
+    long i = buscar_pos(a, clave);
+    if (i != -1) borrar_en(a, (size_t)i);
+}
+
+/* Elimina las claves seleccionadas.  Se recogen antes de borrar porque
+ * el desplazamiento hacia atrás mueve entradas durante el recorrido.     */
+static void borrar_si(AlmacenContadores *a, time_t ahora, uint64_t reloj_corte) {
+    uint64_t *claves = malloc(a->usados * sizeof(uint64_t));
+    size_t n = 0;
+    for (size_t i = 0; i < a->capacidad; ++i) {
+        const EntradaContador *e = &a->e[i];
+        if (libre(e)) continue;
+        if (ahora - e->ts > a->ttl || e->uso < reloj_corte)
+            claves[n++] = e->clave;
+    }
+    for (size_t k = 0; k < n; ++k) ac_borrar(a, claves[k]);
+    a->desalojos += n;
+    free(claves);
+}
+
+static void hacer_sitio(AlmacenContadores *a, time_t ahora) {
+    borrar_si(a, ahora, 0);                      /* sólo caducadas */
+    if (a->usados < a->max_usados) return;
+
+    uint64_t minimo = a->reloj;
+    for (size_t i = 0; i < a->capacidad; ++i)
+        if (!libre(&a->e[i]) && a->e[i].uso < minimo) minimo = a->e[i].uso;
+
+    borrar_si(a, ahora, minimo + (a->reloj - minimo) / 4 + 1);
+}
+
+/* Posición de `clave`, creada a cero si no existe o ha caducado. */
+static size_t entrada(AlmacenContadores *a, uint64_t clave, time_t ahora) {
+    long i = buscar_pos(a, clave);
+
+    if (i == -1) {
+        if (a->usados >= a->max_usados) hacer_sitio(a, ahora);
+
+        size_t j = hash_clave(clave, a->mascara);
+        while (!libre(&a->e[j])) j = (j + 1) & a->mascara;
+        a->e[j].clave = clave;
+        a->e[j].valor = 0;
+        a->usados++;
+        i = (long)j;
+    } else if (ahora - a->e[i].ts > a->ttl) {
+        a->e[i].valor = 0;
+        if (a->datos) memset(dato(a, (size_t)i), 0, a->tam_dato);
+    }
+
+    a->e[i].ts  = ahora;
+    a->e[i].uso = ++a->reloj;
+    return (size_t)i;
+}
+
+/* Devuelve el contador de `clave`, creándolo a cero si no existe o ha
+ * caducado.  El puntero vale hasta la siguiente llamada al almacén.      */
+int *ac_contador(AlmacenContadores *a, uint64_t clave, time_t ahora) {
+    return &a->e[entrada(a, clave, ahora)].valor;
+}
+
+/* Igual, pero devuelve los tam_dato bytes de la entrada. */
+void *ac_datos(AlmacenContadores *a, uint64_t clave, time_t ahora) {
+    return dato(a, entrada(a, clave, ahora));
+}
+
+void ac_estadisticas(const AlmacenContadores *a, EstadisticasContadores *s) {
+    s->entradas   = a->usados;
+    s->capacidad  = a->capacidad;
+    s->bytes      = a->capacidad * (sizeof(EntradaContador) + a->tam_dato);
+    s->desalojos  = a->desalojos;
+    s->sondeo_max = 0;
+    s->sondeo_medio_busqueda = a->busquedas ? (double)a->sondeos / a->busquedas : 0;
+
+    size_t total = 0;
+    for (size_t i = 0; i < a->capacidad; ++i) {
+        if (libre(&a->e[i])) continue;
+        size_t casa = hash_clave(a->e[i].clave, a->mascara);
+        size_t d = (i - casa) & a->mascara;
+        total += d + 1;
+        if (d + 1 > s->sondeo_max) s->sondeo_max = d + 1;
+    }
+    s->sondeo_medio = a->usados ? (double)total / a->usados : 0;
+}
@@ -0,0 +1,434 @@
+/* dosfases.c — Transferencias entre particiones en dos fases
+ *
+ *  ▸ Preparar: cada partición bloquea su cuenta y valida su apunte
+ *    (op_preparar).  Siempre se bloquea antes la de menor número de
+ *    partición, así dos transferencias cruzadas no se esperan en círculo.
+ *    Un «no» suelta lo tomado sin escribir nada: lo que no tiene decisión
+ *    en el log se da por abortado.
+ *  ▸ Decidir: un registro DF_CONFIRMADA con las dos post-imágenes al final
+ *    del log ARCHIVO_2PC y fdatasync.  Ése es el punto de commit; el xid es
+ *    la posición del registro en el log (más la base, si lo hay, del
+ *    registro DF_BASE con que empieza un log compactado).
+ *  ▸ Aplicar: cada partición escribe su rama y la anota en su diario con el
+ *    xid (op_confirmar).  Con los dos diarios confirmados se añade
+ *    DF_TERMINADA, sin sincronizar.
+ *  ▸ Si el coordinador o la máquina caen entre la decisión y los diarios,
+ *    cada partición lo arregla al arrancar y al cerrar, antes de truncar su
+ *    diario (dosfases_resolver): a una CONFIRMADA sin TERMINADA cuya rama
+ *    no llegó a su diario le aplica la post-imagen.  Es exacto porque la
+ *    cuenta siguió bloqueada hasta anotar la rama, y nada posterior sobre
+ *    ella llega al diario sin que llegue antes la rama.  Tras el punto de
+ *    control lo apunta con DF_RESUELTA y no lo vuelve a mirar.  Lo mismo
+ *    hace con las ramas que el hilo IO quita al recortar el diario en
+ *    marcha: ya están en el punto de control que precede al recorte.
+ *  ▸ Varios procesos escriben el log a la vez: registros de tamaño fijo,
+ *    una write() con O_APPEND cada uno, con el log compartido (flock).
+ *  ▸ Compactar: cada vez que el log dobla su tamaño, el banco de una
+ *    partición (al recortar su diario, al arrancar y al cerrar) quita del
+ *    principio las transferencias acabadas: las que tienen TERMINADA o
+ *    RESUELTA de sus dos particiones.  Con el log en exclusiva escribe lo
+ *    que queda tras un DF_BASE y lo pone en su sitio con rename(); quien
+ *    tenía abierto el viejo lo ve al ir a escribir y abre el nuevo.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+static int fd_2pc = -1;                  /* descriptor de este proceso */
+static uint32_t base_2pc;                /* xid del primer registro tras la cabecera */
+static int cabecera_2pc;                 /* 1 si el log empieza con DF_BASE */
+static pthread_mutex_t mutex_2pc = PTHREAD_MUTEX_INITIALIZER;
+
+/* Registros del log tras la última compactación de este proceso. */
+#define MIN_COMPACTAR_2PC 1024
+static long tam_compactado;
+
+/* Lo que dosfases_resolver() aplicó o encontró hecho, pendiente de
+ * DF_RESUELTA tras el punto de control.                                  */
+static uint32_t *resueltas;
+static int num_resueltas, particion_resuelta;
+
+/* Partición cuyo diario vigila este proceso (dosfases_vigilar_diario). */
+static char archivo_vigilado[50];
+static int  particion_vigilada = -1;
+
+static uint32_t fnv1a(const void *p, size_t n)
+{
+    const unsigned char *b = p;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= b[i]; h *= 16777619u; }
+    return h;
+}
+
+static int registro_valido(const RegistroDosFases *r)
+{
+    return r->suma == fnv1a(r, offsetof(RegistroDosFases, suma));
+}
+
+static void sincronizar_directorio(const char *ruta)
+{
+    char copia[256];
+    snprintf(copia, sizeof copia, "%s", ruta);
+    int fd = open(dirname(copia), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return;
+    fsync(fd);
+    close(fd);
+}
+
+/*─────────────────────────────────────────────*/
+/*              LOG DE DECISIONES              */
+/*─────────────────────────────────────────────*/
+
+/* Base de xids del log abierto en fd: la del DF_BASE inicial o 0. */
+static void leer_base(int fd, uint32_t *base, int *cabecera)
+{
+    RegistroDosFases r;
+    *base = 0;
+    *cabecera = pread(fd, &r, sizeof r, 0) == (ssize_t)sizeof r &&
+                registro_valido(&r) && r.estado == DF_BASE;
+    if (*cabecera) *base = r.xid;
+}
+
+/* 0 si una compactación ya puso otro fichero en lugar del de fd. */
+static int log_vigente(int fd, const char *archivo)
+{
+    struct stat a, b;
+    return fstat(fd, &a) == 0 && stat(archivo, &b) == 0 &&
+           a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+/* Una escritura cortada por una caída deja el log desalineado: se rellena
+ * con ceros hasta el siguiente registro (que no pasa la suma) para que
+ * las posiciones sigan siendo xids.                                      */
+static int abrir_log(const char *archivo)
+{
+    int fd = open(archivo, O_RDWR | O_APPEND | O_CREAT, 0644);
+    if (fd == -1) { perror(archivo); return -1; }
+
+    struct stat st;
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) == 0 && st.st_size % sizeof(RegistroDosFases) != 0) {
+        char ceros[sizeof(RegistroDosFases)] = { 0 };
+        if (write(fd, ceros, sizeof ceros - st.st_size % sizeof ceros) == -1)
+            perror(archivo);
+    }
+    flock(fd, LOCK_UN);
+    leer_base(fd, &base_2pc, &cabecera_2pc);
+    return fd;
+}
+
+/* Añade r al log y, con `sincronizar`, lo lleva a disco.  Devuelve su
+ * xid o -1 si no se pudo escribir.  El log se escribe compartido: la
+ * compactación lo toma en exclusiva y, si al entrar ya hay otro fichero,
+ * se abre ése.                                                           */
+static int64_t anotar(const char *archivo, RegistroDosFases *r, int sincronizar)
+{
+    r->suma = fnv1a(r, offsetof(RegistroDosFases, suma));
+
+    int64_t pos = -1;
+    int fd = -1;
+    pthread_mutex_lock(&mutex_2pc);
+    for (;;) {
+        if (fd_2pc == -1 && (fd_2pc = abrir_log(archivo)) == -1) break;
+        flock(fd_2pc, LOCK_SH);
+        if (!log_vigente(fd_2pc, archivo)) {
+            flock(fd_2pc, LOCK_UN);
+            close(fd_2pc);
+            fd_2pc = -1;
+            continue;
+        }
+        if (write(fd_2pc, r, sizeof *r) == (ssize_t)sizeof *r)
+            pos = lseek(fd_2pc, 0, SEEK_CUR) / (off_t)sizeof *r - 1
+                  - cabecera_2pc + base_2pc;
+        flock(fd_2pc, LOCK_UN);
+        fd = fd_2pc;
+        break;
+    }
+    pthread_mutex_unlock(&mutex_2pc);
+
+    if (pos == -1) { perror(archivo); return -1; }
+    /* Escrito ya no se puede deshacer: un fallo aquí sólo se avisa.  Si
+     * entretanto se compactó, el registro va en el fichero nuevo, que
+     * quedó sincronizado antes del rename().                            */
+    if (sincronizar && fdatasync(fd) == -1) perror("fdatasync 2pc");
+    return pos;
+}
+
+/* Lee el log entero: n registros, de los que los `*cabecera` primeros
+ * son el DF_BASE; el registro i (i ≥ *cabecera) es el xid
+ * *base + i - *cabecera.  NULL si no hay log.                           */
+static RegistroDosFases *leer_log(int fd, long *n, uint32_t *base, int *cabecera)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1) return NULL;
+    *n = st.st_size / (long)sizeof(RegistroDosFases);
+    RegistroDosFases *log = malloc((*n ? *n : 1) * sizeof *log);
+    if (!log) return NULL;
+    ssize_t leido = pread(fd, log, *n * sizeof *log, 0);
+    *n = leido > 0 ? leido / (long)sizeof *log : 0;
+    *base = 0;
+    *cabecera = *n > 0 && registro_valido(&log[0]) && log[0].estado == DF_BASE;
+    if (*cabecera) *base = log[0].xid;
+    return log;
+}
+
+/*─────────────────────────────────────────────*/
+/*                COMPACTACIÓN                 */
+/*─────────────────────────────────────────────*/
+
+/* Quita del principio del log las transferencias acabadas (TERMINADA, o
+ * RESUELTA en sus dos particiones) hasta la primera que no lo está; lo
+ * que sigue conserva su xid gracias al DF_BASE.  Devuelve cuántos
+ * registros quitó, 0 si no había nada o no se pudo.                     */
+static long compactar(const char *archivo)
+{
+    int fd = open(archivo, O_RDONLY);
+    if (fd == -1) return 0;
+    flock(fd, LOCK_EX);
+
+    long n = 0, quitados = 0;
+    uint32_t base;
+    int cab;
+    RegistroDosFases *log = log_vigente(fd, archivo) ? leer_log(fd, &n, &base, &cab) : NULL;
+    unsigned char *hecho = log ? calloc(n ? n : 1, 1) : NULL;
+    if (!hecho) goto fin;
+
+    /* bit k: la rama de r->particion[k] ya no se necesita */
+    for (long i = cab; i < n; ++i) {
+        const RegistroDosFases *r = &log[i];
+        if (!registro_valido(r) || r->xid < base || r->xid - base >= (uint32_t)(n - cab)) continue;
+        long j = cab + (long)(r->xid - base);
+        if (r->estado == DF_TERMINADA) hecho[j] |= 3;
+        if (r->estado == DF_RESUELTA)
+            for (int k = 0; k < 2; ++k)
+                if (log[j].particion[k] == r->particion[0]) hecho[j] |= 1 << k;
+    }
+    long corte = cab;
+    while (corte < n && !(registro_valido(&log[corte]) &&
+                          log[corte].estado == DF_CONFIRMADA && hecho[corte] != 3))
+        ++corte;
+    /* Lo que no es una CONFIRMADA pendiente se va con el prefijo; una
+     * TERMINADA o RESUELTA posterior de un xid quitado ya no cuenta.    */
+    if (corte == cab) goto fin;
+
+    char tmp[80];
+    snprintf(tmp, sizeof tmp, "%s.tmp", archivo);
+    int g = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (g == -1) { perror(tmp); goto fin; }
+    RegistroDosFases cabecera = { .estado = DF_BASE, .xid = base + (uint32_t)(corte - cab) };
+    cabecera.suma = fnv1a(&cabecera, offsetof(RegistroDosFases, suma));
+    size_t resto = (size_t)(n - corte) * sizeof *log;
+    int error = write(g, &cabecera, sizeof cabecera) != (ssize_t)sizeof cabecera ||
+                write(g, &log[corte], resto) != (ssize_t)resto ||
+                fsync(g) == -1;
+    close(g);
+    if (error || rename(tmp, archivo) == -1) {
+        perror(tmp);
+        unlink(tmp);
+        goto fin;
+    }
+    sincronizar_directorio(archivo);
+    quitados = corte - cab;
+
+fin:
+    free(hecho);
+    free(log);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return quitados;
+}
+
+/* Compacta si el log ha doblado su tamaño desde la última vez. */
+static void compactar_si_toca(const char *archivo)
+{
+    struct stat st;
+    if (stat(archivo, &st) == -1) return;
+    long n = st.st_size / (long)sizeof(RegistroDosFases);
+    if (n < MIN_COMPACTAR_2PC || n < 2 * tam_compactado) return;
+    compactar(archivo);
+    tam_compactado = stat(archivo, &st) == 0 ? st.st_size / (long)sizeof(RegistroDosFases) : n;
+}
+
+/*─────────────────────────────────────────────*/
+/*                COORDINADOR                  */
+/*─────────────────────────────────────────────*/
+
+/* origen y destino en particiones distintas de e.  Mismos resultados que
+ * op_transferencia(); OP_LIMITE si no se pudo escribir la decisión.      */
+ResultadoOp dosfases_transferencia(Enrutador *e, int origen, int destino, int64_t cent)
+{
+    uint64_t t0 = reloj_metricas();
+    int      part[2]   = { particion_de(origen, e->num), particion_de(destino, e->num) };
+    int      cuenta[2] = { origen, destino };
+    int64_t  apunte[2] = { -cent, cent };
+    TablaCuentas *t[2] = { e->tablas[part[0]], e->tablas[part[1]] };
+    Preparada pr[2];
+
+    /* Fase 1, en orden de partición */
+    seccion_entrar();
+    int a = part[0] < part[1] ? 0 : 1, b = 1 - a;
+    ResultadoOp r = op_preparar(t[a], cuenta[a], apunte[a], &pr[a]);
+    if (r == OP_OK) {
+        r = op_preparar(t[b], cuenta[b], apunte[b], &pr[b]);
+        if (r != OP_OK) op_abortar(t[a], &pr[a]);
+    }
+
+    /* Decisión */
+    int64_t xid = -1;
+    if (r == OP_OK) {
+        RegistroDosFases d = {
+            .estado    = DF_CONFIRMADA,
+            .particion = { part[0], part[1] },
+            .cuenta    = { origen, destino },
+            .despues   = { pr[0].despues, pr[1].despues },
+        };
+        xid = anotar(e->archivo_2pc, &d, 1);
+        if (xid == -1) {
+            op_abortar(t[b], &pr[b]);
+            op_abortar(t[a], &pr[a]);
+            r = OP_LIMITE;
+        }
+    }
+
+    /* Fase 2 */
+    if (r == OP_OK) {
+        uint64_t lsn[2];
+        for (int k = 0; k < 2; ++k) lsn[k] = op_confirmar(t[k], &pr[k], (uint32_t)xid);
+        for (int k = 0; k < 2; ++k) wal_confirmar(&t[k]->wal, lsn[k]);
+
+        RegistroDosFases fin = { .estado = DF_TERMINADA, .xid = (uint32_t)xid };
+        anotar(e->archivo_2pc, &fin, 0);
+    }
+    seccion_salir();
+
+    if (t0) metrica_observar(H_OPERACION, reloj_ns() - t0);
+    metrica_sumar(M_TRANSFERENCIAS, 1);
+    return r;
+}
+
+/*─────────────────────────────────────────────*/
+/*         RESOLUCIÓN EN CADA PARTICIÓN        */
+/*─────────────────────────────────────────────*/
+
+#define TERMINADA 1
+#define RESUELTA  2                      /* en esta partición */
+#define EN_DIARIO 4
+
+/* Aplica a la tabla de la partición p las ramas confirmadas que no
+ * llegaron a su diario.  Se llama con la partición parada (tras
+ * wal_recuperar() al arrancar o tras parar el hilo IO al cerrar) y antes
+ * del punto de control; después, dosfases_cerrar_resueltas().  Devuelve
+ * cuántas ramas aplicó.                                                  */
+int dosfases_resolver(TablaCuentas *t, const Config *cfg, int p)
+{
+    free(resueltas);
+    resueltas = NULL;
+    num_resueltas = 0;
+    particion_resuelta = p;
+
+    int fd = open(cfg->archivo_2pc, O_RDONLY);
+    if (fd == -1) return 0;
+    long total;
+    uint32_t base;
+    int cab;
+    RegistroDosFases *todo = leer_log(fd, &total, &base, &cab);
+    close(fd);
+    if (!todo) return 0;
+
+    /* log[i] es el xid base + i */
+    RegistroDosFases *log = todo + cab;
+    long n = total - cab;
+    unsigned char *marca = calloc(n ? n : 1, 1);
+    for (long i = 0; i < n; ++i) {
+        const RegistroDosFases *r = &log[i];
+        if (!registro_valido(r) || r->xid < base || r->xid - base >= (uint32_t)n)
+            continue;
+        if (r->estado == DF_TERMINADA) marca[r->xid - base] |= TERMINADA;
+        if (r->estado == DF_RESUELTA && r->particion[0] == p) marca[r->xid - base] |= RESUELTA;
+    }
+
+    /* Lo anotado en el anillo y aún no escrito también cuenta. */
+    uint64_t reservado = atomic_load(&t->wal.reservado);
+    if (reservado > 0) wal_confirmar(&t->wal, reservado - 1);
+    int num_ramas;
+    uint32_t *ramas = wal_ramas(&t->wal, &num_ramas);
+    for (int i = 0; i < num_ramas; ++i)
+        if (ramas[i] >= base && ramas[i] - base < (uint32_t)n) marca[ramas[i] - base] |= EN_DIARIO;
+    free(ramas);
+
+    int aplicadas = 0;
+    resueltas = malloc((n ? n : 1) * sizeof *resueltas);
+    for (long i = 0; i < n; ++i) {
+        const RegistroDosFases *r = &log[i];
+        if (r->estado != DF_CONFIRMADA || (marca[i] & (TERMINADA | RESUELTA)) ||
+            !registro_valido(r))
+            continue;
+        for (int k = 0; k < 2; ++k) {
+            if (r->particion[k] != p) continue;
+            if (!(marca[i] & EN_DIARIO)) {
+                int idx = buscar_cuenta(t, r->cuenta[k]);
+                if (idx != -1) {
+                    saldos_tabla(t)[idx] = r->despues[k];
+                    ++aplicadas;
+                }
+            }
+            resueltas[num_resueltas++] = base + (uint32_t)i;
+        }
+    }
+    free(marca);
+    free(todo);
+    return aplicadas;
+}
+
+/* Apunta como resueltas las ramas de la última dosfases_resolver(), ya
+ * guardadas en el punto de control: el diario se puede truncar.  Después
+ * compacta el log si toca.                                               */
+void dosfases_cerrar_resueltas(const Config *cfg)
+{
+    for (int i = 0; i < num_resueltas; ++i) {
+        RegistroDosFases r = {
+            .estado    = DF_RESUELTA,
+            .xid       = resueltas[i],
+            .particion = { particion_resuelta, -1 },
+        };
+        anotar(cfg->archivo_2pc, &r, i == num_resueltas - 1);
+    }
+    free(resueltas);
+    resueltas = NULL;
+    num_resueltas = 0;
+    compactar_si_toca(cfg->archivo_2pc);
+}
+
+/* El hilo IO va a quitar del diario de la partición estas ramas, ya
+ * guardadas en cuentas.dat: se apuntan como resueltas (y se sincroniza)
+ * antes, o al arrancar parecerían no haber llegado y se reaplicarían.
+ * Con ellas puede haber transferencias que ya no hagan falta en el log;
+ * compactar_si_toca() sólo relee el log cuando ha doblado su tamaño.     */
+static void ramas_recortadas(const uint32_t *xids, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        RegistroDosFases r = {
+            .estado    = DF_RESUELTA,
+            .xid       = xids[i],
+            .particion = { particion_vigilada, -1 },
+        };
+        anotar(archivo_vigilado, &r, i == n - 1);
+    }
+    compactar_si_toca(archivo_vigilado);
+}
+
+/* banco en la partición p: avisa de las ramas que salen del diario. */
+void dosfases_vigilar_diario(const Config *cfg, int p)
+{
+    snprintf(archivo_vigilado, sizeof archivo_vigilado, "%s", cfg->archivo_2pc);
+    particion_vigilada = p;
+    wal_al_recortar(ramas_recortadas);
+}
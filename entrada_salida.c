@@ -3,64 +3,437 @@
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>  // para getenv
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
 
 #include "utils.h"
 
 /*─────────────────────────────────────────────*/
 /*        FUNCIONES PARA GESTIÓN DE BUFFER      */
 /*─────────────────────────────────────────────*/
+static CeldaCola *celdas(BufferPrioridad *b, int nivel) {
+    return (CeldaCola *)((char *)b + b->colas[nivel].desplazamiento);
+}
+
+/* `desplazamiento` es la distancia en bytes desde b hasta la zona de
+ * celdas reservada para las tres colas (3 · capacidad celdas).           */
+void buffer_inicializar(BufferPrioridad *b, size_t capacidad, size_t desplazamiento) {
+    b->capacidad = capacidad;
+    atomic_init(&b->esperas, 0);
+    atomic_init(&b->durmiendo, 0);
+    atomic_init(&b->parar, 0);
+    inicializar_mutex_proceso_compartido(&b->mutex_aviso);
+    inicializar_cond_proceso_compartido(&b->hay_datos);
+
+    for (int nivel = 0; nivel < 3; ++nivel) {
+        ColaMPMC *c = &b->colas[nivel];
+        c->mascara        = capacidad - 1;
+        c->desplazamiento = desplazamiento + nivel * capacidad * sizeof(CeldaCola);
+        atomic_init(&c->cabeza, 0);
+        atomic_init(&c->cola, 0);
+
+        CeldaCola *cs = celdas(b, nivel);
+        for (size_t i = 0; i < capacidad; ++i)
+            atomic_init(&cs[i].secuencia, i);
+    }
+}
+
+static int cola_push(BufferPrioridad *b, int nivel, const Operacion *op) {
+    ColaMPMC  *c  = &b->colas[nivel];
+    CeldaCola *cs = celdas(b, nivel);
+    size_t pos = atomic_load_explicit(&c->cabeza, memory_order_relaxed);
+
+    for (;;) {
+        CeldaCola *celda = &cs[pos & c->mascara];
+        size_t seq = atomic_load_explicit(&celda->secuencia, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&c->cabeza, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                celda->op = *op;
+                atomic_store_explicit(&celda->secuencia, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;                              /* llena */
+        } else {
+            pos = atomic_load_explicit(&c->cabeza, memory_order_relaxed);
+        }
+    }
+}
+
+static int cola_pop(BufferPrioridad *b, int nivel, Operacion *op) {
+    ColaMPMC  *c  = &b->colas[nivel];
+    CeldaCola *cs = celdas(b, nivel);
+    size_t pos = atomic_load_explicit(&c->cola, memory_order_relaxed);
+
+    for (;;) {
+        CeldaCola *celda = &cs[pos & c->mascara];
+        size_t seq = atomic_load_explicit(&celda->secuencia, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&c->cola, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                *op = celda->op;
+                atomic_store_explicit(&celda->secuencia, pos + c->mascara + 1,
+                                      memory_order_release);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;                              /* vacía */
+        } else {
+            pos = atomic_load_explicit(&c->cola, memory_order_relaxed);
+        }
+    }
+}
+
+/* Encola la instantánea en la cola de su prioridad.  Con la cola llena el
+ * productor cede la CPU y reintenta (contrapresión): nunca se pierde una
+ * actualización.                                                         */
 void buffer_push(BufferPrioridad *b, const Cuenta *cta, Prioridad prio) {
-    if (b->n >= BUF_CAP)
-        return;
+    Operacion op = { .prio = prio, .snapshot = *cta };
 
-    int i = b->n++;
-    while (i > 0 && b->ops[i-1].prio < prio) {
-        b->ops[i] = b->ops[i-1];
-        --i;
+    if (!cola_push(b, prio, &op)) {
+        atomic_fetch_add_explicit(&b->esperas, 1, memory_order_relaxed);
+        metrica_sumar(M_COLA_LLENA, 1);
+        struct timespec pausa = {0, 100000L};  // 0,1 ms
+        while (!cola_push(b, prio, &op))
+            nanosleep(&pausa, NULL);
+    }
+    ColaMPMC *c = &b->colas[prio];
+    metrica_observar(H_COLA, atomic_load_explicit(&c->cabeza, memory_order_relaxed) -
+                             atomic_load_explicit(&c->cola, memory_order_relaxed));
+
+    /* El fence empareja con el de esperar_datos(): o el hilo IO ve la
+     * operación al revisar las colas, o nosotros vemos `durmiendo`.     */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&b->durmiendo, memory_order_relaxed)) {
+        pthread_mutex_lock(&b->mutex_aviso);
+        pthread_cond_signal(&b->hay_datos);
+        pthread_mutex_unlock(&b->mutex_aviso);
     }
-    b->ops[i].prio     = prio;
-    b->ops[i].snapshot = *cta;
+}
+
+/* Saca la operación más prioritaria disponible; 0 si no hay ninguna. */
+int buffer_pop(BufferPrioridad *b, Operacion *op) {
+    for (int nivel = P_ALTA; nivel >= P_BAJA; --nivel)
+        if (cola_pop(b, nivel, op)) return 1;
+    return 0;
 }
 
 /*─────────────────────────────────────────────*/
 /*             HILO CONSUMIDOR IO               */
 /*─────────────────────────────────────────────*/
 
+/* Conjunto de cuentas sucias pendientes de volcar.  Es privado del hilo
+ * IO: `hueco[idx]` indica dónde está la última instantánea de la cuenta
+ * idx dentro del lote (-1 si está limpia), de modo que varias operaciones
+ * sobre la misma cuenta se funden en una sola escritura.                 */
+#define LOTE_MAX 4096
+#define MAX_IOV  1024                    /* UIO_MAXIOV de Linux */
+
+typedef struct {
+    int    *hueco;
+    int     idx[LOTE_MAX];
+    Cuenta  snap[LOTE_MAX];
+    int     n;
+    /* Tramos de cuentas contiguas ya preparados para escribir; con
+     * io_uring deben seguir vivos hasta recoger los completados.         */
+    struct iovec iov[LOTE_MAX];
+    struct { int primero, n; off_t desp; } tramo[LOTE_MAX];
+    int     num_tramos;
+} Sucias;
+
+static void anotar(Sucias *s, int idx, const Cuenta *c) {
+    if (s->hueco[idx] == -1) {
+        s->hueco[idx]  = s->n;
+        s->idx[s->n++] = idx;
+    }
+    s->snap[s->hueco[idx]] = *c;
+}
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* Ordena el lote por posición y lo parte en tramos de cuentas contiguas
+ * (cada uno, como mucho MAX_IOV).  Antes confirma el diario hasta el
+ * último lsn repartido, para que cuentas.dat nunca vaya por delante del
+ * WAL.                                                                   */
+static void preparar_tramos(Sucias *s, TablaCuentas *t) {
+    uint64_t reservado = atomic_load(&t->wal.reservado);
+    if (reservado > 0) wal_confirmar(&t->wal, reservado - 1);
+
+    qsort(s->idx, s->n, sizeof(int), cmp_int);
+
+    int i = 0;
+    s->num_tramos = 0;
+    while (i < s->n) {
+        int inicio = s->idx[i], k = 0;
+        s->tramo[s->num_tramos].primero = i;
+        while (i < s->n && k < MAX_IOV && s->idx[i] == inicio + k) {
+            s->iov[i].iov_base = &s->snap[s->hueco[s->idx[i]]];
+            s->iov[i].iov_len  = sizeof(Cuenta);
+            ++k; ++i;
+        }
+        s->tramo[s->num_tramos].n    = k;
+        s->tramo[s->num_tramos].desp = (off_t)inicio * sizeof(Cuenta);
+        s->num_tramos++;
+    }
+}
+
+/* Cuenta el lote como volcado y lo deja vacío para anotar; snap/iov
+ * siguen válidos hasta que se vuelva a preparar.                         */
+static void lote_volcado(Sucias *s, TablaCuentas *t) {
+    atomic_fetch_add_explicit(&t->lotes_volcados, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&t->cuentas_volcadas, s->n, memory_order_relaxed);
+    metrica_sumar(M_VOLCADOS, 1);
+    metrica_sumar(M_CUENTAS_VOLCADAS, s->n);
+    if (t->politica_fsync == FSYNC_VOLCADO) metrica_sumar(M_FSYNCS_VOLCADO, 1);
+    for (int j = 0; j < s->n; ++j) s->hueco[s->idx[j]] = -1;
+    s->n = 0;
+}
+
+/* BACKEND_ES=posix: un pwritev por tramo y fdatasync, todo bloqueante.
+ * Si algo falla el lote sigue anotado y se reintenta en el siguiente
+ * volcado (lo que se anote entretanto sustituye a su instantánea).       */
+static void volcar_sucias(Sucias *s, TablaCuentas *t, int fd) {
+    if (s->n == 0) return;
+    preparar_tramos(s, t);
+
+    for (int k = 0; k < s->num_tramos; ++k)
+        if (pwritev(fd, &s->iov[s->tramo[k].primero], s->tramo[k].n, s->tramo[k].desp) == -1) {
+            perror("pwritev cuentas.dat (hilo IO)");
+            return;
+        }
+    if (t->politica_fsync == FSYNC_VOLCADO && fdatasync(fd) == -1) {
+        perror("fdatasync cuentas.dat (hilo IO)");
+        return;
+    }
+    lote_volcado(s, t);
+}
+
+/* BACKEND_ES=uring: todos los tramos y el fdatasync encadenados
+ * (IOSQE_IO_LINK) en un único envío; no se espera a que terminen.  Sólo
+ * se espera al lote anterior, para que dos lotes sobre la misma cuenta
+ * no se adelanten el uno al otro.                                        */
+static void enviar_sucias(Sucias *s, TablaCuentas *t, int fd, Uring *u) {
+    if (s->n == 0) return;
+    uring_esperar_todo(u);
+    preparar_tramos(s, t);
+    lote_volcado(s, t);
+
+    int sincronizar = t->politica_fsync == FSYNC_VOLCADO;
+    for (int k = 0; k < s->num_tramos; ++k) {
+        int ultimo = k == s->num_tramos - 1 && !sincronizar;
+        uring_writev(u, fd, &s->iov[s->tramo[k].primero], s->tramo[k].n,
+                     s->tramo[k].desp, ultimo ? 0 : IOSQE_IO_LINK);
+    }
+    if (sincronizar) uring_fdatasync(u, fd, 0);
+    uring_enviar(u, 0);
+}
+
+static void sumar_ms(struct timespec *ts, int ms) {
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) { ts->tv_sec++; ts->tv_nsec -= 1000000000L; }
+}
+
+static int vencido(const struct timespec *plazo) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return ahora.tv_sec > plazo->tv_sec ||
+          (ahora.tv_sec == plazo->tv_sec && ahora.tv_nsec >= plazo->tv_nsec);
+}
+
+/* Duerme hasta que un productor encole algo, llegue el plazo (si hay) o se
+ * pida parar.  Vuelve sin dormir si las colas tienen datos.              */
+static void esperar_datos(BufferPrioridad *b, const struct timespec *plazo) {
+    pthread_mutex_lock(&b->mutex_aviso);
+    atomic_store(&b->durmiendo, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int vacias = 1;
+    for (int nivel = 0; nivel < 3 && vacias; ++nivel) {
+        ColaMPMC *c = &b->colas[nivel];
+        vacias = atomic_load(&c->cabeza) == atomic_load(&c->cola);
+    }
+    if (vacias && !atomic_load(&b->parar)) {
+        if (plazo) pthread_cond_timedwait(&b->hay_datos, &b->mutex_aviso, plazo);
+        else       pthread_cond_wait(&b->hay_datos, &b->mutex_aviso);
+    }
+
+    atomic_store(&b->durmiendo, 0);
+    pthread_mutex_unlock(&b->mutex_aviso);
+}
+
+/* Vuelca el lote en curso y devuelve en el que seguir anotando.  El
+ * histograma H_VOLCADO recoge lo que el hilo queda bloqueado: con io_uring
+ * es la espera al lote anterior más el envío, no la escritura entera.    */
+static Sucias *volcar(Sucias *lotes[2], int *actual, TablaCuentas *t, int fd, Uring *u) {
+    Sucias *s = lotes[u ? *actual : 0];
+    if (s->n == 0) return s;
+
+    uint64_t t0 = reloj_ns();
+    if (!u) volcar_sucias(s, t, fd);
+    else  { enviar_sucias(s, t, fd, u); *actual ^= 1; }
+    metrica_observar(H_VOLCADO, reloj_ns() - t0);
+    return lotes[u ? *actual : 0];
+}
+
+/* Anota la instantánea sacada de las colas en el lote en curso y lo
+ * vuelca si se llena.  Devuelve en el que seguir anotando.               */
+static Sucias *recoger(Sucias *lotes[2], int *actual, TablaCuentas *t, int fd, Uring *u,
+                       const Operacion *op, struct timespec *plazo) {
+    Sucias *s = lotes[u ? *actual : 0];
+    int idx = buscar_cuenta(t, op->snapshot.numero_cuenta);
+    if (idx == -1) return s;
+
+    /* Lote lleno porque su volcado falló: se reintenta hasta que haya
+     * sitio, y mientras las colas hacen de contrapresión.                */
+    struct timespec pausa = { 0, 100000000L };
+    while (s->n == LOTE_MAX && s->hueco[idx] == -1) {
+        s = volcar(lotes, actual, t, fd, u);
+        if (s->n == LOTE_MAX) nanosleep(&pausa, NULL);
+    }
+
+    if (s->n == 0) {                       /* primera sucia del lote */
+        clock_gettime(CLOCK_MONOTONIC, plazo);
+        sumar_ms(plazo, t->intervalo_volcado_ms);
+    }
+    anotar(s, idx, &op->snapshot);
+    return s->n == LOTE_MAX ? volcar(lotes, actual, t, fd, u) : s;
+}
+
+/* Quien reservó un lsn anterior a `corte` tiene sus franjas tomadas desde
+ * antes de reservarlo hasta después de encolar sus cuentas, así que tras
+ * pasar una vez por cada franja ya está todo en las colas.  Con try-lock
+ * y sacando de las colas entretanto: un productor puede estar esperando
+ * hueco con su franja tomada.                                            */
+static Sucias *pasar_franjas(Sucias *lotes[2], int *actual, TablaCuentas *t, int fd, Uring *u,
+                             struct timespec *plazo) {
+    Sucias *s = lotes[u ? *actual : 0];
+    struct timespec pausa = { 0, 100000L };
+    for (int i = 0; i < t->num_cerrojos; ++i) {
+        while (pthread_mutex_trylock(&t->cerrojos[i].m) != 0) {
+            Operacion op;
+            if (buffer_pop(&t->buffer, &op)) s = recoger(lotes, actual, t, fd, u, &op, plazo);
+            else nanosleep(&pausa, NULL);
+        }
+        pthread_mutex_unlock(&t->cerrojos[i].m);
+    }
+    return s;
+}
+
+/* El diario pasa de PUNTO_CONTROL_WAL_MB: punto de control de lo anotado
+ * hasta el lsn `corte` y recorte del diario hasta ahí.  Lo encolado antes
+ * del corte está por delante de la cabeza que se lee ahora en cada cola;
+ * se saca nivel a nivel (buffer_pop podría no llegar nunca a las colas
+ * bajas), se vuelca, se espera a que esté escrito y se sincroniza.       */
+static Sucias *recortar_diario(Sucias *lotes[2], int *actual, TablaCuentas *t, int fd, Uring *u,
+                               struct timespec *plazo) {
+    BufferPrioridad *b = &t->buffer;
+    uint64_t corte = atomic_load(&t->wal.reservado);
+    Sucias *s = pasar_franjas(lotes, actual, t, fd, u, plazo);
+
+    for (int nivel = P_ALTA; nivel >= P_BAJA; --nivel) {
+        size_t fin = atomic_load(&b->colas[nivel].cabeza);
+        while (atomic_load(&b->colas[nivel].cola) < fin) {
+            Operacion op;
+            if (cola_pop(b, nivel, &op)) s = recoger(lotes, actual, t, fd, u, &op, plazo);
+            else sched_yield();                /* el productor aún la copia */
+        }
+    }
+    s = volcar(lotes, actual, t, fd, u);
+    if (s->n == 0) {
+        if (u) uring_esperar_todo(u);
+        if (fdatasync(fd) == 0) {
+            wal_recortar(&t->wal, wal_corte(&t->wal, corte));
+            return s;
+        }
+        perror("fdatasync cuentas.dat (hilo IO)");
+    }
+    /* Sin escribir o sin sincronizar el diario se queda entero; el
+     * siguiente intento, tras una pausa para no girar sobre el error.    */
+    struct timespec pausa = { 0, 100000000L };
+    nanosleep(&pausa, NULL);
+    return s;
+}
+
+static Sucias *crear_sucias(int capacidad) {
+    Sucias *s = malloc(sizeof *s);
+    s->hueco  = malloc(capacidad * sizeof(int));
+    s->n      = 0;
+    for (int i = 0; i < capacidad; ++i) s->hueco[i] = -1;
+    return s;
+}
+
+static void liberar_sucias(Sucias *s) {
+    if (!s) return;
+    free(s->hueco);
+    free(s);
+}
+
 void *gestionar_entrada_salida(void *arg) {
     TablaCuentas *t = arg;
     const char *path = getenv("SECUREBANK_FILE");
-    struct timespec pausa = {0, 20000000L};  // 20 ms
 
+    int fd = open(path, O_RDWR);
+    if (fd == -1) { perror("cuentas.dat (hilo IO)"); return NULL; }
+
+    /* Con io_uring se alternan dos lotes: mientras uno está en vuelo el
+     * hilo sigue anotando en el otro.                                    */
+    Uring u;
+    int con_uring = t->backend_es == ES_URING;
+    if (con_uring && uring_iniciar(&u, 2 * LOTE_MAX) == -1) {
+        fputs("io_uring no disponible: volcado con pwritev\n", stderr);
+        con_uring = 0;
+    }
+    Sucias *lotes[2] = { crear_sucias(t->capacidad),
+                         con_uring ? crear_sucias(t->capacidad) : NULL };
+    int actual = 0;
+    Sucias *s = lotes[0];
+
+    struct timespec plazo;
     for (;;) {
-        pthread_mutex_lock(&t->mutex);
-        if (t->buffer.n == 0) {
-            pthread_mutex_unlock(&t->mutex);
-            nanosleep(&pausa, NULL);
-            continue;
-        }
+        Operacion op;
+        while (buffer_pop(&t->buffer, &op))
+            s = recoger(lotes, &actual, t, fd, con_uring ? &u : NULL, &op, &plazo);
 
-        Operacion op = t->buffer.ops[0];
-        memmove(&t->buffer.ops[0], &t->buffer.ops[1],
-                (t->buffer.n - 1) * sizeof(Operacion));
-        --t->buffer.n;
-        pthread_mutex_unlock(&t->mutex);
-
-        int idx = -1;
-        for (int i = 0; i < t->num_cuentas; ++i) {
-            if (t->cuentas[i].numero_cuenta == op.snapshot.numero_cuenta) {
-                idx = i;
-                break;
+        if (atomic_load(&t->buffer.parar)) break;
+        if (s->n > 0 && vencido(&plazo)) {
+            s = volcar(lotes, &actual, t, fd, con_uring ? &u : NULL);
+            if (s->n > 0) {                /* falló: otro intento en un plazo */
+                clock_gettime(CLOCK_MONOTONIC, &plazo);
+                sumar_ms(&plazo, t->intervalo_volcado_ms);
             }
         }
-        if (idx == -1) continue;
+        if (wal_crecido(&t->wal)) s = recortar_diario(lotes, &actual, t, fd, con_uring ? &u : NULL, &plazo);
+        if (con_uring) uring_cosechar(&u);
 
-        FILE *f = fopen(path, "rb+");
-        if (!f) { perror("cuentas.dat (hilo IO)"); continue; }
-        fseek(f, idx * sizeof(Cuenta), SEEK_SET);
-        fwrite(&op.snapshot, sizeof(Cuenta), 1, f);
-        fclose(f);
+        esperar_datos(&t->buffer, s->n > 0 ? &plazo : NULL);
     }
 
+    volcar(lotes, &actual, t, fd, con_uring ? &u : NULL);
+    if (con_uring) { uring_esperar_todo(&u); uring_cerrar(&u); }
+    close(fd);
+    liberar_sucias(lotes[0]);
+    liberar_sucias(lotes[1]);
     return NULL;
 }
+
+/* Pide al hilo IO que vuelque lo pendiente y termine (luego pthread_join). */
+void detener_entrada_salida(TablaCuentas *t) {
+    BufferPrioridad *b = &t->buffer;
+    pthread_mutex_lock(&b->mutex_aviso);
+    atomic_store(&b->parar, 1);
+    pthread_cond_signal(&b->hay_datos);
+    pthread_mutex_unlock(&b->mutex_aviso);
+}
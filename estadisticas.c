@@ -0,0 +1,221 @@
+/* estadisticas.c — Métricas de SecureBank en vivo
+ *   ● Se adjunta al banco en marcha y cada `intervalo` ms suma las ranuras
+ *     de métricas de todos los procesos (metricas.c) y muestra las tasas
+ *     del intervalo: operaciones, esperas por cerrojo, cola del hilo IO,
+ *     eventos perdidos, fsyncs del diario y del volcado y bytes de log,
+ *     con los percentiles 50/99 de sus histogramas.
+ *   ● Con json=fichero añade además una línea JSON por intervalo (totales,
+ *     tasas, percentiles y las cubetas del intervalo).
+ *   ● Con procesos=1 desglosa las operaciones por proceso registrado.
+ *   ● veces=N para tras N intervalos (0 = hasta Ctrl-C).
+ *
+ *  Ejecutar:  ./estadisticas <shm_id> [intervalo=1000] [veces=0]
+ *                            [json=fichero] [procesos=0]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "utils.h"
+
+typedef struct {
+    long valor[NUM_METRICAS];
+    long hist[NUM_HISTOGRAMAS][CUBETAS_HIST];
+} Totales;
+
+static volatile sig_atomic_t salir;
+
+static void manejar_int(int sig) { (void)sig; salir = 1; }
+
+static double ahora_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void leer_ranura(RanuraMetricas *r, Totales *o)
+{
+    for (int m = 0; m < NUM_METRICAS; ++m)
+        o->valor[m] += atomic_load_explicit(&r->valor[m], memory_order_relaxed);
+    for (int h = 0; h < NUM_HISTOGRAMAS; ++h)
+        for (int c = 0; c < CUBETAS_HIST; ++c)
+            o->hist[h][c] += atomic_load_explicit(&r->hist[h][c], memory_order_relaxed);
+}
+
+static void sumar_ranuras(TablaCuentas *t, Totales *o)
+{
+    memset(o, 0, sizeof *o);
+    RanuraMetricas *rs = ranuras_tabla(t);
+    for (int i = 0; i < MAX_RANURAS; ++i) leer_ranura(&rs[i], o);
+}
+
+/* Diferencia entre dos lecturas; una ranura reutilizada mientras se leía
+ * puede dar un valor algo menor, que se toma como 0.                     */
+static void restar(const Totales *a, const Totales *b, Totales *d)
+{
+    for (int m = 0; m < NUM_METRICAS; ++m) {
+        long x = a->valor[m] - b->valor[m];
+        d->valor[m] = x > 0 ? x : 0;
+    }
+    for (int h = 0; h < NUM_HISTOGRAMAS; ++h)
+        for (int c = 0; c < CUBETAS_HIST; ++c) {
+            long x = a->hist[h][c] - b->hist[h][c];
+            d->hist[h][c] = x > 0 ? x : 0;
+        }
+}
+
+/* Cota superior de la cubeta que contiene el percentil p (0 sin datos). */
+static double percentil(const long *cub, double p)
+{
+    long total = 0;
+    for (int c = 0; c < CUBETAS_HIST; ++c) total += cub[c];
+    if (total == 0) return 0;
+    long acum = 0, objetivo = (long)(p * total);
+    if (objetivo < 1) objetivo = 1;
+    for (int c = 0; c < CUBETAS_HIST; ++c) {
+        acum += cub[c];
+        if (acum >= objetivo) return c == 0 ? 0 : (double)(1ULL << c);
+    }
+    return (double)(1ULL << (CUBETAS_HIST - 1));
+}
+
+static long operaciones(const Totales *d)
+{
+    return d->valor[M_DEPOSITOS] + d->valor[M_RETIROS] + d->valor[M_TRANSFERENCIAS] +
+           d->valor[M_SALDOS] + d->valor[M_LOTES];
+}
+
+static void imprimir_cabecera(void)
+{
+    printf("%9s %8s %8s %9s %8s %6s %7s %7s %7s %8s %7s %8s %9s\n",
+           "ops/s", "op p50", "op p99", "esperas/s", "esp p99", "cola99",
+           "llena/s", "perd/s", "wal/s", "wal p99", "volc/s", "volc p99", "log KB/s");
+    printf("%9s %8s %8s %9s %8s %6s %7s %7s %7s %8s %7s %8s %9s\n",
+           "", "µs", "µs", "", "µs", "", "", "", "fsync", "µs", "", "ms", "");
+}
+
+static void imprimir_fila(const Totales *d, double dt)
+{
+    printf("%9.0f %8.1f %8.1f %9.0f %8.1f %6.0f %7.0f %7.0f %7.0f %8.0f %7.1f %8.2f %9.1f\n",
+           operaciones(d) / dt,
+           percentil(d->hist[H_OPERACION], 0.50) / 1e3,
+           percentil(d->hist[H_OPERACION], 0.99) / 1e3,
+           d->valor[M_CERROJOS_OCUPADOS] / dt,
+           percentil(d->hist[H_ESPERA_CERROJO], 0.99) / 1e3,
+           percentil(d->hist[H_COLA], 0.99),
+           d->valor[M_COLA_LLENA] / dt,
+           d->valor[M_EVENTOS_PERDIDOS] / dt,
+           d->valor[M_FSYNCS_WAL] / dt,
+           percentil(d->hist[H_FSYNC_WAL], 0.99) / 1e3,
+           d->valor[M_VOLCADOS] / dt,
+           percentil(d->hist[H_VOLCADO], 0.99) / 1e6,
+           d->valor[M_BYTES_LOG] / dt / 1024.0);
+}
+
+static void imprimir_procesos(TablaCuentas *t, long previas[MAX_RANURAS],
+                              int pids[MAX_RANURAS], double dt)
+{
+    RanuraMetricas *rs = ranuras_tabla(t);
+    for (int i = 1; i < MAX_RANURAS; ++i) {
+        int pid = atomic_load(&rs[i].pid);
+        if (pid == 0) continue;
+        Totales r;
+        memset(&r, 0, sizeof r);
+        leer_ranura(&rs[i], &r);
+        long ops = operaciones(&r);
+        long antes = pids[i] == pid ? previas[i] : 0;
+        printf("    %-15.15s pid %-7d %9.0f ops/s  %9ld esperas de cerrojo en total%s\n",
+               rs[i].nombre, pid, (ops - antes) / dt, r.valor[M_CERROJOS_OCUPADOS],
+               kill(pid, 0) == -1 && errno == ESRCH ? "  (terminado)" : "");
+        previas[i] = ops;
+        pids[i] = pid;
+    }
+}
+
+static void escribir_json(FILE *f, const Totales *tot, const Totales *d, double dt)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fprintf(f, "{\"ts\":%.3f,\"intervalo_s\":%.3f,\"totales\":{",
+            ts.tv_sec + ts.tv_nsec / 1e9, dt);
+    for (int m = 0; m < NUM_METRICAS; ++m)
+        fprintf(f, "%s\"%s\":%ld", m ? "," : "", nombre_metrica(m), tot->valor[m]);
+    fputs("},\"tasas\":{", f);
+    for (int m = 0; m < NUM_METRICAS; ++m)
+        fprintf(f, "%s\"%s\":%.1f", m ? "," : "", nombre_metrica(m), d->valor[m] / dt);
+    fputs("},\"histogramas\":{", f);
+    for (int h = 0; h < NUM_HISTOGRAMAS; ++h) {
+        fprintf(f, "%s\"%s\":{\"p50\":%.0f,\"p99\":%.0f,\"p999\":%.0f,\"cubetas\":[",
+                h ? "," : "", nombre_histograma(h), percentil(d->hist[h], 0.50),
+                percentil(d->hist[h], 0.99), percentil(d->hist[h], 0.999));
+        for (int c = 0; c < CUBETAS_HIST; ++c) fprintf(f, "%s%ld", c ? "," : "", d->hist[h][c]);
+        fputs("]}", f);
+    }
+    fputs("}}\n", f);
+    fflush(f);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Uso: %s <shm_id> [intervalo=ms] [veces=N] [json=fichero] [procesos=1]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    int intervalo_ms = 1000, veces = 0, procesos = 0;
+    const char *ruta_json = NULL;
+    for (int i = 2; i < argc; ++i) {
+        const char *v = strchr(argv[i], '=');
+        if (!v) { fprintf(stderr, "opción desconocida: %s\n", argv[i]); continue; }
+        ++v;
+        if      (strncmp(argv[i], "intervalo=", 10) == 0) intervalo_ms = atoi(v);
+        else if (strncmp(argv[i], "veces=", 6) == 0)      veces = atoi(v);
+        else if (strncmp(argv[i], "json=", 5) == 0)       ruta_json = v;
+        else if (strncmp(argv[i], "procesos=", 9) == 0)   procesos = atoi(v);
+        else fprintf(stderr, "opción desconocida: %s\n", argv[i]);
+    }
+    if (intervalo_ms < 10) intervalo_ms = 10;
+
+    FILE *json = NULL;
+    if (ruta_json && !(json = fopen(ruta_json, "a"))) { perror(ruta_json); return EXIT_FAILURE; }
+
+    TablaCuentas *t = adjuntar_shm(atoi(argv[1]));
+
+    struct sigaction sa = { .sa_handler = manejar_int };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    static Totales antes, ahora, delta;
+    long previas[MAX_RANURAS] = { 0 };
+    int  pids[MAX_RANURAS] = { 0 };
+    sumar_ranuras(t, &antes);
+    double t_antes = ahora_s();
+
+    struct timespec pausa = { intervalo_ms / 1000, (long)(intervalo_ms % 1000) * 1000000L };
+    for (int n = 0; !salir && (veces == 0 || n < veces); ++n) {
+        nanosleep(&pausa, NULL);
+        sumar_ranuras(t, &ahora);
+        double t_ahora = ahora_s(), dt = t_ahora - t_antes;
+        restar(&ahora, &antes, &delta);
+
+        if (n % 20 == 0) imprimir_cabecera();
+        imprimir_fila(&delta, dt);
+        if (procesos) imprimir_procesos(t, previas, pids, dt);
+        if (json) escribir_json(json, &ahora, &delta, dt);
+        fflush(stdout);
+
+        antes = ahora;
+        t_antes = t_ahora;
+    }
+
+    if (json) fclose(json);
+    liberar_shm(t, -1);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+/* eventos.c — Avisos de usuario a monitor
+ *
+ *  ▸ CANAL_SHM: anillo de la SHM con varios productores (usuarios) y un
+ *    único consumidor (monitor).  Los productores reservan hueco con CAS
+ *    como en la cola del buffer de E/S; el monitor avanza `cola` sin
+ *    atómicos y saca todos los eventos disponibles de una vez.
+ *  ▸ CANAL_COLA: los mismos registros binarios por la cola SysV, abierta
+ *    una sola vez por proceso.  El monitor también los lee por lotes.
+ *  ▸ Con el canal lleno, un depósito se descarta y se cuenta en
+ *    `perdidos`.  Retiros, transferencias y lotes (lo que miran las
+ *    reglas de fraude) esperan hueco mientras viva el monitor que consume
+ *    (`consumidor`); sin monitor también se descartan y se cuentan.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+
+#include "utils.h"
+
+struct msg_evento {
+    long tipo;
+    Evento ev;
+};
+
+#define REVISAR_CONSUMIDOR 1000         /* reintentos entre comprobaciones */
+
+static int cola_monitor = -1;            /* cola SysV de este proceso */
+
+static CeldaEvento *celdas_eventos(AnilloEventos *a) {
+    return (CeldaEvento *)((char *)a + a->desplazamiento);
+}
+
+static int abrir_cola(void) {
+    if (cola_monitor == -1) {
+        cola_monitor = msgget(CLAVE_COLA_MONITOR, IPC_CREAT | 0666);
+        if (cola_monitor == -1) perror("msgget");
+    }
+    return cola_monitor;
+}
+
+/*─────────────────────────────────────────────*/
+/*              INICIALIZACIÓN                 */
+/*─────────────────────────────────────────────*/
+
+/* `desplazamiento` es la distancia desde a hasta las `capacidad` celdas. */
+void eventos_inicializar(AnilloEventos *a, size_t capacidad, size_t desplazamiento) {
+    a->mascara        = capacidad - 1;
+    a->desplazamiento = desplazamiento;
+    a->cola           = 0;
+    atomic_init(&a->cabeza, 0);
+    atomic_init(&a->perdidos, 0);
+    atomic_init(&a->durmiendo, 0);
+    atomic_init(&a->consumidor, 0);
+    inicializar_mutex_proceso_compartido(&a->mutex_aviso);
+    inicializar_cond_proceso_compartido(&a->hay_eventos);
+
+    CeldaEvento *cs = celdas_eventos(a);
+    for (size_t i = 0; i < capacidad; ++i) atomic_init(&cs[i].secuencia, i);
+}
+
+/*─────────────────────────────────────────────*/
+/*                 PUBLICAR                    */
+/*─────────────────────────────────────────────*/
+
+static int anillo_push(AnilloEventos *a, const Evento *ev) {
+    CeldaEvento *cs = celdas_eventos(a);
+    size_t pos = atomic_load_explicit(&a->cabeza, memory_order_relaxed);
+
+    for (;;) {
+        CeldaEvento *celda = &cs[pos & a->mascara];
+        size_t seq = atomic_load_explicit(&celda->secuencia, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&a->cabeza, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                celda->ev = *ev;
+                atomic_store_explicit(&celda->secuencia, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;                              /* lleno */
+        } else {
+            pos = atomic_load_explicit(&a->cabeza, memory_order_relaxed);
+        }
+    }
+}
+
+/* ¿Hay un monitor vivo sacando eventos? */
+static int consumidor_vivo(AnilloEventos *a) {
+    pid_t pid = atomic_load(&a->consumidor);
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/* Con el canal lleno: 1 si hay que esperar hueco y reintentar. */
+static int esperar_hueco(AnilloEventos *a, TipoOp tipo, long *intentos) {
+    if (tipo == OP_DEPOSITO) return 0;
+    if ((*intentos)++ % REVISAR_CONSUMIDOR == 0 && !consumidor_vivo(a)) return 0;
+    struct timespec pausa = {0, 100000L};  // 0,1 ms
+    nanosleep(&pausa, NULL);
+    return 1;
+}
+
+static void perder(AnilloEventos *a) {
+    atomic_fetch_add_explicit(&a->perdidos, 1, memory_order_relaxed);
+    metrica_sumar(M_EVENTOS_PERDIDOS, 1);
+}
+
+/* Avisa al monitor de una operación ya confirmada.  `destino` vale -1 si
+ * la operación sólo toca una cuenta.  `sesion` distingue las conexiones
+ * que atiende un mismo proceso (servidor.c); 0 si el proceso es la sesión. */
+void evento_publicar(TablaCuentas *t, TipoOp tipo, int origen, int destino, int64_t centimos, int sesion) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    Evento ev = {
+        .tipo     = tipo,
+        .cuenta   = { origen, destino },
+        .pid      = getpid(),
+        .sesion   = sesion,
+        .centimos = centimos,
+        .ts_ns    = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+    };
+
+    AnilloEventos *a = &t->eventos;
+    long intentos = 0;
+    if (t->canal_monitor == CANAL_COLA) {
+        int q = abrir_cola();
+        struct msg_evento m = { .tipo = 1, .ev = ev };
+        while (q != -1 && msgsnd(q, &m, sizeof m.ev, IPC_NOWAIT) == -1)
+            if (errno != EAGAIN || !esperar_hueco(a, tipo, &intentos)) { perder(a); break; }
+        return;
+    }
+
+    while (!anillo_push(a, &ev))
+        if (!esperar_hueco(a, tipo, &intentos)) { perder(a); return; }
+
+    /* Mismo protocolo que buffer_push(): o el monitor ve el evento al
+     * revisar el anillo, o nosotros vemos `durmiendo`.                    */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&a->durmiendo, memory_order_relaxed)) {
+        pthread_mutex_lock(&a->mutex_aviso);
+        pthread_cond_signal(&a->hay_eventos);
+        pthread_mutex_unlock(&a->mutex_aviso);
+    }
+}
+
+/*─────────────────────────────────────────────*/
+/*                 RECIBIR                     */
+/*─────────────────────────────────────────────*/
+
+static int anillo_drenar(AnilloEventos *a, Evento *lote, int max) {
+    CeldaEvento *cs = celdas_eventos(a);
+    int n = 0;
+    while (n < max) {
+        CeldaEvento *celda = &cs[a->cola & a->mascara];
+        if (atomic_load_explicit(&celda->secuencia, memory_order_acquire) != a->cola + 1)
+            break;
+        lote[n++] = celda->ev;
+        atomic_store_explicit(&celda->secuencia, a->cola + a->mascara + 1,
+                              memory_order_release);
+        a->cola++;
+    }
+    return n;
+}
+
+static int anillo_recibir(AnilloEventos *a, Evento *lote, int max) {
+    int n = anillo_drenar(a, lote, max);
+    if (n > 0) return n;
+
+    struct timespec plazo;
+    clock_gettime(CLOCK_MONOTONIC, &plazo);
+    plazo.tv_sec += 1;
+
+    pthread_mutex_lock(&a->mutex_aviso);
+    atomic_store(&a->durmiendo, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    n = anillo_drenar(a, lote, max);
+    if (n == 0) {
+        pthread_cond_timedwait(&a->hay_eventos, &a->mutex_aviso, &plazo);
+        n = anillo_drenar(a, lote, max);
+    }
+    atomic_store(&a->durmiendo, 0);
+    pthread_mutex_unlock(&a->mutex_aviso);
+    return n;
+}
+
+static int cola_recibir(Evento *lote, int max) {
+    int q = abrir_cola();
+    if (q == -1) return -1;
+
+    struct msg_evento m;
+    int n = 0;
+    while (n < max) {
+        if (msgrcv(q, &m, sizeof m.ev, 0, n == 0 ? 0 : IPC_NOWAIT) == -1) {
+            if (n == 0 && errno != EINTR) return -1;
+            break;
+        }
+        lote[n++] = m.ev;
+    }
+    return n;
+}
+
+/* Lo usa el monitor (único consumidor).  Espera a que haya eventos y
+ * devuelve hasta `max`; 0 si venció el plazo (1 s) o llegó una señal,
+ * -1 ante un error.  Con t == NULL se lee de la cola SysV.               */
+int eventos_recibir(TablaCuentas *t, Evento *lote, int max) {
+    if (t && atomic_load_explicit(&t->eventos.consumidor, memory_order_relaxed) != getpid())
+        atomic_store(&t->eventos.consumidor, getpid());
+    if (t == NULL || t->canal_monitor == CANAL_COLA) return cola_recibir(lote, max);
+    return anillo_recibir(&t->eventos, lote, max);
+}
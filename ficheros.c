@@ -3,19 +3,71 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "utils.h"
 
 /*─────────────────────────────────────────────*/
 /*            CONFIGURACIÓN GENERAL            */
 /*─────────────────────────────────────────────*/
+
+/* REGLA=<nombre> <tipo> <ventana_s> <n> <importe_min> <importe_max> */
+static int leer_regla(const char *ln, ReglaAnomalia *r) {
+    static const struct { const char *nombre; int tipo; ClaveRegla clave; } tipos[] = {
+        { "DEPOSITO", OP_DEPOSITO, REGLA_CUENTA },
+        { "RETIRO", OP_RETIRO, REGLA_CUENTA },
+        { "TRANSFERENCIA", OP_TRANSFERENCIA, REGLA_CUENTA },
+        { "PAR", OP_TRANSFERENCIA, REGLA_PAR },
+        { "LOTE", OP_LOTE, REGLA_CUENTA },
+        { "TODAS", 0, REGLA_CUENTA },
+        { "SESIONES", 0, REGLA_SESIONES },
+    };
+    char tipo[16];
+    double minimo, maximo;
+
+    memset(r, 0, sizeof *r);
+    if (sscanf(ln, "REGLA=%23s %15s %d %d %lf %lf", r->nombre, tipo,
+               &r->ventana_s, &r->max_ops, &minimo, &maximo) != 6)
+        return -1;
+
+    size_t k = 0;
+    while (k < sizeof tipos / sizeof tipos[0] && strcmp(tipo, tipos[k].nombre) != 0) ++k;
+    if (k == sizeof tipos / sizeof tipos[0]) return -1;
+    r->tipo        = tipos[k].tipo;
+    r->clave       = tipos[k].clave;
+    r->importe_min = (int64_t)(minimo * 100 + 0.5);
+    r->max_importe = (int64_t)(maximo * 100 + 0.5);
+
+    if (r->ventana_s <= 0 || r->max_ops < 0 || (r->max_ops == 0 && r->max_importe <= 0))
+        return -1;
+    if (r->clave == REGLA_SESIONES &&
+        (r->max_ops < 2 || r->max_ops > MAX_PIDS_SESION)) return -1;
+    return 0;
+}
+
+/* Sin líneas REGLA=: las reglas de siempre, ahora con ventana de 60 s. */
+static void reglas_por_defecto(Config *c) {
+    if (c->umbral_retiros > 0)
+        c->reglas[c->num_reglas++] = (ReglaAnomalia){
+            "retiros", OP_RETIRO, REGLA_CUENTA, 60, c->umbral_retiros, 0, 0 };
+    if (c->umbral_transferencias > 0)
+        c->reglas[c->num_reglas++] = (ReglaAnomalia){
+            "transferencias", OP_TRANSFERENCIA, REGLA_PAR, 60, c->umbral_transferencias, 0, 0 };
+    c->reglas[c->num_reglas++] = (ReglaAnomalia){
+        "sesiones", 0, REGLA_SESIONES, 30, 2, 0, 0 };
+}
+
 Config leer_config(const char *ruta) {
     Config c = {0};
+    c.punto_control_wal_mb = -1;         /* 0 es un valor válido */
     FILE *f = fopen(ruta, "r");
     if (!f) { perror("config.txt"); exit(EXIT_FAILURE); }
 
-    char ln[128];
+    char ln[128], politica[16], modo[16], canal[16], backend[16], txt[16];
     while (fgets(ln, sizeof ln, f)) {
         if (ln[0]=='#' || strlen(ln)<3) continue;
         sscanf(ln, "LIMITE_RETIRO=%d",        &c.limite_retiro);
@@ -23,30 +75,268 @@ Config leer_config(const char *ruta) {
         sscanf(ln, "UMBRAL_RETIROS=%d",       &c.umbral_retiros);
         sscanf(ln, "UMBRAL_TRANSFERENCIAS=%d",&c.umbral_transferencias);
         sscanf(ln, "NUM_HILOS=%d",            &c.num_hilos);
+        sscanf(ln, "CAPACIDAD_BUFFER=%d",     &c.capacidad_buffer);
+        sscanf(ln, "INTERVALO_VOLCADO_MS=%d", &c.intervalo_volcado_ms);
+        sscanf(ln, "CAPACIDAD_WAL=%d",        &c.capacidad_wal);
+        sscanf(ln, "VENTANA_GRUPO_US=%d",     &c.ventana_grupo_us);
+        sscanf(ln, "PUNTO_CONTROL_WAL_MB=%d", &c.punto_control_wal_mb);
+        sscanf(ln, "CAPACIDAD_CONTADORES=%d", &c.capacidad_contadores);
+        sscanf(ln, "HILOS_MONITOR=%d",        &c.hilos_monitor);
+        if (strncmp(ln, "REGLA=", 6) == 0) {
+            if (c.num_reglas == MAX_REGLAS || leer_regla(ln, &c.reglas[c.num_reglas]) == -1)
+                fprintf(stderr, "config.txt: regla ignorada: %s", ln);
+            else
+                c.num_reglas++;
+        }
+        sscanf(ln, "CAPACIDAD_EVENTOS=%d",    &c.capacidad_eventos);
+        if (sscanf(ln, "CANAL_MONITOR=%15s", canal) == 1)
+            c.canal_monitor = strcmp(canal, "cola") == 0 ? CANAL_COLA : CANAL_SHM;
+        sscanf(ln, "ARCHIVO_WAL=%49s",         c.archivo_wal);
+        if (sscanf(ln, "MODO_CUENTAS=%15s", modo) == 1)
+            c.modo_cuentas = strcmp(modo, "mmap") == 0 ? MODO_MMAP : MODO_SHM;
+        if (sscanf(ln, "BACKEND_ES=%15s", backend) == 1)
+            c.backend_es = strcmp(backend, "uring") == 0 ? ES_URING : ES_POSIX;
+        if (sscanf(ln, "POLITICA_FSYNC=%15s", politica) == 1)
+            c.politica_fsync = strcmp(politica, "volcado") == 0
+                             ? FSYNC_VOLCADO : FSYNC_NUNCA;
         sscanf(ln, "ARCHIVO_CUENTAS=%49s",     c.archivo_cuentas);
         sscanf(ln, "ARCHIVO_LOG=%49s",         c.archivo_log);
+        sscanf(ln, "SOCKET_BANCO=%49s",        c.socket_banco);
+        sscanf(ln, "HILOS_SERVIDOR=%d",       &c.hilos_servidor);
+        sscanf(ln, "DIRECTORIO_FOTOS=%49s",    c.directorio_fotos);
+        sscanf(ln, "INTERVALO_FOTO_S=%d",     &c.intervalo_foto_s);
+        sscanf(ln, "CONSERVAR_FOTOS=%d",      &c.conservar_fotos);
+        sscanf(ln, "PARTICIONES=%d",          &c.particiones);
+        sscanf(ln, "ARCHIVO_2PC=%49s",         c.archivo_2pc);
+        sscanf(ln, "SOCKET_REPLICA=%49s",      c.socket_replica);
+        if (sscanf(ln, "SEGMENTO=%15s", txt) == 1)
+            c.segmento = strcmp(txt, "posix") == 0 ? SEG_POSIX : SEG_SYSV;
+        if (sscanf(ln, "PAGINAS_GRANDES=%15s", txt) == 1)
+            c.paginas = strcmp(txt, "thp") == 0     ? PAG_THP
+                      : strcmp(txt, "hugetlb") == 0 ? PAG_HUGETLB : PAG_NORMALES;
+        sscanf(ln, "PRECARGAR=%d",            &c.precargar);
+        if (sscanf(ln, "NUMA=%15s", txt) == 1) {
+            if (strcmp(txt, "entrelazada") == 0) c.numa = NUMA_ENTRELAZADA;
+            else if (sscanf(txt, "%d", &c.nodo_numa) == 1) c.numa = NUMA_NODO;
+            else c.numa = NUMA_LOCAL;
+        }
+        sscanf(ln, "RESERVA_CUENTAS=%d",      &c.reserva_cuentas);
+        double x;                        /* porcentajes y euros, a centésimas */
+        if (sscanf(ln, "INTERES_ANUAL=%lf", &x) == 1)       c.interes_pb      = (int)(x * 100 + 0.5);
+        if (sscanf(ln, "INTERES_DESCUBIERTO=%lf", &x) == 1) c.descubierto_pb  = (int)(x * 100 + 0.5);
+        if (sscanf(ln, "COMISION_DIARIA=%lf", &x) == 1)     c.comision_diaria = (int)(x * 100 + 0.5);
+        if (sscanf(ln, "SALDO_EXENTO=%lf", &x) == 1)        c.saldo_exento    = (int)(x * 100 + 0.5);
+        sscanf(ln, "HILOS_LIQUIDACION=%d",    &c.hilos_liquidacion);
+        sscanf(ln, "DIRECTORIO_EXTRACTOS=%49s", c.directorio_extractos);
+        sscanf(ln, "DIRECTORIO_HISTORIAL=%49s", c.directorio_historial);
+        sscanf(ln, "TAM_SEGMENTO_HISTORIAL=%d", &c.tam_segmento_historial);
+        sscanf(ln, "ROTACION_HISTORIAL_S=%d",   &c.rotacion_historial_s);
+        sscanf(ln, "RETENCION_HISTORIAL_DIAS=%d", &c.retencion_historial_dias);
     }
     fclose(f);
+
+    /* valores por defecto de los parámetros opcionales */
+    if (c.capacidad_buffer     <= 0) c.capacidad_buffer     = CAPACIDAD_BUFFER_DEF;
+    if (c.intervalo_volcado_ms <= 0) c.intervalo_volcado_ms = 50;
+    if (c.capacidad_wal        <= 0) c.capacidad_wal        = CAPACIDAD_WAL_DEF;
+    if (c.punto_control_wal_mb <  0) c.punto_control_wal_mb = 64;
+    if (c.capacidad_contadores <= 0) c.capacidad_contadores = CAPACIDAD_CONTADORES_DEF;
+    if (c.capacidad_eventos    <= 0) c.capacidad_eventos    = CAPACIDAD_EVENTOS_DEF;
+    if (c.hilos_servidor       <= 0) c.hilos_servidor       = 4;
+    if (c.hilos_monitor        <= 0) c.hilos_monitor        = 2;
+    if (c.conservar_fotos      <= 0) c.conservar_fotos      = 5;
+    if (c.directorio_fotos[0] == '\0') strcpy(c.directorio_fotos, "fotos");
+    if (c.particiones <= 0 || c.particiones > MAX_PARTICIONES) c.particiones = 1;
+    if (c.archivo_2pc[0] == '\0') strcpy(c.archivo_2pc, "dosfases.log");
+    if (c.directorio_extractos[0] == '\0') strcpy(c.directorio_extractos, "extractos");
+    if (c.directorio_historial[0] == '\0') strcpy(c.directorio_historial, "historial");
+    if (c.tam_segmento_historial <= 0) c.tam_segmento_historial = 16;
+    if (c.rotacion_historial_s < 0) c.rotacion_historial_s = 0;
+    if (c.retencion_historial_dias < 0) c.retencion_historial_dias = 0;
+    if (c.num_reglas == 0) reglas_por_defecto(&c);
     return c;
 }
 
+static void con_sufijo(char *campo, size_t n, int p) {
+    char base[64];
+    snprintf(base, sizeof base, "%s", campo);
+    snprintf(campo, n, "%.45s.%d", base, p);
+}
+
+/* Ficheros propios de la partición p: cuentas.dat.p, banco.wal.p,
+ * fotos.p, extractos.p y el socket de sus réplicas.  Una partición no
+ * abre el socket de sesiones: van por el enrutador (./usuario
+ * particiones).                                                          */
+void config_particion(Config *c, int p) {
+    con_sufijo(c->archivo_cuentas, sizeof c->archivo_cuentas, p);
+    if (c->archivo_wal[0]) con_sufijo(c->archivo_wal, sizeof c->archivo_wal, p);
+    con_sufijo(c->directorio_fotos, sizeof c->directorio_fotos, p);
+    con_sufijo(c->directorio_extractos, sizeof c->directorio_extractos, p);
+    c->socket_banco[0] = '\0';
+    if (c->socket_replica[0]) con_sufijo(c->socket_replica, sizeof c->socket_replica, p);
+}
+
 /*─────────────────────────────────────────────*/
 /*         LECTURA Y VOLCADO DE CUENTAS        */
 /*─────────────────────────────────────────────*/
 
-int cargar_cuentas(const char *ruta, Cuenta *cuentas) {
+/* Registro de cuentas.dat antes de FORMATO_CUENTA. */
+typedef struct {
+    int numero_cuenta;
+    char titular[TAM_TITULAR];
+    float saldo;
+    int bloqueado;
+} CuentaV1;
+
+_Static_assert(sizeof(CuentaV1) == TAM_CUENTA_V1, "registro antiguo de 64 bytes");
+
+/* Convierte un registro del formato antiguo. */
+void cuenta_desde_v1(const void *registro, Cuenta *c) {
+    CuentaV1 v;
+    memcpy(&v, registro, sizeof v);
+    memset(c, 0, sizeof *c);
+    c->numero_cuenta = v.numero_cuenta;
+    memcpy(c->titular, v.titular, TAM_TITULAR);
+    c->formato   = FORMATO_CUENTA;
+    c->saldo     = a_centimos(v.saldo);
+    c->bloqueado = v.bloqueado;
+}
+
+/* Si `ruta` está en el formato antiguo (saldo float), la reescribe en
+ * céntimos: a un .tmp, fsync y rename encima.  0 si ya estaba al día o se
+ * migró; -1 si no se reconoce el formato o falla la escritura.           */
+int migrar_cuentas(const char *ruta) {
+    FILE *f = fopen(ruta, "rb");
+    if (!f) return 0;                    /* que lo diga quien lo abra */
+    struct stat st;
+    fstat(fileno(f), &st);
+
+    Cuenta primera;
+    int actual = st.st_size == 0 ||
+                 (st.st_size % sizeof(Cuenta) == 0 &&
+                  fread(&primera, sizeof primera, 1, f) == 1 &&
+                  primera.formato == FORMATO_CUENTA);
+    if (actual || st.st_size % TAM_CUENTA_V1 != 0) {
+        fclose(f);
+        if (!actual) fprintf(stderr, "%s: formato de cuentas desconocido\n", ruta);
+        return actual ? 0 : -1;
+    }
+
+    char tmp[300];
+    snprintf(tmp, sizeof tmp, "%s.tmp", ruta);
+    FILE *g = fopen(tmp, "wb");
+    if (!g) { perror(tmp); fclose(f); return -1; }
+
+    rewind(f);
+    unsigned char v1[1024][TAM_CUENTA_V1];
+    Cuenta bloque[1024];
+    size_t leidas;
+    long total = 0;
+    while ((leidas = fread(v1, TAM_CUENTA_V1, 1024, f)) > 0) {
+        for (size_t i = 0; i < leidas; ++i) cuenta_desde_v1(v1[i], &bloque[i]);
+        fwrite(bloque, sizeof(Cuenta), leidas, g);
+        total += (long)leidas;
+    }
+    fclose(f);
+    int error = fflush(g) != 0 || fsync(fileno(g)) == -1 || ferror(g);
+    fclose(g);
+    if (error || rename(tmp, ruta) == -1) {
+        perror(ruta);
+        unlink(tmp);
+        return -1;
+    }
+    printf("%s: %ld cuentas pasadas del formato antiguo (float) a céntimos\n", ruta, total);
+    return 0;
+}
+
+/* Uso exclusivo de `ruta` mientras viva el proceso: flock sobre
+ * <ruta>.lock, que toman banco y liquidar.  Devuelve el descriptor, o -1
+ * si otro proceso ya lo tiene.                                           */
+int reservar_cuentas(const char *ruta) {
+    char cerrojo[128];
+    snprintf(cerrojo, sizeof cerrojo, "%s.lock", ruta);
+    int fd = open(cerrojo, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) { perror(cerrojo); return -1; }
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) { close(fd); return -1; }
+    return fd;
+}
+
+/* Nº de registros Cuenta que contiene el fichero (para dimensionar la
+ * SHM).  Antes migra un fichero del formato antiguo.                    */
+int contar_cuentas(const char *ruta) {
+    struct stat st;
+    if (migrar_cuentas(ruta) == -1) exit(EXIT_FAILURE);
+    if (stat(ruta, &st) == -1) { perror("cuentas.dat"); exit(EXIT_FAILURE); }
+    return (int)(st.st_size / sizeof(Cuenta));
+}
+
+/* Lee el fichero por bloques e inserta cada cuenta en la tabla indexada.
+ * Las cuentas quedan en el mismo orden que en disco, de modo que la
+ * posición en las columnas coincide con el registro del fichero.         */
+int cargar_cuentas(const char *ruta, TablaCuentas *t) {
+    if (t->modo == MODO_MMAP) {
+        /* Las cuentas ya están en la proyección: pasarlas a columnas e
+         * indexarlas.                                                    */
+        cargar_proyeccion(t);
+        for (int i = 0; i < t->capacidad; ++i)
+            if (indexar_cuenta(t, i) == -1)
+                fprintf(stderr, "cuenta %d duplicada\n", numeros_tabla(t)[i]);
+        t->num_cuentas = t->capacidad;
+        return t->num_cuentas;
+    }
+
     FILE *fc = fopen(ruta, "rb");
     if (!fc) { perror("cuentas.dat"); exit(EXIT_FAILURE); }
-    int n = fread(cuentas, sizeof(Cuenta), 100, fc);
+
+    Cuenta bloque[1024];
+    size_t leidas;
+    while ((leidas = fread(bloque, sizeof(Cuenta), 1024, fc)) > 0) {
+        for (size_t i = 0; i < leidas; ++i)
+            if (insertar_cuenta(t, &bloque[i]) == -1)
+                fprintf(stderr, "cuenta %d duplicada o tabla llena\n",
+                        bloque[i].numero_cuenta);
+    }
     fclose(fc);
-    return n;
+    return t->num_cuentas;
 }
 
-void volcar_cuentas(const char *ruta, Cuenta *cuentas, int n) {
-    FILE *fc = fopen(ruta, "wb");
-    if (!fc) { perror("cuentas.dat (guardar)"); return; }
-    fwrite(cuentas, sizeof(Cuenta), n, fc);
-    fclose(fc);
+/* fsync del directorio que contiene `ruta`, para que un rename persista. */
+static int sincronizar_directorio(const char *ruta) {
+    char copia[256];
+    snprintf(copia, sizeof copia, "%s", ruta);
+    int fd = open(dirname(copia), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return -1;
+    int r = fsync(fd);
+    close(fd);
+    return r;
+}
+
+/* Punto de control: compone los registros desde las columnas por bloques
+ * en <ruta>.tmp, lo sincroniza y lo pone encima con rename.  Un fallo a
+ * medias deja intacto el fichero anterior; sólo con 0 puede truncarse el
+ * diario.                                                                */
+int volcar_cuentas(const char *ruta, TablaCuentas *t) {
+    char tmp[300];
+    snprintf(tmp, sizeof tmp, "%s.tmp", ruta);
+    FILE *fc = fopen(tmp, "wb");
+    if (!fc) { perror(tmp); return -1; }
+
+    Cuenta bloque[1024];
+    int error = 0;
+    for (int i = 0; i < t->num_cuentas && !error; i += 1024) {
+        int n = t->num_cuentas - i < 1024 ? t->num_cuentas - i : 1024;
+        for (int k = 0; k < n; ++k) leer_cuenta(t, i + k, &bloque[k]);
+        error = fwrite(bloque, sizeof(Cuenta), n, fc) != (size_t)n;
+    }
+    error = error || fflush(fc) != 0 || fsync(fileno(fc)) == -1;
+    if (fclose(fc) != 0) error = 1;
+    if (error || rename(tmp, ruta) == -1) {
+        perror(ruta);
+        unlink(tmp);
+        return -1;
+    }
+    if (sincronizar_directorio(ruta) == -1) { perror(ruta); return -1; }
+    return 0;
 }
 
 /*─────────────────────────────────────────────*/
@@ -62,33 +352,17 @@ void obtener_timestamp(char *dst, size_t n) {
 /*                LOG CENTRAL                  */
 /*─────────────────────────────────────────────*/
 
+/* Sólo encola la línea; la escribe el hilo de registro.c, igual que los
+ * apuntes del historial.                                                 */
 void append_log(const char *ruta_log, const char *linea) {
-    FILE *lf = fopen(ruta_log, "a");
-    if (!lf) { perror("log file"); return; }
-
-    char ts[32];
-    obtener_timestamp(ts, sizeof ts);
-    fprintf(lf, "%s %s\n", ts, linea);
-    fclose(lf);
+    registro_global(ruta_log, linea);
 }
 
 /*─────────────────────────────────────────────*/
-/*              LOG TRANSACCIÓN                */
+/*             HISTORIAL DE CUENTA             */
 /*─────────────────────────────────────────────*/
-void log_transaccion_individual(int cuenta, const char *linea) {
-    char ruta[160];
-    snprintf(ruta, sizeof ruta, "transacciones/%d/transacciones.log", cuenta);
-
-    mkdir("transacciones", 0777);
-    char dir[128];
-    snprintf(dir, sizeof dir, "transacciones/%d", cuenta);
-    mkdir(dir, 0777);
-
-    FILE *lf = fopen(ruta, "a");
-    if (!lf) { perror("fopen log individual"); return; }
-
-    char ts[32];
-    obtener_timestamp(ts, sizeof ts);
-    fprintf(lf, "%s %s\n", ts, linea);
-    fclose(lf);
-}
\ No newline at end of file
+void anotar_historial(int cuenta, TipoOp tipo, int otra, int64_t centimos) {
+    RegistroHistorial r = { .ts = historial_ahora(), .cuenta = cuenta, .otra = otra,
+                            .centimos = centimos, .tipo = (uint8_t)tipo };
+    registro_apunte(&r);
+}
@@ -0,0 +1,1178 @@
+/* historial.c — Historial binario de movimientos por cuenta
+ *
+ *  ▸ Sustituye a transacciones/<cuenta>/transacciones.log: un directorio
+ *    por cuenta eran millones de inodos, y "los últimos 50 movimientos"
+ *    obligaban a leer el fichero entero.
+ *  ▸ Escritura: cada proceso (su hilo de registro.c) reserva huecos con
+ *    un CAS sobre el cursor del fichero de control, que proyectan todos, y
+ *    escribe su lote de registros con un pwrite en <n>.act.  No hay
+ *    cerrojos entre procesos; un hueco reservado y aún sin escribir se lee
+ *    como ceros y su suma no cuadra.
+ *  ▸ Rotación: cuando el activo llega a TAM_SEGMENTO_HISTORIAL MB o cumple
+ *    ROTACION_HISTORIAL_S segundos, el primero que lo nota pasa el cursor
+ *    al n + 1 y sella el n: espera (hasta un segundo) a que se llenen sus
+ *    huecos, ordena los registros por (cuenta, ts), antepone un índice de
+ *    cuentas y lo deja en <n>.seg con un rename.  Un .act viejo que nadie
+ *    selló (su proceso murió) lo sella el siguiente escritor que abre el
+ *    historial, mezclándolo con el .seg si ya lo había.
+ *  ▸ Enlace: cada entrada del índice de un sellado guarda el sellado
+ *    anterior con la misma cuenta, y el fichero "ultimos" (hash proyectado,
+ *    cuenta → último sellado) la cabeza de la cadena.  Lo actualiza quien
+ *    sella, con flock; si falta o quedó a medias se rehace recorriendo los
+ *    sellados, lo que de paso enlaza los de la versión 1.
+ *  ▸ Consulta: los .act del activo hacia atrás y después la cadena de la
+ *    cuenta, con búsqueda binaria de la cuenta en el índice y del
+ *    intervalo de tiempo en sus registros, hasta tener los pedidos: no se
+ *    tocan los segmentos sin apuntes de la cuenta.  Los sellados se
+ *    proyectan una vez por proceso.  Del activo cada proceso lleva un
+ *    índice en memoria (cuenta → apuntes por tiempo) al que sólo añade lo
+ *    escrito desde la vez anterior y los huecos que entretanto se llenaron;
+ *    historial_preparar() lo pone al día fuera de las consultas.
+ *  ▸ Retención: con RETENCION_HISTORIAL_DIAS el escritor que sella borra
+ *    los sellados más viejos que ya no hacen falta.
+ *  ▸ historial_migrar() importa una vez los transacciones.log de antes.
+ */
+#define _DEFAULT_SOURCE                  /* flock */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+#define SIN_SEGMENTO    UINT32_MAX
+#define ESPERA_HUECOS   100              /* ×10 ms antes de sellar con huecos */
+#define BLOQUE_LECTURA  4096             /* registros por pread del activo */
+#define CUENTAS_ACTIVO  1024             /* capacidad inicial del índice del activo */
+
+static uint32_t fnv1a(const void *p, size_t n) {
+    const unsigned char *b = p;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= b[i]; h *= 16777619u; }
+    return h;
+}
+
+int64_t historial_ahora(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* "AAAA-MM-DD" en hora local a ns: el principio del día o, con
+ * fin_de_dia, su último instante.  -1 si no es una fecha.               */
+int64_t historial_fecha(const char *aaaa_mm_dd, int fin_de_dia) {
+    struct tm tm = { 0 };
+    char resto;
+    if (sscanf(aaaa_mm_dd, "%d-%d-%d%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &resto) != 3)
+        return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon  -= 1;
+    tm.tm_mday += fin_de_dia;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1) return -1;
+    return (int64_t)t * 1000000000 - fin_de_dia;
+}
+
+int historial_valido(const RegistroHistorial *r) {
+    return r->ts != 0 && r->suma == fnv1a(r, offsetof(RegistroHistorial, suma));
+}
+
+static void ruta_segmento(char *dst, size_t n, const char *dir, uint32_t numero, const char *ext) {
+    snprintf(dst, n, "%s/%08u.%s", dir, numero, ext);
+}
+
+/*─────────────────────────────────────────────*/
+/*            SEGMENTOS EN DISCO               */
+/*─────────────────────────────────────────────*/
+
+static int comparar_numeros(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Números de segmento presentes (activos o sellados), de menor a mayor. */
+int historial_listar(const char *dir, uint32_t **numeros) {
+    *numeros = NULL;
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    int n = 0, cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        unsigned num;
+        char ext[4], resto;
+        if (sscanf(e->d_name, "%u.%3[a-z]%c", &num, ext, &resto) != 2) continue;
+        if (strcmp(ext, "act") != 0 && strcmp(ext, "seg") != 0) continue;
+        if (n == cap) *numeros = realloc(*numeros, (cap = cap ? cap * 2 : 64) * sizeof **numeros);
+        (*numeros)[n++] = num;
+    }
+    closedir(d);
+    qsort(*numeros, n, sizeof **numeros, comparar_numeros);
+    int u = 0;                           /* un número con .act y .seg, una vez */
+    for (int i = 0; i < n; ++i)
+        if (u == 0 || (*numeros)[u - 1] != (*numeros)[i]) (*numeros)[u++] = (*numeros)[i];
+    return u;
+}
+
+/* Proyecta el segmento `numero`: el sellado si existe y si no el activo. */
+int historial_mapear(const char *dir, uint32_t numero, MapaSegmentoHist *m) {
+    char ruta[128];
+    memset(m, 0, sizeof *m);
+    m->numero = numero;
+
+    ruta_segmento(ruta, sizeof ruta, dir, numero, "seg");
+    int fd = open(ruta, O_RDONLY);
+    m->sellado = fd != -1;
+    if (fd == -1) {
+        ruta_segmento(ruta, sizeof ruta, dir, numero, "act");
+        if ((fd = open(ruta, O_RDONLY)) == -1) return -1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    m->tam = st.st_size;
+    if (m->tam > 0) {
+        m->base = mmap(NULL, m->tam, PROT_READ, MAP_SHARED, fd, 0);
+        if (m->base == MAP_FAILED) { m->base = NULL; close(fd); return -1; }
+    }
+    close(fd);
+
+    if (!m->sellado) {
+        m->registros     = m->base;
+        m->num_registros = m->tam / sizeof(RegistroHistorial);
+        return 0;
+    }
+    const CabeceraSegmentoHist *c = m->base;
+    if (m->tam < sizeof *c || (memcmp(c->magia, MAGIA_SEGMENTO_HIST, 8) != 0 &&
+                               memcmp(c->magia, MAGIA_SEGMENTO_HIST1, 8) != 0) ||
+        m->tam != sizeof *c + c->num_cuentas * sizeof(EntradaIndiceHist) +
+                  c->num_registros * sizeof(RegistroHistorial)) {
+        fprintf(stderr, "%s: segmento de historial dañado\n", ruta);
+        historial_desmapear(m);
+        return -1;
+    }
+    m->cab           = c;
+    m->indice        = (const EntradaIndiceHist *)(c + 1);
+    m->registros     = (const RegistroHistorial *)(m->indice + c->num_cuentas);
+    m->num_registros = c->num_registros;
+    return 0;
+}
+
+void historial_desmapear(MapaSegmentoHist *m) {
+    if (m->base) munmap(m->base, m->tam);
+    memset(m, 0, sizeof *m);
+}
+
+/* Entrada de la cuenta en el índice de un sellado, o NULL. */
+static const EntradaIndiceHist *entrada_de(const MapaSegmentoHist *m, int32_t cuenta) {
+    size_t lo = 0, hi = m->cab->num_cuentas;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->indice[mid].cuenta < cuenta) lo = mid + 1;
+        else                                hi = mid;
+    }
+    return lo < m->cab->num_cuentas && m->indice[lo].cuenta == cuenta ? &m->indice[lo] : NULL;
+}
+
+static int escribir_todo(int fd, const void *p, size_t n) {
+    const char *c = p;
+    while (n > 0) {
+        ssize_t w = write(fd, c, n);
+        if (w == -1 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        c += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*        ÚLTIMO SELLADO DE CADA CUENTA        */
+/*─────────────────────────────────────────────*/
+
+static uint32_t hash_cuenta(int32_t cuenta, uint32_t cap) {
+    return ((uint32_t)cuenta * 2654435761u) & (cap - 1);
+}
+
+static EntradaUltimosHist *entradas_ultimos(const CabeceraUltimosHist *u) {
+    return (EntradaUltimosHist *)(u + 1);
+}
+
+static size_t tam_ultimos(uint32_t cap) {
+    return sizeof(CabeceraUltimosHist) + (size_t)cap * sizeof(EntradaUltimosHist);
+}
+
+/* Último sellado con la cuenta + 1, o 0.  Sin cerrojo: quien escribe pone
+ * la cuenta antes que el segmento, y la tabla nunca pasa del 70 %.      */
+static uint32_t ultimo_de(const CabeceraUltimosHist *u, int32_t cuenta) {
+    EntradaUltimosHist *e = entradas_ultimos(u);
+    for (uint32_t i = hash_cuenta(cuenta, u->cap); ; i = (i + 1) & (u->cap - 1)) {
+        uint32_t s = atomic_load(&e[i].segmento);
+        if (s == 0) return 0;
+        if (atomic_load(&e[i].cuenta) == cuenta) return s;
+    }
+}
+
+static void poner_ultimo(CabeceraUltimosHist *u, int32_t cuenta, uint32_t segmento) {
+    EntradaUltimosHist *e = entradas_ultimos(u);
+    uint32_t i = hash_cuenta(cuenta, u->cap);
+    while (atomic_load(&e[i].segmento) != 0 && atomic_load(&e[i].cuenta) != cuenta)
+        i = (i + 1) & (u->cap - 1);
+    if (atomic_load(&e[i].segmento) == 0) {
+        atomic_store(&e[i].cuenta, cuenta);
+        u->usadas++;
+    }
+    atomic_store(&e[i].segmento, segmento);
+}
+
+/* ¿Caben `mas` cuentas nuevas sin pasar del 70 %? */
+static int caben(const CabeceraUltimosHist *u, uint32_t mas) {
+    return ((uint64_t)u->usadas + mas) * 10 <= (uint64_t)u->cap * 7;
+}
+
+/* Tabla vacía en memoria con sitio para `cuentas`. */
+static CabeceraUltimosHist *crear_ultimos(uint32_t cuentas) {
+    uint32_t cap = 1024;
+    while ((uint64_t)cuentas * 10 > (uint64_t)cap * 7) cap *= 2;
+    CabeceraUltimosHist *u = calloc(1, tam_ultimos(cap));
+    memcpy(u->magia, MAGIA_ULTIMOS_HIST, 8);
+    u->cap = cap;
+    return u;
+}
+
+/* Copia de u con sitio para `mas` cuentas nuevas. */
+static CabeceraUltimosHist *ampliar_ultimos(const CabeceraUltimosHist *u, uint32_t mas) {
+    CabeceraUltimosHist *n = crear_ultimos(u->usadas + mas);
+    EntradaUltimosHist *e = entradas_ultimos(u);
+    for (uint32_t i = 0; i < u->cap; ++i)
+        if (atomic_load(&e[i].segmento) != 0)
+            poner_ultimo(n, atomic_load(&e[i].cuenta), atomic_load(&e[i].segmento));
+    return n;
+}
+
+/* Deja la tabla en memoria u como DIRECTORIO_HISTORIAL/ultimos. */
+static int publicar_ultimos(const char *dir, const CabeceraUltimosHist *u) {
+    char ruta[128], tmp[140];
+    snprintf(ruta, sizeof ruta, "%s/ultimos", dir);
+    snprintf(tmp, sizeof tmp, "%s.%d", ruta, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd != -1 && escribir_todo(fd, u, tam_ultimos(u->cap)) == 0 && fsync(fd) == 0;
+    if (fd != -1) close(fd);
+    if (ok && rename(tmp, ruta) == 0) return 0;
+    perror(ruta);
+    unlink(tmp);
+    return -1;
+}
+
+/* Abre "ultimos" para escribir y toma su flock, reintentando si otro la
+ * sustituyó mientras se esperaba.  *u queda proyectada (NULL si el
+ * fichero está vacío) y *sirve dice si se puede actualizar en su sitio.
+ * Devuelve el fd, que al cerrarlo suelta el flock, o -1.                 */
+static int tomar_ultimos(const char *dir, CabeceraUltimosHist **u, size_t *tam, int *sirve) {
+    char ruta[128];
+    snprintf(ruta, sizeof ruta, "%s/ultimos", dir);
+    for (;;) {
+        int fd = open(ruta, O_RDWR | O_CREAT, 0644);
+        if (fd == -1) { perror(ruta); return -1; }
+        flock(fd, LOCK_EX);
+        struct stat abierto, actual;
+        fstat(fd, &abierto);
+        if (stat(ruta, &actual) == -1 || actual.st_ino != abierto.st_ino) { close(fd); continue; }
+
+        *u     = NULL;
+        *tam   = (size_t)abierto.st_size;
+        *sirve = 0;
+        if (*tam >= sizeof **u) {
+            void *p = mmap(NULL, *tam, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) *u = p;
+        }
+        *sirve = *u && memcmp((*u)->magia, MAGIA_ULTIMOS_HIST, 8) == 0 &&
+                 *tam == tam_ultimos((*u)->cap) && !atomic_load(&(*u)->sucio);
+        return fd;
+    }
+}
+
+/* Rehace la tabla desde los sellados, del más viejo al más nuevo, y de
+ * paso escribe el `anterior` de sus índices (la versión 1 no lo tenía).
+ * Sólo con el flock de "ultimos".                                        */
+static CabeceraUltimosHist *reconstruir_ultimos(const char *dir) {
+    CabeceraUltimosHist *u = crear_ultimos(0);
+    uint32_t *nums;
+    int n = historial_listar(dir, &nums);
+    for (int i = 0; i < n; ++i) {
+        char ruta[128];
+        ruta_segmento(ruta, sizeof ruta, dir, nums[i], "seg");
+        int fd = open(ruta, O_RDWR);
+        if (fd == -1) continue;
+        struct stat st;
+        fstat(fd, &st);
+        size_t tam = (size_t)st.st_size;
+        CabeceraSegmentoHist *c = tam >= sizeof *c
+            ? mmap(NULL, tam, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (c == MAP_FAILED) continue;
+        if ((memcmp(c->magia, MAGIA_SEGMENTO_HIST, 8) == 0 ||
+             memcmp(c->magia, MAGIA_SEGMENTO_HIST1, 8) == 0) &&
+            tam >= sizeof *c + c->num_cuentas * sizeof(EntradaIndiceHist)) {
+            if (!caben(u, c->num_cuentas)) {
+                CabeceraUltimosHist *mayor = ampliar_ultimos(u, c->num_cuentas);
+                free(u);
+                u = mayor;
+            }
+            EntradaIndiceHist *e = (EntradaIndiceHist *)(c + 1);
+            for (uint32_t k = 0; k < c->num_cuentas; ++k) {
+                uint32_t anterior = ultimo_de(u, e[k].cuenta);
+                if (e[k].anterior != anterior) e[k].anterior = anterior;
+                poner_ultimo(u, e[k].cuenta, nums[i] + 1);
+            }
+            if (memcmp(c->magia, MAGIA_SEGMENTO_HIST, 8) != 0) memcpy(c->magia, MAGIA_SEGMENTO_HIST, 8);
+            msync(c, tam, MS_SYNC);
+        } else {
+            fprintf(stderr, "%s: segmento de historial dañado\n", ruta);
+        }
+        munmap(c, tam);
+    }
+    free(nums);
+    return u;
+}
+
+/* Rehace "ultimos" si falta o quedó a medias (un sellador murió). */
+static void asegurar_ultimos(const char *dir) {
+    CabeceraUltimosHist *u;
+    size_t tam;
+    int sirve;
+    int fd = tomar_ultimos(dir, &u, &tam, &sirve);
+    if (fd == -1) return;
+    if (!sirve) {
+        CabeceraUltimosHist *nueva = reconstruir_ultimos(dir);
+        if (publicar_ultimos(dir, nueva) == 0 && u) atomic_store(&u->sustituida, 1);
+        free(nueva);
+    }
+    if (u) munmap(u, tam);
+    close(fd);
+}
+
+/* En el sellado `k`, el `anterior` de la cuenta.  Si apunta a un segmento
+ * previo a `numero` (que se sella fuera de orden) lo cambia por él: 1.
+ * Si no, 0 para seguir por *anterior; -1 si no está.                     */
+static int intercalar(const char *dir, uint32_t k, int32_t cuenta, uint32_t numero,
+                      uint32_t *anterior) {
+    char ruta[128];
+    ruta_segmento(ruta, sizeof ruta, dir, k, "seg");
+    int fd = open(ruta, O_RDWR);
+    if (fd == -1) return -1;
+    CabeceraSegmentoHist c;
+    EntradaIndiceHist e;
+    int r = -1;
+    if (pread(fd, &c, sizeof c, 0) == (ssize_t)sizeof c) {
+        size_t lo = 0, hi = c.num_cuentas;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (pread(fd, &e, sizeof e, sizeof c + mid * sizeof e) != (ssize_t)sizeof e) break;
+            if (e.cuenta < cuenta) lo = mid + 1;
+            else                   hi = mid;
+        }
+        off_t pos = (off_t)(sizeof c + lo * sizeof e);
+        if (lo < c.num_cuentas && pread(fd, &e, sizeof e, pos) == (ssize_t)sizeof e &&
+            e.cuenta == cuenta) {
+            *anterior = e.anterior;
+            r = 0;
+            if (e.anterior < numero + 1) {
+                e.anterior = numero + 1;
+                r = pwrite(fd, &e, sizeof e, pos) == (ssize_t)sizeof e ? 1 : -1;
+            }
+        }
+    }
+    close(fd);
+    return r;
+}
+
+/* `anterior` de la cuenta para el sellado `numero`: el del .seg que ya
+ * hubiera (escritores rezagados), el último de la tabla o, si ya hay
+ * sellados más nuevos con la cuenta, el hueco que le toca en su cadena.  */
+static uint32_t enlazar(const char *dir, const CabeceraUltimosHist *u,
+                        const MapaSegmentoHist *viejo, uint32_t numero, int32_t cuenta) {
+    const EntradaIndiceHist *e = viejo ? entrada_de(viejo, cuenta) : NULL;
+    if (e) return e->anterior;
+    uint32_t sig = ultimo_de(u, cuenta);
+    while (sig > numero + 1) {
+        uint32_t anterior;
+        int r = intercalar(dir, sig - 1, cuenta, numero, &anterior);
+        if (r == -1) return 0;
+        if (r == 1)  return anterior;
+        sig = anterior;
+    }
+    return sig;
+}
+
+/*─────────────────────────────────────────────*/
+/*                  SELLADO                    */
+/*─────────────────────────────────────────────*/
+
+static int comparar_registros(const void *a, const void *b) {
+    const RegistroHistorial *x = a, *y = b;
+    if (x->cuenta != y->cuenta) return x->cuenta < y->cuenta ? -1 : 1;
+    if (x->ts != y->ts)         return x->ts < y->ts ? -1 : 1;
+    return memcmp(x, y, sizeof *x);
+}
+
+/* Lee los registros válidos de <numero>.act, esperando a los huecos. */
+static RegistroHistorial *leer_activo(int fd, uint32_t esperados, size_t *validos) {
+    RegistroHistorial *r = NULL;
+    size_t n = 0, buenos = 0;
+    for (int intento = 0; ; ++intento) {
+        struct stat st;
+        fstat(fd, &st);
+        size_t en_fichero = st.st_size / sizeof *r;
+        n = en_fichero > esperados ? en_fichero : esperados;
+        free(r);
+        r = calloc(n + 1, sizeof *r);
+        size_t leidos = 0, tam = en_fichero * sizeof *r;
+        while (leidos < tam) {
+            ssize_t k = pread(fd, (char *)r + leidos, tam - leidos, leidos);
+            if (k <= 0) break;
+            leidos += (size_t)k;
+        }
+        buenos = 0;
+        for (size_t i = 0; i < n; ++i) buenos += historial_valido(&r[i]);
+        if (buenos == n || intento == ESPERA_HUECOS) break;
+        struct timespec pausa = { 0, 10000000L };
+        nanosleep(&pausa, NULL);
+    }
+    size_t k = 0;                        /* un hueco que sigue vacío se pierde */
+    for (size_t i = 0; i < n; ++i)
+        if (historial_valido(&r[i])) r[k++] = r[i];
+    *validos = k;
+    return r;
+}
+
+/* Convierte <numero>.act en <numero>.seg.  Si otro proceso lo está
+ * sellando (tiene el flock) no hace nada.                                */
+static void sellar(Historial *h, uint32_t numero, uint32_t esperados) {
+    char act[128], seg[128], tmp[140];
+    ruta_segmento(act, sizeof act, h->dir, numero, "act");
+    ruta_segmento(seg, sizeof seg, h->dir, numero, "seg");
+    snprintf(tmp, sizeof tmp, "%s.%d", seg, (int)getpid());
+
+    int fd = open(act, O_RDONLY);
+    if (fd == -1) return;
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) { close(fd); return; }
+
+    size_t n;
+    RegistroHistorial *r = leer_activo(fd, esperados, &n);
+
+    MapaSegmentoHist viejo;              /* escritores rezagados: se mezcla */
+    if (historial_mapear(h->dir, numero, &viejo) == 0 && viejo.sellado) {
+        r = realloc(r, (n + viejo.num_registros + 1) * sizeof *r);
+        memcpy(r + n, viejo.registros, viejo.num_registros * sizeof *r);
+        n += viejo.num_registros;
+    }
+    qsort(r, n, sizeof *r, comparar_registros);
+    size_t u = 0;                        /* .act que sobrevivió a su sellado */
+    for (size_t i = 0; i < n; ++i)
+        if (u == 0 || memcmp(&r[u - 1], &r[i], sizeof *r) != 0) r[u++] = r[i];
+    n = u;
+
+    CabeceraSegmentoHist cab = { .num_registros = n, .ts_min = INT64_MAX, .ts_max = INT64_MIN };
+    memcpy(cab.magia, MAGIA_SEGMENTO_HIST, 8);
+    EntradaIndiceHist *indice = malloc((n + 1) * sizeof *indice);
+    for (size_t i = 0; i < n; ++i) {
+        if (i == 0 || r[i].cuenta != r[i - 1].cuenta)
+            indice[cab.num_cuentas++] = (EntradaIndiceHist){ .cuenta = r[i].cuenta, .primero = i };
+        indice[cab.num_cuentas - 1].num++;
+        if (r[i].ts < cab.ts_min) cab.ts_min = r[i].ts;
+        if (r[i].ts > cab.ts_max) cab.ts_max = r[i].ts;
+    }
+
+    /* Enlace con "ultimos": en su sitio si cabe, si no en una copia mayor
+     * que la sustituye.  Con `sucio` puesto hasta acabar, un sellador que
+     * muera a medias deja que el siguiente la rehaga.                    */
+    CabeceraUltimosHist *ult = NULL, *nueva = NULL;
+    size_t tam_u;
+    int sirve;
+    int fu = tomar_ultimos(h->dir, &ult, &tam_u, &sirve);
+    uint32_t nuevas = cab.num_cuentas;   /* cuentas que aún no están */
+    if (sirve) {
+        nuevas = 0;
+        for (uint32_t i = 0; i < cab.num_cuentas; ++i)
+            nuevas += ultimo_de(ult, indice[i].cuenta) == 0;
+    }
+    if (fu != -1 && (!sirve || !caben(ult, nuevas))) {
+        nueva = sirve ? ampliar_ultimos(ult, nuevas) : reconstruir_ultimos(h->dir);
+        if (!caben(nueva, nuevas)) {
+            CabeceraUltimosHist *mayor = ampliar_ultimos(nueva, nuevas);
+            free(nueva);
+            nueva = mayor;
+        }
+    }
+    CabeceraUltimosHist *t = nueva ? nueva : ult;
+    for (uint32_t i = 0; i < cab.num_cuentas; ++i)
+        indice[i].anterior = t ? enlazar(h->dir, t, viejo.sellado ? &viejo : NULL,
+                                         numero, indice[i].cuenta) : 0;
+    historial_desmapear(&viejo);
+    if (ult) {
+        atomic_store(&ult->sucio, 1);
+        msync(ult, tam_u, MS_SYNC);
+    }
+
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = out != -1 &&
+             escribir_todo(out, &cab, sizeof cab) == 0 &&
+             escribir_todo(out, indice, cab.num_cuentas * sizeof *indice) == 0 &&
+             escribir_todo(out, r, n * sizeof *r) == 0 &&
+             fsync(out) == 0;
+    if (out != -1) close(out);
+    if (ok && rename(tmp, seg) == 0) {
+        for (uint32_t i = 0; t && i < cab.num_cuentas; ++i)
+            if (ultimo_de(t, indice[i].cuenta) < numero + 1)
+                poner_ultimo(t, indice[i].cuenta, numero + 1);
+        if (nueva) {
+            if (publicar_ultimos(h->dir, nueva) == 0 && ult) atomic_store(&ult->sustituida, 1);
+        } else if (ult) {
+            msync(ult, tam_u, MS_SYNC);
+            atomic_store(&ult->sucio, 0);
+        }
+        unlink(act);
+    } else {
+        perror(seg);                     /* `sucio` sigue puesto: se rehará */
+        unlink(tmp);
+    }
+    if (ult) munmap(ult, tam_u);
+    if (fu != -1) close(fu);             /* suelta el flock de "ultimos" */
+    free(nueva);
+    free(indice);
+    free(r);
+    close(fd);                           /* suelta el flock */
+}
+
+/* Sella los .act anteriores al activo que hayan quedado sin sellar. */
+static void sellar_pendientes(Historial *h) {
+    uint32_t activo = (uint32_t)(atomic_load(&h->ctl->cursor) >> 32);
+    uint32_t *nums;
+    int n = historial_listar(h->dir, &nums);
+    for (int i = 0; i < n && nums[i] < activo; ++i) {
+        char act[128];
+        ruta_segmento(act, sizeof act, h->dir, nums[i], "act");
+        if (access(act, F_OK) == 0) sellar(h, nums[i], 0);
+    }
+    free(nums);
+}
+
+/* Borra, del más viejo al más nuevo, los sellados cuyo último apunte pasó
+ * de RETENCION_HISTORIAL_DIAS; para en el primero que no o sin sellar.   */
+static void purgar(Historial *h) {
+    if (h->retencion_ns <= 0) return;
+    int64_t corte   = historial_ahora() - h->retencion_ns;
+    uint32_t activo = (uint32_t)(atomic_load(&h->ctl->cursor) >> 32);
+    uint32_t k      = atomic_load(&h->ctl->primero_vivo);
+    for (; k < activo; ++k) {
+        char act[128], seg[128];
+        ruta_segmento(act, sizeof act, h->dir, k, "act");
+        ruta_segmento(seg, sizeof seg, h->dir, k, "seg");
+        if (access(act, F_OK) == 0) break;
+        int fd = open(seg, O_RDONLY);
+        if (fd == -1) continue;          /* ya lo borró otro */
+        CabeceraSegmentoHist c;
+        int caducado = pread(fd, &c, sizeof c, 0) == (ssize_t)sizeof c && c.ts_max < corte;
+        close(fd);
+        if (!caducado) break;
+        unlink(seg);
+    }
+    uint32_t antes = atomic_load(&h->ctl->primero_vivo);
+    while (antes < k && !atomic_compare_exchange_weak(&h->ctl->primero_vivo, &antes, k)) {}
+}
+
+/*─────────────────────────────────────────────*/
+/*            APERTURA Y ESCRITURA             */
+/* Olvida el índice del activo y lo prepara para el segmento `numero`. */
+static void vaciar_indice(IndiceActivoHist *x, uint32_t numero) {
+    for (uint32_t i = 0; i < x->cap_cuentas; ++i) free(x->cuentas[i].v);
+    free(x->cuentas);
+    free(x->huecos);
+    memset(x, 0, sizeof *x);
+    x->segmento = numero;
+}
+
+/* Entrada de la cuenta en el índice; la crea si `crear`.  NULL si no hay. */
+static CuentaActivaHist *cuenta_activa(IndiceActivoHist *x, int32_t cuenta, int crear) {
+    if (x->cap_cuentas == 0) {
+        if (!crear) return NULL;
+        x->cap_cuentas = CUENTAS_ACTIVO;
+        x->cuentas = calloc(x->cap_cuentas, sizeof *x->cuentas);
+    }
+    uint32_t i = hash_cuenta(cuenta, x->cap_cuentas);
+    while (x->cuentas[i].cap != 0 && x->cuentas[i].cuenta != cuenta)
+        i = (i + 1) & (x->cap_cuentas - 1);
+    if (x->cuentas[i].cap != 0 || !crear) return x->cuentas[i].cap ? &x->cuentas[i] : NULL;
+
+    if ((x->usadas + 1) * 10 > x->cap_cuentas * 7) {       /* crece al 70 % */
+        CuentaActivaHist *viejas = x->cuentas;
+        uint32_t cap_vieja = x->cap_cuentas;
+        x->cap_cuentas *= 2;
+        x->cuentas = calloc(x->cap_cuentas, sizeof *x->cuentas);
+        for (uint32_t k = 0; k < cap_vieja; ++k) {
+            if (viejas[k].cap == 0) continue;
+            uint32_t j = hash_cuenta(viejas[k].cuenta, x->cap_cuentas);
+            while (x->cuentas[j].cap != 0) j = (j + 1) & (x->cap_cuentas - 1);
+            x->cuentas[j] = viejas[k];
+        }
+        free(viejas);
+        return cuenta_activa(x, cuenta, 1);
+    }
+    x->usadas++;
+    x->cuentas[i] = (CuentaActivaHist){ .cuenta = cuenta, .cap = 8 };
+    x->cuentas[i].v = malloc(8 * sizeof *x->cuentas[i].v);
+    return &x->cuentas[i];
+}
+
+/* Añade el apunte de la posición pos manteniendo el orden por tiempo: casi
+ * siempre va al final, salvo lotes de procesos que se adelantaron.      */
+static void indexar(IndiceActivoHist *x, const RegistroHistorial *r, uint32_t pos) {
+    CuentaActivaHist *c = cuenta_activa(x, r->cuenta, 1);
+    if (c->num == c->cap) c->v = realloc(c->v, (c->cap *= 2) * sizeof *c->v);
+    uint32_t i = c->num++;
+    while (i > 0 && c->v[i - 1].ts > r->ts) { c->v[i] = c->v[i - 1]; --i; }
+    c->v[i] = (PosicionHist){ r->ts, pos };
+}
+
+/* Pone el índice al día con lo escrito en el .act: primero los huecos que
+ * ya se llenaron, después lo añadido al final.                           */
+static void actualizar_indice(IndiceActivoHist *x, int fd, uint32_t total) {
+    RegistroHistorial r;
+    uint32_t quedan = 0;
+    for (uint32_t i = 0; i < x->num_huecos; ++i) {
+        uint32_t pos = x->huecos[i];
+        if (pread(fd, &r, sizeof r, (off_t)pos * sizeof r) == (ssize_t)sizeof r &&
+            historial_valido(&r))
+            indexar(x, &r, pos);
+        else
+            x->huecos[quedan++] = pos;
+    }
+    x->num_huecos = quedan;
+
+    RegistroHistorial *bloque = malloc(BLOQUE_LECTURA * sizeof *bloque);
+    for (uint32_t i = x->escaneados; i < total; i += BLOQUE_LECTURA) {
+        uint32_t k = total - i < BLOQUE_LECTURA ? total - i : BLOQUE_LECTURA;
+        if (pread(fd, bloque, k * sizeof *bloque, (off_t)i * sizeof *bloque) !=
+            (ssize_t)(k * sizeof *bloque))
+            break;
+        for (uint32_t j = 0; j < k; ++j) {
+            if (historial_valido(&bloque[j])) { indexar(x, &bloque[j], i + j); continue; }
+            if (x->num_huecos == x->cap_huecos)
+                x->huecos = realloc(x->huecos, (x->cap_huecos = x->cap_huecos ? x->cap_huecos * 2 : 64)
+                                               * sizeof *x->huecos);
+            x->huecos[x->num_huecos++] = i + j;
+        }
+        x->escaneados = i + k;
+    }
+    free(bloque);
+}
+
+/*─────────────────────────────────────────────*/
+
+/* Abre (o crea) el historial de cfg->directorio_historial.  Un escritor
+ * además sella lo que otros dejaran pendiente.  0 si va bien.           */
+int historial_abrir(Historial *h, const Config *cfg, int escritor) {
+    memset(h, 0, sizeof *h);
+    h->fd          = -1;
+    h->segmento_fd = SIN_SEGMENTO;
+    pthread_mutex_init(&h->mutex, NULL);
+    pthread_mutex_init(&h->mutex_activo, NULL);
+    pthread_rwlock_init(&h->uso, NULL);
+    h->activo.segmento = SIN_SEGMENTO;
+    snprintf(h->dir, sizeof h->dir, "%s",
+             cfg->directorio_historial[0] ? cfg->directorio_historial : "historial");
+    int mb = cfg->tam_segmento_historial > 0 ? cfg->tam_segmento_historial : 16;
+    h->max_registros = (uint32_t)((size_t)mb * 1024 * 1024 / sizeof(RegistroHistorial));
+    h->rotacion_ns   = (int64_t)cfg->rotacion_historial_s * 1000000000;
+    h->retencion_ns  = (int64_t)cfg->retencion_historial_dias * 86400 * 1000000000;
+
+    if (mkdir(h->dir, 0755) == -1 && errno != EEXIST) { perror(h->dir); return -1; }
+    char ruta[128];
+    snprintf(ruta, sizeof ruta, "%s/control", h->dir);
+    int fd = open(ruta, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) { perror(ruta); return -1; }
+
+    flock(fd, LOCK_EX);                  /* sólo para crearlo una vez */
+    struct stat st;
+    fstat(fd, &st);
+    int nuevo = st.st_size == 0;
+    if (nuevo && ftruncate(fd, sizeof(ControlHistorial)) == -1) {
+        perror(ruta); close(fd); return -1;
+    }
+    h->ctl = mmap(NULL, sizeof(ControlHistorial), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h->ctl == MAP_FAILED) { perror("mmap historial"); h->ctl = NULL; close(fd); return -1; }
+    if (nuevo) {
+        memcpy(h->ctl->magia, MAGIA_HISTORIAL, 8);
+        h->ctl->tam_registro = sizeof(RegistroHistorial);
+        atomic_store(&h->ctl->cursor, 0);
+        atomic_store(&h->ctl->inicio, historial_ahora());
+        atomic_store(&h->ctl->segmento_inicio, 0);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if (memcmp(h->ctl->magia, MAGIA_HISTORIAL, 8) != 0 ||
+        h->ctl->tam_registro != sizeof(RegistroHistorial)) {
+        fprintf(stderr, "%s: no es un historial de esta versión\n", ruta);
+        historial_cerrar(h);
+        return -1;
+    }
+    asegurar_ultimos(h->dir);
+    if (escritor) sellar_pendientes(h);
+    return 0;
+}
+
+void historial_cerrar(Historial *h) {
+    if (h->ctl) munmap(h->ctl, sizeof(ControlHistorial));
+    if (h->fd != -1) close(h->fd);
+    for (uint32_t i = 0; i < h->num_mapas; ++i) {
+        historial_desmapear(h->mapas[i]);
+        free(h->mapas[i]);
+    }
+    free(h->mapas);
+    if (h->ultimos) munmap(h->ultimos, h->tam_ultimos);
+    vaciar_indice(&h->activo, SIN_SEGMENTO);
+    pthread_mutex_destroy(&h->mutex);
+    pthread_mutex_destroy(&h->mutex_activo);
+    pthread_rwlock_destroy(&h->uso);
+    memset(h, 0, sizeof *h);
+    h->fd = -1;
+}
+
+/* Reserva hasta n huecos en el segmento activo y devuelve cuántos, con
+ * su segmento y posición.  Si el activo está lleno o ha cumplido su
+ * tiempo lo rota; a quien gana el cambio le toca sellar el anterior.    */
+static uint32_t reservar(Historial *h, uint32_t n, uint32_t *seg, uint32_t *pos,
+                         uint32_t *a_sellar, uint32_t *cuantos) {
+    ControlHistorial *c = h->ctl;
+    uint_fast64_t cur = atomic_load(&c->cursor);
+    for (;;) {
+        uint32_t s = (uint32_t)(cur >> 32), usados = (uint32_t)cur;
+        int caducado = usados > 0 && h->rotacion_ns > 0 &&
+                       atomic_load(&c->segmento_inicio) == s &&
+                       historial_ahora() - atomic_load(&c->inicio) >= h->rotacion_ns;
+        if (usados >= h->max_registros || caducado) {
+            uint_fast64_t nuevo = (uint_fast64_t)(s + 1) << 32;
+            if (atomic_compare_exchange_weak(&c->cursor, &cur, nuevo)) {
+                atomic_store(&c->inicio, historial_ahora());
+                atomic_store(&c->segmento_inicio, s + 1);
+                *a_sellar = s;
+                *cuantos  = usados;
+                cur = nuevo;
+            }
+            continue;
+        }
+        uint32_t k = h->max_registros - usados < n ? h->max_registros - usados : n;
+        if (atomic_compare_exchange_weak(&c->cursor, &cur, cur + k)) {
+            *seg = s;
+            *pos = usados;
+            return k;
+        }
+    }
+}
+
+static int fd_segmento(Historial *h, uint32_t seg) {
+    if (h->segmento_fd == seg && h->fd != -1) return h->fd;
+    if (h->fd != -1) close(h->fd);
+    char ruta[128];
+    ruta_segmento(ruta, sizeof ruta, h->dir, seg, "act");
+    h->fd = open(ruta, O_WRONLY | O_CREAT, 0644);
+    h->segmento_fd = seg;
+    if (h->fd == -1) perror(ruta);
+    return h->fd;
+}
+
+/* Añade n registros (rellena su suma).  Sólo lo usa un hilo por
+ * Historial; entre procesos no hace falta más que el cursor.  Devuelve
+ * cuántos no llegaron a disco, que quedan al principio de r para
+ * reintentarlos (0 si van todos).                                        */
+int historial_escribir(Historial *h, RegistroHistorial *r, int n) {
+    for (int i = 0; i < n; ++i) r[i].suma = fnv1a(&r[i], offsetof(RegistroHistorial, suma));
+
+    int pendientes = 0;
+    for (int hechos = 0; hechos < n; ) {
+        uint32_t seg, pos, a_sellar = SIN_SEGMENTO, cuantos = 0;
+        uint32_t k = reservar(h, (uint32_t)(n - hechos), &seg, &pos, &a_sellar, &cuantos);
+        int fd = fd_segmento(h, seg);
+        size_t tam = k * sizeof *r;
+        if (fd == -1 || pwrite(fd, r + hechos, tam, (off_t)pos * sizeof *r) != (ssize_t)tam) {
+            memmove(r + pendientes, r + hechos, tam);
+            pendientes += (int)k;
+        }
+        hechos += (int)k;
+        if (a_sellar != SIN_SEGMENTO) {
+            sellar(h, a_sellar, cuantos);
+            sellar_pendientes(h);
+            purgar(h);
+        }
+    }
+    return pendientes;
+}
+
+/*─────────────────────────────────────────────*/
+/*                  CONSULTA                   */
+/*─────────────────────────────────────────────*/
+
+/* Segmento sellado `numero` de la caché (ordenada por número), que lo
+ * proyecta la primera vez.  NULL si no hay .seg.  Las proyecciones duran
+ * lo que el Historial salvo las que la retención deja sin fichero.      */
+static const MapaSegmentoHist *mapa_sellado(Historial *h, uint32_t numero) {
+    pthread_mutex_lock(&h->mutex);
+    uint32_t lo = 0, hi = h->num_mapas;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (h->mapas[mid]->numero < numero) lo = mid + 1;
+        else                                hi = mid;
+    }
+    MapaSegmentoHist *m = lo < h->num_mapas && h->mapas[lo]->numero == numero ? h->mapas[lo] : NULL;
+    if (!m) {
+        m = malloc(sizeof *m);
+        if (historial_mapear(h->dir, numero, m) == 0 && m->sellado) {
+            if (h->num_mapas == h->cap_mapas)
+                h->mapas = realloc(h->mapas, (h->cap_mapas = h->cap_mapas ? h->cap_mapas * 2 : 64)
+                                             * sizeof *h->mapas);
+            memmove(&h->mapas[lo + 1], &h->mapas[lo], (h->num_mapas - lo) * sizeof *h->mapas);
+            h->mapas[lo] = m;
+            h->num_mapas++;
+        } else {
+            historial_desmapear(m);
+            free(m);
+            m = NULL;
+        }
+    }
+    pthread_mutex_unlock(&h->mutex);
+    return m;
+}
+
+/* Suelta las proyecciones de los segmentos que borró la retención.  Con
+ * consultas en curso lo deja para otra vez.                              */
+static void desproyectar_purgados(Historial *h) {
+    uint32_t vivo = atomic_load(&h->ctl->primero_vivo);
+    pthread_mutex_lock(&h->mutex);
+    int hay = h->num_mapas > 0 && h->mapas[0]->numero < vivo;
+    pthread_mutex_unlock(&h->mutex);
+    if (!hay || pthread_rwlock_trywrlock(&h->uso) != 0) return;
+    uint32_t k = 0;
+    while (k < h->num_mapas && h->mapas[k]->numero < vivo) {
+        historial_desmapear(h->mapas[k]);
+        free(h->mapas[k++]);
+    }
+    memmove(h->mapas, h->mapas + k, (h->num_mapas - k) * sizeof *h->mapas);
+    h->num_mapas -= k;
+    pthread_rwlock_unlock(&h->uso);
+}
+
+/* Último sellado con la cuenta + 1 (0 si ninguno), según "ultimos"; si
+ * otro proceso la sustituyó se vuelve a proyectar.                       */
+static uint32_t ultimo_sellado(Historial *h, int32_t cuenta) {
+    pthread_mutex_lock(&h->mutex);
+    if (h->ultimos && atomic_load(&h->ultimos->sustituida)) {
+        munmap(h->ultimos, h->tam_ultimos);
+        h->ultimos = NULL;
+    }
+    if (!h->ultimos) {
+        char ruta[128];
+        snprintf(ruta, sizeof ruta, "%s/ultimos", h->dir);
+        int fd = open(ruta, O_RDONLY);
+        struct stat st;
+        if (fd != -1 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof *h->ultimos) {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) { h->ultimos = p; h->tam_ultimos = st.st_size; }
+            if (h->ultimos && (memcmp(h->ultimos->magia, MAGIA_ULTIMOS_HIST, 8) != 0 ||
+                               h->tam_ultimos != tam_ultimos(h->ultimos->cap))) {
+                munmap(h->ultimos, h->tam_ultimos);
+                h->ultimos = NULL;
+            }
+        }
+        if (fd != -1) close(fd);
+    }
+    uint32_t s = h->ultimos ? ultimo_de(h->ultimos, cuenta) : 0;
+    pthread_mutex_unlock(&h->mutex);
+    return s;
+}
+
+/* Primera posición de [0, n) con ts > t (mayor = 1) o ts ≥ t (mayor = 0). */
+static size_t cota(const RegistroHistorial *r, size_t n, int64_t t, int mayor) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t m = lo + (hi - lo) / 2;
+        if (r[m].ts < t || (mayor && r[m].ts == t)) lo = m + 1;
+        else                                        hi = m;
+    }
+    return lo;
+}
+
+static size_t cota_posiciones(const PosicionHist *v, size_t n, int64_t t, int mayor) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t m = lo + (hi - lo) / 2;
+        if (v[m].ts < t || (mayor && v[m].ts == t)) lo = m + 1;
+        else                                        hi = m;
+    }
+    return lo;
+}
+
+static int por_tiempo(const void *a, const void *b) {
+    const RegistroHistorial *x = a, *y = b;
+    return (x->ts > y->ts) - (x->ts < y->ts);
+}
+
+/* Añade a out[n..max) los apuntes de la entrada e de un sellado, del más
+ * nuevo hacia atrás.  Devuelve cuántos.                                  */
+static int de_sellado(const MapaSegmentoHist *m, const EntradaIndiceHist *e,
+                      int64_t desde, int64_t hasta, RegistroHistorial *out, int n, int max) {
+    const RegistroHistorial *r = m->registros + e->primero;
+    size_t a = cota(r, e->num, desde, 0), b = cota(r, e->num, hasta, 1);
+    int k = 0;
+    while (b > a && n + k < max) out[n + k++] = r[--b];
+    return k;
+}
+
+/* Lo mismo en un .act sin índice, leyéndolo entero: sólo pasa con el
+ * anterior al activo mientras se sella.                                  */
+static int recorrer_activo(int fd, uint32_t total, int cuenta, int64_t desde, int64_t hasta,
+                           RegistroHistorial *out, int n, int max) {
+    RegistroHistorial *bloque = malloc(BLOQUE_LECTURA * sizeof *bloque), *v = NULL;
+    size_t num = 0, cap = 0;
+    for (uint32_t i = 0; i < total; i += BLOQUE_LECTURA) {
+        uint32_t k = total - i < BLOQUE_LECTURA ? total - i : BLOQUE_LECTURA;
+        ssize_t l = pread(fd, bloque, k * sizeof *bloque, (off_t)i * sizeof *bloque);
+        if (l <= 0) break;
+        for (size_t j = 0; j < (size_t)l / sizeof *bloque; ++j) {
+            const RegistroHistorial *r = &bloque[j];
+            if (r->cuenta != cuenta || r->ts < desde || r->ts > hasta || !historial_valido(r))
+                continue;
+            if (num == cap) v = realloc(v, (cap = cap ? cap * 2 : 64) * sizeof *v);
+            v[num++] = *r;
+        }
+    }
+    free(bloque);
+    qsort(v, num, sizeof *v, por_tiempo);
+    int k = 0;
+    while (num > 0 && n + k < max) out[n + k++] = v[--num];
+    free(v);
+    return k;
+}
+
+/* Lo mismo en el .act `numero`, o -1 si no existe.  Para el más nuevo se
+ * pone al día su índice y, ya sin cerrojo, un pread por apunte devuelto. */
+static int de_activo(Historial *h, uint32_t numero, int cuenta, int64_t desde, int64_t hasta,
+                     RegistroHistorial *out, int n, int max) {
+    char ruta[128];
+    ruta_segmento(ruta, sizeof ruta, h->dir, numero, "act");
+    int fd = open(ruta, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat st;
+    fstat(fd, &st);
+    uint32_t total = (uint32_t)(st.st_size / sizeof(RegistroHistorial));
+
+    pthread_mutex_lock(&h->mutex_activo);
+    if (h->activo.segmento == SIN_SEGMENTO || h->activo.segmento < numero)
+        vaciar_indice(&h->activo, numero);
+    if (h->activo.segmento != numero) {
+        pthread_mutex_unlock(&h->mutex_activo);
+        int k = recorrer_activo(fd, total, cuenta, desde, hasta, out, n, max);
+        close(fd);
+        return k;
+    }
+    actualizar_indice(&h->activo, fd, total);
+    const CuentaActivaHist *c = cuenta_activa(&h->activo, cuenta, 0);
+    PosicionHist *v = NULL;
+    size_t a = 0, b = 0;
+    if (c) {
+        a = cota_posiciones(c->v, c->num, desde, 0);
+        b = cota_posiciones(c->v, c->num, hasta, 1);
+        if (b - a > (size_t)(max - n)) a = b - (size_t)(max - n);
+        if (b > a) {
+            v = malloc((b - a) * sizeof *v);
+            memcpy(v, c->v + a, (b - a) * sizeof *v);
+        }
+    }
+    pthread_mutex_unlock(&h->mutex_activo);
+
+    int k = 0;
+    for (size_t i = b - a; i > 0; --i)
+        if (pread(fd, &out[n + k], sizeof *out, (off_t)v[i - 1].pos * sizeof *out) ==
+            (ssize_t)sizeof *out)
+            ++k;
+    free(v);
+    close(fd);
+    return k;
+}
+
+/* Pone al día el índice del activo fuera de las consultas: servidor.c lo
+ * llama al arrancar y después cada poco desde su propio hilo.            */
+void historial_preparar(Historial *h) {
+    uint32_t numero = (uint32_t)(atomic_load(&h->ctl->cursor) >> 32);
+    char ruta[128];
+    ruta_segmento(ruta, sizeof ruta, h->dir, numero, "act");
+    int fd = open(ruta, O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    fstat(fd, &st);
+    pthread_mutex_lock(&h->mutex_activo);
+    if (h->activo.segmento == SIN_SEGMENTO || h->activo.segmento < numero)
+        vaciar_indice(&h->activo, numero);
+    if (h->activo.segmento == numero)
+        actualizar_indice(&h->activo, fd, (uint32_t)(st.st_size / sizeof(RegistroHistorial)));
+    pthread_mutex_unlock(&h->mutex_activo);
+    close(fd);
+}
+
+/* Como mucho `max` apuntes de la cuenta con desde ≤ ts ≤ hasta (ns), los
+ * más recientes, en orden cronológico.  Devuelve cuántos.  Primero los
+ * .act, del activo hacia atrás mientras los haya; después la cadena de
+ * sellados de la cuenta, saltando los que ya se leyeron como .act.       */
+int historial_consultar(Historial *h, int cuenta, int64_t desde, int64_t hasta,
+                        RegistroHistorial *out, int max) {
+    desproyectar_purgados(h);
+    pthread_rwlock_rdlock(&h->uso);
+
+    uint32_t activo = (uint32_t)(atomic_load(&h->ctl->cursor) >> 32), leidos = activo + 1;
+    int n = 0;
+    for (uint32_t s = activo; n < max; --s) {
+        int k = de_activo(h, s, cuenta, desde, hasta, out, n, max);
+        if (k == -1 && s != activo) break;     /* el activo puede no tener aún .act */
+        if (k != -1) { n += k; leidos = s; }
+        if (s == 0) break;
+    }
+
+    for (uint32_t sig = ultimo_sellado(h, cuenta); sig != 0 && n < max; ) {
+        const MapaSegmentoHist *m = mapa_sellado(h, sig - 1);
+        const EntradaIndiceHist *e = m ? entrada_de(m, cuenta) : NULL;
+        if (!e) break;                   /* borrado por la retención */
+        sig = e->anterior;
+        if (m->numero >= leidos || m->cab->ts_min > hasta) continue;
+        if (m->cab->ts_max < desde) break;         /* los anteriores son más viejos */
+        n += de_sellado(m, e, desde, hasta, out, n, max);
+    }
+    pthread_rwlock_unlock(&h->uso);
+
+    qsort(out, n, sizeof *out, por_tiempo);
+    return n;
+}
+
+/* "[AAAA-MM-DD hh:mm:ss] Transferencia a 1002        -25.00" */
+void historial_describir(const RegistroHistorial *r, char *dst, size_t n) {
+    char cuando[32], que[48];
+    time_t s = (time_t)(r->ts / 1000000000);
+    struct tm tm;
+    localtime_r(&s, &tm);
+    strftime(cuando, sizeof cuando, "[%Y-%m-%d %H:%M:%S]", &tm);
+
+    switch (r->tipo) {
+    case OP_DEPOSITO:      snprintf(que, sizeof que, "Depósito");                   break;
+    case OP_RETIRO:        snprintf(que, sizeof que, "Retiro");                     break;
+    case OP_TRANSFERENCIA: snprintf(que, sizeof que, "Transferencia %s %d",
+                                    r->centimos < 0 ? "a" : "de", r->otra);         break;
+    case OP_LOTE:          snprintf(que, sizeof que, "Lote (%d apuntes)", r->otra); break;
+    case OP_INTERES:       snprintf(que, sizeof que, "Intereses");                  break;
+    case OP_COMISION:      snprintf(que, sizeof que, "Comisión");                   break;
+    default:               snprintf(que, sizeof que, "Movimiento");
+    }
+    snprintf(dst, n, "%s %-26s %s%lld.%02lld", cuando, que, r->centimos < 0 ? "-" : "+",
+             llabs(r->centimos) / 100, llabs(r->centimos) % 100);
+}
+
+/*─────────────────────────────────────────────*/
+/*        MIGRACIÓN DEL FORMATO ANTERIOR       */
+/*─────────────────────────────────────────────*/
+
+#define DIR_TRANSACCIONES "transacciones"
+#define LOTE_MIGRACION    1024
+
+/* "[2025-05-19 22:13:25] Transferencia a 1002: -3000.00" de la cuenta a
+ * un apunte (sin suma).  -1 si la línea no es de las que se escribían.  */
+static int linea_antigua(const char *linea, int cuenta, RegistroHistorial *r) {
+    struct tm tm = { 0 };
+    int desp = 0, otra = -1;
+    double euros;
+    if (sscanf(linea, "[%d-%d-%d %d:%d:%d] %n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &desp) != 6 || desp == 0)
+        return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon  -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1) return -1;
+
+    const char *texto = linea + desp;
+    memset(r, 0, sizeof *r);
+    if (sscanf(texto, "Depósito: +%lf", &euros) == 1) {
+        r->tipo = OP_DEPOSITO;
+    } else if (sscanf(texto, "Retiro: -%lf", &euros) == 1) {
+        r->tipo = OP_RETIRO;
+        euros   = -euros;
+    } else if (sscanf(texto, "Transferencia a %d: -%lf", &otra, &euros) == 2) {
+        r->tipo = OP_TRANSFERENCIA;
+        euros   = -euros;
+    } else if (sscanf(texto, "Transferencia de %d: +%lf", &otra, &euros) == 2) {
+        r->tipo = OP_TRANSFERENCIA;
+    } else {
+        return -1;
+    }
+    r->ts       = (int64_t)t * 1000000000;
+    r->cuenta   = cuenta;
+    r->otra     = otra;
+    r->centimos = a_centimos(euros);
+    return 0;
+}
+
+/* Importa una vez transacciones/<cuenta>/transacciones.log, el historial
+ * de texto de antes: cada log importado pasa a transacciones.log.migrado
+ * (así una migración cortada sigue donde iba) y al acabar el directorio a
+ * transacciones.migrado.  Devuelve los apuntes importados o -1.          */
+int historial_migrar(const Config *cfg) {
+    DIR *d = opendir(DIR_TRANSACCIONES);
+    if (!d) return 0;
+    Historial h;
+    if (historial_abrir(&h, cfg, 1) == -1) { closedir(d); return -1; }
+
+    RegistroHistorial *lote = malloc(LOTE_MIGRACION * sizeof *lote);
+    long total = 0;
+    int error = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        int cuenta;
+        char resto, ruta[320], hecho[336], linea[256];
+        if (sscanf(e->d_name, "%d%c", &cuenta, &resto) != 1) continue;
+        snprintf(ruta, sizeof ruta, "%s/%s/transacciones.log", DIR_TRANSACCIONES, e->d_name);
+        FILE *f = fopen(ruta, "r");
+        if (!f) continue;                /* ya migrado */
+        int n = 0;
+        int64_t previo = 0;
+        while (fgets(linea, sizeof linea, f)) {
+            RegistroHistorial r;
+            if (linea_antigua(linea, cuenta, &r) == -1) continue;
+            if (r.ts <= previo && previo - r.ts < 1000000000)
+                r.ts = previo + 1;       /* mismo segundo: el orden del fichero */
+            previo = r.ts;
+            lote[n++] = r;
+            if (n == LOTE_MIGRACION) {
+                error |= historial_escribir(&h, lote, n);
+                total += n;
+                n = 0;
+            }
+        }
+        fclose(f);
+        error |= historial_escribir(&h, lote, n);
+        total += n;
+        snprintf(hecho, sizeof hecho, "%s.migrado", ruta);
+        if (!error && rename(ruta, hecho) == -1) perror(ruta);
+        if (error) break;
+    }
+    closedir(d);
+    free(lote);
+    historial_cerrar(&h);
+    if (error) { perror("historial"); return -1; }
+    if (rename(DIR_TRANSACCIONES, DIR_TRANSACCIONES ".migrado") == -1) perror(DIR_TRANSACCIONES);
+    return (int)total;
+}
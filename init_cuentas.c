@@ -1,17 +1,37 @@
-/* init_cuentas.c  –  Genera cuentas.dat con la estructura vigente */
+/* init_cuentas.c  –  Genera cuentas.dat con la estructura vigente
+ *
+ *  ./init_cuentas        → las tres cuentas de ejemplo
+ *  ./init_cuentas <n>    → n cuentas sintéticas (1001, 1002, …) para pruebas
+ *                          de carga con tablas grandes
+ */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 /* ---------- Estructura actual de una cuenta ---------- */
+#define FORMATO_CUENTA 0xCE02
+
 typedef struct {
-    int   numero_cuenta;
-    char  titular[50];
-    float saldo;
-    int   bloqueado;          /* 0 = activa, 1 = bloqueada */
+    int      numero_cuenta;
+    char     titular[50];
+    uint16_t formato;         /* FORMATO_CUENTA */
+    int64_t  saldo;           /* céntimos */
+    int      bloqueado;       /* 0 = activa, 1 = bloqueada */
 } Cuenta;
 
-int main(void)
+static int generar_sinteticas(FILE *f, long n)
+{
+    for (long i = 0; i < n; ++i) {
+        Cuenta c = { .numero_cuenta = (int)(1001 + i), .formato = FORMATO_CUENTA,
+                     .saldo = 100000 };
+        snprintf(c.titular, sizeof c.titular, "Cliente %ld", 1001 + i);
+        if (fwrite(&c, sizeof c, 1, f) != 1) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
 {
     FILE *f = fopen("cuentas.dat", "wb");
     if (!f) {
@@ -19,11 +39,20 @@ int main(void)
         return 1;
     }
 
+    if (argc > 1) {
+        long n = atol(argv[1]);
+        int err = generar_sinteticas(f, n);
+        fclose(f);
+        if (err) { fprintf(stderr, "Error escribiendo cuentas.dat\n"); return 1; }
+        printf("Archivo cuentas.dat creado con %ld cuentas sintéticas.\n", n);
+        return 0;
+    }
+
     /* Cuentas iniciales */
     Cuenta cuentas[] = {
-        {1001, "John Doe",    5000.00f, 0},
-        {1002, "Jane Smith",  3000.00f, 0},
-        {1003, "Carlos Ruiz", 7000.00f, 0}
+        {1001, "John Doe",    FORMATO_CUENTA, 500000, 0},
+        {1002, "Jane Smith",  FORMATO_CUENTA, 300000, 0},
+        {1003, "Carlos Ruiz", FORMATO_CUENTA, 700000, 0}
     };
 
     size_t total = sizeof(cuentas) / sizeof(cuentas[0]);
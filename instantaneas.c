@@ -0,0 +1,293 @@
+/* instantaneas.c — Instantáneas consistentes de la tabla con el banco en marcha
+ *
+ *  ▸ Empezar una foto sólo cuesta tomar todas las franjas un instante:
+ *    se abre una época nueva, se anota el lsn del diario y se activa la
+ *    copia al escribir.  Las operaciones siguen mientras se escribe.
+ *  ▸ Desde ese momento, la primera escritura de cada cuenta guarda antes
+ *    su saldo (empezar_escritura, memoria.c).  El recorrido no toma
+ *    cerrojos: por cada cuenta lee el saldo y, si la cuenta ya tiene copia
+ *    de esta época, usa la copia.  El resultado es la tabla tal como
+ *    estaba al empezar, con todo lo del diario anterior al lsn.
+ *  ▸ Se escribe en cuentas.NNNNNN.foto.tmp, se sincroniza y se renombra,
+ *    así que una foto con nombre definitivo siempre está completa.  Se
+ *    conservan las CONSERVAR_FOTOS más recientes.
+ *  ▸ En banco un hilo las toma cada INTERVALO_FOTO_S segundos o cuando se
+ *    pide con instantanea_pedir() (segura desde un manejador de señal).
+ *  ▸ Sólo el saldo cambia con el banco en marcha; número, titular y estado
+ *    se copian tal cual.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+#define BLOQUE_FOTO 4096                 /* cuentas por fwrite */
+
+static double ahora_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*─────────────────────────────────────────────*/
+/*              FICHEROS VERSIONADOS           */
+/*─────────────────────────────────────────────*/
+
+static void ruta_foto(char *ruta, size_t tam, const char *dir, unsigned version, const char *sufijo) {
+    snprintf(ruta, tam, "%s/cuentas.%06u.foto%s", dir, version, sufijo);
+}
+
+/* Mayor versión presente en el directorio (0 si no hay ninguna). */
+static unsigned ultima_version(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    unsigned mayor = 0, v;
+    char fin[8];
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+        if (sscanf(e->d_name, "cuentas.%u.%7s", &v, fin) == 2 &&
+            strcmp(fin, "foto") == 0 && v > mayor)
+            mayor = v;
+    closedir(d);
+    return mayor;
+}
+
+/* Borra las fotos anteriores a las `conservar` últimas. */
+static void purgar(const char *dir, unsigned ultima, int conservar) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    unsigned v;
+    char fin[8], ruta[300];
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+        if (sscanf(e->d_name, "cuentas.%u.%7s", &v, fin) == 2 &&
+            strcmp(fin, "foto") == 0 && v + (unsigned)conservar <= ultima) {
+            ruta_foto(ruta, sizeof ruta, dir, v, "");
+            unlink(ruta);
+        }
+    closedir(d);
+}
+
+/*─────────────────────────────────────────────*/
+/*                 TOMAR UNA FOTO              */
+/*─────────────────────────────────────────────*/
+
+/* Saldo de la cuenta idx al empezar la foto, sin cerrojo.  Si la lectura
+ * ve un saldo escrito después, también ve la época (la publica antes la
+ * escritura), y entonces vale la copia.                                  */
+static int64_t saldo_foto(TablaCuentas *t, int idx, unsigned epoca) {
+    int64_t s = ((const volatile int64_t *)saldos_tabla(t))[idx];
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&epocas_tabla(t)[idx], memory_order_relaxed) == epoca)
+        return ((const volatile int64_t *)fotos_tabla(t))[idx];
+    return s;
+}
+
+void foto_ruta(char *ruta, size_t tam, const char *directorio, int version) {
+    ruta_foto(ruta, tam, directorio, (unsigned)version, "");
+}
+
+static int tomar(TablaCuentas *t, const char *directorio, int conservar,
+                 CabeceraFoto *cab, double *parada_ms) {
+    if (mkdir(directorio, 0755) == -1 && errno != EEXIST) { perror(directorio); return -1; }
+
+    unsigned version = ultima_version(directorio) + 1;
+    char tmp[300], ruta[300];
+    ruta_foto(tmp,  sizeof tmp,  directorio, version, ".tmp");
+    ruta_foto(ruta, sizeof ruta, directorio, version, "");
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) { perror(tmp); return -1; }
+
+    memset(cab, 0, sizeof *cab);
+    memcpy(cab->magia, MAGIA_FOTO, sizeof cab->magia);
+    cab->version = version;
+    cab->ts      = time(NULL);
+    fwrite(cab, sizeof *cab, 1, f);            /* se reescribe al final */
+
+    /* Punto de corte: ninguna operación a medias con las franjas tomadas. */
+    double t0 = ahora_ms();
+    bloquear_todo(t);
+    unsigned epoca   = ++t->epoca_foto;
+    cab->lsn         = atomic_load(&t->wal.reservado);
+    cab->num_cuentas = t->num_cuentas;
+    atomic_store(&t->foto_activa, 1);
+    desbloquear_todo(t);
+    if (parada_ms) *parada_ms = ahora_ms() - t0;
+
+    /* Lo que recoge la foto tiene que ser durable antes que la foto. */
+    if (cab->lsn > 0) wal_confirmar(&t->wal, cab->lsn - 1);
+
+    static Cuenta bloque[BLOQUE_FOTO];
+    int64_t total = 0;
+    for (int i = 0; i < cab->num_cuentas; i += BLOQUE_FOTO) {
+        int n = cab->num_cuentas - i < BLOQUE_FOTO ? cab->num_cuentas - i : BLOQUE_FOTO;
+        for (int k = 0; k < n; ++k) {
+            int64_t s = saldo_foto(t, i + k, epoca);
+            leer_cuenta(t, i + k, &bloque[k]);
+            bloque[k].saldo = s;
+            total += s;
+        }
+        fwrite(bloque, sizeof(Cuenta), n, f);
+    }
+    atomic_store(&t->foto_activa, 0);
+
+    cab->total = total;
+    rewind(f);
+    fwrite(cab, sizeof *cab, 1, f);
+    int error = fflush(f) != 0 || fsync(fileno(f)) == -1 || ferror(f);
+    fclose(f);
+    if (error || rename(tmp, ruta) == -1) {
+        perror(ruta);
+        unlink(tmp);
+        return -1;
+    }
+
+    /* Que el nombre nuevo también sobreviva a una caída. */
+    int fd = open(directorio, O_RDONLY);
+    if (fd != -1) { fsync(fd); close(fd); }
+
+    purgar(directorio, version, conservar);
+    return (int)version;
+}
+
+/* Toma una instantánea en `directorio`.  Rellena `cab` y, si no es NULL,
+ * `parada_ms` con lo que estuvieron paradas las operaciones.  Devuelve la
+ * versión escrita o -1.  Una sola foto a la vez por tabla: en banco la
+ * piden el hilo de instantáneas y el envío a las réplicas.               */
+int foto_tomar(TablaCuentas *t, const char *directorio, int conservar,
+               CabeceraFoto *cab, double *parada_ms) {
+    static pthread_mutex_t una_a_la_vez = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&una_a_la_vez);
+    int version = tomar(t, directorio, conservar, cab, parada_ms);
+    pthread_mutex_unlock(&una_a_la_vez);
+    return version;
+}
+
+/*─────────────────────────────────────────────*/
+/*                 LEER UNA FOTO               */
+/*─────────────────────────────────────────────*/
+
+int foto_leer_cabecera(const char *ruta, CabeceraFoto *c) {
+    FILE *f = fopen(ruta, "rb");
+    if (!f) { perror(ruta); return -1; }
+    int ok = fread(c, sizeof *c, 1, f) == 1 &&
+             (memcmp(c->magia, MAGIA_FOTO, sizeof c->magia) == 0 ||
+              memcmp(c->magia, MAGIA_FOTO_V1, sizeof c->magia) == 0);
+    fclose(f);
+    if (!ok) fprintf(stderr, "%s: no es una instantánea\n", ruta);
+    return ok ? 0 : -1;
+}
+
+/* Inserta en t (vacía, con capacidad suficiente) las cuentas de la foto,
+ * convirtiendo las de una foto antigua.  Devuelve cuántas cargó o -1.    */
+int foto_cargar(const char *ruta, TablaCuentas *t) {
+    CabeceraFoto c;
+    if (foto_leer_cabecera(ruta, &c) == -1) return -1;
+
+    FILE *f = fopen(ruta, "rb");
+    if (!f) { perror(ruta); return -1; }
+    fseek(f, sizeof c, SEEK_SET);
+
+    static Cuenta bloque[BLOQUE_FOTO];
+    static unsigned char v1[BLOQUE_FOTO][TAM_CUENTA_V1];
+    int antigua = memcmp(c.magia, MAGIA_FOTO_V1, sizeof c.magia) == 0;
+    int restantes = c.num_cuentas;
+    size_t leidas;
+    while (restantes > 0 &&
+           (leidas = antigua
+                ? fread(v1, TAM_CUENTA_V1, restantes < BLOQUE_FOTO ? restantes : BLOQUE_FOTO, f)
+                : fread(bloque, sizeof(Cuenta),
+                        restantes < BLOQUE_FOTO ? restantes : BLOQUE_FOTO, f)) > 0) {
+        if (antigua)
+            for (size_t i = 0; i < leidas; ++i) cuenta_desde_v1(v1[i], &bloque[i]);
+        for (size_t i = 0; i < leidas; ++i)
+            if (insertar_cuenta(t, &bloque[i]) == -1)
+                fprintf(stderr, "cuenta %d duplicada o tabla llena\n",
+                        bloque[i].numero_cuenta);
+        restantes -= (int)leidas;
+    }
+    fclose(f);
+    if (restantes > 0) fprintf(stderr, "%s: faltan %d cuentas\n", ruta, restantes);
+    return t->num_cuentas;
+}
+
+/*─────────────────────────────────────────────*/
+/*            HILO DE INSTANTÁNEAS             */
+/*─────────────────────────────────────────────*/
+
+static TablaCuentas *tabla_fotos;
+static char          dir_fotos[50];
+static int           intervalo_s, conservar;
+static sem_t         peticiones;
+static atomic_int    parar_fotos;
+static pthread_t     hilo_fotos;
+static volatile sig_atomic_t hilo_activo;
+
+static void *bucle_fotos(void *arg) {
+    (void)arg;
+    for (;;) {
+        if (intervalo_s > 0) {
+            struct timespec hasta;
+            clock_gettime(CLOCK_REALTIME, &hasta);
+            hasta.tv_sec += intervalo_s;
+            while (sem_timedwait(&peticiones, &hasta) == -1 && errno == EINTR) ;
+        } else {
+            while (sem_wait(&peticiones) == -1 && errno == EINTR) ;
+        }
+        if (atomic_load(&parar_fotos)) break;
+        while (sem_trywait(&peticiones) == 0) ;  /* peticiones acumuladas: una foto */
+
+        CabeceraFoto c;
+        double parada, t0 = ahora_ms();
+        int v = foto_tomar(tabla_fotos, dir_fotos, conservar, &c, &parada);
+        if (v < 0) continue;
+        printf("Instantánea %s/cuentas.%06d.foto: %d cuentas, lsn %llu, "
+               "total %lld.%02lld €, %.1f ms (parada %.3f ms)\n",
+               dir_fotos, v, c.num_cuentas, (unsigned long long)c.lsn,
+               (long long)(c.total / 100), (long long)llabs(c.total % 100),
+               ahora_ms() - t0, parada);
+    }
+    return NULL;
+}
+
+void instantaneas_iniciar(TablaCuentas *t, const Config *cfg) {
+    tabla_fotos = t;
+    snprintf(dir_fotos, sizeof dir_fotos, "%s", cfg->directorio_fotos);
+    intervalo_s = cfg->intervalo_foto_s;
+    conservar   = cfg->conservar_fotos;
+    atomic_store(&parar_fotos, 0);
+    sem_init(&peticiones, 0, 0);
+    if (pthread_create(&hilo_fotos, NULL, bucle_fotos, NULL) != 0) {
+        perror("pthread_create instantáneas");
+        return;
+    }
+    hilo_activo = 1;
+}
+
+/* Pide una foto al hilo.  Sólo usa sem_post: vale en un manejador. */
+void instantanea_pedir(void) {
+    if (hilo_activo) sem_post(&peticiones);
+}
+
+/* Espera a que termine la foto en curso, si la hay. */
+void instantaneas_detener(void) {
+    if (!hilo_activo) return;
+    atomic_store(&parar_fotos, 1);
+    sem_post(&peticiones);
+    pthread_join(hilo_fotos, NULL);
+    sem_destroy(&peticiones);
+    hilo_activo = 0;
+}
@@ -0,0 +1,183 @@
+/* liquidacion.c — Intereses y comisiones de fin de día sobre toda la tabla
+ *
+ *  ▸ Cada cuenta no bloqueada recibe, por cada día liquidado:
+ *      · saldo > 0: INTERES_ANUAL / 365 del saldo (abono);
+ *      · saldo < 0: INTERES_DESCUBIERTO / 365 del descubierto (cargo);
+ *      · saldo < SALDO_EXENTO: COMISION_DIARIA (cargo).
+ *    Todo en céntimos enteros, redondeando al céntimo más cercano; el
+ *    mismo saldo da siempre el mismo apunte, sea cual sea el reparto.
+ *  ▸ La tabla se parte en tantos tramos contiguos como hilos.  Cada hilo
+ *    recorre las columnas de saldos y estados de su tramo, escribe los
+ *    saldos nuevos (con el seqlock, por si alguien lee) y compone las
+ *    líneas de extracto por bloques, que escribe con pwrite en su sitio.
+ *    Los totales se suman por hilo y se juntan al final.
+ *  ▸ No encola nada en el buffer de E/S ni en el diario: quien llama
+ *    guarda después la tabla entera de una vez (liquidar.c, bench.c).
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+#define MAX_HILOS_LIQ 256
+#define BLOQUE_LIQ    4096               /* cuentas por pwrite del extracto */
+
+typedef struct {
+    TablaCuentas *t;
+    const Config *cfg;
+    int desde, hasta, dias, fd;
+    int error;
+    ResumenLiquidacion r;
+} Tramo;
+
+/* a·b/c redondeado al entero más cercano; a ≥ 0. */
+static int64_t proporcion(int64_t a, int64_t b, int64_t c)
+{
+    return (int64_t)(((__int128)a * b + c / 2) / c);
+}
+
+/* Escribe v alineado a la derecha en [ini, fin), con dos decimales si
+ * `centimos`; lo que no quepa se corta por la izquierda.  Sin snprintf:
+ * son cinco campos por cuenta y millones de cuentas.                    */
+static void campo(char *ini, char *fin, int64_t v, int centimos)
+{
+    uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+    char *p = fin;
+    int cifras = 0;
+    do {
+        if (centimos && cifras == 2 && p > ini) *--p = '.';
+        if (p > ini) *--p = (char)('0' + u % 10);
+        u /= 10;
+        ++cifras;
+    } while (u > 0 || (centimos && cifras < 3));
+    if (v < 0 && p > ini) *--p = '-';
+}
+
+/* Columnas: cuenta, saldo anterior, intereses, comisión y saldo; cada una
+ * termina en la posición indicada y la separa un espacio de la anterior. */
+static const int fin_columna[] = { 10, 27, 41, 54, 71 };
+
+/* Línea de extracto de LARGO_EXTRACTO caracteres con su salto de línea. */
+void linea_extracto(char *linea, int numero, int64_t antes, int64_t interes,
+                    int64_t comision, int64_t despues)
+{
+    memset(linea, ' ', LARGO_EXTRACTO - 1);
+    linea[LARGO_EXTRACTO - 1] = '\n';
+    campo(linea,                      linea + fin_columna[0], numero,   0);
+    campo(linea + fin_columna[0] + 1, linea + fin_columna[1], antes,    1);
+    campo(linea + fin_columna[1] + 1, linea + fin_columna[2], interes,  1);
+    campo(linea + fin_columna[2] + 1, linea + fin_columna[3], comision, 1);
+    campo(linea + fin_columna[3] + 1, linea + fin_columna[4], despues,  1);
+}
+
+static void *liquidar_tramo(void *arg)
+{
+    Tramo *tr = arg;
+    TablaCuentas *t = tr->t;
+    const Config *cfg = tr->cfg;
+    int64_t *saldos   = saldos_tabla(t);
+    uint8_t *estados  = estados_tabla(t);
+    int32_t *numeros  = numeros_tabla(t);
+    int64_t  dias_pb  = (int64_t)365 * 10000;
+    char    *lineas   = malloc((size_t)BLOQUE_LIQ * LARGO_EXTRACTO + 1);
+    if (!lineas) { tr->error = 1; return NULL; }   /* sin tocar ningún saldo */
+
+    for (int b = tr->desde; b < tr->hasta; b += BLOQUE_LIQ) {
+        int fin = b + BLOQUE_LIQ < tr->hasta ? b + BLOQUE_LIQ : tr->hasta;
+        for (int i = b; i < fin; ++i) {
+            int64_t antes = saldos[i], interes = 0, comision = 0;
+            tr->r.total_antes += antes;
+            if (estados[i] & ESTADO_BLOQUEADA) {
+                tr->r.bloqueadas++;
+            } else {
+                if (antes > 0)
+                    interes = proporcion(antes, (int64_t)cfg->interes_pb * tr->dias, dias_pb);
+                else if (antes < 0)
+                    interes = -proporcion(-antes, (int64_t)cfg->descubierto_pb * tr->dias, dias_pb);
+                if (antes < cfg->saldo_exento) comision = (int64_t)cfg->comision_diaria * tr->dias;
+                else                           tr->r.exentas++;
+            }
+            int64_t despues = antes + interes - comision;
+            if (despues != antes) {
+                empezar_escritura(t, i);
+                saldos[i] = despues;
+                terminar_escritura(t, i);
+                tr->r.con_movimiento++;
+            }
+            if (interes > 0) tr->r.intereses    += interes;
+            else             tr->r.descubiertos -= interes;
+            tr->r.comisiones    += comision;
+            tr->r.total_despues += despues;
+            linea_extracto(lineas + (size_t)(i - b) * LARGO_EXTRACTO, numeros[i],
+                           antes, interes, comision, despues);
+        }
+        size_t  tam = (size_t)(fin - b) * LARGO_EXTRACTO;
+        off_t   pos = (off_t)(b + 1) * LARGO_EXTRACTO;
+        if (tr->fd != -1 && pwrite(tr->fd, lineas, tam, pos) != (ssize_t)tam) tr->error = 1;
+    }
+    tr->r.cuentas = tr->hasta - tr->desde;
+    free(lineas);
+    return NULL;
+}
+
+/* Liquida `dias` días sobre todas las cuentas de t con `hilos` hilos (0 =
+ * HILOS_LIQUIDACION o uno por CPU).  Con fd_extracto != -1 escribe allí el
+ * extracto completo (cabecera, una línea por cuenta y totales).  Deja en
+ * r los totales; devuelve 0, o -1 si no se pudo escribir el extracto o a
+ * un hilo le faltó memoria (su tramo queda sin liquidar: no se guarda). */
+int liquidar_tabla(TablaCuentas *t, const Config *cfg, int dias, int hilos,
+                   int fd_extracto, ResumenLiquidacion *r)
+{
+    if (hilos <= 0) hilos = cfg->hilos_liquidacion;
+    if (hilos <= 0) hilos = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (hilos > MAX_HILOS_LIQ) hilos = MAX_HILOS_LIQ;
+    if (hilos > t->num_cuentas) hilos = t->num_cuentas > 0 ? t->num_cuentas : 1;
+    if (dias < 1) dias = 1;
+
+    Tramo     tramos[MAX_HILOS_LIQ];
+    pthread_t ids[MAX_HILOS_LIQ];
+    int n = t->num_cuentas;
+    for (int h = 0; h < hilos; ++h) {
+        /* Tramos múltiplos del bloque: ningún pwrite pisa a otro hilo. */
+        int por_hilo = (n / hilos + BLOQUE_LIQ - 1) / BLOQUE_LIQ * BLOQUE_LIQ;
+        tramos[h] = (Tramo){ .t = t, .cfg = cfg, .dias = dias, .fd = fd_extracto };
+        tramos[h].desde = h * por_hilo < n ? h * por_hilo : n;
+        tramos[h].hasta = h == hilos - 1 || (h + 1) * por_hilo > n ? n : (h + 1) * por_hilo;
+        pthread_create(&ids[h], NULL, liquidar_tramo, &tramos[h]);
+    }
+
+    memset(r, 0, sizeof *r);
+    int error = 0;
+    for (int h = 0; h < hilos; ++h) {
+        pthread_join(ids[h], NULL);
+        const ResumenLiquidacion *p = &tramos[h].r;
+        r->cuentas        += p->cuentas;
+        r->con_movimiento += p->con_movimiento;
+        r->bloqueadas     += p->bloqueadas;
+        r->exentas        += p->exentas;
+        r->total_antes    += p->total_antes;
+        r->total_despues  += p->total_despues;
+        r->intereses      += p->intereses;
+        r->descubiertos   += p->descubiertos;
+        r->comisiones     += p->comisiones;
+        error |= tramos[h].error;
+    }
+    if (fd_extracto == -1) return error ? -1 : 0;
+
+    char linea[LARGO_EXTRACTO + 1];
+    snprintf(linea, sizeof linea, "%10s %16s %13s %12s %16s\n",
+             "cuenta", "saldo anterior", "intereses", "comisión", "saldo");
+    error |= pwrite(fd_extracto, linea, LARGO_EXTRACTO, 0) != LARGO_EXTRACTO;
+
+    linea_extracto(linea, n, r->total_antes, r->intereses - r->descubiertos,
+                   r->comisiones, r->total_despues);
+    memcpy(linea, "     total", 10);
+    error |= pwrite(fd_extracto, linea, LARGO_EXTRACTO,
+                    (off_t)(n + 1) * LARGO_EXTRACTO) != LARGO_EXTRACTO;
+    return error ? -1 : 0;
+}
@@ -0,0 +1,269 @@
+/* liquidar.c — Cierre del día: intereses, comisiones y extractos
+ *   ● Con el banco parado, carga cuentas.dat, reaplica el diario y guarda
+ *     un punto de control, como hace banco al arrancar.  Liquida después
+ *     toda la tabla en paralelo (liquidacion.c) y la guarda de una vez:
+ *     un volcado a cuentas.dat.tmp, rename y diario vacío, en lugar de un
+ *     apunte por cuenta en el buffer de E/S.
+ *   ● El extracto va a DIRECTORIO_EXTRACTOS/<fecha>.txt: una línea por
+ *     cuenta con el saldo anterior, los intereses, la comisión y el saldo
+ *     nuevo, y una de totales.  Se escribe como <fecha>.txt.parcial y sólo
+ *     se renombra cuando cuentas.dat ya tiene los saldos nuevos.
+ *   ● Los intereses y comisiones van también al historial de cada cuenta
+ *     (DIRECTORIO_HISTORIAL), leídos del extracto una vez guardados los
+ *     saldos y antes de renombrarlo.
+ *   ● Una fecha ya liquidada no se repite.  Si quedó un .parcial (caída a
+ *     medias), se mira si cuentas.dat ya tiene sus saldos finales: si es
+ *     así se da por hecho, se anota en el historial y se renombra; si no,
+ *     se descarta y se liquida.
+ *   ● No corre a la vez que banco: los dos toman cuentas.dat en exclusiva
+ *     (reservar_cuentas).
+ *   ● Con particion=i trabaja sobre cuentas.dat.i y los ficheros de la
+ *     partición, resolviendo antes las ramas de transferencias pendientes.
+ *
+ *  Ejecutar:  ./liquidar [fecha=AAAA-MM-DD] [dias=1] [hilos=N] [particion=i]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+static double ahora(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void imprimir_centimos(const char *etiqueta, int64_t c)
+{
+    printf("%-26s %s%lld.%02lld €\n", etiqueta, c < 0 ? "-" : "",
+           llabs(c) / 100, llabs(c) % 100);
+}
+
+/* fsync del directorio que contiene `ruta`, para que un rename persista. */
+static void sincronizar_directorio(const char *ruta)
+{
+    char copia[256];
+    snprintf(copia, sizeof copia, "%s", ruta);
+    int fd = open(dirname(copia), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return;
+    fsync(fd);
+    close(fd);
+}
+
+/* "[-]E.CC" a céntimos. */
+static int leer_importe(const char *s, int64_t *c)
+{
+    long long e;
+    unsigned cts;
+    int neg = *s == '-';
+    if (sscanf(s + neg, "%lld.%2u", &e, &cts) != 2) return 0;
+    *c = (neg ? -1 : 1) * (e * 100 + cts);
+    return 1;
+}
+
+/* ¿Tiene ya la tabla los saldos finales del extracto parcial? */
+static int parcial_aplicado(const char *ruta, TablaCuentas *t)
+{
+    FILE *f = fopen(ruta, "r");
+    if (!f) return 0;
+    char linea[LARGO_EXTRACTO + 8], final[32];
+    int64_t *saldos = saldos_tabla(t);
+    int numero, vistas = 0, iguales = 1;
+
+    if (!fgets(linea, sizeof linea, f)) iguales = 0;          /* cabecera */
+    while (iguales && fgets(linea, sizeof linea, f)) {
+        if (sscanf(linea, "%d %*s %*s %*s %31s", &numero, final) != 2) break;   /* totales */
+        int64_t despues;
+        int idx = buscar_cuenta(t, numero);
+        if (!leer_importe(final, &despues) || idx == -1 || saldos[idx] != despues)
+            iguales = 0;
+        ++vistas;
+    }
+    fclose(f);
+    return iguales && vistas == t->num_cuentas;
+}
+
+/* Apunta en el historial los intereses y comisiones del extracto `ruta`.
+ * Una caída entre esto y el rename del extracto los repetiría al volver
+ * a lanzar liquidar: mejor de más y a la vista que perdidos.            */
+#define LOTE_APUNTES 4096
+
+static int anotar_extracto(const char *ruta, const Config *cfg)
+{
+    FILE *f = fopen(ruta, "r");
+    if (!f) { perror(ruta); return -1; }
+    Historial h;
+    if (historial_abrir(&h, cfg, 1) == -1) { fclose(f); return -1; }
+
+    RegistroHistorial lote[LOTE_APUNTES];
+    char linea[LARGO_EXTRACTO + 8], s_int[32], s_com[32];
+    int64_t ts = historial_ahora();
+    int n = 0, numero, error = 0;
+    long apuntes = 0;
+
+    if (!fgets(linea, sizeof linea, f)) error = -1;           /* cabecera */
+    while (!error && fgets(linea, sizeof linea, f)) {
+        int64_t interes, comision;
+        if (sscanf(linea, "%d %*s %31s %31s", &numero, s_int, s_com) != 3) break;   /* totales */
+        if (!leer_importe(s_int, &interes) || !leer_importe(s_com, &comision)) { error = -1; break; }
+        if (interes != 0)
+            lote[n++] = (RegistroHistorial){ .ts = ts, .cuenta = numero, .otra = -1,
+                                             .centimos = interes, .tipo = OP_INTERES };
+        if (comision != 0)
+            lote[n++] = (RegistroHistorial){ .ts = ts, .cuenta = numero, .otra = -1,
+                                             .centimos = -comision, .tipo = OP_COMISION };
+        if (n >= LOTE_APUNTES - 1) {
+            error = historial_escribir(&h, lote, n);
+            apuntes += n;
+            n = 0;
+        }
+    }
+    if (!error && n > 0) error = historial_escribir(&h, lote, n);
+    apuntes += n;
+    fclose(f);
+    historial_cerrar(&h);
+    if (error) fprintf(stderr, "%s: historial incompleto\n", cfg->directorio_historial);
+    else       printf("%ld apuntes de liquidación en %s\n", apuntes, cfg->directorio_historial);
+    return error;
+}
+
+/* Punto de control de toda la tabla (volcar_cuentas: .tmp y rename). */
+static void guardar_tabla(TablaCuentas *t)
+{
+    if (volcar_cuentas(t->archivo_cuentas, t) == -1) exit(EXIT_FAILURE);
+}
+
+/*─────────────────────────────────────────────*/
+/*                   MAIN                      */
+/*─────────────────────────────────────────────*/
+
+int main(int argc, char *argv[])
+{
+    Config cfg = leer_config("config.txt");
+    char fecha[16] = "";
+    int dias = 1, hilos = 0, particion = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        if      (sscanf(argv[i], "fecha=%10s", fecha) == 1) ;
+        else if (sscanf(argv[i], "dias=%d", &dias) == 1) ;
+        else if (sscanf(argv[i], "hilos=%d", &hilos) == 1) ;
+        else if (sscanf(argv[i], "particion=%d", &particion) == 1) ;
+        else {
+            fprintf(stderr, "Uso: %s [fecha=AAAA-MM-DD] [dias=1] [hilos=N] [particion=i]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!fecha[0]) {
+        time_t hoy = time(NULL);
+        struct tm tm;
+        localtime_r(&hoy, &tm);
+        strftime(fecha, sizeof fecha, "%Y-%m-%d", &tm);
+    }
+    if (particion >= cfg.particiones || (particion < 0 && cfg.particiones > 1)) {
+        fprintf(stderr, "Con PARTICIONES=%d: %s particion=<0..%d>\n",
+                cfg.particiones, argv[0], cfg.particiones - 1);
+        return 1;
+    }
+    if (particion >= 0) config_particion(&cfg, particion);
+    cfg.modo_cuentas = MODO_SHM;
+    if (reservar_cuentas(cfg.archivo_cuentas) == -1) {
+        fprintf(stderr, "%s está en uso: cierra banco antes de liquidar\n", cfg.archivo_cuentas);
+        return 1;
+    }
+
+    char ruta[128], parcial[136];
+    mkdir(cfg.directorio_extractos, 0755);
+    snprintf(ruta, sizeof ruta, "%s/%s.txt", cfg.directorio_extractos, fecha);
+    snprintf(parcial, sizeof parcial, "%s.parcial", ruta);
+    if (access(ruta, F_OK) == 0) {
+        fprintf(stderr, "%s: el día %s ya está liquidado\n", ruta, fecha);
+        return 1;
+    }
+
+    /* 1. Carga, diario y ramas pendientes, y punto de control limpio */
+    double t0 = ahora();
+    int capacidad = contar_cuentas(cfg.archivo_cuentas);
+    if (capacidad < 1) capacidad = 1;
+    int shm_id = particion >= 0 ? crear_shm_particion(particion, capacidad, &cfg)
+                                : crear_shm(capacidad, &cfg);
+    TablaCuentas *tabla = adjuntar_shm(shm_id);
+    inicializar_tabla(tabla, capacidad, &cfg);
+    cargar_cuentas(cfg.archivo_cuentas, tabla);
+
+    int recuperados = wal_recuperar(tabla);
+    int ramas = particion >= 0 ? dosfases_resolver(tabla, &cfg, particion) : 0;
+    if (recuperados > 0 || ramas > 0) {
+        printf("Recuperadas %d operaciones del diario %s y %d ramas de %s\n",
+               recuperados, cfg.archivo_wal, ramas, cfg.archivo_2pc);
+        guardar_tabla(tabla);
+    }
+    if (particion >= 0) dosfases_cerrar_resueltas(&cfg);
+    wal_truncar(&tabla->wal);
+    double t1 = ahora();
+
+    /* 2. Restos de una liquidación interrumpida */
+    int estado = 0;
+    if (access(parcial, F_OK) == 0) {
+        if (parcial_aplicado(parcial, tabla)) {
+            anotar_extracto(parcial, &cfg);
+            if (rename(parcial, ruta) == -1) { perror(ruta); estado = 1; }
+            else {
+                sincronizar_directorio(ruta);
+                printf("%s: la liquidación anterior ya estaba en %s; extracto completado\n",
+                       fecha, cfg.archivo_cuentas);
+            }
+            goto fin;
+        }
+        printf("Descartado %s de una liquidación sin terminar\n", parcial);
+        unlink(parcial);
+    }
+
+    /* 3. Liquidación y extracto */
+    int fd = open(parcial, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { perror(parcial); estado = 1; goto fin; }
+    ResumenLiquidacion r;
+    int error = liquidar_tabla(tabla, &cfg, dias, hilos, fd, &r);
+    if (error == 0) error = fdatasync(fd);
+    close(fd);
+    if (error) {
+        fprintf(stderr, "%s: no se pudo escribir el extracto; cuentas.dat sin tocar\n", parcial);
+        unlink(parcial);
+        estado = 1;
+        goto fin;
+    }
+    double t2 = ahora();
+
+    /* 4. Un único punto de control, el historial y el extracto definitivo */
+    guardar_tabla(tabla);
+    anotar_extracto(parcial, &cfg);
+    if (rename(parcial, ruta) == -1) { perror(ruta); estado = 1; goto fin; }
+    sincronizar_directorio(ruta);
+    double t3 = ahora();
+
+    printf("Liquidado %s (%d %s) sobre %s: %ld cuentas, %ld con movimiento, "
+           "%ld bloqueadas, %ld exentas de comisión\n",
+           fecha, dias, dias == 1 ? "día" : "días", cfg.archivo_cuentas,
+           r.cuentas, r.con_movimiento, r.bloqueadas, r.exentas);
+    imprimir_centimos("Saldo total anterior", r.total_antes);
+    imprimir_centimos("Intereses abonados", r.intereses);
+    imprimir_centimos("Intereses de descubierto", -r.descubiertos);
+    imprimir_centimos("Comisiones", -r.comisiones);
+    imprimir_centimos("Saldo total nuevo", r.total_despues);
+    printf("Extracto en %s\n", ruta);
+    printf("Carga %.3f s, liquidación %.3f s (%.0f cuentas/s), punto de control %.3f s\n",
+           t1 - t0, t2 - t1, r.cuentas / (t2 - t1 > 0 ? t2 - t1 : 1e-9), t3 - t2);
+
+fin:
+    destruir_tabla(tabla);
+    liberar_shm(tabla, shm_id);
+    return estado;
+}
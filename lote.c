@@ -0,0 +1,127 @@
+/* lote.c — Lotes de apuntes (nóminas, repartos) sobre el banco en marcha
+ *   ● Lee de un fichero una línea por apunte: "cuenta importe", con el
+ *     importe en euros, negativo para cargos y positivo para abonos.
+ *     Líneas vacías y las que empiezan por '#' se ignoran.
+ *   ● Aplica todos los apuntes con op_lote(): todo o nada, una escritura
+ *     por cuenta tocada y LIMITE_TRANSFERENCIA comprobado para cada cargo
+ *     y cada abono antes de empezar.  Los apuntes deben sumar cero: un
+ *     lote reparte dinero entre cuentas, no lo crea ni lo retira.
+ *   ● Deja un apunte por cuenta en su historial (el neto del lote) y manda
+ *     un único evento OP_LOTE al monitor.
+ *
+ *  Ejecutar:  ./lote <shm_id> <fichero>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+/* Devuelve el nº de apuntes leídos, o -1 si una línea no se entiende. */
+static int leer_apuntes(const char *ruta, Apunte *apuntes)
+{
+    FILE *f = fopen(ruta, "r");
+    if (!f) { perror(ruta); return -1; }
+
+    char linea[256];
+    int n = 0, num_linea = 0;
+    while (fgets(linea, sizeof linea, f)) {
+        ++num_linea;
+        char *p = linea + strspn(linea, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+
+        int cuenta; double euros;
+        if (sscanf(p, "%d %lf", &cuenta, &euros) != 2) {
+            fprintf(stderr, "%s:%d: se esperaba \"cuenta importe\"\n", ruta, num_linea);
+            fclose(f);
+            return -1;
+        }
+        if (n == MAX_APUNTES) {
+            fprintf(stderr, "%s: más de %d apuntes\n", ruta, MAX_APUNTES);
+            fclose(f);
+            return -1;
+        }
+        apuntes[n].cuenta   = cuenta;
+        apuntes[n].centimos = a_centimos(euros);
+        ++n;
+    }
+    fclose(f);
+    return n;
+}
+
+/* Un apunte de historial por cuenta con el neto de sus apuntes. */
+static void registrar(const Apunte *apuntes, int n)
+{
+    char *hecho = calloc(n, 1);
+    for (int i = 0; i < n; ++i) {
+        if (hecho[i]) continue;
+        int64_t neto = 0;
+        int veces = 0;
+        for (int j = i; j < n; ++j)
+            if (apuntes[j].cuenta == apuntes[i].cuenta) {
+                neto += apuntes[j].centimos;
+                hecho[j] = 1;
+                ++veces;
+            }
+        anotar_historial(apuntes[i].cuenta, OP_LOTE, veces, neto);
+    }
+    free(hecho);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) { fprintf(stderr, "Uso: %s <shm_id> <fichero>\n", argv[0]); return EXIT_FAILURE; }
+
+    Config cfg = leer_config("config.txt");
+    registro_backend(cfg.backend_es);
+    registro_historial(&cfg);
+    registro_iniciar();
+
+    static Apunte apuntes[MAX_APUNTES];
+    int n = leer_apuntes(argv[2], apuntes);
+    if (n <= 0) {
+        if (n == 0) fprintf(stderr, "%s: sin apuntes\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    TablaCuentas *tabla = adjuntar_shm(atoi(argv[1]));
+    metricas_registrar(tabla, "lote");
+
+    int fallo;
+    ResultadoOp r = op_lote(tabla, apuntes, n,
+                            (int64_t)cfg.limite_transferencia * 100, &fallo);
+    if (r != OP_OK) {
+        const char *motivo = r == OP_SALDO_INSUFICIENTE ? "saldo insuficiente"
+                           : r == OP_CUENTA_NO_EXISTE   ? "la cuenta no existe"
+                           : r == OP_DESCUADRE          ? "los apuntes no suman cero"
+                           : r == OP_CERRANDO           ? "el banco está cerrando"
+                           : fallo >= 0                 ? "supera LIMITE_TRANSFERENCIA"
+                                                        : "lote demasiado grande";
+        if (fallo >= 0)
+            printf("Lote rechazado: apunte %d (cuenta %d): %s.  No se aplicó nada.\n",
+                   fallo + 1, apuntes[fallo].cuenta, motivo);
+        else
+            printf("Lote rechazado: %s.  No se aplicó nada.\n", motivo);
+        liberar_shm(tabla, -1);
+        return EXIT_FAILURE;
+    }
+
+    /* Resumen para el monitor: el mayor cargo y el total cargado. */
+    int64_t cargos = 0, abonos = 0, mayor = 0;
+    int pagador = apuntes[0].cuenta;
+    for (int i = 0; i < n; ++i) {
+        if (apuntes[i].centimos < 0) cargos -= apuntes[i].centimos;
+        else                         abonos += apuntes[i].centimos;
+        if (-apuntes[i].centimos > mayor) { mayor = -apuntes[i].centimos; pagador = apuntes[i].cuenta; }
+    }
+    registrar(apuntes, n);
+    evento_publicar(tabla, OP_LOTE, pagador, n, cargos, 0);
+
+    printf("Lote aplicado: %d apuntes, cargos %lld.%02lld €, abonos %lld.%02lld €\n",
+           n, (long long)(cargos / 100), (long long)(cargos % 100),
+           (long long)(abonos / 100), (long long)(abonos % 100));
+    liberar_shm(tabla, -1);
+    return EXIT_SUCCESS;
+}
@@ -1,63 +1,798 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
 
-#define BUF_CAP 64
+#include "utils.h"
 
-typedef struct {
-    int   numero_cuenta;
-    char  titular[50];
-    float saldo;
-    int   bloqueado;
-} Cuenta;
+/* Proyección de cuentas.dat en banco (sólo MODO_MMAP): de ella se cargan
+ * las columnas y en ella se guarda el punto de control.                 */
+static Cuenta *cuentas_mapeadas = NULL;
+static size_t  tam_mapeo = 0;
 
-typedef enum { P_BAJA = 0, P_MEDIA = 1, P_ALTA = 2 } Prioridad;
+/*─────────────────────────────────────────────*/
+/*         DISPOSICIÓN DEL SEGMENTO            */
+/*─────────────────────────────────────────────*/
 
-typedef struct {
-    Prioridad prio;
-    Cuenta    snapshot;
-} Operacion;
+static size_t potencia2(size_t n) {
+    size_t p = 2;
+    while (p < n) p <<= 1;
+    return p;
+}
 
-typedef struct {
-    Operacion ops[BUF_CAP];
-    int       n;
-} BufferPrioridad;
+static size_t alinear64(size_t d) {
+    return (d + 63) & ~(size_t)63;
+}
 
+/* Disposición del segmento: cabecera | colas | diario | eventos |
+ * métricas | índice | versiones | números | saldos | estados | titulares |
+ * fotos | épocas.
+ * Lo que no depende del número de cuentas va delante, así crecer_tabla()
+ * sólo mueve lo que sigue al índice.  El índice se dimensiona a la
+ * potencia de 2 ≥ 2·capacidad para mantener el factor de carga por debajo
+ * de 0,5; colas, diario y eventos, a la potencia de 2 ≥ la capacidad
+ * configurada.  Cada columna empieza alineada a 64 bytes para que la
+ * auditoría la recorra con cargas vectoriales.                            */
 typedef struct {
-    Cuenta cuentas[100];
-    int num_cuentas;
-    pthread_mutex_t mutex;
-    BufferPrioridad buffer;
-} TablaCuentas;
+    int    num_cubetas;
+    size_t cap_buffer, cap_wal, cap_eventos;
+    size_t desp_colas, desp_wal, desp_eventos, desp_metricas, desp_indice;
+    size_t desp_versiones, desp_numeros, desp_saldos, desp_estados, desp_titulares;
+    size_t desp_fotos, desp_epocas, tam;
+} Disposicion;
+
+/* Índice y columnas de `capacidad` cuentas a partir de d->desp_indice. */
+static void disponer_columnas(Disposicion *d, int capacidad) {
+    d->num_cubetas    = (int)potencia2((size_t)2 * capacidad);
+    d->desp_versiones = alinear64(d->desp_indice + (size_t)d->num_cubetas * sizeof(int));
+    d->desp_numeros   = alinear64(d->desp_versiones + (size_t)capacidad * sizeof(atomic_uint));
+    d->desp_saldos    = alinear64(d->desp_numeros + (size_t)capacidad * sizeof(int32_t));
+    d->desp_estados   = alinear64(d->desp_saldos + (size_t)capacidad * sizeof(int64_t));
+    d->desp_titulares = alinear64(d->desp_estados + (size_t)capacidad * sizeof(uint8_t));
+    d->desp_fotos     = alinear64(d->desp_titulares + (size_t)capacidad * sizeof(Titular));
+    d->desp_epocas    = alinear64(d->desp_fotos + (size_t)capacidad * sizeof(int64_t));
+    d->tam            = d->desp_epocas + (size_t)capacidad * sizeof(atomic_uint);
+}
+
+static Disposicion disposicion(int capacidad, const Config *cfg) {
+    Disposicion d;
+    d.cap_buffer   = potencia2(cfg->capacidad_buffer);
+    d.cap_wal      = potencia2(cfg->capacidad_wal);
+    d.cap_eventos  = potencia2(cfg->capacidad_eventos);
+
+    d.desp_colas   = alinear64(sizeof(TablaCuentas));
+    d.desp_wal     = alinear64(d.desp_colas + 3 * d.cap_buffer * sizeof(CeldaCola));
+    d.desp_eventos = alinear64(d.desp_wal + d.cap_wal * sizeof(CeldaWAL));
+    d.desp_metricas = alinear64(d.desp_eventos + d.cap_eventos * sizeof(CeldaEvento));
+    d.desp_indice  = alinear64(d.desp_metricas + MAX_RANURAS * sizeof(RanuraMetricas));
+    disponer_columnas(&d, capacidad);
+    return d;
+}
+
+/* Bytes que ocupa una tabla con `capacidad` cuentas y la configuración dada. */
+size_t tam_tabla(int capacidad, const Config *cfg) {
+    return disposicion(capacidad, cfg).tam;
+}
 
 /*─────────────────────────────────────────────*/
-/*           FUNCIONES DE GESTIÓN DE SHM        */
+/*        PÁGINAS, NUMA Y PRECARGA             */
 /*─────────────────────────────────────────────*/
 
-int crear_shm() {
-    int shm_id = shmget(IPC_PRIVATE, sizeof(TablaCuentas), IPC_CREAT | 0666);
-    if (shm_id == -1) {
-        perror("shmget");
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22           /* Linux 5.14 */
+#define MADV_POPULATE_WRITE 23
+#endif
+#define MPOL_BIND_SB        2            /* <numaif.h>, sin depender de libnuma */
+#define MPOL_INTERLEAVE_SB  3
+#define MAX_NODOS_NUMA      1024
+
+static size_t tam_pagina(PaginasSegmento p) {
+    return p == PAG_HUGETLB ? TAM_PAGINA_GRANDE : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static size_t redondear(size_t n, size_t pagina) {
+    return (n + pagina - 1) / pagina * pagina;
+}
+
+/* Nodos en línea según /sys ("0-3,6"), o sólo el 0 si no se puede leer. */
+static void nodos_en_linea(unsigned long *mascara) {
+    char txt[256] = "0";
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    if (f) { if (!fgets(txt, sizeof txt, f)) strcpy(txt, "0"); fclose(f); }
+
+    char *resto;
+    for (char *tramo = strtok_r(txt, ",\n", &resto); tramo; tramo = strtok_r(NULL, ",\n", &resto)) {
+        int a, b;
+        if (sscanf(tramo, "%d-%d", &a, &b) != 2 && sscanf(tramo, "%d", &a) == 1) b = a;
+        for (int i = a; i <= b && i >= 0 && i < MAX_NODOS_NUMA; ++i)
+            mascara[i / (8 * sizeof(long))] |= 1UL << (i % (8 * sizeof(long)));
+    }
+}
+
+/* Política NUMA del rango antes de tocar sus páginas.  En tmpfs y SysV la
+ * política es del objeto compartido: vale para lo que cualquier proceso
+ * toque después, también al crecer.                                      */
+static void aplicar_numa(void *dir, size_t tam, const Config *cfg) {
+    if (cfg->numa == NUMA_LOCAL) return;
+
+    unsigned long mascara[MAX_NODOS_NUMA / (8 * sizeof(long))] = { 0 };
+    int modo = MPOL_INTERLEAVE_SB;
+    if (cfg->numa == NUMA_NODO && cfg->nodo_numa >= 0 && cfg->nodo_numa < MAX_NODOS_NUMA) {
+        mascara[cfg->nodo_numa / (8 * sizeof(long))] |= 1UL << (cfg->nodo_numa % (8 * sizeof(long)));
+        modo = MPOL_BIND_SB;
+    } else {
+        nodos_en_linea(mascara);
+    }
+    if (syscall(SYS_mbind, dir, tam, modo, mascara, MAX_NODOS_NUMA + 1, 0) == -1)
+        perror("mbind");
+}
+
+/* Trae a memoria las páginas de [desde, hasta) y sus entradas de tabla de
+ * páginas en este proceso; si el núcleo no sabe (antes de 5.14), tocando
+ * una palabra por página.                                                */
+static void precargar_paginas(void *dir, size_t desde, size_t hasta, size_t pagina, int escribir) {
+    char *p = (char *)dir + desde / pagina * pagina;
+    size_t n = (char *)dir + hasta - p;
+    if (madvise(p, n, escribir ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0) return;
+    for (size_t i = 0; i < n; i += pagina) {
+        if (escribir) ((volatile char *)p)[i] = ((volatile char *)p)[i];
+        else          (void)((volatile char *)p)[i];
+    }
+}
+
+/* Cada proyección pide sus huge pages transparentes (madvise es por
+ * proyección, no del objeto).                                            */
+static void proyeccion_thp(TablaCuentas *t, size_t tam) {
+    if (t->paginas == PAG_THP && madvise(t, tam, MADV_HUGEPAGE) == -1)
+        perror("madvise MADV_HUGEPAGE");
+}
+
+/* Deja en la cabecera cómo es el segmento recién creado (antes de
+ * inicializar_tabla) y le aplica NUMA, THP y precarga.                   */
+static void preparar_segmento(TablaCuentas *t, size_t tam, size_t reserva,
+                              const char *nombre, const Config *cfg) {
+    aplicar_numa(t, reserva, cfg);
+    t->paginas     = cfg->paginas;
+    t->tam_reserva = reserva;
+    t->segmento    = nombre ? SEG_POSIX : SEG_SYSV;
+    t->precargar   = cfg->precargar;
+    snprintf(t->nombre_segmento, sizeof t->nombre_segmento, "%s", nombre ? nombre : "");
+    proyeccion_thp(t, reserva);
+    if (cfg->precargar) precargar_paginas(t, 0, tam, tam_pagina(t->paginas), 1);
+    t->tam_segmento = tam;
+}
+
+/*─────────────────────────────────────────────*/
+/*            SEGMENTO SYSV (shmget)           */
+/*─────────────────────────────────────────────*/
+
+static int crear_sysv(int clave, int capacidad, const Config *cfg) {
+    size_t pagina = tam_pagina(cfg->paginas);
+    size_t tam    = redondear(tam_tabla(capacidad, cfg), pagina);
+    int    flags  = IPC_CREAT | IPC_EXCL | 0666 | (cfg->paginas == PAG_HUGETLB ? SHM_HUGETLB : 0);
+
+    for (;;) {
+        int shm_id = shmget((key_t)clave, tam, flags);
+        if (shm_id != -1) {
+            TablaCuentas *t = shmat(shm_id, NULL, 0);
+            if (t == (void *)-1) break;
+            preparar_segmento(t, tam_tabla(capacidad, cfg), tam, NULL, cfg);
+            shmdt(t);
+            return shm_id;
+        }
+        if (errno != EEXIST) break;
+
+        struct shmid_ds ds;
+        int viejo = shmget((key_t)clave, 0, 0);
+        if (viejo == -1 || shmctl(viejo, IPC_STAT, &ds) == -1) break;
+        if (ds.shm_nattch > 0) {
+            fprintf(stderr, "shmget: la clave %#x está en uso por otro proceso\n", clave);
+            exit(EXIT_FAILURE);
+        }
+        shmctl(viejo, IPC_RMID, NULL);
+    }
+    perror(cfg->paginas == PAG_HUGETLB ? "shmget SHM_HUGETLB" : "shmget");
+    exit(EXIT_FAILURE);
+}
+
+/*─────────────────────────────────────────────*/
+/*        SEGMENTO POSIX (shm_open + mmap)     */
+/*─────────────────────────────────────────────*/
+
+/* Un segmento POSIX se identifica con un shm_id negativo, -n, para que
+ * argv y los demás programas sigan pasando un entero: /securebank.<n> en
+ * /dev/shm o, con huge pages reservadas, en DIRECTORIO_HUGETLB.  Los de
+ * crear_shm() llevan el bit 30 y el pid, los de crear_shm_clave() la
+ * clave.  Cada proceso proyecta tam_reserva bytes desde el principio: al
+ * crecer el objeto las páginas nuevas ya están en su proyección.  Quien
+ * lo tiene proyectado guarda un flock compartido: sin nadie, un objeto
+ * viejo se puede borrar (como shm_nattch en SysV).                       */
+#define MAX_PROYECCIONES 32
+#define BIT_PRIVADO      0x40000000
+
+static struct { void *dir; size_t tam; int fd; } proyecciones[MAX_PROYECCIONES];
+
+static void nombre_posix(char *nombre, size_t tam, int n, int hugetlb) {
+    snprintf(nombre, tam, "%s/securebank.%x", hugetlb ? DIRECTORIO_HUGETLB : "", (unsigned)n);
+}
+
+static int abrir_posix(const char *nombre, int hugetlb, int flags) {
+    return hugetlb ? open(nombre, flags, 0666) : shm_open(nombre, flags, 0666);
+}
+
+static void borrar_posix(const char *nombre, int hugetlb) {
+    if (hugetlb) unlink(nombre);
+    else         shm_unlink(nombre);
+}
+
+static int crear_posix(int n, int capacidad, const Config *cfg) {
+    int    hugetlb = cfg->paginas == PAG_HUGETLB;
+    size_t pagina  = tam_pagina(cfg->paginas);
+    size_t tam     = tam_tabla(capacidad, cfg);
+    size_t reserva = tam_tabla(cfg->reserva_cuentas > capacidad ? cfg->reserva_cuentas
+                                                                : capacidad, cfg);
+    reserva = redondear(reserva, pagina);
+
+    char nombre[64];
+    nombre_posix(nombre, sizeof nombre, n, hugetlb);
+    int fd;
+    while ((fd = abrir_posix(nombre, hugetlb, O_RDWR | O_CREAT | O_EXCL)) == -1) {
+        int viejo = errno == EEXIST ? abrir_posix(nombre, hugetlb, O_RDWR) : -1;
+        if (viejo == -1) { perror(nombre); exit(EXIT_FAILURE); }
+        int libre = flock(viejo, LOCK_EX | LOCK_NB) == 0;
+        close(viejo);
+        if (!libre) {
+            fprintf(stderr, "%s: el segmento está en uso por otro proceso\n", nombre);
+            exit(EXIT_FAILURE);
+        }
+        borrar_posix(nombre, hugetlb);
+    }
+
+    /* hugetlbfs reserva las páginas de toda la proyección al hacerla */
+    if (ftruncate(fd, (off_t)(hugetlb ? reserva : redondear(tam, pagina))) == -1) {
+        perror(nombre); borrar_posix(nombre, hugetlb); exit(EXIT_FAILURE);
+    }
+    TablaCuentas *t = mmap(NULL, reserva, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (t == MAP_FAILED) { perror("mmap segmento"); borrar_posix(nombre, hugetlb); exit(EXIT_FAILURE); }
+    preparar_segmento(t, tam, reserva, nombre, cfg);
+    munmap(t, reserva);
+    close(fd);
+    return -n;
+}
+
+static TablaCuentas *adjuntar_posix(int n) {
+    char nombre[64];
+    nombre_posix(nombre, sizeof nombre, n, 0);
+    int  fd = abrir_posix(nombre, 0, O_RDWR);
+    if (fd == -1) {
+        nombre_posix(nombre, sizeof nombre, n, 1);
+        fd = abrir_posix(nombre, 1, O_RDWR);
+    }
+    if (fd == -1) { perror(nombre); exit(EXIT_FAILURE); }
+
+    TablaCuentas *cab = mmap(NULL, sizeof *cab, PROT_READ, MAP_SHARED, fd, 0);
+    if (cab == MAP_FAILED) { perror("mmap segmento"); exit(EXIT_FAILURE); }
+    size_t reserva = cab->tam_reserva;
+    munmap(cab, sizeof *cab);
+
+    TablaCuentas *t = mmap(NULL, reserva, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (t == MAP_FAILED) { perror("mmap segmento"); exit(EXIT_FAILURE); }
+    flock(fd, LOCK_SH);
+
+    int i = 0;
+    while (i < MAX_PROYECCIONES && proyecciones[i].dir) ++i;
+    if (i == MAX_PROYECCIONES) {
+        fprintf(stderr, "%s: demasiados segmentos proyectados\n", nombre);
         exit(EXIT_FAILURE);
     }
-    return shm_id;
+    proyecciones[i].dir = t;
+    proyecciones[i].tam = reserva;
+    proyecciones[i].fd  = fd;
+    return t;
+}
+
+/* Deshace la proyección de adjuntar_posix(); 0 si ptr no era una. */
+static int soltar_posix(void *ptr) {
+    for (int i = 0; i < MAX_PROYECCIONES; ++i)
+        if (proyecciones[i].dir == ptr) {
+            munmap(ptr, proyecciones[i].tam);
+            close(proyecciones[i].fd);
+            proyecciones[i].dir = NULL;
+            return 1;
+        }
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*           FUNCIONES DE GESTIÓN DE SHM        */
+/*─────────────────────────────────────────────*/
+
+int crear_shm(int capacidad, const Config *cfg) {
+    return crear_shm_clave(IPC_PRIVATE, capacidad, cfg);
+}
+
+/* Como crear_shm() pero con una clave conocida, para que otros procesos
+ * encuentren el segmento sin que se les pase el shm_id (particiones).  Un
+ * segmento viejo con esa clave y nadie adjunto (banco que murió sin
+ * liberarlo) se borra; si alguien lo usa, la clave está ocupada.         */
+int crear_shm_clave(int clave, int capacidad, const Config *cfg) {
+    if (cfg->segmento == SEG_SYSV) return crear_sysv(clave, capacidad, cfg);
+
+    static int creados;
+    int n = clave != IPC_PRIVATE ? clave
+          : BIT_PRIVADO | (getpid() & 0x3fffff) << 6 | (creados++ & 63);
+    return crear_posix(n, capacidad, cfg);
+}
+
+/* shm_id del segmento creado con crear_shm_clave(clave), o -1 si no hay. */
+int buscar_shm_clave(int clave, const Config *cfg) {
+    if (cfg->segmento == SEG_SYSV) return shmget((key_t)clave, 0, 0);
+
+    char nombre[64];
+    int  hugetlb = cfg->paginas == PAG_HUGETLB;
+    nombre_posix(nombre, sizeof nombre, clave, hugetlb);
+    int fd = abrir_posix(nombre, hugetlb, O_RDWR);
+    if (fd == -1) return -1;
+    close(fd);
+    return -clave;
 }
 
 TablaCuentas* adjuntar_shm(int shm_id) {
-    TablaCuentas *tabla = shmat(shm_id, NULL, 0);
-    if (tabla == (void*)-1) {
-        perror("shmat");
-        exit(EXIT_FAILURE);
+    TablaCuentas *tabla;
+    if (shm_id < -1) {
+        tabla = adjuntar_posix(-shm_id);
+    } else {
+        tabla = shmat(shm_id, NULL, 0);
+        if (tabla == (void*)-1) {
+            perror("shmat");
+            exit(EXIT_FAILURE);
+        }
     }
+    proyeccion_thp(tabla, tabla->tam_reserva);
+    if (tabla->precargar)
+        precargar_paginas(tabla, 0, tabla->tam_segmento, tam_pagina(tabla->paginas), 0);
     return tabla;
 }
 
+/* Amplía la tabla a `capacidad` cuentas dentro de su reserva: extiende el
+ * objeto POSIX, mueve las columnas de la última a la primera (cada una a
+ * un desplazamiento mayor), inicia lo nuevo y rehace el índice.  Sólo con
+ * la tabla quieta, mientras se carga; los demás procesos ya tienen toda
+ * la reserva proyectada.  Devuelve 0, o -1 si no cabe o el segmento no
+ * puede crecer (SysV o MODO_MMAP).                                       */
+int crecer_tabla(TablaCuentas *t, int capacidad) {
+    if (t->segmento != SEG_POSIX || t->modo == MODO_MMAP || capacidad <= t->capacidad)
+        return -1;
+    Disposicion d = { .desp_indice = t->desp_indice };
+    disponer_columnas(&d, capacidad);
+    if (d.tam > t->tam_reserva) return -1;
+
+    size_t pagina = tam_pagina(t->paginas);
+    if (t->paginas != PAG_HUGETLB) {
+        int fd = shm_open(t->nombre_segmento, O_RDWR, 0);
+        if (fd == -1 || ftruncate(fd, (off_t)redondear(d.tam, pagina)) == -1) {
+            perror(t->nombre_segmento);
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    if (t->precargar) precargar_paginas(t, t->tam_segmento, d.tam, pagina, 1);
+
+    pthread_mutex_lock(&t->mutex);
+    char  *b   = (char *)t;
+    size_t cap = (size_t)t->capacidad;
+    const struct { size_t antes, ahora, tam; } col[] = {
+        { t->desp_versiones, d.desp_versiones, sizeof(atomic_uint) },
+        { t->desp_numeros,   d.desp_numeros,   sizeof(int32_t) },
+        { t->desp_saldos,    d.desp_saldos,    sizeof(int64_t) },
+        { t->desp_estados,   d.desp_estados,   sizeof(uint8_t) },
+        { t->desp_titulares, d.desp_titulares, sizeof(Titular) },
+        { t->desp_fotos,     d.desp_fotos,     sizeof(int64_t) },
+        { t->desp_epocas,    d.desp_epocas,    sizeof(atomic_uint) },
+    };
+    for (int k = (int)(sizeof col / sizeof col[0]) - 1; k >= 0; --k)
+        memmove(b + col[k].ahora, b + col[k].antes, cap * col[k].tam);
+
+    t->capacidad      = capacidad;
+    t->num_cubetas    = d.num_cubetas;
+    t->tam_segmento   = d.tam;
+    t->desp_versiones = d.desp_versiones;
+    t->desp_numeros   = d.desp_numeros;
+    t->desp_saldos    = d.desp_saldos;
+    t->desp_estados   = d.desp_estados;
+    t->desp_titulares = d.desp_titulares;
+    t->desp_fotos     = d.desp_fotos;
+    t->desp_epocas    = d.desp_epocas;
+
+    atomic_uint *ver = versiones_tabla(t);
+    atomic_uint *epo = epocas_tabla(t);
+    for (size_t i = cap; i < (size_t)capacidad; ++i) { atomic_init(&ver[i], 0); atomic_init(&epo[i], 0); }
+    int *ind = indice_tabla(t);
+    for (int i = 0; i < t->num_cubetas; ++i) ind[i] = CUBETA_VACIA;
+    for (int i = 0; i < t->num_cuentas; ++i) indexar_cuenta(t, i);
+    pthread_mutex_unlock(&t->mutex);
+    return 0;
+}
+
+/* La mayor capacidad que cabe en la reserva del segmento. */
+static int capacidad_reservada(TablaCuentas *t) {
+    int lo = t->capacidad, hi = INT_MAX / 2;
+    while (lo < hi) {
+        int medio = lo + (hi - lo + 1) / 2;
+        Disposicion d = { .desp_indice = t->desp_indice };
+        disponer_columnas(&d, medio);
+        if (d.tam <= t->tam_reserva) lo = medio;
+        else                         hi = medio - 1;
+    }
+    return lo;
+}
+
+/*─────────────────────────────────────────────*/
+/*          ÍNDICE HASH DE CUENTAS             */
+/*─────────────────────────────────────────────*/
+
+static unsigned hash_cuenta(int numero, int num_cubetas) {
+    return ((unsigned)numero * 2654435761u) & (unsigned)(num_cubetas - 1);
+}
+
+int *indice_tabla(TablaCuentas *t) {
+    return (int *)((char *)t + t->desp_indice);
+}
+
+int32_t *numeros_tabla(TablaCuentas *t) {
+    return (int32_t *)((char *)t + t->desp_numeros);
+}
+
+int64_t *saldos_tabla(TablaCuentas *t) {
+    return (int64_t *)((char *)t + t->desp_saldos);
+}
+
+uint8_t *estados_tabla(TablaCuentas *t) {
+    return (uint8_t *)((char *)t + t->desp_estados);
+}
+
+Titular *titulares_tabla(TablaCuentas *t) {
+    return (Titular *)((char *)t + t->desp_titulares);
+}
+
+int64_t *fotos_tabla(TablaCuentas *t) {
+    return (int64_t *)((char *)t + t->desp_fotos);
+}
+
+atomic_uint *epocas_tabla(TablaCuentas *t) {
+    return (atomic_uint *)((char *)t + t->desp_epocas);
+}
+
+/* Importe en euros tecleado o leído de un fichero, redondeado al céntimo. */
+int64_t a_centimos(double euros) {
+    return (int64_t)(euros * 100.0 + (euros < 0 ? -0.5 : 0.5));
+}
+
+/* Compone el registro de disco de la cuenta en la posición idx. */
+void leer_cuenta(TablaCuentas *t, int idx, Cuenta *c) {
+    c->numero_cuenta = numeros_tabla(t)[idx];
+    memcpy(c->titular, titulares_tabla(t)[idx].nombre, TAM_TITULAR);
+    c->formato   = FORMATO_CUENTA;
+    c->saldo     = saldos_tabla(t)[idx];
+    c->bloqueado = estados_tabla(t)[idx] & ESTADO_BLOQUEADA;
+}
+
+/* Reparte un registro de disco entre las columnas de la posición idx. */
+void escribir_cuenta(TablaCuentas *t, int idx, const Cuenta *c) {
+    numeros_tabla(t)[idx] = c->numero_cuenta;
+    memcpy(titulares_tabla(t)[idx].nombre, c->titular, TAM_TITULAR);
+    saldos_tabla(t)[idx]  = c->saldo;
+    estados_tabla(t)[idx] = c->bloqueado ? ESTADO_BLOQUEADA : 0;
+}
+
+/* Prepara la cabecera, el índice vacío, los cerrojos, las colas, el
+ * diario y el anillo de eventos.  En MODO_MMAP también proyecta cuentas.dat. */
+void inicializar_tabla(TablaCuentas *t, int capacidad, const Config *cfg) {
+    Disposicion d = disposicion(capacidad, cfg);
+
+    t->num_cuentas  = 0;
+    t->capacidad    = capacidad;
+    t->num_cubetas  = d.num_cubetas;
+    t->tam_segmento = d.tam;
+    t->desp_metricas = d.desp_metricas;
+    t->desp_indice  = d.desp_indice;
+    t->desp_versiones = d.desp_versiones;
+    t->desp_numeros = d.desp_numeros;
+    t->desp_saldos  = d.desp_saldos;
+    t->desp_estados = d.desp_estados;
+    t->desp_titulares = d.desp_titulares;
+    t->desp_fotos   = d.desp_fotos;
+    t->desp_epocas  = d.desp_epocas;
+    t->modo         = cfg->modo_cuentas;
+    snprintf(t->archivo_cuentas, sizeof t->archivo_cuentas, "%s", cfg->archivo_cuentas);
+    t->intervalo_volcado_ms = cfg->intervalo_volcado_ms;
+    t->politica_fsync       = cfg->politica_fsync;
+    t->backend_es           = cfg->backend_es;
+    atomic_init(&t->lotes_volcados, 0);
+    atomic_init(&t->cuentas_volcadas, 0);
+
+    int *ind = indice_tabla(t);
+    for (int i = 0; i < t->num_cubetas; ++i) ind[i] = CUBETA_VACIA;
+
+    atomic_uint *ver = versiones_tabla(t);
+    atomic_uint *epo = epocas_tabla(t);
+    for (int i = 0; i < capacidad; ++i) { atomic_init(&ver[i], 0); atomic_init(&epo[i], 0); }
+    atomic_init(&t->foto_activa, 0);
+    t->epoca_foto = 0;
+    atomic_init(&t->cerrando, 0);
+    atomic_init(&t->en_curso, 0);
+    metricas_inicializar(t);
+
+    inicializar_mutex_proceso_compartido(&t->mutex);
+    t->num_cerrojos = MAX_CERROJOS;
+    for (int i = 0; i < MAX_CERROJOS; ++i)
+        inicializar_mutex_proceso_compartido(&t->cerrojos[i].m);
+
+    buffer_inicializar(&t->buffer, d.cap_buffer,
+                       d.desp_colas - offsetof(TablaCuentas, buffer));
+    wal_inicializar(&t->wal, cfg, d.cap_wal, d.desp_wal - offsetof(TablaCuentas, wal));
+    t->canal_monitor = cfg->canal_monitor;
+    eventos_inicializar(&t->eventos, d.cap_eventos,
+                        d.desp_eventos - offsetof(TablaCuentas, eventos));
+
+    if (t->modo == MODO_MMAP) mapear_cuentas(t);
+}
+
+/* Devuelve la posición de la cuenta en las columnas o -1 si no existe. */
+int buscar_cuenta(TablaCuentas *t, int numero) {
+    int *ind = indice_tabla(t);
+    int32_t *num = numeros_tabla(t);
+    unsigned h = hash_cuenta(numero, t->num_cubetas);
+
+    while (ind[h] != CUBETA_VACIA) {
+        if (num[ind[h]] == numero)
+            return ind[h];
+        h = (h + 1) & (unsigned)(t->num_cubetas - 1);
+    }
+    return -1;
+}
+
+/* Indexa la cuenta que ya ocupa la posición idx.  Devuelve 0, o -1 si su
+ * número ya estaba en el índice.                                         */
+int indexar_cuenta(TablaCuentas *t, int idx) {
+    int *ind = indice_tabla(t);
+    int32_t *num = numeros_tabla(t);
+    unsigned h = hash_cuenta(num[idx], t->num_cubetas);
+
+    while (ind[h] != CUBETA_VACIA) {
+        if (num[ind[h]] == num[idx])
+            return -1;
+        h = (h + 1) & (unsigned)(t->num_cubetas - 1);
+    }
+    ind[h] = idx;
+    return 0;
+}
+
+/* Añade la cuenta al final de la tabla y la indexa.  Una tabla llena que
+ * puede crecer dobla su capacidad (hasta la reserva).  Devuelve su
+ * posición, o -1 si la tabla está llena o el número ya existe.          */
+int insertar_cuenta(TablaCuentas *t, const Cuenta *c) {
+    if (t->num_cuentas >= t->capacidad) {
+        int nueva = t->tam_reserva > t->tam_segmento ? capacidad_reservada(t) : 0;
+        if (nueva > 2 * t->capacidad) nueva = 2 * t->capacidad;
+        if (crecer_tabla(t, nueva) == -1) return -1;
+    }
+    if (buscar_cuenta(t, c->numero_cuenta) != -1) return -1;
+
+    int idx = t->num_cuentas++;
+    escribir_cuenta(t, idx, c);
+    indexar_cuenta(t, idx);
+    return idx;
+}
+
+/*─────────────────────────────────────────────*/
+/*          CERROJOS POR FRANJA DE CUENTAS     */
+/*─────────────────────────────────────────────*/
+
+static int franja(const TablaCuentas *t, int idx) {
+    return idx % t->num_cerrojos;
+}
+
+/* Toma una franja; sólo mide el tiempo si de verdad hay que esperar. */
+static void tomar(pthread_mutex_t *m) {
+    if (pthread_mutex_trylock(m) != 0) {
+        uint64_t t0 = reloj_ns();
+        pthread_mutex_lock(m);
+        metrica_observar(H_ESPERA_CERROJO, reloj_ns() - t0);
+        metrica_sumar(M_CERROJOS_OCUPADOS, 1);
+    }
+    metrica_sumar(M_CERROJOS, 1);
+}
+
+void bloquear_cuenta(TablaCuentas *t, int idx) {
+    tomar(&t->cerrojos[franja(t, idx)].m);
+}
+
+void desbloquear_cuenta(TablaCuentas *t, int idx) {
+    pthread_mutex_unlock(&t->cerrojos[franja(t, idx)].m);
+}
+
+/* Toma las franjas de dos cuentas siempre en orden creciente, de modo que
+ * dos transferencias cruzadas (A→B y B→A) no puedan interbloquearse.     */
+void bloquear_par(TablaCuentas *t, int idx_a, int idx_b) {
+    int fa = franja(t, idx_a), fb = franja(t, idx_b);
+    if (fa == fb) { tomar(&t->cerrojos[fa].m); return; }
+    if (fa > fb) { int x = fa; fa = fb; fb = x; }
+    tomar(&t->cerrojos[fa].m);
+    tomar(&t->cerrojos[fb].m);
+}
+
+void desbloquear_par(TablaCuentas *t, int idx_a, int idx_b) {
+    int fa = franja(t, idx_a), fb = franja(t, idx_b);
+    pthread_mutex_unlock(&t->cerrojos[fa].m);
+    if (fa != fb) pthread_mutex_unlock(&t->cerrojos[fb].m);
+}
+
+static int cmp_franja(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Las franjas de n cuentas, sin repetir y en orden creciente como en
+ * bloquear_par.  Deja en `franjas` (hueco para n) las tomadas y devuelve
+ * cuántas son, para desbloquear_varias().                                */
+int bloquear_varias(TablaCuentas *t, const int *idx, int n, int *franjas) {
+    for (int i = 0; i < n; ++i) franjas[i] = franja(t, idx[i]);
+    qsort(franjas, n, sizeof(int), cmp_franja);
+
+    int nf = 0;
+    for (int i = 0; i < n; ++i)
+        if (nf == 0 || franjas[nf - 1] != franjas[i]) franjas[nf++] = franjas[i];
+    for (int i = 0; i < nf; ++i) tomar(&t->cerrojos[franjas[i]].m);
+    return nf;
+}
+
+void desbloquear_varias(TablaCuentas *t, const int *franjas, int nf) {
+    for (int i = nf - 1; i >= 0; --i) pthread_mutex_unlock(&t->cerrojos[franjas[i]].m);
+}
+
+/* Todas las franjas, en el mismo orden creciente que bloquear_par: deja
+ * la tabla quieta para una foto coherente (auditoría).                    */
+void bloquear_todo(TablaCuentas *t) {
+    for (int i = 0; i < t->num_cerrojos; ++i) pthread_mutex_lock(&t->cerrojos[i].m);
+}
+
+void desbloquear_todo(TablaCuentas *t) {
+    for (int i = t->num_cerrojos - 1; i >= 0; --i) pthread_mutex_unlock(&t->cerrojos[i].m);
+}
+
+/*─────────────────────────────────────────────*/
+/*        LECTURA DE SALDOS SIN CERROJO        */
+/*─────────────────────────────────────────────*/
+
+/* Seqlock por cuenta: quien escribe, con la franja ya bloqueada, deja la
+ * versión impar mientras modifica la cuenta y par al terminar.  El lector
+ * reintenta si la vio impar o si cambió mientras copiaba el saldo.       */
+atomic_uint *versiones_tabla(TablaCuentas *t) {
+    return (atomic_uint *)((char *)t + t->desp_versiones);
+}
+
+/* Copia al escribir: con una instantánea en curso, la primera escritura
+ * de la cuenta en la época guarda antes su saldo en fotos_tabla.  La
+ * época se publica antes de que cambie el saldo (la barrera de
+ * empezar_escritura), así que quien lea el saldo nuevo ve ya la copia.   */
+static void copiar_antes(TablaCuentas *t, int idx) {
+    atomic_uint *e = &epocas_tabla(t)[idx];
+    if (atomic_load_explicit(e, memory_order_relaxed) == t->epoca_foto) return;
+    fotos_tabla(t)[idx] = saldos_tabla(t)[idx];
+    atomic_store_explicit(e, t->epoca_foto, memory_order_release);
+}
+
+void empezar_escritura(TablaCuentas *t, int idx) {
+    if (atomic_load_explicit(&t->foto_activa, memory_order_relaxed)) copiar_antes(t, idx);
+    atomic_uint *v = &versiones_tabla(t)[idx];
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void terminar_escritura(TablaCuentas *t, int idx) {
+    atomic_uint *v = &versiones_tabla(t)[idx];
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+int64_t leer_saldo(TablaCuentas *t, int idx) {
+    atomic_uint *v = &versiones_tabla(t)[idx];
+    const volatile int64_t *saldo = &saldos_tabla(t)[idx];
+
+    for (;;) {
+        unsigned antes = atomic_load_explicit(v, memory_order_acquire);
+        if (antes & 1) { sched_yield(); continue; }
+        int64_t s = *saldo;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(v, memory_order_relaxed) == antes) return s;
+    }
+}
+
+static void destruir_cerrojos(TablaCuentas *t) {
+    for (int i = 0; i < MAX_CERROJOS; ++i)
+        pthread_mutex_destroy(&t->cerrojos[i].m);
+}
+
+/* Libera los objetos de sincronización que inicializar_tabla() creó.
+ * wal.volcado y eventos.hay_eventos los esperan otros procesos y no se
+ * destruyen: si uno salió a medio esperar (el monitor con SIGTERM),
+ * pthread_cond_destroy se quedaría esperando a que despierte.  El
+ * segmento se borra igual.                                               */
+void destruir_tabla(TablaCuentas *t) {
+    destruir_cerrojos(t);
+    destruir_mutex(&t->buffer.mutex_aviso);
+    pthread_cond_destroy(&t->buffer.hay_datos);
+    destruir_mutex(&t->wal.mutex);
+    destruir_mutex(&t->eventos.mutex_aviso);
+    destruir_mutex(&t->mutex);
+}
+
+/*─────────────────────────────────────────────*/
+/*     CUENTAS PROYECTADAS (MODO_MMAP)         */
+/*─────────────────────────────────────────────*/
+
+/* Proyecta t->archivo_cuentas con MAP_SHARED.  Las operaciones no
+ * escriben en ella: sus cuentas van por el hilo IO, que sólo las lleva al
+ * fichero con el diario confirmado, igual que en MODO_SHM.                */
+void mapear_cuentas(TablaCuentas *t) {
+    int fd = open(t->archivo_cuentas, O_RDWR);
+    if (fd == -1) { perror(t->archivo_cuentas); exit(EXIT_FAILURE); }
+
+    tam_mapeo = (size_t)t->capacidad * sizeof(Cuenta);
+    cuentas_mapeadas = mmap(NULL, tam_mapeo, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+    close(fd);
+    if (cuentas_mapeadas == MAP_FAILED) { perror("mmap cuentas"); exit(EXIT_FAILURE); }
+}
+
+/* En MODO_MMAP carga las columnas desde la proyección. */
+void cargar_proyeccion(TablaCuentas *t) {
+    for (int i = 0; i < t->capacidad; ++i)
+        escribir_cuenta(t, i, &cuentas_mapeadas[i]);
+}
+
+/* Punto de control en MODO_MMAP: copia las columnas (con lo recuperado
+ * del diario) a la proyección y la sincroniza.  Sin operaciones en curso. */
+int sincronizar_cuentas(TablaCuentas *t) {
+    if (t->modo != MODO_MMAP) return 0;
+    for (int i = 0; i < t->num_cuentas; ++i)
+        leer_cuenta(t, i, &cuentas_mapeadas[i]);
+    if (msync(cuentas_mapeadas, tam_mapeo, MS_SYNC) == -1) {
+        perror("msync cuentas");
+        return -1;
+    }
+    return 0;
+}
+
+/* Suelta el segmento en este proceso y, con su shm_id (no -1), lo borra:
+ * el objeto POSIX desaparece cuando lo suelte el último.                 */
 void liberar_shm(void *ptr, int shm_id) {
-    shmdt(ptr);
-    shmctl(shm_id, IPC_RMID, NULL);
+    metricas_soltar(ptr);
+    if (cuentas_mapeadas) {
+        munmap(cuentas_mapeadas, tam_mapeo);
+        cuentas_mapeadas = NULL;
+    }
+    TablaCuentas *t = ptr;
+    char nombre[sizeof t->nombre_segmento];
+    int  hugetlb = t->paginas == PAG_HUGETLB;
+    snprintf(nombre, sizeof nombre, "%s", t->nombre_segmento);
+
+    if (!soltar_posix(ptr)) shmdt(ptr);
+    if (shm_id < -1)      borrar_posix(nombre, hugetlb);
+    else if (shm_id >= 0) shmctl(shm_id, IPC_RMID, NULL);
 }
 
 /*─────────────────────────────────────────────*/
@@ -73,6 +808,30 @@ void inicializar_mutex_proceso_compartido(pthread_mutex_t *mutex)
     pthread_mutexattr_destroy(&attr);
 }
 
+/* Como el anterior, pero si muere el proceso que lo tiene el siguiente en
+ * tomarlo recibe EOWNERDEAD en lugar de quedarse esperando para siempre. */
+void inicializar_mutex_robusto(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* Condición compartida entre procesos; los plazos se miden con
+ * CLOCK_MONOTONIC para no depender de cambios de hora.              */
+void inicializar_cond_proceso_compartido(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
 void destruir_mutex(pthread_mutex_t *mutex) {
     pthread_mutex_destroy(mutex);
 }
@@ -0,0 +1,153 @@
+/* metricas.c — Contadores e histogramas de ejecución en la SHM
+ *
+ *  ▸ Cada proceso pide una ranura con metricas_registrar() y desde ese
+ *    momento metrica_sumar()/metrica_observar() escriben en ella con sumas
+ *    atómicas relajadas.  Las ranuras van en líneas de caché distintas:
+ *    dos procesos nunca se estorban al contar.
+ *  ▸ Sin ranura (procesos que no se registran, tablas sintéticas de bench)
+ *    las llamadas no hacen nada.
+ *  ▸ Si no queda ninguna libre se reutiliza la de un proceso terminado,
+ *    sumando antes sus valores a la ranura 0 para que los totales nunca
+ *    retrocedan.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "utils.h"
+
+static _Atomic(RanuraMetricas *) mi_ranura;
+
+static const char *nombres_metrica[NUM_METRICAS] = {
+    "depositos", "retiros", "transferencias", "saldos", "lotes",
+    "cerrojos", "cerrojos_ocupados", "cola_llena", "eventos_perdidos",
+    "fsyncs_wal", "volcados", "cuentas_volcadas", "fsyncs_volcado",
+    "bytes_log", "apuntes_perdidos",
+};
+
+static const char *nombres_hist[NUM_HISTOGRAMAS] = {
+    "espera_cerrojo_ns", "operacion_ns", "profundidad_cola",
+    "fsync_wal_ns", "volcado_ns",
+};
+
+const char *nombre_metrica(Metrica m)       { return nombres_metrica[m]; }
+const char *nombre_histograma(Histograma h) { return nombres_hist[h]; }
+
+RanuraMetricas *ranuras_tabla(TablaCuentas *t) {
+    return (RanuraMetricas *)((char *)t + t->desp_metricas);
+}
+
+static void vaciar_ranura(RanuraMetricas *r) {
+    for (int m = 0; m < NUM_METRICAS; ++m) atomic_init(&r->valor[m], 0);
+    for (int h = 0; h < NUM_HISTOGRAMAS; ++h)
+        for (int c = 0; c < CUBETAS_HIST; ++c) atomic_init(&r->hist[h][c], 0);
+}
+
+void metricas_inicializar(TablaCuentas *t) {
+    RanuraMetricas *rs = ranuras_tabla(t);
+    for (int i = 0; i < MAX_RANURAS; ++i) {
+        atomic_init(&rs[i].pid, 0);
+        rs[i].nombre[0] = '\0';
+        vaciar_ranura(&rs[i]);
+    }
+    snprintf(rs[0].nombre, sizeof rs[0].nombre, "terminados");
+}
+
+/* Pasa a la ranura 0 lo contado por un proceso que ya no existe. */
+static void jubilar(RanuraMetricas *rs, RanuraMetricas *r) {
+    for (int m = 0; m < NUM_METRICAS; ++m)
+        atomic_fetch_add_explicit(&rs[0].valor[m], atomic_load(&r->valor[m]), memory_order_relaxed);
+    for (int h = 0; h < NUM_HISTOGRAMAS; ++h)
+        for (int c = 0; c < CUBETAS_HIST; ++c)
+            atomic_fetch_add_explicit(&rs[0].hist[h][c], atomic_load(&r->hist[h][c]),
+                                      memory_order_relaxed);
+    vaciar_ranura(r);
+}
+
+/* Ranura propia para este proceso (la misma si ya tenía una).  Tras un
+ * fork() el hijo debe llamarla de nuevo para contar aparte.              */
+void metricas_registrar(TablaCuentas *t, const char *nombre) {
+    RanuraMetricas *rs = ranuras_tabla(t);
+    int yo = getpid();
+
+    for (int i = 1; i < MAX_RANURAS; ++i)
+        if (atomic_load(&rs[i].pid) == yo) { atomic_store(&mi_ranura, &rs[i]); return; }
+
+    for (int i = 1; i < MAX_RANURAS; ++i) {
+        int libre = 0;
+        if (atomic_compare_exchange_strong(&rs[i].pid, &libre, yo)) {
+            snprintf(rs[i].nombre, sizeof rs[i].nombre, "%s", nombre);
+            atomic_store(&mi_ranura, &rs[i]);
+            return;
+        }
+    }
+
+    for (int i = 1; i < MAX_RANURAS; ++i) {
+        int pid = atomic_load(&rs[i].pid);
+        if (kill(pid, 0) == 0 || errno != ESRCH) continue;
+        if (!atomic_compare_exchange_strong(&rs[i].pid, &pid, yo)) continue;
+        jubilar(rs, &rs[i]);
+        snprintf(rs[i].nombre, sizeof rs[i].nombre, "%s", nombre);
+        atomic_store(&mi_ranura, &rs[i]);
+        return;
+    }
+    fprintf(stderr, "métricas: sin ranuras libres, %s no cuenta\n", nombre);
+}
+
+/* Manda `senal` a los procesos vivos con ranura a nombre de `nombre` y
+ * devuelve a cuántos.  Así banco llega a monitor y usuarios aunque los
+ * lance dentro de una terminal; /proc/<pid>/comm descarta un pid ya
+ * reutilizado por otro programa.                                         */
+int metricas_senalar(TablaCuentas *t, const char *nombre, int senal) {
+    RanuraMetricas *rs = ranuras_tabla(t);
+    int n = 0;
+    for (int i = 1; i < MAX_RANURAS; ++i) {
+        int pid = atomic_load(&rs[i].pid);
+        if (pid <= 0 || strcmp(rs[i].nombre, nombre) != 0) continue;
+
+        char ruta[32], comm[32] = "";
+        snprintf(ruta, sizeof ruta, "/proc/%d/comm", pid);
+        FILE *f = fopen(ruta, "r");
+        if (!f) continue;
+        if (!fgets(comm, sizeof comm, f)) comm[0] = '\0';
+        fclose(f);
+        comm[strcspn(comm, "\n")] = '\0';
+        if (strcmp(comm, nombre) == 0 && kill(pid, senal) == 0) ++n;
+    }
+    return n;
+}
+
+/* Deja de contar si la ranura está en el segmento que se va a soltar. */
+void metricas_soltar(const TablaCuentas *t) {
+    const char *r = (const char *)atomic_load(&mi_ranura);
+    if (r >= (const char *)t && r < (const char *)t + t->tam_segmento)
+        atomic_store(&mi_ranura, NULL);
+}
+
+uint64_t reloj_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* reloj_ns() si este proceso cuenta, 0 si no: quien no se registró no
+ * paga la lectura del reloj en cada operación.                           */
+uint64_t reloj_metricas(void) {
+    return atomic_load_explicit(&mi_ranura, memory_order_relaxed) ? reloj_ns() : 0;
+}
+
+void metrica_sumar(Metrica m, long n) {
+    RanuraMetricas *r = atomic_load_explicit(&mi_ranura, memory_order_relaxed);
+    if (r) atomic_fetch_add_explicit(&r->valor[m], n, memory_order_relaxed);
+}
+
+void metrica_observar(Histograma h, uint64_t valor) {
+    RanuraMetricas *r = atomic_load_explicit(&mi_ranura, memory_order_relaxed);
+    if (!r) return;
+    int c = valor ? 64 - __builtin_clzll(valor) : 0;
+    if (c >= CUBETAS_HIST) c = CUBETAS_HIST - 1;
+    atomic_fetch_add_explicit(&r->hist[h][c], 1, memory_order_relaxed);
+}
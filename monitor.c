@@ -1,123 +1,128 @@
 /* monitor.c — Proceso de supervisión de SecureBank
- * - Lee los mensajes que envían usuarios por la cola SYSV (clave 1234)
- * - Muestra la transacción por pantalla y la añade a transacciones.log
- * - Detecta patrones sencillos de fraude (retiros y transferencias repetitivas) */
+ * - Recibe por argv[1] el shm_id de banco y saca por lotes los eventos
+ *   binarios que publican los usuarios (eventos.c).  Con CANAL_MONITOR=cola,
+ *   o sin argumento, los lee de la cola SysV (clave 1234)
+ * - El hilo principal sólo recibe y reparte por cuenta entre HILOS_MONITOR
+ *   hilos de análisis (tuberia.c), que pasan cada evento por las reglas de
+ *   config.txt (reglas.c): ventanas deslizantes por cuenta o par de
+ *   cuentas y uso simultáneo de una cuenta desde varios procesos
+ * - Un hilo sumidero escribe por lotes en pantalla y en el log global las
+ *   transacciones y las alertas
+ * - El estado de cada regla vive en almacenes hash acotados (contadores.c);
+ *   SIGUSR1 o la salida del monitor imprimen alertas, ocupación y sondeo */
 
  #define _POSIX_C_SOURCE 200809L     /* strptime, etc.              */
  #include <stdio.h>
  #include <stdlib.h>
  #include <string.h>
- #include <sys/ipc.h>
- #include <sys/msg.h>
  #include <unistd.h>
  #include <time.h>
  #include <errno.h>
+ #include <signal.h>
 
  #include "utils.h"
  
  /* ────────── Constantes ────────── */
- #define MSG_KEY  1234
- #define TAM_MAX  128
+ #define LOTE_EVENTOS 256
  
- /* ────────── Configuración (sólo umbrales) ────────── */
- typedef struct {
-     int umbral_retiros;
-     int umbral_transferencias;
-     char archivo_log[64];
- } Cfg;
- 
- static Cfg cfg;
- 
- /* ────────── Mensaje recibido ───────── */
- struct msgbuf {
-     long tipo;
-     char texto[TAM_MAX];
- };
- 
- /* ────────── Estado para la detección de anomalías ────────── */
- static int  retiros_consecutivos[10000]      = {0};
- static int  transferencias_rep[10000][10000] = {{0}};
- 
- /* ────────── Utilidades ────────── */
- static void timestamp(char *dst, size_t n)
+ /* ────────── Configuración ────────── */
+ static Config        cfg;
+ static TablaCuentas *tabla = NULL;      /* NULL = sólo cola SysV */
+ static volatile sig_atomic_t pedir_estadisticas = 0;
+
+ /* ────────── Estadísticas de la tubería ────────── */
+ static void imprimir_estadisticas(void)
  {
-     time_t t = time(NULL);
-     struct tm tm = *localtime(&t);
-     strftime(dst, n, "[%Y-%m-%d %H:%M:%S]", &tm);
+     EstadisticasTuberia e;
+     tuberia_estadisticas(&e);
+
+     long total = 0;
+     for (int i = 0; i < e.hilos; ++i) total += e.eventos[i];
+     printf("Monitor: %ld eventos en %d hilos (", total, e.hilos);
+     for (int i = 0; i < e.hilos; ++i) printf("%s%ld", i ? " / " : "", e.eventos[i]);
+     printf("), %ld alertas, %ld fuera de ventana\n", e.alertas, e.atrasados);
+     printf("  salida: %ld escrituras, %ld KiB, %ld esperas de bloque\n",
+            e.escrituras, e.bytes / 1024, e.esperas);
+     for (int r = 0; r < e.num_reglas; ++r)
+         printf("  %-15s %ld alertas, %zu/%zu entradas, %zu KiB, %ld desalojos\n",
+                e.regla[r].nombre, e.regla[r].disparos, e.regla[r].entradas,
+                e.regla[r].capacidad, e.regla[r].bytes / 1024, e.regla[r].desalojos);
+     if (tabla)
+         printf("  eventos perdidos (canal lleno): %ld\n",
+                atomic_load(&tabla->eventos.perdidos));
+     fflush(stdout);
  }
- 
- 
- 
- /* ────────── Reglas de anomalía ────────── */
- static void analizar(const char *msg)
+
+ /* Eventos que los usuarios tuvieron que descartar con el canal lleno
+  * desde la última vez: alerta en consola y en el log, porque las reglas
+  * no los han visto.                                                   */
+ static void avisar_perdidos(void)
  {
-     int origen, destino;
-     float monto;
- 
-     if (sscanf(msg, "RETIRO %d %f", &origen, &monto) == 2) {
- 
-         if (++retiros_consecutivos[origen] >= cfg.umbral_retiros) {
-             char alerta[128];
-             snprintf(alerta, sizeof alerta,
-                      "ALERTA: %d retiros seguidos en cuenta %d",
-                      cfg.umbral_retiros, origen);
-             puts(alerta);
-             append_log(cfg.archivo_log, alerta);
-             retiros_consecutivos[origen] = 0;
-         }
- 
-     } else if (sscanf(msg, "TRANSFERENCIA %d %d %f",
-                       &origen, &destino, &monto) == 3) {
- 
-         if (++transferencias_rep[origen][destino] >= cfg.umbral_transferencias) {
-             char alerta[160];
-             snprintf(alerta, sizeof alerta,
-                      "ALERTA: %d transferencias seguidas de %d a %d",
-                      cfg.umbral_transferencias, origen, destino);
-             puts(alerta);
-             append_log(cfg.archivo_log, alerta);
+     static long avisados;
+     if (!tabla) return;
+     long perdidos = atomic_load_explicit(&tabla->eventos.perdidos, memory_order_relaxed);
+     if (perdidos == avisados) return;
 
-             transferencias_rep[origen][destino] = 0;
-         }
- 
-     } else if (sscanf(msg, "DEPOSITO %d %f", &origen, &monto) == 2) {
-         /* reinicia contador de retiros cuando llega un depósito           */
-         retiros_consecutivos[origen] = 0;
-     }
+     char linea[128];
+     snprintf(linea, sizeof linea,
+              "ALERTA [canal]: %ld eventos perdidos con el canal lleno (%ld en total)",
+              perdidos - avisados, perdidos);
+     puts(linea);
+     fflush(stdout);
+     append_log(cfg.archivo_log, linea);
+     avisados = perdidos;
+ }
+
+ /* Al salir: lo ya recibido se analiza y escribe antes del resumen. */
+ static void cerrar(void)
+ {
+     tuberia_detener();
+     imprimir_estadisticas();
+ }
+
+ static void manejar_usr1(int sig)
+ {
+     (void)sig;
+     pedir_estadisticas = 1;
  }
  
  /* ────────── main ────────── */
- int main(void)
+ int main(int argc, char *argv[])
  {
-     Config cfg;
      cfg = leer_config("config.txt");
- 
-     int qid = msgget(MSG_KEY, IPC_CREAT | 0666);
-     if (qid == -1) { perror("msgget"); exit(EXIT_FAILURE); }
+     registro_backend(cfg.backend_es);
+     registro_iniciar();         /* SIGTERM/SIGINT: exit() y cerrar() */
+     if (argc > 1) {
+         tabla = adjuntar_shm(atoi(argv[1]));
+         metricas_registrar(tabla, "monitor");
+     }
+
+     tuberia_iniciar(&cfg, cfg.hilos_monitor, cfg.archivo_log, 1);
+     atexit(cerrar);
+
+     /* sin SA_RESTART: msgrcv vuelve con EINTR y se atiende la petición */
+     struct sigaction sa = { .sa_handler = manejar_usr1 };
+     sigemptyset(&sa.sa_mask);
+     sigaction(SIGUSR1, &sa, NULL);
  
      puts("Monitor activo. Esperando transacciones…");
+     fflush(stdout);             /* el sumidero escribe en el descriptor */
  
-     struct msgbuf m;
+     Evento lote[LOTE_EVENTOS];
  
      for (;;) 
      {
-         if (msgrcv(qid, &m, sizeof m.texto, 0, 0) == -1) 
-         {
-             if (errno == EINTR) continue;
-             perror("msgrcv");
-             break;
-         }
- 
-         char ts[32];
-         timestamp(ts, sizeof ts);
-         printf("%s %s\n", ts, m.texto);
- 
-         append_log(cfg.archivo_log, m.texto);
+         int n = eventos_recibir(tabla, lote, LOTE_EVENTOS);
+         if (n == -1) { perror("eventos_recibir"); break; }
 
+         if (pedir_estadisticas) {
+             pedir_estadisticas = 0;
+             imprimir_estadisticas();
+         }
  
-         analizar(m.texto);              /* reglas de fraude */
+         tuberia_encolar(lote, n);
+         avisar_perdidos();
      }
  
      return 0;
  }
- 
@@ -0,0 +1,315 @@
+/* operaciones.c — Lógica de las operaciones bancarias sobre la SHM
+ *
+ *  ▸ Cada operación bloquea sólo la(s) franja(s) de las cuentas que toca.
+ *  ▸ Las que cambian saldos anotan la post-imagen en el diario (wal.c) con
+ *    la cuenta bloqueada y esperan su commit en grupo ya sin cerrojo.
+ *  ▸ Cada escritura de saldo va entre empezar_escritura() y
+ *    terminar_escritura() para que op_saldo() lea sin cerrojo (seqlock).
+ *  ▸ Los saldos y los importes son céntimos enteros (columna
+ *    saldos_tabla); quien lee euros los redondea al céntimo (a_centimos).
+ *  ▸ Encola el registro de la cuenta modificada en el buffer de E/S para el
+ *    hilo de banco, también en MODO_MMAP.
+ *  ▸ op_lote() aplica N apuntes (cargos y abonos) todo o nada, con las
+ *    franjas tomadas en orden y una escritura por cuenta tocada.
+ *  ▸ op_preparar()/op_confirmar()/op_abortar() son el lado de cada
+ *    partición en una transferencia entre dos de ellas (dosfases.c).
+ *  ▸ Cada operación suma su contador y su duración a las métricas del
+ *    proceso (metricas.c).
+ *  ▸ No escribe logs ni avisa al monitor: eso lo hace quien la invoca
+ *    (usuario.c) fuera de la sección crítica.
+ *  ▸ Desde el cerrojo hasta el commit van entre seccion_entrar() y
+ *    seccion_salir(): una señal de terminación espera a que acaben.
+ *  ▸ Las que escriben cuentan en t->en_curso; con t->cerrando puesto
+ *    (operaciones_cerrar, al cerrar banco) se rechazan con OP_CERRANDO,
+ *    así ningún proceso adjunto cambia saldos tras el último punto de
+ *    control.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+/* Encola el registro de la cuenta en el buffer de E/S: el hilo de banco
+ * lo lleva a cuentas.dat cuando el diario ya lo tiene confirmado.        */
+static void marcar_sucia(TablaCuentas *t, int idx)
+{
+    Cuenta c;
+    leer_cuenta(t, idx, &c);
+    buffer_push(&t->buffer, &c, P_ALTA);
+}
+
+/* Anota una operación que escribe: 0 si banco está cerrando.  El orden
+ * (anotarse y luego mirar la marca, al revés que operaciones_cerrar)
+ * garantiza que la que pasa termina antes de que banco siga.            */
+static int anotarse(TablaCuentas *t)
+{
+    atomic_fetch_add(&t->en_curso, 1);
+    if (!atomic_load(&t->cerrando)) return 1;
+    atomic_fetch_sub(&t->en_curso, 1);
+    return 0;
+}
+
+static int entrar(TablaCuentas *t)
+{
+    seccion_entrar();
+    if (anotarse(t)) return 1;
+    seccion_salir();
+    return 0;
+}
+
+static void salir(TablaCuentas *t)
+{
+    atomic_fetch_sub(&t->en_curso, 1);
+    seccion_salir();
+}
+
+/* banco al cerrar: rechaza desde ya las operaciones que escriben y espera
+ * hasta `espera_ms` a que acaben las que estaban dentro.  Devuelve
+ * cuántas quedan (un proceso muerto a medias no sale nunca).            */
+int operaciones_cerrar(TablaCuentas *t, int espera_ms)
+{
+    struct timespec pausa = { 0, 1000000 };
+    atomic_store(&t->cerrando, 1);
+    for (int ms = 0; atomic_load(&t->en_curso) > 0 && ms < espera_ms; ++ms)
+        nanosleep(&pausa, NULL);
+    return atomic_load(&t->en_curso);
+}
+
+/* Cuenta la operación y su duración (histograma H_OPERACION). */
+static ResultadoOp medido(Metrica m, uint64_t t0, ResultadoOp r)
+{
+    if (t0) metrica_observar(H_OPERACION, reloj_ns() - t0);
+    metrica_sumar(m, 1);
+    return r;
+}
+
+ResultadoOp op_deposito(TablaCuentas *t, int cuenta, int64_t cent)
+{
+    uint64_t t0 = reloj_metricas();
+    int idx = buscar_cuenta(t, cuenta);
+    if (idx == -1) return medido(M_DEPOSITOS, t0, OP_CUENTA_NO_EXISTE);
+    int64_t *saldos = saldos_tabla(t);
+
+    if (!entrar(t)) return medido(M_DEPOSITOS, t0, OP_CERRANDO);
+    bloquear_cuenta(t, idx);
+    empezar_escritura(t, idx);
+    saldos[idx] += cent;
+    terminar_escritura(t, idx);
+    uint64_t lsn = wal_anotar(&t->wal, OP_DEPOSITO, (int[2]){ cuenta, -1 },
+                              (int64_t[2]){ saldos[idx], 0 });
+    marcar_sucia(t, idx);
+    desbloquear_cuenta(t, idx);
+
+    wal_confirmar(&t->wal, lsn);
+    salir(t);
+    return medido(M_DEPOSITOS, t0, OP_OK);
+}
+
+ResultadoOp op_retiro(TablaCuentas *t, int cuenta, int64_t cent)
+{
+    uint64_t t0 = reloj_metricas();
+    int idx = buscar_cuenta(t, cuenta);
+    if (idx == -1) return medido(M_RETIROS, t0, OP_CUENTA_NO_EXISTE);
+    int64_t *saldos = saldos_tabla(t);
+
+    ResultadoOp r = OP_SALDO_INSUFICIENTE;
+    uint64_t lsn = 0;
+    if (!entrar(t)) return medido(M_RETIROS, t0, OP_CERRANDO);
+    bloquear_cuenta(t, idx);
+    if (saldos[idx] >= cent) {
+        empezar_escritura(t, idx);
+        saldos[idx] -= cent;
+        terminar_escritura(t, idx);
+        lsn = wal_anotar(&t->wal, OP_RETIRO, (int[2]){ cuenta, -1 },
+                         (int64_t[2]){ saldos[idx], 0 });
+        marcar_sucia(t, idx);
+        r = OP_OK;
+    }
+    desbloquear_cuenta(t, idx);
+
+    if (r == OP_OK) wal_confirmar(&t->wal, lsn);
+    salir(t);
+    return medido(M_RETIROS, t0, r);
+}
+
+ResultadoOp op_transferencia(TablaCuentas *t, int origen, int destino, int64_t cent)
+{
+    uint64_t t0 = reloj_metricas();
+    int idx_o = buscar_cuenta(t, origen);
+    int idx_d = buscar_cuenta(t, destino);
+    if (idx_o == -1 || idx_d == -1) return medido(M_TRANSFERENCIAS, t0, OP_CUENTA_NO_EXISTE);
+    int64_t *saldos = saldos_tabla(t);
+
+    ResultadoOp r = OP_SALDO_INSUFICIENTE;
+    uint64_t lsn = 0;
+    if (!entrar(t)) return medido(M_TRANSFERENCIAS, t0, OP_CERRANDO);
+    bloquear_par(t, idx_o, idx_d);
+    if (saldos[idx_o] >= cent) {
+        empezar_escritura(t, idx_o);
+        if (idx_d != idx_o) empezar_escritura(t, idx_d);
+        saldos[idx_o] -= cent;
+        saldos[idx_d] += cent;
+        if (idx_d != idx_o) terminar_escritura(t, idx_d);
+        terminar_escritura(t, idx_o);
+
+        lsn = wal_anotar(&t->wal, OP_TRANSFERENCIA, (int[2]){ origen, destino },
+                         (int64_t[2]){ saldos[idx_o], saldos[idx_d] });
+        marcar_sucia(t, idx_o);
+        marcar_sucia(t, idx_d);
+        r = OP_OK;
+    }
+    desbloquear_par(t, idx_o, idx_d);
+
+    if (r == OP_OK) wal_confirmar(&t->wal, lsn);
+    salir(t);
+    return medido(M_TRANSFERENCIAS, t0, r);
+}
+
+/* Sólo lectura: ni cerrojo ni buffer de E/S. */
+ResultadoOp op_saldo(TablaCuentas *t, int cuenta, int64_t *centimos)
+{
+    uint64_t t0 = reloj_metricas();
+    int idx = buscar_cuenta(t, cuenta);
+    if (idx == -1) return medido(M_SALDOS, t0, OP_CUENTA_NO_EXISTE);
+
+    *centimos = leer_saldo(t, idx);
+    return medido(M_SALDOS, t0, OP_OK);
+}
+
+/*─────────────────────────────────────────────*/
+/*              LOTES DE APUNTES               */
+/*─────────────────────────────────────────────*/
+
+typedef struct {
+    int     idx;
+    int     primero;                     /* primer apunte de la cuenta */
+    int64_t neto;
+} Movimiento;
+
+static int cmp_movimiento(const void *a, const void *b)
+{
+    const Movimiento *x = a, *y = b;
+    return x->idx != y->idx ? (x->idx > y->idx) - (x->idx < y->idx)
+                            : x->primero - y->primero;
+}
+
+/* Aplica los n apuntes de una vez o ninguno.  Un lote sólo mueve dinero
+ * entre sus cuentas: se rechaza entero si los apuntes no suman cero
+ * (OP_DESCUADRE), si un cargo o un abono supera `limite` céntimos en
+ * valor absoluto (0 = sin límite, como cada lado de una transferencia),
+ * si falta una cuenta o si alguna quedaría en negativo.  Los apuntes de una misma cuenta se suman: cada cuenta tocada
+ * se escribe, se anota en el diario y se encola una sola vez.  Las franjas
+ * se toman todas, en orden, antes de validar saldos.  En `fallo` (si no es
+ * NULL) queda el apunte que hizo fallar el lote.                         */
+ResultadoOp op_lote(TablaCuentas *t, const Apunte *apuntes, int n, int64_t limite, int *fallo)
+{
+    uint64_t t0 = reloj_metricas();
+    int fallo_local;
+    if (!fallo) fallo = &fallo_local;
+    *fallo = -1;
+    if (n < 1 || n > MAX_APUNTES || !wal_cabe_lote(&t->wal, n)) return medido(M_LOTES, t0, OP_LIMITE);
+
+    Movimiento mov[MAX_APUNTES];
+    int64_t suma = 0;
+    for (int i = 0; i < n; ++i) {
+        int64_t c = apuntes[i].centimos;
+        if (limite > 0 && (c > limite || c < -limite)) { *fallo = i; return medido(M_LOTES, t0, OP_LIMITE); }
+        mov[i].idx = buscar_cuenta(t, apuntes[i].cuenta);
+        if (mov[i].idx == -1) { *fallo = i; return medido(M_LOTES, t0, OP_CUENTA_NO_EXISTE); }
+        mov[i].primero = i;
+        mov[i].neto    = c;
+        suma += c;
+    }
+    if (suma != 0) return medido(M_LOTES, t0, OP_DESCUADRE);
+
+    /* Agrupar por posición: una entrada por cuenta con el saldo neto. */
+    qsort(mov, n, sizeof mov[0], cmp_movimiento);
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        if (m > 0 && mov[m - 1].idx == mov[i].idx) mov[m - 1].neto += mov[i].neto;
+        else mov[m++] = mov[i];
+    }
+
+    int idx[MAX_APUNTES], franjas[MAX_APUNTES];
+    for (int i = 0; i < m; ++i) idx[i] = mov[i].idx;
+
+    int64_t *saldos = saldos_tabla(t);
+    ResultadoOp r = OP_OK;
+    uint64_t lsn = 0;
+    if (!entrar(t)) return medido(M_LOTES, t0, OP_CERRANDO);
+    int nf = bloquear_varias(t, idx, m, franjas);
+
+    for (int i = 0; i < m && r == OP_OK; ++i)
+        if (saldos[mov[i].idx] + mov[i].neto < 0) { r = OP_SALDO_INSUFICIENTE; *fallo = mov[i].primero; }
+
+    if (r == OP_OK) {
+        int     cuentas[MAX_APUNTES];
+        int64_t post[MAX_APUNTES];
+
+        for (int i = 0; i < m; ++i) {
+            empezar_escritura(t, mov[i].idx);
+            saldos[mov[i].idx] += mov[i].neto;
+            terminar_escritura(t, mov[i].idx);
+            cuentas[i] = numeros_tabla(t)[mov[i].idx];
+            post[i]    = saldos[mov[i].idx];
+        }
+        lsn = wal_anotar_lote(&t->wal, cuentas, post, m);
+        for (int i = 0; i < m; ++i) marcar_sucia(t, mov[i].idx);
+    }
+    desbloquear_varias(t, franjas, nf);
+
+    if (r == OP_OK) wal_confirmar(&t->wal, lsn);
+    salir(t);
+    return medido(M_LOTES, t0, r);
+}
+
+/*─────────────────────────────────────────────*/
+/*        RAMAS DE DOS FASES (dosfases.c)      */
+/*─────────────────────────────────────────────*/
+
+/* Primera fase: bloquea la cuenta y comprueba que admite el apunte
+ * (cargo si centimos < 0).  Con OP_OK la franja queda tomada y en `p` la
+ * post-imagen; cualquier otro resultado no deja nada bloqueado.  Quien
+ * las usa (dosfases_transferencia) pone la sección de las tres fases; la
+ * rama cuenta como en curso hasta op_confirmar()/op_abortar().           */
+ResultadoOp op_preparar(TablaCuentas *t, int cuenta, int64_t centimos, Preparada *p)
+{
+    int idx = buscar_cuenta(t, cuenta);
+    if (idx == -1) return OP_CUENTA_NO_EXISTE;
+
+    if (!anotarse(t)) return OP_CERRANDO;
+    bloquear_cuenta(t, idx);
+    int64_t despues = saldos_tabla(t)[idx] + centimos;
+    if (despues < 0) {
+        desbloquear_cuenta(t, idx);
+        atomic_fetch_sub(&t->en_curso, 1);
+        return OP_SALDO_INSUFICIENTE;
+    }
+    p->idx     = idx;
+    p->cuenta  = cuenta;
+    p->despues = despues;
+    return OP_OK;
+}
+
+/* Segunda fase, ya decidida: escribe la post-imagen, la anota en el
+ * diario con el xid de la decisión y suelta la franja.  Devuelve el lsn
+ * a confirmar.                                                           */
+uint64_t op_confirmar(TablaCuentas *t, const Preparada *p, uint32_t xid)
+{
+    empezar_escritura(t, p->idx);
+    saldos_tabla(t)[p->idx] = p->despues;
+    terminar_escritura(t, p->idx);
+    uint64_t lsn = wal_anotar_rama(&t->wal, p->cuenta, p->despues, xid);
+    marcar_sucia(t, p->idx);
+    desbloquear_cuenta(t, p->idx);
+    atomic_fetch_sub(&t->en_curso, 1);
+    return lsn;
+}
+
+void op_abortar(TablaCuentas *t, const Preparada *p)
+{
+    desbloquear_cuenta(t, p->idx);
+    atomic_fetch_sub(&t->en_curso, 1);
+}
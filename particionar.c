@@ -0,0 +1,107 @@
+/* particionar.c — Reparte cuentas.dat entre las particiones y las junta
+ *   ● Sin argumentos lee ARCHIVO_CUENTAS y escribe la cuenta c en el
+ *     fichero de la partición c mod PARTICIONES (cuentas.dat.0, .1, …),
+ *     conservando el orden.  No pisa ficheros de partición existentes.
+ *   ● Con `unir` hace lo contrario: mezcla los ficheros de las
+ *     particiones (cada uno en el orden en que quedó) en ARCHIVO_CUENTAS,
+ *     tomando cada vez la cuenta de número menor.
+ *   ● Con los bancos de las particiones parados: sus ficheros sólo están
+ *     al día tras el punto de control del cierre.
+ *   ● Un fichero del formato antiguo (saldo float) se migra antes.
+ *
+ *  Ejecutar:  ./particionar [unir]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+static Config cfg;
+static char   rutas[MAX_PARTICIONES][50];
+
+static int repartir(void)
+{
+    int n = cfg.particiones;
+    for (int p = 0; p < n; ++p)
+        if (access(rutas[p], F_OK) == 0) {
+            fprintf(stderr, "%s ya existe: bórralo o usa ./particionar unir\n", rutas[p]);
+            return 1;
+        }
+
+    if (migrar_cuentas(cfg.archivo_cuentas) == -1) return 1;
+    FILE *ent = fopen(cfg.archivo_cuentas, "rb");
+    if (!ent) { perror(cfg.archivo_cuentas); return 1; }
+    FILE *sal[MAX_PARTICIONES];
+    long cuantas[MAX_PARTICIONES] = { 0 };
+    for (int p = 0; p < n; ++p)
+        if (!(sal[p] = fopen(rutas[p], "wb"))) { perror(rutas[p]); return 1; }
+
+    Cuenta c;
+    while (fread(&c, sizeof c, 1, ent) == 1) {
+        int p = particion_de(c.numero_cuenta, n);
+        fwrite(&c, sizeof c, 1, sal[p]);
+        cuantas[p]++;
+    }
+    fclose(ent);
+
+    for (int p = 0; p < n; ++p) {
+        fflush(sal[p]);
+        fsync(fileno(sal[p]));
+        fclose(sal[p]);
+        printf("%-20s %ld cuentas\n", rutas[p], cuantas[p]);
+    }
+    return 0;
+}
+
+static int unir(void)
+{
+    int n = cfg.particiones;
+    FILE *ent[MAX_PARTICIONES];
+    Cuenta cabeza[MAX_PARTICIONES];
+    int quedan[MAX_PARTICIONES];
+    for (int p = 0; p < n; ++p) {
+        if (migrar_cuentas(rutas[p]) == -1) return 1;
+        if (!(ent[p] = fopen(rutas[p], "rb"))) { perror(rutas[p]); return 1; }
+        quedan[p] = fread(&cabeza[p], sizeof(Cuenta), 1, ent[p]) == 1;
+    }
+
+    FILE *sal = fopen(cfg.archivo_cuentas, "wb");
+    if (!sal) { perror(cfg.archivo_cuentas); return 1; }
+
+    long total = 0;
+    for (;;) {
+        int m = -1;
+        for (int p = 0; p < n; ++p)
+            if (quedan[p] && (m == -1 || cabeza[p].numero_cuenta < cabeza[m].numero_cuenta))
+                m = p;
+        if (m == -1) break;
+        fwrite(&cabeza[m], sizeof(Cuenta), 1, sal);
+        ++total;
+        quedan[m] = fread(&cabeza[m], sizeof(Cuenta), 1, ent[m]) == 1;
+    }
+    for (int p = 0; p < n; ++p) fclose(ent[p]);
+    fflush(sal);
+    fsync(fileno(sal));
+    fclose(sal);
+    printf("%s: %ld cuentas de %d particiones\n", cfg.archivo_cuentas, total, n);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    cfg = leer_config("config.txt");
+    if (cfg.particiones < 2) {
+        fprintf(stderr, "config.txt: PARTICIONES=%d, nada que repartir\n", cfg.particiones);
+        return 1;
+    }
+    for (int p = 0; p < cfg.particiones; ++p) {
+        Config c = cfg;
+        config_particion(&c, p);
+        snprintf(rutas[p], sizeof rutas[p], "%s", c.archivo_cuentas);
+    }
+    return argc > 1 && strcmp(argv[1], "unir") == 0 ? unir() : repartir();
+}
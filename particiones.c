@@ -0,0 +1,109 @@
+/* particiones.c — Reparto de las cuentas entre varios procesos banco
+ *
+ *  ▸ Con PARTICIONES=N corren N procesos `./banco particion=i`.  Cada uno
+ *    carga su cuentas.dat.i (las reparte ./particionar), crea su segmento
+ *    con la clave fija CLAVE_PARTICIONES + i y tiene su propio diario, su
+ *    hilo IO y su monitor.  Entre ellos sólo comparten el log de
+ *    decisiones de dosfases.c.
+ *  ▸ La cuenta c vive en la partición c mod N.  Los números de cuenta son
+ *    correlativos, así que el reparto sale parejo.
+ *  ▸ El Enrutador se adjunta a los N segmentos por su clave y lleva cada
+ *    operación al suyo.  Una transferencia dentro de una partición es un
+ *    op_transferencia de siempre; entre dos, dosfases_transferencia().
+ *  ▸ Con un solo segmento (enrutador_unico) todo va directo a
+ *    operaciones.c: usuario.c usa el enrutador en los dos casos.
+ *  ▸ Sólo con MODO_CUENTAS=shm: en MODO_MMAP cada proceso tiene una única
+ *    proyección de cuentas (memoria.c).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+int particion_de(int cuenta, int num)
+{
+    int p = cuenta % num;
+    return p < 0 ? p + num : p;
+}
+
+/* Segmento de la partición p; otro banco con la misma partición en
+ * marcha hace fallar el arranque.                                        */
+int crear_shm_particion(int p, int capacidad, const Config *cfg)
+{
+    return crear_shm_clave(CLAVE_PARTICIONES + p, capacidad, cfg);
+}
+
+/*─────────────────────────────────────────────*/
+/*                 ENRUTADOR                   */
+/*─────────────────────────────────────────────*/
+
+/* Se adjunta a las cfg->particiones particiones, que deben estar en
+ * marcha.                                                                */
+void enrutador_abrir(Enrutador *e, const Config *cfg)
+{
+    memset(e, 0, sizeof *e);
+    if (cfg->modo_cuentas == MODO_MMAP && cfg->particiones > 1) {
+        fprintf(stderr, "particiones: sólo con MODO_CUENTAS=shm\n");
+        exit(EXIT_FAILURE);
+    }
+    e->num     = cfg->particiones;
+    e->propias = 1;
+    snprintf(e->archivo_2pc, sizeof e->archivo_2pc, "%s", cfg->archivo_2pc);
+
+    for (int p = 0; p < e->num; ++p) {
+        int id = buscar_shm_clave(CLAVE_PARTICIONES + p, cfg);
+        if (id == -1) {
+            fprintf(stderr, "partición %d sin arrancar (./banco particion=%d)\n", p, p);
+            exit(EXIT_FAILURE);
+        }
+        e->tablas[p] = adjuntar_shm(id);
+    }
+}
+
+/* Enrutador de una sola tabla ya adjunta (banco sin particiones). */
+void enrutador_unico(Enrutador *e, TablaCuentas *t, const Config *cfg)
+{
+    memset(e, 0, sizeof *e);
+    e->num       = 1;
+    e->tablas[0] = t;
+    snprintf(e->archivo_2pc, sizeof e->archivo_2pc, "%s", cfg->archivo_2pc);
+}
+
+void enrutador_cerrar(Enrutador *e)
+{
+    for (int p = 0; e->propias && p < e->num; ++p)
+        liberar_shm(e->tablas[p], -1);   /* los segmentos los libera cada banco */
+    e->num = 0;
+}
+
+TablaCuentas *tabla_de(Enrutador *e, int cuenta)
+{
+    return e->tablas[particion_de(cuenta, e->num)];
+}
+
+/*─────────────────────────────────────────────*/
+/*            OPERACIONES ENRUTADAS            */
+/*─────────────────────────────────────────────*/
+
+ResultadoOp ruta_deposito(Enrutador *e, int cuenta, int64_t centimos)
+{
+    return op_deposito(tabla_de(e, cuenta), cuenta, centimos);
+}
+
+ResultadoOp ruta_retiro(Enrutador *e, int cuenta, int64_t centimos)
+{
+    return op_retiro(tabla_de(e, cuenta), cuenta, centimos);
+}
+
+ResultadoOp ruta_saldo(Enrutador *e, int cuenta, int64_t *centimos)
+{
+    return op_saldo(tabla_de(e, cuenta), cuenta, centimos);
+}
+
+ResultadoOp ruta_transferencia(Enrutador *e, int origen, int destino, int64_t centimos)
+{
+    if (particion_de(origen, e->num) == particion_de(destino, e->num))
+        return op_transferencia(tabla_de(e, origen), origen, destino, centimos);
+    return dosfases_transferencia(e, origen, destino, centimos);
+}
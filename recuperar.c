@@ -0,0 +1,511 @@
+/* recuperar.c — Reconstrucción de saldos a partir de los logs
+ *   ● Parte de una base conocida (una instantánea .foto o un cuentas.dat
+ *     guardado) y le suma los movimientos del log global del monitor
+ *     (ARCHIVO_LOG) o, con cuentas=1, los del historial por cuenta
+ *     (DIRECTORIO_HISTORIAL, que sí detalla los lotes).
+ *   ● Todo se proyecta con mmap.  El log global se parte en tantos trozos
+ *     como hilos, cortando en fin de línea; los segmentos del historial se
+ *     reparten uno a uno.  Cada hilo suma en su propio vector de céntimos
+ *     por cuenta; después cada hilo reduce un rango de cuentas, así que
+ *     ninguna cuenta la toca más de un hilo.  Sumar es conmutativo: el
+ *     orden en que se lean los trozos no cambia el resultado.
+ *   ● Con una instantánea como base sólo se aplican las líneas posteriores
+ *     a su segundo; las del mismo segundo se cuentan como dudosas (pueden
+ *     estar ya dentro de la foto).  desde= fija el corte a mano (incluido).
+ *   ● Compara con ARCHIVO_CUENTAS y lista las diferencias; reparar=1
+ *     escribe en él los saldos reconstruidos.  Sólo con el banco parado: si
+ *     queda un diario (ARCHIVO_WAL) con registros, banco lo reaplicará al
+ *     arrancar y es mejor fuente que los logs.
+ *   ● Sale con 0 si no hay diferencias (o se repararon) y 1 si las hay.
+ *
+ *  Ejecutar:  ./recuperar base=<foto|cuentas> [cuentas=1] [hilos=N]
+ *                         [desde="AAAA-MM-DD hh:mm:ss"] [reparar=1] [listar=20]
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+#define LARGO_TS 19                      /* "AAAA-MM-DD hh:mm:ss" */
+#define MAX_HILOS 64
+
+typedef enum { E_DEPOSITO, E_RETIRO, E_TRANSFERENCIA, E_LOTE, NUM_EVENTOS } TipoEvento;
+
+static const char *nombres_evento[NUM_EVENTOS] = {
+    "depósitos", "retiros", "transferencias", "lotes",
+};
+
+/* Trabajo y resultados de un hilo. */
+typedef struct {
+    const char *ini, *fin;               /* trozo del log global */
+    int64_t *delta;                      /* céntimos por posición de la tabla */
+    long lineas, eventos[NUM_EVENTOS];
+    long anteriores, dudosas, sin_cuenta, lotes_sin_detalle, ilegibles;
+    size_t bytes;
+} Trozo;
+
+static TablaCuentas *tabla;
+static char          corte[LARGO_TS + 1];     /* vacío = sin corte */
+static int           excluir_corte;           /* base foto: el segundo ya está dentro */
+static int64_t       corte_ns;                /* el mismo corte, para el historial */
+static const char   *dir_historial;
+static uint32_t     *segmentos;
+static int           num_segmentos;
+static atomic_int    siguiente_segmento;
+
+static double ahora(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*─────────────────────────────────────────────*/
+/*                 ANÁLISIS                    */
+/*─────────────────────────────────────────────*/
+
+static int prefijo(const char *p, const char *fin, const char *s)
+{
+    size_t n = strlen(s);
+    return (size_t)(fin - p) >= n && memcmp(p, s, n) == 0;
+}
+
+static int leer_entero(const char **p, const char *fin, int *v)
+{
+    const char *q = *p;
+    int x = 0, dig = 0;
+    while (q < fin && *q >= '0' && *q <= '9') { x = x * 10 + (*q++ - '0'); ++dig; }
+    if (!dig) return 0;
+    *v = x;
+    *p = q;
+    return 1;
+}
+
+/* "[+-]E.CC" a céntimos, sin pasar por coma flotante. */
+static int leer_importe(const char **p, const char *fin, int64_t *c)
+{
+    const char *q = *p;
+    int neg = 0;
+    if (q < fin && (*q == '-' || *q == '+')) neg = *q++ == '-';
+    int64_t e = 0, cts = 0;
+    int dig = 0;
+    while (q < fin && *q >= '0' && *q <= '9') { e = e * 10 + (*q++ - '0'); ++dig; }
+    if (!dig) return 0;
+    if (q < fin && *q == '.') {
+        ++q;
+        for (int k = 0; k < 2; ++k) {
+            cts *= 10;
+            if (q < fin && *q >= '0' && *q <= '9') cts += *q++ - '0';
+        }
+    }
+    *c = (neg ? -1 : 1) * (e * 100 + cts);
+    *p = q;
+    return 1;
+}
+
+static int saltar(const char **p, const char *fin, char c)
+{
+    if (*p >= fin || **p != c) return 0;
+    ++*p;
+    return 1;
+}
+
+static void sumar(Trozo *z, int cuenta, int64_t centimos)
+{
+    int idx = buscar_cuenta(tabla, cuenta);
+    if (idx == -1) { z->sin_cuenta++; return; }
+    z->delta[idx] += centimos;
+}
+
+/* Marca "[AAAA-MM-DD hh:mm:ss] " al principio de la línea frente al corte.
+ * Devuelve el texto que sigue, o NULL si la línea no cuenta.             */
+static const char *pasar_marca(Trozo *z, const char *p, const char *fin)
+{
+    if (fin - p < LARGO_TS + 3 || p[0] != '[' || p[LARGO_TS + 1] != ']') {
+        z->ilegibles++;
+        return NULL;
+    }
+    if (corte[0]) {
+        int c = memcmp(p + 1, corte, LARGO_TS);
+        if (c < 0) { z->anteriores++; return NULL; }
+        if (c == 0 && excluir_corte) { z->dudosas++; return NULL; }
+    }
+    return p + LARGO_TS + 3;
+}
+
+/* Línea del log global: DEPOSITO c x | RETIRO c x | TRANSFERENCIA o d x |
+ * LOTE p n apuntes x.  Las alertas y el resto se saltan.                 */
+static void linea_global(Trozo *z, const char *p, const char *fin)
+{
+    if (!(p = pasar_marca(z, p, fin))) return;
+    int a, b;
+    int64_t c;
+
+    if (prefijo(p, fin, "DEPOSITO ")) {
+        p += 9;
+        if (!leer_entero(&p, fin, &a) || !saltar(&p, fin, ' ') || !leer_importe(&p, fin, &c)) goto mal;
+        sumar(z, a, c);
+        z->eventos[E_DEPOSITO]++;
+    } else if (prefijo(p, fin, "RETIRO ")) {
+        p += 7;
+        if (!leer_entero(&p, fin, &a) || !saltar(&p, fin, ' ') || !leer_importe(&p, fin, &c)) goto mal;
+        sumar(z, a, -c);
+        z->eventos[E_RETIRO]++;
+    } else if (prefijo(p, fin, "TRANSFERENCIA ")) {
+        p += 14;
+        if (!leer_entero(&p, fin, &a) || !saltar(&p, fin, ' ') || !leer_entero(&p, fin, &b) ||
+            !saltar(&p, fin, ' ') || !leer_importe(&p, fin, &c)) goto mal;
+        sumar(z, a, -c);
+        sumar(z, b, c);
+        z->eventos[E_TRANSFERENCIA]++;
+    } else if (prefijo(p, fin, "LOTE ")) {
+        z->eventos[E_LOTE]++;
+        z->lotes_sin_detalle++;          /* el global no lleva los apuntes */
+    }
+    return;
+mal:
+    z->ilegibles++;
+}
+
+/* Apunte del historial: cada lado de una transferencia tiene el suyo,
+ * así que basta con sumarlo a su cuenta.                                */
+static void apunte_cuenta(Trozo *z, const RegistroHistorial *r)
+{
+    if (!historial_valido(r) || r->tipo < OP_DEPOSITO || r->tipo > OP_LOTE) {
+        z->ilegibles++;
+        return;
+    }
+    if (corte[0]) {
+        if (r->ts < corte_ns) { z->anteriores++; return; }
+        if (excluir_corte && r->ts < corte_ns + 1000000000) { z->dudosas++; return; }
+    }
+    sumar(z, r->cuenta, r->centimos);
+    z->eventos[r->tipo - OP_DEPOSITO]++;
+}
+
+static const char *fin_linea(const char *p, const char *fin)
+{
+    const char *q = memchr(p, '\n', fin - p);
+    return q ? q : fin;
+}
+
+/*─────────────────────────────────────────────*/
+/*                  HILOS                      */
+/*─────────────────────────────────────────────*/
+
+static void *analizar_global(void *arg)
+{
+    Trozo *z = arg;
+    for (const char *p = z->ini; p < z->fin; ) {
+        const char *f = fin_linea(p, z->fin);
+        z->lineas++;
+        linea_global(z, p, f);
+        p = f + 1;
+    }
+    z->bytes = z->fin - z->ini;
+    return NULL;
+}
+
+static void *analizar_cuentas(void *arg)
+{
+    Trozo *z = arg;
+    int i;
+    while ((i = atomic_fetch_add(&siguiente_segmento, 1)) < num_segmentos) {
+        MapaSegmentoHist m;
+        if (historial_mapear(dir_historial, segmentos[i], &m) == -1) continue;
+        for (size_t k = 0; k < m.num_registros; ++k) {
+            z->lineas++;
+            apunte_cuenta(z, &m.registros[k]);
+        }
+        z->bytes += m.tam;
+        historial_desmapear(&m);
+    }
+    return NULL;
+}
+
+/* Reducción: el hilo k suma los vectores de todos en su rango de cuentas. */
+typedef struct {
+    Trozo *trozos;
+    int num_trozos;
+    int desde, hasta;
+} Rango;
+
+static void *reducir(void *arg)
+{
+    Rango *r = arg;
+    int64_t *saldos = saldos_tabla(tabla);
+    for (int h = 0; h < r->num_trozos; ++h) {
+        const int64_t *d = r->trozos[h].delta;
+        for (int i = r->desde; i < r->hasta; ++i) saldos[i] += d[i];
+    }
+    return NULL;
+}
+
+/*─────────────────────────────────────────────*/
+/*                 ENTRADAS                    */
+/*─────────────────────────────────────────────*/
+
+/* Carga la base en una tabla propia.  Con una foto, fija el corte. */
+static int cargar_base(const char *ruta, Config *cfg, int *shm_id)
+{
+    char magia[8] = { 0 };
+    FILE *f = fopen(ruta, "rb");
+    if (!f) { perror(ruta); return -1; }
+    size_t leidos = fread(magia, 1, sizeof magia, f);
+    fclose(f);
+    int es_foto = leidos == sizeof magia && (memcmp(magia, MAGIA_FOTO, sizeof magia) == 0 ||
+                                             memcmp(magia, MAGIA_FOTO_V1, sizeof magia) == 0);
+
+    CabeceraFoto cab;
+    int capacidad;
+    if (es_foto) {
+        if (foto_leer_cabecera(ruta, &cab) == -1) return -1;
+        capacidad = cab.num_cuentas;
+    } else {
+        capacidad = contar_cuentas(ruta);
+    }
+    if (capacidad < 1) capacidad = 1;
+
+    cfg->modo_cuentas = MODO_SHM;
+    cfg->archivo_wal[0] = '\0';
+    *shm_id = crear_shm(capacidad, cfg);
+    tabla = adjuntar_shm(*shm_id);
+    inicializar_tabla(tabla, capacidad, cfg);
+
+    if (es_foto) {
+        foto_cargar(ruta, tabla);
+        if (!corte[0]) {
+            time_t ts = (time_t)cab.ts;
+            struct tm tm;
+            localtime_r(&ts, &tm);
+            strftime(corte, sizeof corte, "%Y-%m-%d %H:%M:%S", &tm);
+            excluir_corte = 1;
+        }
+        printf("Base: instantánea v%u (%d cuentas, lsn %llu), corte en %s\n",
+               cab.version, tabla->num_cuentas, (unsigned long long)cab.lsn, corte);
+    } else {
+        cargar_cuentas(ruta, tabla);
+        printf("Base: %s (%d cuentas)\n", ruta, tabla->num_cuentas);
+    }
+    return 0;
+}
+
+/* "AAAA-MM-DD hh:mm:ss" en hora local a ns. */
+static int64_t corte_en_ns(const char *c)
+{
+    struct tm tm = { 0 };
+    if (sscanf(c, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+        return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon  -= 1;
+    tm.tm_isdst = -1;
+    return (int64_t)mktime(&tm) * 1000000000;
+}
+
+static void imprimir_centimos(const char *etiqueta, int64_t c)
+{
+    printf("%-26s %s%lld.%02lld €\n", etiqueta, c < 0 ? "-" : "",
+           llabs(c) / 100, llabs(c) % 100);
+}
+
+static void formato_centimos(char *dst, size_t n, int64_t c)
+{
+    snprintf(dst, n, "%s%lld.%02lld", c < 0 ? "-" : "", llabs(c) / 100, llabs(c) % 100);
+}
+
+/*─────────────────────────────────────────────*/
+/*                   MAIN                      */
+/*─────────────────────────────────────────────*/
+
+int main(int argc, char *argv[])
+{
+    Config cfg = leer_config("config.txt");
+    const char *base = NULL;
+    int por_cuenta = 0, reparar = 0, listar = 20;
+    int hilos = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; ++i) {
+        const char *v = strchr(argv[i], '=');
+        if (!v) { fprintf(stderr, "opción desconocida: %s\n", argv[i]); continue; }
+        ++v;
+        if      (strncmp(argv[i], "base=", 5) == 0)    base = v;
+        else if (strncmp(argv[i], "cuentas=", 8) == 0) por_cuenta = atoi(v);
+        else if (strncmp(argv[i], "hilos=", 6) == 0)   hilos = atoi(v);
+        else if (strncmp(argv[i], "reparar=", 8) == 0) reparar = atoi(v);
+        else if (strncmp(argv[i], "listar=", 7) == 0)  listar = atoi(v);
+        else if (strncmp(argv[i], "desde=", 6) == 0) {
+            if (strlen(v) != LARGO_TS) { fprintf(stderr, "desde=\"AAAA-MM-DD hh:mm:ss\"\n"); return 1; }
+            snprintf(corte, sizeof corte, "%s", v);
+        }
+        else fprintf(stderr, "opción desconocida: %s\n", argv[i]);
+    }
+    if (!base) {
+        fprintf(stderr, "Uso: %s base=<foto|cuentas> [cuentas=1] [hilos=N] "
+                        "[desde=\"AAAA-MM-DD hh:mm:ss\"] [reparar=1] [listar=20]\n", argv[0]);
+        return 1;
+    }
+    if (hilos < 1) hilos = 1;
+    if (hilos > MAX_HILOS) hilos = MAX_HILOS;
+
+    char archivo_wal[sizeof cfg.archivo_wal];
+    snprintf(archivo_wal, sizeof archivo_wal, "%s", cfg.archivo_wal);
+
+    int shm_id, estado = 1;
+    if (cargar_base(base, &cfg, &shm_id) == -1) return 1;
+    int n = tabla->num_cuentas;
+
+    /* 1. Análisis en paralelo */
+    double t0 = ahora();
+    Trozo trozos[MAX_HILOS];
+    memset(trozos, 0, sizeof trozos);
+    for (int h = 0; h < hilos; ++h) trozos[h].delta = calloc(n, sizeof(int64_t));
+
+    const char *mapa = NULL;
+    size_t tam_mapa = 0;
+    pthread_t th[MAX_HILOS];
+    if (por_cuenta) {
+        dir_historial = cfg.directorio_historial;
+        num_segmentos = historial_listar(dir_historial, &segmentos);
+        if (num_segmentos == 0) { fprintf(stderr, "%s: historial vacío\n", dir_historial); goto fin; }
+        if (corte[0]) corte_ns = corte_en_ns(corte);
+        printf("Historial: %d segmentos en %s/, %d hilos\n", num_segmentos, dir_historial, hilos);
+        for (int h = 0; h < hilos; ++h) pthread_create(&th[h], NULL, analizar_cuentas, &trozos[h]);
+    } else {
+        int fd = open(cfg.archivo_log, O_RDONLY);
+        if (fd == -1) { perror(cfg.archivo_log); goto fin; }
+        struct stat st;
+        fstat(fd, &st);
+        tam_mapa = st.st_size;
+        if (tam_mapa > 0) {
+            mapa = mmap(NULL, tam_mapa, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapa == MAP_FAILED) { perror("mmap"); mapa = NULL; close(fd); goto fin; }
+            posix_madvise((void *)mapa, tam_mapa, POSIX_MADV_SEQUENTIAL);
+        }
+        close(fd);
+        printf("Log: %s (%.1f MB), %d hilos\n", cfg.archivo_log, tam_mapa / 1e6, hilos);
+
+        /* Trozos del mismo tamaño, cada uno empezando tras un '\n'. */
+        const char *p = mapa, *fin = mapa + tam_mapa;
+        for (int h = 0; h < hilos; ++h) {
+            const char *f = h == hilos - 1 ? fin : mapa + tam_mapa * (h + 1) / hilos;
+            if (f < p) f = p;
+            if (f < fin) f = fin_linea(f, fin) + 1;
+            if (f > fin) f = fin;
+            trozos[h].ini = p;
+            trozos[h].fin = f;
+            p = f;
+        }
+        for (int h = 0; h < hilos; ++h) pthread_create(&th[h], NULL, analizar_global, &trozos[h]);
+    }
+    for (int h = 0; h < hilos; ++h) pthread_join(th[h], NULL);
+    double t1 = ahora();
+
+    /* 2. Reducción por rangos de cuentas */
+    Rango rangos[MAX_HILOS];
+    for (int h = 0; h < hilos; ++h) {
+        rangos[h] = (Rango){ trozos, hilos, (int)((long)n * h / hilos), (int)((long)n * (h + 1) / hilos) };
+        pthread_create(&th[h], NULL, reducir, &rangos[h]);
+    }
+    for (int h = 0; h < hilos; ++h) pthread_join(th[h], NULL);
+    double t2 = ahora();
+
+    Trozo tot;
+    memset(&tot, 0, sizeof tot);
+    for (int h = 0; h < hilos; ++h) {
+        tot.lineas += trozos[h].lineas;
+        for (int e = 0; e < NUM_EVENTOS; ++e) tot.eventos[e] += trozos[h].eventos[e];
+        tot.anteriores        += trozos[h].anteriores;
+        tot.dudosas           += trozos[h].dudosas;
+        tot.sin_cuenta        += trozos[h].sin_cuenta;
+        tot.lotes_sin_detalle += trozos[h].lotes_sin_detalle;
+        tot.ilegibles         += trozos[h].ilegibles;
+        tot.bytes             += trozos[h].bytes;
+    }
+
+    printf("\n%ld %s (%.1f MB) en %.3f s (%.0f MB/s), reducción %.3f s\n",
+           tot.lineas, por_cuenta ? "apuntes" : "líneas", tot.bytes / 1e6, t1 - t0, tot.bytes / 1e6 / (t1 - t0 > 0 ? t1 - t0 : 1e-9),
+           t2 - t1);
+    for (int e = 0; e < NUM_EVENTOS; ++e) printf("  %-24s %ld\n", nombres_evento[e], tot.eventos[e]);
+    if (tot.anteriores)   printf("  %-24s %ld\n", "anteriores al corte", tot.anteriores);
+    if (tot.dudosas)      printf("  %-24s %ld  (mismo segundo que la foto: no aplicadas)\n",
+                                 "dudosas", tot.dudosas);
+    if (tot.sin_cuenta)   printf("  %-24s %ld\n", "cuentas fuera de la base", tot.sin_cuenta);
+    if (tot.ilegibles)    printf("  %-24s %ld\n", por_cuenta ? "apuntes no válidos" : "líneas no reconocidas",
+                                 tot.ilegibles);
+    if (tot.lotes_sin_detalle)
+        printf("  ¡%ld lotes sin apuntes en el log global: use cuentas=1!\n", tot.lotes_sin_detalle);
+
+    /* 3. Comparación con cuentas.dat */
+    if (migrar_cuentas(cfg.archivo_cuentas) == -1) goto fin;
+    int fd = open(cfg.archivo_cuentas, reparar ? O_RDWR : O_RDONLY);
+    if (fd == -1) { perror(cfg.archivo_cuentas); goto fin; }
+    struct stat st;
+    fstat(fd, &st);
+    size_t num_disco = st.st_size / sizeof(Cuenta);
+    Cuenta *disco = num_disco ? mmap(NULL, num_disco * sizeof(Cuenta),
+                                     PROT_READ | (reparar ? PROT_WRITE : 0), MAP_SHARED, fd, 0)
+                              : NULL;
+    close(fd);
+    if (disco == MAP_FAILED) { perror("mmap cuentas"); goto fin; }
+
+    int64_t *saldos = saldos_tabla(tabla);
+    int64_t total_esperado = 0, total_disco = 0;
+    long distintas = 0, fuera = 0;
+    for (int i = 0; i < n; ++i) total_esperado += saldos[i];
+
+    printf("\n%-8s %16s %16s %16s\n", "cuenta", "reconstruido", "en disco", "diferencia");
+    for (size_t i = 0; i < num_disco; ++i) {
+        int64_t en_disco = disco[i].saldo;
+        total_disco += en_disco;
+        int idx = buscar_cuenta(tabla, disco[i].numero_cuenta);
+        if (idx == -1) { fuera++; continue; }
+        if (en_disco == saldos[idx]) continue;
+
+        if (distintas++ < listar) {
+            char a[32], b[32], c[32];
+            formato_centimos(a, sizeof a, saldos[idx]);
+            formato_centimos(b, sizeof b, en_disco);
+            formato_centimos(c, sizeof c, saldos[idx] - en_disco);
+            printf("%-8d %16s %16s %16s\n", disco[i].numero_cuenta, a, b, c);
+        }
+        if (reparar) disco[i].saldo = saldos[idx];
+    }
+    if (distintas > listar) printf("… y otras %ld (listar=%d)\n", distintas - listar, listar);
+    printf("\n%ld de %zu cuentas distintas", distintas, num_disco);
+    if (fuera) printf(", %ld en disco sin base", fuera);
+    printf("\n");
+    imprimir_centimos("Total reconstruido", total_esperado);
+    imprimir_centimos("Total en disco", total_disco);
+
+    if (reparar && distintas > 0) {
+        msync(disco, num_disco * sizeof(Cuenta), MS_SYNC);
+        printf("%s reparado: %ld cuentas reescritas\n", cfg.archivo_cuentas, distintas);
+    }
+    if (disco) munmap(disco, num_disco * sizeof(Cuenta));
+
+    struct stat sw;
+    if (archivo_wal[0] && stat(archivo_wal, &sw) == 0 && sw.st_size > 0)
+        printf("Aviso: %s tiene %lld registros; banco los reaplicará al arrancar\n",
+               archivo_wal, (long long)(sw.st_size / sizeof(RegistroWAL)));
+    estado = distintas == 0 || reparar ? 0 : 1;
+
+    /* Cualquier salida tras crear la tabla pasa por aquí: el segmento no
+     * se queda huérfano.                                                 */
+fin:
+    for (int h = 0; h < hilos; ++h) free(trozos[h].delta);
+    if (mapa) munmap((void *)mapa, tam_mapa);
+    free(segmentos);
+    destruir_tabla(tabla);
+    liberar_shm(tabla, shm_id);
+    return estado;
+}
@@ -0,0 +1,402 @@
+/* registro.c — Registro (logs) asíncrono de SecureBank
+ *
+ *  ▸ append_log() y anotar_historial() sólo copian la línea o el apunte en
+ *    un anillo sin cerrojos del propio proceso y vuelven; no hacen open,
+ *    write ni strftime en el camino de la operación.
+ *  ▸ Un hilo escritor vacía el anillo por lotes: agrupa las líneas por
+ *    fichero, mantiene abiertos los descriptores (O_APPEND, así varias
+ *    líneas salen en un único write atómico) y formatea la marca de tiempo
+ *    una sola vez por segundo.  Los apuntes de cuenta se juntan y van al
+ *    historial binario (historial.c) con un pwrite por lote.
+ *  ▸ Con BACKEND_ES=uring (registro_backend) cada vaciado prepara un
+ *    write por log global y los envía todos con una sola llamada al
+ *    núcleo.
+ *  ▸ registro_cerrar() (registrado con atexit) vacía lo pendiente antes de
+ *    terminar.  registro_iniciar() además convierte SIGTERM/SIGHUP/SIGINT
+ *    en un exit() ordenado para que los logs sobrevivan al cierre de banco.
+ *    Ese exit() espera a que ninguna operación del proceso esté dentro de
+ *    la SHM (seccion_entrar/seccion_salir): salir con una franja tomada,
+ *    como líder del diario o a medio seqlock pararía a los demás.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+#define CAP_REGISTRO   4096              /* líneas en el anillo (2^n)   */
+#define MAX_RUTAS      8                 /* logs globales distintos     */
+#define TAM_LOTE       8192              /* bytes por fichero y write   */
+#define LOTE_HISTORIAL 256               /* apuntes por pwrite          */
+
+typedef struct {
+    int    ruta;                         /* rutas[ruta]; -1: apunte     */
+    time_t ts;
+    union {
+        char              texto[120];
+        RegistroHistorial apunte;
+    };
+} LineaLog;
+
+typedef struct {
+    atomic_size_t secuencia;
+    LineaLog      l;
+} CeldaLog;
+
+/* Destino de escritura: un log global con su búfer de lote. */
+typedef struct {
+    int    fd;
+    size_t usados;
+    char   buf[TAM_LOTE];
+} Destino;
+
+static CeldaLog        anillo[CAP_REGISTRO];
+static atomic_size_t   cabeza, cola;
+static atomic_int      durmiendo, parar;
+
+static char            rutas[MAX_RUTAS][64];
+static atomic_int      num_rutas;
+static pthread_mutex_t mtx_rutas = PTHREAD_MUTEX_INITIALIZER;
+
+static Destino         globales[MAX_RUTAS];
+
+static Config            cfg_historial;          /* DIRECTORIO_HISTORIAL… */
+static Historial         historial;
+static int               historial_listo;        /* 0 sin abrir, 1 abierto */
+static RegistroHistorial lote_historial[LOTE_HISTORIAL];
+static int               num_historial;
+
+static pthread_mutex_t mtx_aviso = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  hay_lineas = PTHREAD_COND_INITIALIZER;
+static pthread_t       escritor;
+static pthread_once_t  arranque = PTHREAD_ONCE_INIT;
+static int             escritor_vivo;
+
+static atomic_int      en_seccion, terminando;
+
+static atomic_int      backend = ES_POSIX;
+static Uring           anillo_es;           /* sólo lo usa el escritor */
+static int             anillo_es_listo;     /* 0 sin probar, 1, -1     */
+
+/*─────────────────────────────────────────────*/
+/*            ANILLO MPSC DEL PROCESO          */
+/*─────────────────────────────────────────────*/
+
+static int anillo_push(const LineaLog *l) {
+    size_t pos = atomic_load_explicit(&cabeza, memory_order_relaxed);
+    for (;;) {
+        CeldaLog *c = &anillo[pos & (CAP_REGISTRO - 1)];
+        size_t seq = atomic_load_explicit(&c->secuencia, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&cabeza, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                c->l = *l;
+                atomic_store_explicit(&c->secuencia, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (dif < 0) {
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&cabeza, memory_order_relaxed);
+        }
+    }
+}
+
+/* Un único consumidor (el escritor): no necesita CAS. */
+static int anillo_pop(LineaLog *l) {
+    size_t pos = atomic_load_explicit(&cola, memory_order_relaxed);
+    CeldaLog *c = &anillo[pos & (CAP_REGISTRO - 1)];
+    if (atomic_load_explicit(&c->secuencia, memory_order_acquire) != pos + 1)
+        return 0;
+    *l = c->l;
+    atomic_store_explicit(&c->secuencia, pos + CAP_REGISTRO, memory_order_release);
+    atomic_store_explicit(&cola, pos + 1, memory_order_relaxed);
+    return 1;
+}
+
+/*─────────────────────────────────────────────*/
+/*               HILO ESCRITOR                 */
+/*─────────────────────────────────────────────*/
+
+static Destino *destino_global(int ruta) {
+    Destino *d = &globales[ruta];
+    if (d->fd == -1) {
+        d->fd = open(rutas[ruta], O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (d->fd == -1) perror(rutas[ruta]);
+    }
+    return d;
+}
+
+/* ¿Está abierto el fichero del destino?  Si no, se reintenta abrirlo; sin
+ * él las líneas se quedan en el búfer para el siguiente vaciado.         */
+static int destino_abierto(Destino *d) {
+    return d->fd != -1 || destino_global((int)(d - globales))->fd != -1;
+}
+
+static void vaciar_destino(Destino *d) {
+    if (d->usados == 0 || !destino_abierto(d)) return;
+    if (write(d->fd, d->buf, d->usados) == -1) perror("write log");
+    else metrica_sumar(M_BYTES_LOG, d->usados);
+    d->usados = 0;
+}
+
+/* "[AAAA-MM-DD hh:mm:ss]" recalculado sólo cuando cambia el segundo. */
+static const char *marca_tiempo(time_t ts) {
+    static time_t ultimo = (time_t)-1;
+    static char   txt[32];
+    if (ts != ultimo) {
+        struct tm tm;
+        localtime_r(&ts, &tm);
+        strftime(txt, sizeof txt, "[%Y-%m-%d %H:%M:%S]", &tm);
+        ultimo = ts;
+    }
+    return txt;
+}
+
+/* El historial se abre la primera vez que hay apuntes que escribir.  Lo
+ * que no llega a disco (sin historial o con error) se queda en el lote
+ * para el siguiente vaciado, como las líneas de los logs.               */
+static void vaciar_historial(void) {
+    if (num_historial == 0) return;
+    if (!historial_listo)
+        historial_listo = historial_abrir(&historial, &cfg_historial, 1) == 0;
+    if (!historial_listo) return;
+
+    int pendientes = historial_escribir(&historial, lote_historial, num_historial);
+    metrica_sumar(M_BYTES_LOG, (long)(num_historial - pendientes) * sizeof(RegistroHistorial));
+    if (pendientes > 0) perror("historial");
+    num_historial = pendientes;
+}
+
+static void escribir_linea(const LineaLog *l) {
+    if (l->ruta < 0) {
+        if (num_historial == LOTE_HISTORIAL) vaciar_historial();
+        if (num_historial == LOTE_HISTORIAL) {   /* sin historial y sin sitio */
+            metrica_sumar(M_APUNTES_PERDIDOS, 1);
+            return;
+        }
+        lote_historial[num_historial++] = l->apunte;
+        if (num_historial == LOTE_HISTORIAL) vaciar_historial();
+        return;
+    }
+    Destino *d = destino_global(l->ruta);
+
+    char linea[192];
+    int n = snprintf(linea, sizeof linea, "%s %s\n", marca_tiempo(l->ts), l->texto);
+    if (n >= (int)sizeof linea) n = sizeof linea - 1;
+
+    if (d->usados + n > TAM_LOTE) vaciar_destino(d);
+    if (d->usados + n > TAM_LOTE) return;  /* sin fichero y sin sitio */
+    memcpy(d->buf + d->usados, linea, n);
+    d->usados += n;
+}
+
+/* Un write (O_APPEND, desplazamiento -1) por log global con datos y un
+ * único io_uring_enter para todos; se espera a que acaben porque los búferes se
+ * reutilizan en cuanto vuelve.  0 si no se pudo usar io_uring.           */
+static int vaciar_todo_uring(void) {
+    if (anillo_es_listo == 0) {
+        anillo_es_listo = uring_iniciar(&anillo_es, MAX_RUTAS) == 0 ? 1 : -1;
+        if (anillo_es_listo < 0) fputs("registro: io_uring no disponible\n", stderr);
+    }
+    if (anillo_es_listo < 0) return 0;
+
+    int enviados[MAX_RUTAS] = { 0 };
+    for (int i = 0; i < MAX_RUTAS; ++i) {
+        Destino *d = &globales[i];
+        if (d->usados > 0 && destino_abierto(d)) {
+            uring_write(&anillo_es, d->fd, d->buf, d->usados, -1, 0);
+            metrica_sumar(M_BYTES_LOG, d->usados);
+            enviados[i] = 1;
+        }
+    }
+    uring_enviar(&anillo_es, 0);
+    uring_esperar_todo(&anillo_es);
+    for (int i = 0; i < MAX_RUTAS; ++i) if (enviados[i]) globales[i].usados = 0;
+    return 1;
+}
+
+static void vaciar_todo(void) {
+    vaciar_historial();
+    if (atomic_load_explicit(&backend, memory_order_relaxed) == ES_URING && vaciar_todo_uring())
+        return;
+    for (int i = 0; i < MAX_RUTAS; ++i) vaciar_destino(&globales[i]);
+}
+
+static void *hilo_escritor(void *arg) {
+    (void)arg;
+    LineaLog l;
+
+    for (;;) {
+        int n = 0;
+        while (anillo_pop(&l)) { escribir_linea(&l); ++n; }
+        if (n > 0) vaciar_todo();
+
+        if (atomic_load(&parar)) {
+            while (anillo_pop(&l)) escribir_linea(&l);
+            vaciar_todo();
+            if (num_historial > 0) {
+                fprintf(stderr, "historial: %d apuntes sin escribir al salir\n", num_historial);
+                metrica_sumar(M_APUNTES_PERDIDOS, num_historial);
+            }
+            break;
+        }
+
+        pthread_mutex_lock(&mtx_aviso);
+        atomic_store(&durmiendo, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&cabeza) == atomic_load(&cola) && !atomic_load(&parar))
+            pthread_cond_wait(&hay_lineas, &mtx_aviso);
+        atomic_store(&durmiendo, 0);
+        pthread_mutex_unlock(&mtx_aviso);
+    }
+
+    for (int i = 0; i < MAX_RUTAS; ++i) if (globales[i].fd != -1) close(globales[i].fd);
+    if (historial_listo > 0) historial_cerrar(&historial);
+    if (anillo_es_listo > 0) uring_cerrar(&anillo_es);
+    return NULL;
+}
+
+/*─────────────────────────────────────────────*/
+/*          ARRANQUE, CIERRE Y SEÑALES         */
+/*─────────────────────────────────────────────*/
+
+static void arrancar_escritor(void) {
+    for (size_t i = 0; i < CAP_REGISTRO; ++i) atomic_init(&anillo[i].secuencia, i);
+    for (int i = 0; i < MAX_RUTAS; ++i) globales[i].fd = -1;
+
+    if (pthread_create(&escritor, NULL, hilo_escritor, NULL) != 0) {
+        perror("pthread_create registro");
+        return;
+    }
+    escritor_vivo = 1;
+    atexit(registro_cerrar);
+}
+
+/* Vacía todas las líneas pendientes y detiene el escritor. */
+void registro_cerrar(void) {
+    if (!escritor_vivo) return;
+    escritor_vivo = 0;
+
+    pthread_mutex_lock(&mtx_aviso);
+    atomic_store(&parar, 1);
+    pthread_cond_signal(&hay_lineas);
+    pthread_mutex_unlock(&mtx_aviso);
+    pthread_join(escritor, NULL);
+}
+
+/* Hilo que recibe las señales de terminación y sale con exit(), de forma
+ * que corren los atexit (registro_cerrar) fuera de un manejador.  Antes
+ * cierra la puerta a operaciones nuevas y espera a las que estén dentro. */
+static void *hilo_senales(void *arg) {
+    sigset_t *set = arg;
+    int sig;
+    sigwait(set, &sig);
+
+    struct timespec pausa = {0, 1000000L};  // 1 ms
+    atomic_store(&terminando, 1);
+    while (atomic_load(&en_seccion) > 0) nanosleep(&pausa, NULL);
+    exit(0);
+}
+
+/* Marcan una operación que toma franjas, el diario o el seqlock.  Si el
+ * proceso ya está terminando, el hilo no entra: se queda parado hasta que
+ * el exit() del hilo de señales acabe con él.                            */
+void seccion_entrar(void) {
+    atomic_fetch_add(&en_seccion, 1);
+    if (!atomic_load(&terminando)) return;
+    atomic_fetch_sub(&en_seccion, 1);
+    for (;;) pause();
+}
+
+void seccion_salir(void) {
+    atomic_fetch_sub(&en_seccion, 1);
+}
+
+/* Backend de escritura de los logs (BACKEND_ES en config.txt). */
+void registro_backend(BackendES b) {
+    atomic_store(&backend, b);
+}
+
+/* Dónde y cómo rota el historial (DIRECTORIO_HISTORIAL…); sin llamarla,
+ * "historial" con los valores por defecto.  Antes del primer apunte.     */
+void registro_historial(const Config *cfg) {
+    cfg_historial = *cfg;
+}
+
+/* Llamar al principio de main, antes de crear otros hilos, para que
+ * SIGTERM/SIGHUP/SIGINT terminen el proceso vaciando los logs.           */
+void registro_iniciar(void) {
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_t h;
+    if (pthread_create(&h, NULL, hilo_senales, &set) == 0)
+        pthread_detach(h);
+
+    pthread_once(&arranque, arrancar_escritor);
+}
+
+/*─────────────────────────────────────────────*/
+/*                PRODUCTORES                  */
+/*─────────────────────────────────────────────*/
+
+static void encolar(const LineaLog *l) {
+    pthread_once(&arranque, arrancar_escritor);
+
+    struct timespec pausa = {0, 100000L};  // 0,1 ms: anillo lleno
+    while (!anillo_push(l)) nanosleep(&pausa, NULL);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&durmiendo, memory_order_relaxed)) {
+        pthread_mutex_lock(&mtx_aviso);
+        pthread_cond_signal(&hay_lineas);
+        pthread_mutex_unlock(&mtx_aviso);
+    }
+}
+
+/* Índice de la ruta en `rutas`, registrándola la primera vez. */
+static int id_ruta(const char *ruta) {
+    int n = atomic_load_explicit(&num_rutas, memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+        if (strcmp(rutas[i], ruta) == 0) return i;
+
+    pthread_mutex_lock(&mtx_rutas);
+    n = atomic_load(&num_rutas);
+    int id = -1;
+    for (int i = 0; i < n && id == -1; ++i)
+        if (strcmp(rutas[i], ruta) == 0) id = i;
+    if (id == -1 && n < MAX_RUTAS) {
+        snprintf(rutas[n], sizeof rutas[0], "%s", ruta);
+        atomic_store_explicit(&num_rutas, n + 1, memory_order_release);
+        id = n;
+    }
+    pthread_mutex_unlock(&mtx_rutas);
+    return id;
+}
+
+void registro_global(const char *ruta_log, const char *linea) {
+    int id = id_ruta(ruta_log);
+    if (id == -1) { fprintf(stderr, "registro: demasiados logs globales\n"); return; }
+    LineaLog l = { .ruta = id, .ts = time(NULL) };
+    snprintf(l.texto, sizeof l.texto, "%s", linea);
+    encolar(&l);
+}
+
+void registro_apunte(const RegistroHistorial *r) {
+    LineaLog l = { .ruta = -1, .apunte = *r };
+    encolar(&l);
+}
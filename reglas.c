@@ -0,0 +1,223 @@
+/* reglas.c — Motor de reglas de anomalía del monitor
+ *
+ *  ▸ Las reglas se declaran en config.txt (REGLA=, ver ficheros.c).  Cada
+ *    una tiene su almacén acotado (contadores.c) con una ventana por clave:
+ *    cuenta de origen, par origen/destino o, en las de sesiones, cuenta.
+ *  ▸ Una ventana de `ventana_s` segundos son CUBETAS_VENTANA cubetas de
+ *    ancho fijo en un anillo, con el número de operaciones y la suma de
+ *    cada una y los totales de toda la ventana.  Un evento vacía las
+ *    cubetas que han quedado atrás (como mucho todas) y suma en la suya:
+ *    trabajo constante por evento y por regla.  La ventana es exacta al
+ *    ancho de una cubeta.
+ *  ▸ Las sesiones guardan hasta MAX_PIDS_SESION pids con la última vez que
+ *    cada uno tocó la cuenta; salta cuando `max_ops` siguen dentro de la
+ *    ventana a la vez (README: uso simultáneo desde varios procesos).
+ *  ▸ Tras una alerta la misma regla calla para esa clave una ventana, y una
+ *    entrada sin tocar más de una ventana vuelve a cero sola (ttl).
+ *  ▸ Los productores no se ordenan entre sí: un evento algo atrasado suma en
+ *    su cubeta; si ya salió de la ventana sólo se cuenta en `atrasados`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+
+#define CUBETAS_VENTANA 8                /* potencia de 2 */
+#define NS 1000000000LL
+
+typedef struct {
+    int64_t ultima;              /* índice absoluto de la cubeta más reciente */
+    int64_t suma;                /* céntimos dentro de la ventana */
+    int64_t silencio_ns;         /* no repetir la alerta antes de esto */
+    int32_t ops;
+    int32_t cub_ops[CUBETAS_VENTANA];
+    int64_t cub_suma[CUBETAS_VENTANA];
+} Ventana;
+
+typedef struct {
+    int32_t pid[MAX_PIDS_SESION];        /* una sesión es pid + conexión */
+    int32_t sesion[MAX_PIDS_SESION];
+    int64_t visto_ns[MAX_PIDS_SESION];
+    int64_t silencio_ns;
+} Sesiones;
+
+static uint64_t clave_par(int origen, int destino) {
+    return (uint64_t)(uint32_t)origen << 32 | (uint32_t)destino;
+}
+
+/*─────────────────────────────────────────────*/
+/*                 INICIALIZACIÓN              */
+/*─────────────────────────────────────────────*/
+
+void motor_iniciar(MotorReglas *m, const Config *cfg) {
+    memset(m, 0, sizeof *m);
+    m->num_reglas = cfg->num_reglas;
+    for (int i = 0; i < m->num_reglas; ++i) {
+        m->reglas[i] = cfg->reglas[i];
+        size_t tam = m->reglas[i].clave == REGLA_SESIONES ? sizeof(Sesiones) : sizeof(Ventana);
+        ac_iniciar_datos(&m->estado[i], cfg->capacidad_contadores, m->reglas[i].ventana_s, tam);
+    }
+}
+
+void motor_liberar(MotorReglas *m) {
+    for (int i = 0; i < m->num_reglas; ++i) ac_liberar(&m->estado[i]);
+    m->num_reglas = 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*              VENTANAS DESLIZANTES           */
+/*─────────────────────────────────────────────*/
+
+/* Lleva la ventana hasta la cubeta b (> ultima) vaciando las que salen. */
+static void avanzar(Ventana *v, int64_t b) {
+    if (b - v->ultima >= CUBETAS_VENTANA) {
+        memset(v->cub_ops, 0, sizeof v->cub_ops);
+        memset(v->cub_suma, 0, sizeof v->cub_suma);
+        v->ops  = 0;
+        v->suma = 0;
+    } else {
+        for (int64_t k = v->ultima + 1; k <= b; ++k) {
+            int c = (int)(k & (CUBETAS_VENTANA - 1));
+            v->ops  -= v->cub_ops[c];
+            v->suma -= v->cub_suma[c];
+            v->cub_ops[c]  = 0;
+            v->cub_suma[c] = 0;
+        }
+    }
+    v->ultima = b;
+}
+
+static int evaluar_ventana(MotorReglas *m, int i, const Evento *ev, Alerta *a) {
+    const ReglaAnomalia *r = &m->reglas[i];
+    int64_t importe = llabs(ev->centimos);
+    if (importe < r->importe_min) return 0;
+
+    uint64_t clave = r->clave == REGLA_PAR ? clave_par(ev->cuenta[0], ev->cuenta[1])
+                                           : (uint32_t)ev->cuenta[0];
+    Ventana *v = ac_datos(&m->estado[i], clave, (time_t)(ev->ts_ns / NS));
+
+    int64_t ventana_ns = r->ventana_s * NS;
+    int64_t b = ev->ts_ns / (ventana_ns / CUBETAS_VENTANA);
+    if (b > v->ultima) {
+        avanzar(v, b);
+    } else if (v->ultima - b >= CUBETAS_VENTANA) {
+        m->atrasados++;
+        return 0;
+    }
+    int c = (int)(b & (CUBETAS_VENTANA - 1));
+    v->cub_ops[c]++;
+    v->cub_suma[c] += importe;
+    v->ops++;
+    v->suma += importe;
+
+    if (ev->ts_ns < v->silencio_ns) return 0;
+    if (!(r->max_ops > 0 && v->ops >= r->max_ops) &&
+        !(r->max_importe > 0 && v->suma >= r->max_importe)) return 0;
+
+    v->silencio_ns = ev->ts_ns + ventana_ns;
+    memset(a, 0, sizeof *a);
+    a->regla   = r;
+    a->cuenta  = ev->cuenta[0];
+    a->destino = r->clave == REGLA_PAR ? ev->cuenta[1] : -1;
+    a->ops     = v->ops;
+    a->suma    = v->suma;
+    return 1;
+}
+
+/*─────────────────────────────────────────────*/
+/*             SESIONES SIMULTÁNEAS            */
+/*─────────────────────────────────────────────*/
+
+static int evaluar_sesiones(MotorReglas *m, int i, const Evento *ev, Alerta *a) {
+    const ReglaAnomalia *r = &m->reglas[i];
+    Sesiones *s = ac_datos(&m->estado[i], (uint32_t)ev->cuenta[0], (time_t)(ev->ts_ns / NS));
+    int64_t desde = ev->ts_ns - r->ventana_s * NS;
+
+    /* Hueco de la sesión: el suyo o, si no tiene, el visto hace más
+     * tiempo (los libres tienen visto_ns = 0).  Las conexiones de
+     * servidor.c comparten pid y se distinguen por `sesion`.             */
+    int k = -1, viejo = 0;
+    for (int j = 0; j < MAX_PIDS_SESION; ++j) {
+        if (s->pid[j] == ev->pid && s->sesion[j] == ev->sesion) { k = j; break; }
+        if (s->visto_ns[j] < s->visto_ns[viejo]) viejo = j;
+    }
+    if (k == -1) {
+        k = viejo;
+        s->pid[k] = ev->pid;
+        s->sesion[k] = ev->sesion;
+        s->visto_ns[k] = 0;
+    }
+    if (ev->ts_ns > s->visto_ns[k]) s->visto_ns[k] = ev->ts_ns;
+
+    int vivos = 0;
+    for (int j = 0; j < MAX_PIDS_SESION; ++j)
+        if (s->pid[j] != 0 && s->visto_ns[j] >= desde) {
+            a->pids[vivos] = s->pid[j];
+            a->sesiones[vivos++] = s->sesion[j];
+        }
+
+    if (vivos < r->max_ops || ev->ts_ns < s->silencio_ns) return 0;
+
+    s->silencio_ns = ev->ts_ns + r->ventana_s * NS;
+    a->regla   = r;
+    a->cuenta  = ev->cuenta[0];
+    a->destino = -1;
+    a->ops     = vivos;
+    a->suma    = 0;
+    for (int j = vivos; j < MAX_PIDS_SESION; ++j) a->pids[j] = a->sesiones[j] = 0;
+    return 1;
+}
+
+/*─────────────────────────────────────────────*/
+/*                  EVALUACIÓN                 */
+/*─────────────────────────────────────────────*/
+
+/* Pasa el evento por todas las reglas y deja en `alertas` (hasta `max`)
+ * las que saltan.  Devuelve cuántas.                                     */
+int motor_evaluar(MotorReglas *m, const Evento *ev, Alerta *alertas, int max) {
+    int n = 0;
+    m->eventos++;
+    for (int i = 0; i < m->num_reglas && n < max; ++i) {
+        const ReglaAnomalia *r = &m->reglas[i];
+        if (r->tipo != 0 && r->tipo != ev->tipo) continue;
+        int salta = r->clave == REGLA_SESIONES ? evaluar_sesiones(m, i, ev, &alertas[n])
+                                               : evaluar_ventana(m, i, ev, &alertas[n]);
+        if (salta) {
+            m->disparos[i]++;
+            n++;
+        }
+    }
+    return n;
+}
+
+static const char *que_cuenta(int tipo) {
+    switch (tipo) {
+    case OP_DEPOSITO:      return "depósitos";
+    case OP_RETIRO:        return "retiros";
+    case OP_TRANSFERENCIA: return "transferencias";
+    case OP_LOTE:          return "lotes";
+    default:               return "operaciones";
+    }
+}
+
+void describir_alerta(const Alerta *a, char *dst, size_t n) {
+    const ReglaAnomalia *r = a->regla;
+    long long euros = a->suma / 100, cts = a->suma % 100;
+
+    if (r->clave == REGLA_SESIONES) {
+        int k = snprintf(dst, n, "ALERTA [%s]: cuenta %d usada desde %d sesiones en %d s (pid[/conexión]",
+                         r->nombre, a->cuenta, a->ops, r->ventana_s);
+        for (int j = 0; j < a->ops && k > 0 && (size_t)k < n; ++j)
+            k += a->sesiones[j] ? snprintf(dst + k, n - k, " %d/%d", a->pids[j], a->sesiones[j])
+                                : snprintf(dst + k, n - k, " %d", a->pids[j]);
+        if (k > 0 && (size_t)k < n) snprintf(dst + k, n - k, ")");
+    } else if (r->clave == REGLA_PAR) {
+        snprintf(dst, n, "ALERTA [%s]: %d transferencias de %d a %d en %d s (%lld.%02lld €)",
+                 r->nombre, a->ops, a->cuenta, a->destino, r->ventana_s, euros, cts);
+    } else {
+        snprintf(dst, n, "ALERTA [%s]: %d %s en cuenta %d en %d s (%lld.%02lld €)",
+                 r->nombre, a->ops, que_cuenta(r->tipo), a->cuenta, r->ventana_s, euros, cts);
+    }
+}
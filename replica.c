@@ -0,0 +1,95 @@
+/* replica.c — Réplica de lectura de SecureBank
+ *   ● Se conecta a SOCKET_REPLICA de un banco en marcha, carga la foto
+ *     que le manda y después aplica los registros del diario según se
+ *     hacen durables (replicacion.c).  Un hilo recibe; el principal
+ *     atiende consultas, que no tocan el segmento de banco.
+ *   ● Su tabla vive en un segmento propio, de sólo lectura para los
+ *     demás: ./bench carga <shm_id> mezcla=0,0,0,100 o ./estadisticas
+ *     pueden leer de él en lugar de cargar al primario.
+ *   ● Órdenes por stdin:  <cuenta>  saldo;  i  informe (auditoría de la
+ *     tabla);  r  retraso;  ENTER  salir.
+ *
+ *  Ejecutar:  ./replica
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "utils.h"
+
+static Replica    rep;
+static atomic_int conectada = 1;
+
+static void *recibir(void *arg)
+{
+    (void)arg;
+    while (replica_recibir(&rep)) ;
+    atomic_store(&conectada, 0);
+    return NULL;
+}
+
+static void imprimir_retraso(void)
+{
+    uint64_t registros;
+    double   ms;
+    replica_retraso(&rep, &registros, &ms);
+    printf("Aplicado hasta el lsn %llu (%ld registros recibidos); retraso %llu registros, %.3f ms%s\n",
+           (unsigned long long)atomic_load(&rep.aplicado), atomic_load(&rep.registros),
+           (unsigned long long)registros, ms,
+           atomic_load(&conectada) ? "" : " (banco desconectado)");
+}
+
+static void informe(void)
+{
+    Auditoria a = { 0 };
+    ImplAuditoria impl = auditar_tabla(rep.tabla, &a, AUD_AUTO);
+    printf("%d cuentas, total %lld.%02lld €, %ld en negativo, %ld bloqueadas (%s)\n",
+           rep.tabla->num_cuentas, (long long)(a.total / 100), (long long)(a.total % 100),
+           a.negativas, a.bloqueadas, nombre_auditoria(impl));
+    imprimir_retraso();
+}
+
+int main(void)
+{
+    Config cfg = leer_config("config.txt");
+    if (cfg.socket_replica[0] == '\0') {
+        fprintf(stderr, "config.txt: falta SOCKET_REPLICA\n");
+        return 1;
+    }
+    if (replica_conectar(&rep, &cfg) == -1) return 1;
+
+    pthread_t hilo;
+    if (pthread_create(&hilo, NULL, recibir, NULL) != 0) { perror("pthread_create"); return 1; }
+
+    printf("Réplica de %s: %d cuentas desde el lsn %llu, segmento SHM %d\n",
+           cfg.socket_replica, rep.tabla->num_cuentas,
+           (unsigned long long)atomic_load(&rep.aplicado), rep.shm_id);
+    puts("<cuenta> saldo · i informe · r retraso · ENTER sale");
+    fflush(stdout);
+
+    char linea[64];
+    while (fgets(linea, sizeof linea, stdin) && linea[0] != '\n') {
+        int cuenta;
+        int64_t saldo;
+        if (linea[0] == 'i') informe();
+        else if (linea[0] == 'r') imprimir_retraso();
+        else if (sscanf(linea, "%d", &cuenta) == 1) {
+            if (op_saldo(rep.tabla, cuenta, &saldo) == OP_OK)
+                printf("Cuenta %d: %s%lld.%02lld €\n", cuenta, saldo < 0 ? "-" : "",
+                       llabs(saldo) / 100, llabs(saldo) % 100);
+            else
+                printf("Cuenta %d no existe.\n", cuenta);
+        }
+        fflush(stdout);
+    }
+
+    /* El hilo puede estar en recv(): se le corta el socket. */
+    shutdown(rep.fd, SHUT_RDWR);
+    pthread_join(hilo, NULL);
+    replica_cerrar(&rep);
+    return 0;
+}
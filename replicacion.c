@@ -0,0 +1,403 @@
+/* replicacion.c — Réplicas de lectura por envío del diario
+ *
+ *  ▸ En banco, un hilo escucha en SOCKET_REPLICA y cada réplica que se
+ *    conecta tiene su hilo emisor (hasta MAX_REPLICAS).  El emisor toma
+ *    una instantánea (instantaneas.c, sin parar las operaciones), se la
+ *    manda y desde su lsn va leyendo del fichero del diario los registros
+ *    que ya son durables y se los manda por lotes.
+ *  ▸ El emisor no toca cerrojos ni el anillo del diario: sólo lee
+ *    wal.durable y el fichero, que ya está en la caché de páginas.  Una
+ *    réplica lenta llena su socket y frena a su emisor, nunca a banco.
+ *    Su lsn queda en wal.retenido para que el hilo IO no recorte lo que
+ *    aún tiene que leer; tras cada recorte reabre el fichero.
+ *  ▸ La réplica (replica.c) aplica cada post-imagen sobre su propia tabla
+ *    con el seqlock de escritura, así op_saldo() y la auditoría leen de
+ *    ella sin cerrojos.  Los registros de un lote se guardan hasta tener
+ *    el último, como al recuperar: nunca se ve un lote a medias.
+ *  ▸ Retraso: en registros, lo durable en el primario menos lo aplicado;
+ *    en tiempo, cuánto hace que la réplica estaba al día (o, si lo está,
+ *    lo que tardó el último mensaje).
+ *  ▸ Hace falta el diario (ARCHIVO_WAL) y MODO_CUENTAS=shm.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "utils.h"
+
+#define REGISTROS_MENSAJE 256
+#define ESPERA_EMISOR_US  500            /* sondeo de wal.durable */
+#define LATIDO_MS         100
+#define BLOQUE_BASE       4096           /* cuentas por envío de la foto */
+
+static TablaCuentas *tabla;
+static Config        cfg;
+static int           escucha = -1;
+static atomic_int    parar;
+static pthread_t     hilo_escucha;
+
+static struct {
+    pthread_t hilo;
+    int       fd;
+    atomic_int activo;
+} emisores[MAX_REPLICAS];
+
+static int64_t reloj_real_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int enviar_todo(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k == -1 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+static int recibir_todo(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n > 0) {
+        ssize_t k = recv(fd, p, n, 0);
+        if (k == -1 && errno == EINTR) continue;
+        if (k <= 0) return -1;
+        p += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*              EMISOR (en banco)              */
+/*─────────────────────────────────────────────*/
+
+static int enviar_cabecera(int fd, TipoMensajeReplica tipo, int n, uint64_t lsn)
+{
+    MensajeReplica m = {
+        .tipo    = tipo,
+        .n       = n,
+        .lsn     = lsn,
+        .durable = atomic_load(&tabla->wal.durable),
+        .ts_ns   = reloj_real_ns(),
+    };
+    return enviar_todo(fd, &m, sizeof m);
+}
+
+/* Foto nueva y su contenido.  Devuelve su lsn o UINT64_MAX. */
+static uint64_t enviar_base(int fd)
+{
+    CabeceraFoto cab;
+    int version = foto_tomar(tabla, cfg.directorio_fotos, cfg.conservar_fotos, &cab, NULL);
+    if (version == -1) return UINT64_MAX;
+
+    char ruta[300];
+    foto_ruta(ruta, sizeof ruta, cfg.directorio_fotos, version);
+    FILE *f = fopen(ruta, "rb");
+    if (!f) { perror(ruta); return UINT64_MAX; }
+    fseek(f, sizeof cab, SEEK_SET);
+
+    int error = enviar_cabecera(fd, REP_BASE, cab.num_cuentas, cab.lsn) == -1;
+    Cuenta *bloque = malloc(BLOQUE_BASE * sizeof(Cuenta));
+    for (int i = 0; i < cab.num_cuentas && !error; i += BLOQUE_BASE) {
+        size_t n = cab.num_cuentas - i < BLOQUE_BASE ? (size_t)(cab.num_cuentas - i) : BLOQUE_BASE;
+        error = fread(bloque, sizeof(Cuenta), n, f) != n ||
+                enviar_todo(fd, bloque, n * sizeof(Cuenta)) == -1;
+    }
+    free(bloque);
+    fclose(f);
+    return error ? UINT64_MAX : cab.lsn;
+}
+
+/* Abre el fichero del diario tal como está ahora y deja en *base su
+ * primer lsn y en *gen su generación (el hilo IO lo recorta en marcha).  */
+static int abrir_diario(int wal, uint64_t *base, unsigned *gen)
+{
+    DiarioWAL *w = &tabla->wal;
+    do {
+        if (wal != -1) close(wal);
+        *gen  = atomic_load(&w->generacion);
+        *base = atomic_load(&w->base);
+        wal   = open(w->archivo, O_RDONLY);
+    } while (wal != -1 && *gen != atomic_load(&w->generacion));
+    return wal;
+}
+
+static void *emisor(void *arg)
+{
+    int i  = (int)(intptr_t)arg;
+    int fd = emisores[i].fd;
+    DiarioWAL *w = &tabla->wal;
+
+    /* Lo retenido no se recorta: primero la base actual (la foto queda
+     * por delante) y luego lo que ya se ha enviado.                      */
+    atomic_store(&w->retenido[i], atomic_load(&w->base));
+    uint64_t base;
+    unsigned gen;
+    int wal = abrir_diario(-1, &base, &gen);
+    uint64_t lsn = wal == -1 ? UINT64_MAX : enviar_base(fd);
+    if (lsn != UINT64_MAX) atomic_store(&w->retenido[i], lsn);
+
+    RegistroWAL *lote = malloc(REGISTROS_MENSAJE * sizeof(RegistroWAL));
+    struct timespec espera = { 0, ESPERA_EMISOR_US * 1000L };
+    int64_t ultimo = reloj_real_ns();
+    while (lsn != UINT64_MAX && !atomic_load(&parar)) {
+        uint64_t durable = atomic_load(&w->durable);
+        if (lsn < durable) {
+            if (gen != atomic_load(&w->generacion)) {
+                wal = abrir_diario(wal, &base, &gen);
+                if (wal == -1 || lsn < base) break;
+            }
+            int n = durable - lsn < REGISTROS_MENSAJE ? (int)(durable - lsn) : REGISTROS_MENSAJE;
+            ssize_t leido = pread(wal, lote, n * sizeof(RegistroWAL),
+                                  (off_t)(lsn - base) * sizeof(RegistroWAL));
+            if (leido != (ssize_t)(n * sizeof(RegistroWAL))) {
+                if (gen != atomic_load(&w->generacion)) continue;   /* recortado entretanto */
+                break;
+            }
+            if (enviar_cabecera(fd, REP_REGISTROS, n, lsn) == -1 ||
+                enviar_todo(fd, lote, n * sizeof(RegistroWAL)) == -1)
+                break;
+            lsn   += n;
+            atomic_store(&w->retenido[i], lsn);
+            ultimo = reloj_real_ns();
+            continue;
+        }
+        if (reloj_real_ns() - ultimo >= LATIDO_MS * 1000000LL) {
+            if (enviar_cabecera(fd, REP_LATIDO, 0, lsn) == -1) break;
+            ultimo = reloj_real_ns();
+        }
+        nanosleep(&espera, NULL);
+    }
+
+    atomic_store(&w->retenido[i], UINT64_MAX);
+    free(lote);
+    if (wal != -1) close(wal);
+    close(fd);
+    atomic_store(&emisores[i].activo, 0);
+    return NULL;
+}
+
+static void *bucle_escucha(void *arg)
+{
+    (void)arg;
+    struct pollfd pf = { .fd = escucha, .events = POLLIN };
+    while (!atomic_load(&parar)) {
+        if (poll(&pf, 1, LATIDO_MS) <= 0) continue;
+        int fd = accept(escucha, NULL, NULL);
+        if (fd == -1) continue;
+        /* Una réplica que deja de leer no retiene a su emisor al cerrar. */
+        struct timeval limite = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &limite, sizeof limite);
+
+        int i = 0;
+        while (i < MAX_REPLICAS && atomic_load(&emisores[i].activo)) ++i;
+        if (i == MAX_REPLICAS) {
+            fprintf(stderr, "replicación: más de %d réplicas\n", MAX_REPLICAS);
+            close(fd);
+            continue;
+        }
+        if (emisores[i].hilo) pthread_join(emisores[i].hilo, NULL);
+        emisores[i].fd = fd;
+        atomic_store(&emisores[i].activo, 1);
+        if (pthread_create(&emisores[i].hilo, NULL, emisor, (void *)(intptr_t)i) != 0) {
+            perror("pthread_create");
+            atomic_store(&emisores[i].activo, 0);
+            emisores[i].hilo = 0;
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+void replicacion_iniciar(TablaCuentas *t, const Config *c)
+{
+    if (c->socket_replica[0] == '\0') return;
+    if (!t->wal.activo || t->modo != MODO_SHM) {
+        fprintf(stderr, "replicación: hace falta ARCHIVO_WAL y MODO_CUENTAS=shm\n");
+        return;
+    }
+    tabla = t;
+    cfg   = *c;
+    atomic_init(&parar, 0);
+
+    escucha = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (escucha == -1) { perror("socket"); return; }
+
+    struct sockaddr_un dir = { .sun_family = AF_UNIX };
+    snprintf(dir.sun_path, sizeof dir.sun_path, "%s", cfg.socket_replica);
+    unlink(dir.sun_path);                /* socket de una ejecución anterior */
+    if (bind(escucha, (struct sockaddr *)&dir, sizeof dir) == -1 ||
+        listen(escucha, MAX_REPLICAS) == -1 ||
+        pthread_create(&hilo_escucha, NULL, bucle_escucha, NULL) != 0) {
+        perror(cfg.socket_replica);
+        close(escucha);
+        escucha = -1;
+    }
+}
+
+/* Corta las réplicas (ven el socket cerrado) antes de truncar el diario. */
+void replicacion_detener(void)
+{
+    if (escucha == -1) return;
+
+    atomic_store(&parar, 1);
+    pthread_join(hilo_escucha, NULL);
+    for (int i = 0; i < MAX_REPLICAS; ++i)
+        if (emisores[i].hilo) pthread_join(emisores[i].hilo, NULL);
+    memset(emisores, 0, sizeof emisores);
+
+    close(escucha);
+    unlink(cfg.socket_replica);
+    escucha = -1;
+}
+
+/*─────────────────────────────────────────────*/
+/*                   RÉPLICA                   */
+/*─────────────────────────────────────────────*/
+
+/* Se conecta a banco y carga la foto en una tabla propia.  Devuelve 0, o
+ * -1 sin dejar nada abierto.                                             */
+int replica_conectar(Replica *r, const Config *c)
+{
+    memset(r, 0, sizeof *r);
+    r->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (r->fd == -1) { perror("socket"); return -1; }
+
+    struct sockaddr_un dir = { .sun_family = AF_UNIX };
+    snprintf(dir.sun_path, sizeof dir.sun_path, "%s", c->socket_replica);
+    MensajeReplica m;
+    if (connect(r->fd, (struct sockaddr *)&dir, sizeof dir) == -1 ||
+        recibir_todo(r->fd, &m, sizeof m) == -1 || m.tipo != REP_BASE) {
+        perror(c->socket_replica);
+        close(r->fd);
+        return -1;
+    }
+
+    /* Sólo se lee: sin diario, y el buffer de E/S nadie lo vacía. */
+    Config propia = *c;
+    propia.archivo_wal[0] = '\0';
+    propia.modo_cuentas   = MODO_SHM;
+    int capacidad = m.n > 0 ? m.n : 1;
+    r->shm_id = crear_shm(capacidad, &propia);
+    r->tabla  = adjuntar_shm(r->shm_id);
+    inicializar_tabla(r->tabla, capacidad, &propia);
+
+    static Cuenta bloque[BLOQUE_BASE];
+    for (int i = 0; i < m.n; i += BLOQUE_BASE) {
+        int n = m.n - i < BLOQUE_BASE ? m.n - i : BLOQUE_BASE;
+        if (recibir_todo(r->fd, bloque, n * sizeof(Cuenta)) == -1) {
+            fprintf(stderr, "réplica: foto cortada\n");
+            replica_cerrar(r);
+            return -1;
+        }
+        for (int k = 0; k < n; ++k) insertar_cuenta(r->tabla, &bloque[k]);
+    }
+
+    r->lote = malloc((MAX_APUNTES / 2 + 1) * sizeof(RegistroWAL));
+    atomic_store(&r->aplicado, m.lsn);
+    atomic_store(&r->durable, m.durable);
+    atomic_store(&r->ts_al_dia, m.ts_ns);
+    return 0;
+}
+
+static void aplicar(Replica *r, const RegistroWAL *w)
+{
+    for (int k = 0; k < 2; ++k) {
+        if (w->cuenta[k] == -1) continue;
+        int idx = buscar_cuenta(r->tabla, w->cuenta[k]);
+        if (idx == -1) continue;
+        empezar_escritura(r->tabla, idx);
+        saldos_tabla(r->tabla)[idx] = w->saldo[k];
+        terminar_escritura(r->tabla, idx);
+    }
+}
+
+/* Recibe y aplica un mensaje.  Devuelve 1, o 0 si banco cerró (o mandó
+ * algo fuera de orden).                                                  */
+int replica_recibir(Replica *r)
+{
+    MensajeReplica m;
+    if (recibir_todo(r->fd, &m, sizeof m) == -1) return 0;
+
+    uint64_t aplicado = atomic_load(&r->aplicado);
+    if (m.tipo == REP_REGISTROS) {
+        static RegistroWAL regs[REGISTROS_MENSAJE];
+        if (m.n < 1 || m.n > REGISTROS_MENSAJE ||
+            recibir_todo(r->fd, regs, m.n * sizeof(RegistroWAL)) == -1)
+            return 0;
+        for (int i = 0; i < m.n; ++i) {
+            const RegistroWAL *w = &regs[i];
+            if (w->lsn != m.lsn + i) {
+                fprintf(stderr, "réplica: lsn %llu fuera de orden\n", (unsigned long long)w->lsn);
+                return 0;
+            }
+            if (r->en_lote > 0 && !wal_sigue_lote(&r->lote[r->en_lote - 1], w))
+                r->en_lote = 0;                  /* lote cortado por una anulación */
+            if (w->tipo == OP_LOTE) {
+                if (r->en_lote > MAX_APUNTES / 2) return 0;
+                r->lote[r->en_lote++] = *w;
+                if (w->resto > 0) continue;
+                for (int j = 0; j < r->en_lote; ++j) aplicar(r, &r->lote[j]);
+                r->en_lote = 0;
+            } else {
+                aplicar(r, w);
+            }
+            aplicado = w->lsn + 1;
+        }
+        atomic_fetch_add(&r->registros, m.n);
+    } else if (m.tipo != REP_LATIDO) {
+        return 0;
+    }
+
+    atomic_store(&r->aplicado, aplicado);
+    atomic_store(&r->durable, m.durable);
+    if (aplicado >= m.durable) {
+        atomic_store(&r->ts_al_dia, m.ts_ns);
+        atomic_store(&r->transito_ns, reloj_real_ns() - m.ts_ns);
+    }
+    return 1;
+}
+
+/* Registros durables en el primario que aún no están en la réplica y, en
+ * ms, cuánto hace que estaba al día (si lo está, lo que tardó el último
+ * mensaje en llegar y aplicarse).                                        */
+void replica_retraso(Replica *r, uint64_t *registros, double *ms)
+{
+    uint64_t aplicado = atomic_load(&r->aplicado);
+    uint64_t durable  = atomic_load(&r->durable);
+    *registros = durable > aplicado ? durable - aplicado : 0;
+    *ms = *registros ? (reloj_real_ns() - atomic_load(&r->ts_al_dia)) / 1e6
+                     : atomic_load(&r->transito_ns) / 1e6;
+}
+
+void replica_cerrar(Replica *r)
+{
+    if (r->fd != -1) close(r->fd);
+    r->fd = -1;
+    if (r->tabla) {
+        destruir_tabla(r->tabla);
+        liberar_shm(r->tabla, r->shm_id);
+        r->tabla = NULL;
+    }
+    free(r->lote);
+    r->lote = NULL;
+}
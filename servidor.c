@@ -0,0 +1,387 @@
+/* servidor.c — Sesiones de cliente por socket Unix dentro de banco
+ *
+ *  ▸ Un hilo con epoll acepta conexiones y vigila las existentes.  Cada
+ *    descriptor se registra con EPOLLONESHOT: cuando llega una petición la
+ *    conexión pasa a la cola de trabajo y nadie más la ve hasta que el
+ *    trabajador que la atiende la rearma.
+ *  ▸ Un pool fijo de HILOS_SERVIDOR trabajadores lee todas las peticiones
+ *    completas disponibles, las ejecuta con op_* (mismos límites, historial
+ *    y avisos al monitor que usuario.c) y responde en el mismo orden.
+ *  ▸ PET_HISTORIAL responde con los apuntes detrás de la Respuesta; antes
+ *    se envían las respuestas pendientes para no desordenar el flujo.  El
+ *    índice del segmento activo se lee al arrancar y lo pone al día un
+ *    hilo aparte, así un trabajador sólo busca y no lee megas del .act.
+ *  ▸ Ninguna conexión tiene hilo ni proceso propio: miles de clientes
+ *    ociosos sólo cuestan un descriptor y una estructura Conexion.
+ */
+#define _GNU_SOURCE                      /* accept4 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "utils.h"
+
+#define MAX_CONEXIONES  65536
+#define MAX_TRABAJADORES 64
+#define PETICIONES_LOTE 64               /* peticiones leídas de una vez */
+#define VUELTAS_MAX     16
+#define PREPARAR_HIST_MS 200             /* el índice del activo, al día */
+
+typedef struct {
+    int    fd;
+    int    sesion;                       /* nº de conexión, en los eventos */
+    int    cuenta;                       /* -1 hasta PET_SESION */
+    size_t usados;                       /* bytes pendientes en buf */
+    char   buf[PETICIONES_LOTE * sizeof(Peticion)];
+} Conexion;
+
+static TablaCuentas *tabla;
+static Config        cfg;
+static int           escucha = -1, ep = -1, despertador = -1;
+static atomic_int    parar;
+static pthread_t     hilo_eventos, hilo_historial, trabajadores[MAX_TRABAJADORES];
+static int           num_trabajadores;
+static Historial     hist;
+static int           hist_abierto;
+
+/* Cola de conexiones listas.  Gracias a EPOLLONESHOT cada conexión está
+ * como mucho una vez, así que MAX_CONEXIONES huecos bastan.              */
+static Conexion       *listas[MAX_CONEXIONES];
+static size_t          cabeza, cola;
+static int             abiertas, ultima_sesion;
+static pthread_mutex_t mutex_cola = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  hay_trabajo = PTHREAD_COND_INITIALIZER;
+
+/*─────────────────────────────────────────────*/
+/*                 OPERACIONES                 */
+/*─────────────────────────────────────────────*/
+
+/* Los saldos ya están en céntimos: se leen sin pasar por float. */
+static void saldo_de(int cuenta, Respuesta *r) {
+    int idx = buscar_cuenta(tabla, cuenta);
+    r->centimos = idx == -1 ? 0 : leer_saldo(tabla, idx);
+}
+
+static void iniciar_sesion(Conexion *c, int cuenta, Respuesta *r) {
+    int idx = buscar_cuenta(tabla, cuenta);
+    if (idx == -1) { r->estado = RES_CUENTA_NO_EXISTE; return; }
+
+    bloquear_cuenta(tabla, idx);
+    int bloqueada = (estados_tabla(tabla)[idx] & ESTADO_BLOQUEADA) != 0;
+    desbloquear_cuenta(tabla, idx);
+
+    if (bloqueada) { r->estado = RES_BLOQUEADA; return; }
+    c->cuenta = cuenta;
+    r->estado = RES_OK;
+    saldo_de(cuenta, r);
+}
+
+static void atender(Conexion *c, const Peticion *p, Respuesta *r) {
+    memset(r, 0, sizeof *r);
+    int64_t cent = p->centimos;
+
+    if (p->tipo == PET_SESION) { iniciar_sesion(c, p->cuenta, r); return; }
+    if (c->cuenta == -1)       { r->estado = RES_SIN_SESION;      return; }
+    if (p->tipo != PET_SALDO && p->centimos <= 0) { r->estado = RES_INVALIDA; return; }
+
+    switch (p->tipo) {
+    case PET_DEPOSITO:
+        r->estado = op_deposito(tabla, c->cuenta, cent);
+        if (r->estado == RES_OK) {
+            anotar_historial(c->cuenta, OP_DEPOSITO, -1, cent);
+            evento_publicar(tabla, OP_DEPOSITO, c->cuenta, -1, cent, c->sesion);
+        }
+        break;
+    case PET_RETIRO:
+        if (cent > (int64_t)cfg.limite_retiro * 100) { r->estado = RES_LIMITE; break; }
+        r->estado = op_retiro(tabla, c->cuenta, cent);
+        if (r->estado == RES_OK) {
+            anotar_historial(c->cuenta, OP_RETIRO, -1, -cent);
+            evento_publicar(tabla, OP_RETIRO, c->cuenta, -1, cent, c->sesion);
+        }
+        break;
+    case PET_TRANSFERENCIA:
+        if (cent > (int64_t)cfg.limite_transferencia * 100) { r->estado = RES_LIMITE; break; }
+        r->estado = op_transferencia(tabla, c->cuenta, p->cuenta, cent);
+        if (r->estado == RES_OK) {
+            anotar_historial(c->cuenta, OP_TRANSFERENCIA, p->cuenta, -cent);
+            anotar_historial(p->cuenta, OP_TRANSFERENCIA, c->cuenta, cent);
+            evento_publicar(tabla, OP_TRANSFERENCIA, c->cuenta, p->cuenta, cent, c->sesion);
+        }
+        break;
+    case PET_SALDO:
+        r->estado = RES_OK;
+        break;
+    default:
+        r->estado = RES_INVALIDA;
+        return;
+    }
+    if (r->estado == (int32_t)OP_CERRANDO) r->estado = RES_CERRANDO;
+    saldo_de(c->cuenta, r);
+}
+
+/*─────────────────────────────────────────────*/
+/*              TRABAJADORES                   */
+/*─────────────────────────────────────────────*/
+
+static void encolar(Conexion *c) {
+    pthread_mutex_lock(&mutex_cola);
+    listas[cola++ % MAX_CONEXIONES] = c;
+    pthread_cond_signal(&hay_trabajo);
+    pthread_mutex_unlock(&mutex_cola);
+}
+
+static Conexion *desencolar(void) {
+    pthread_mutex_lock(&mutex_cola);
+    while (cabeza == cola && !atomic_load(&parar))
+        pthread_cond_wait(&hay_trabajo, &mutex_cola);
+    Conexion *c = cabeza == cola ? NULL : listas[cabeza++ % MAX_CONEXIONES];
+    pthread_mutex_unlock(&mutex_cola);
+    return c;
+}
+
+static void cerrar(Conexion *c) {
+    close(c->fd);                        /* también lo saca de epoll */
+    free(c);
+    pthread_mutex_lock(&mutex_cola);
+    --abiertas;
+    pthread_mutex_unlock(&mutex_cola);
+}
+
+/* Envía todo el lote; si el cliente no lee, espera como mucho 1 s. */
+static int enviar(int fd, const void *datos, size_t n) {
+    const char *p = datos;
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w > 0) { p += w; n -= (size_t)w; continue; }
+        if (w == -1 && errno == EINTR) continue;
+        if (w == -1 && errno == EAGAIN) {
+            struct pollfd pf = { .fd = fd, .events = POLLOUT };
+            if (poll(&pf, 1, 1000) > 0) continue;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Respuesta de PET_HISTORIAL seguida de los apuntes de la cuenta de la
+ * sesión: como mucho p->cuenta, en el intervalo de p->centimos.         */
+static int enviar_historial(Conexion *c, const Peticion *p) {
+    struct {
+        Respuesta         r;
+        RegistroHistorial regs[MAX_HISTORIAL_CONSULTA];
+    } m;
+    memset(&m.r, 0, sizeof m.r);
+
+    int max = p->cuenta >= 1 && p->cuenta <= MAX_HISTORIAL_CONSULTA
+            ? p->cuenta : MAX_HISTORIAL_CONSULTA;
+    uint32_t d = (uint32_t)((uint64_t)p->centimos >> 32), h = (uint32_t)p->centimos;
+    int64_t desde = (int64_t)d * 1000000000;
+    int64_t hasta = h ? (int64_t)h * 1000000000 + 999999999 : INT64_MAX;
+
+    m.r.estado    = hist_abierto ? RES_OK : RES_INVALIDA;
+    m.r.reservado = hist_abierto
+                  ? historial_consultar(&hist, c->cuenta, desde, hasta, m.regs, max) : 0;
+    saldo_de(c->cuenta, &m.r);
+    return enviar(c->fd, &m, sizeof m.r + (size_t)m.r.reservado * sizeof(RegistroHistorial));
+}
+
+/* Lee y atiende las peticiones disponibles (como mucho VUELTAS_MAX lotes,
+ * para que un cliente muy activo no acapare al trabajador; EPOLLIN volverá
+ * a saltar si queda algo).  Devuelve -1 si la conexión se cerró o falló. */
+static int atender_conexion(Conexion *c) {
+    Respuesta resp[PETICIONES_LOTE];
+
+    for (int vuelta = 0; vuelta < VUELTAS_MAX; ++vuelta) {
+        ssize_t r = read(c->fd, c->buf + c->usados, sizeof c->buf - c->usados);
+        if (r == 0) return -1;
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        c->usados += (size_t)r;
+
+        size_t n = c->usados / sizeof(Peticion), enviadas = 0;
+        for (size_t i = 0; i < n; ++i) {
+            Peticion p;
+            memcpy(&p, c->buf + i * sizeof p, sizeof p);
+            if (p.tipo != PET_HISTORIAL || c->cuenta == -1) {
+                atender(c, &p, &resp[i]);
+                continue;
+            }
+            if ((i > enviadas &&
+                 enviar(c->fd, resp + enviadas, (i - enviadas) * sizeof(Respuesta)) == -1) ||
+                enviar_historial(c, &p) == -1)
+                return -1;
+            enviadas = i + 1;
+        }
+        c->usados -= n * sizeof(Peticion);
+        memmove(c->buf, c->buf + n * sizeof(Peticion), c->usados);
+
+        if (n > enviadas &&
+            enviar(c->fd, resp + enviadas, (n - enviadas) * sizeof(Respuesta)) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static void *trabajador(void *arg) {
+    (void)arg;
+    Conexion *c;
+    while ((c = desencolar()) != NULL) {
+        if (atender_conexion(c) == -1) { cerrar(c); continue; }
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+                                  .data.ptr = c };
+        if (epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev) == -1) cerrar(c);
+    }
+    return NULL;
+}
+
+/*─────────────────────────────────────────────*/
+/*              BUCLE DE EVENTOS               */
+/*─────────────────────────────────────────────*/
+
+static void aceptar(void) {
+    for (;;) {
+        int fd = accept4(escucha, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) perror("accept4");
+            return;
+        }
+
+        Conexion *c = NULL;
+        pthread_mutex_lock(&mutex_cola);
+        if (abiertas < MAX_CONEXIONES && (c = malloc(sizeof *c)) != NULL) ++abiertas;
+        pthread_mutex_unlock(&mutex_cola);
+        if (!c) { close(fd); continue; }          /* sin hueco: se rechaza */
+        c->fd = fd;
+        c->sesion = ++ultima_sesion;              /* sólo este hilo acepta */
+        c->cuenta = -1;
+        c->usados = 0;
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+                                  .data.ptr = c };
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1) { perror("epoll_ctl"); cerrar(c); }
+    }
+}
+
+static void *preparar_historial(void *arg) {
+    (void)arg;
+    struct timespec pausa = { 0, PREPARAR_HIST_MS * 1000000L };
+    while (!atomic_load(&parar)) {
+        historial_preparar(&hist);
+        nanosleep(&pausa, NULL);
+    }
+    return NULL;
+}
+
+static void *bucle_eventos(void *arg) {
+    (void)arg;
+    struct epoll_event evs[256];
+
+    while (!atomic_load(&parar)) {
+        int n = epoll_wait(ep, evs, 256, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (evs[i].data.ptr == &escucha)          aceptar();
+            else if (evs[i].data.ptr == &despertador) break;
+            else                                      encolar(evs[i].data.ptr);
+        }
+    }
+    return NULL;
+}
+
+/*─────────────────────────────────────────────*/
+/*            ARRANQUE Y PARADA                */
+/*─────────────────────────────────────────────*/
+
+/* Para miles de clientes hace falta subir el límite de descriptores. */
+static void subir_limite_descriptores(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+void servidor_iniciar(TablaCuentas *t, const Config *c) {
+    tabla = t;
+    cfg   = *c;
+    atomic_init(&parar, 0);
+    subir_limite_descriptores();
+    hist_abierto = historial_abrir(&hist, &cfg, 0) == 0;
+    if (hist_abierto) historial_preparar(&hist);
+
+    escucha = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (escucha == -1) { perror("socket"); exit(EXIT_FAILURE); }
+
+    struct sockaddr_un dir = { .sun_family = AF_UNIX };
+    snprintf(dir.sun_path, sizeof dir.sun_path, "%s", cfg.socket_banco);
+    unlink(dir.sun_path);                /* socket de una ejecución anterior */
+    if (bind(escucha, (struct sockaddr *)&dir, sizeof dir) == -1 ||
+        listen(escucha, SOMAXCONN) == -1) {
+        perror(cfg.socket_banco);
+        exit(EXIT_FAILURE);
+    }
+
+    ep          = epoll_create1(EPOLL_CLOEXEC);
+    despertador = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ep == -1 || despertador == -1) { perror("epoll"); exit(EXIT_FAILURE); }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &escucha };
+    epoll_ctl(ep, EPOLL_CTL_ADD, escucha, &ev);
+    ev.data.ptr = &despertador;
+    epoll_ctl(ep, EPOLL_CTL_ADD, despertador, &ev);
+
+    num_trabajadores = cfg.hilos_servidor < MAX_TRABAJADORES
+                     ? cfg.hilos_servidor : MAX_TRABAJADORES;
+    for (int i = 0; i < num_trabajadores; ++i)
+        if (pthread_create(&trabajadores[i], NULL, trabajador, NULL) != 0) {
+            perror("pthread_create"); exit(EXIT_FAILURE);
+        }
+    if (pthread_create(&hilo_eventos, NULL, bucle_eventos, NULL) != 0 ||
+        (hist_abierto && pthread_create(&hilo_historial, NULL, preparar_historial, NULL) != 0)) {
+        perror("pthread_create"); exit(EXIT_FAILURE);
+    }
+}
+
+/* Deja de aceptar, espera a que los trabajadores terminen la petición en
+ * curso y borra el socket.  Las conexiones abiertas se cierran al salir. */
+void servidor_detener(void) {
+    if (escucha == -1) return;
+
+    atomic_store(&parar, 1);
+    uint64_t uno = 1;
+    if (write(despertador, &uno, sizeof uno) == -1) perror("eventfd");
+    pthread_join(hilo_eventos, NULL);
+
+    pthread_mutex_lock(&mutex_cola);
+    pthread_cond_broadcast(&hay_trabajo);
+    pthread_mutex_unlock(&mutex_cola);
+    for (int i = 0; i < num_trabajadores; ++i) pthread_join(trabajadores[i], NULL);
+    if (hist_abierto) pthread_join(hilo_historial, NULL);
+
+    close(escucha);
+    close(despertador);
+    close(ep);
+    unlink(cfg.socket_banco);
+    escucha = -1;
+    if (hist_abierto) historial_cerrar(&hist);
+    hist_abierto = 0;
+}
@@ -0,0 +1,449 @@
+/* tuberia.c — Tubería de análisis del monitor
+ *
+ *  ▸ Ingesta (el hilo que llama a tuberia_encolar, en monitor el principal):
+ *    reparte cada lote de eventos por cuenta de origen entre los
+ *    trabajadores, cada uno con su anillo de entrada de un productor y un
+ *    consumidor.  Todas las claves de las reglas empiezan por la cuenta de
+ *    origen, así que cada trabajador tiene su propio motor (reglas.c) sin
+ *    compartir nada, y los eventos de una cuenta se analizan en orden.
+ *  ▸ Trabajadores: formatean la línea "[fecha] TEXTO" de cada evento y de
+ *    sus alertas en bloques de TAM_BLOQUE bytes propios.  Un bloque pasa al
+ *    sumidero cuando se llena o cuando el trabajador se queda sin eventos.
+ *  ▸ Sumidero: recoge los bloques de todos los trabajadores y los escribe
+ *    con un writev en la consola (si hay eco) y otro en el log, abierto una
+ *    sola vez con O_APPEND; después devuelve los bloques a su dueño.
+ *  ▸ Cada anillo tiene un solo escritor y un solo lector: no hay cerrojos
+ *    compartidos en el camino del evento.  Los mutex sólo sirven para
+ *    dormir a un hilo sin trabajo, con el protocolo de `durmiendo` de
+ *    eventos.c.  Con el anillo de un trabajador lleno la ingesta espera, y
+ *    con el anillo de la SHM lleno los usuarios descartan los depósitos
+ *    (eventos perdidos, que monitor avisa) y esperan con el resto.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "utils.h"
+
+#define CAP_ENTRADA   8192               /* eventos por trabajador (2^n) */
+#define BLOQUES_HILO  8                  /* bloques de salida por trabajador (2^n) */
+#define TAM_BLOQUE    (64 * 1024)
+#define HUECO_LINEAS  (160 * (MAX_REGLAS + 1))   /* un evento y sus alertas */
+
+typedef struct {
+    size_t usados;
+    char   datos[TAM_BLOQUE];
+} Bloque;
+
+/* Índices de un anillo de un productor y un consumidor. */
+typedef struct {
+    atomic_size_t cabeza __attribute__((aligned(64)));   /* productor */
+    atomic_size_t cola   __attribute__((aligned(64)));   /* consumidor */
+} Indices;
+
+typedef struct {
+    Evento   entrada[CAP_ENTRADA];       /* ingesta → trabajador */
+    Indices  ie;
+    Bloque  *llenos[BLOQUES_HILO];       /* trabajador → sumidero */
+    Indices  il;
+    Bloque  *vacios[BLOQUES_HILO];       /* sumidero → trabajador */
+    Indices  iv;
+
+    Bloque      *actual;
+    MotorReglas  motor;
+    time_t       segundo;                /* caché de la marca de tiempo */
+    char         marca[32];
+
+    pthread_t       hilo;
+    pthread_mutex_t mutex;
+    pthread_cond_t  aviso;
+    atomic_int      durmiendo;
+    atomic_long     eventos, alertas, esperas;
+} Trabajador;
+
+static Trabajador     *trabajadores;
+static int             num_trabajadores;
+static int             fd_log = -1, eco, activa;
+static atomic_int      parar_trabajo, parar_sumidero;
+static pthread_t       sumidero;
+static pthread_mutex_t mutex_sumidero = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  aviso_sumidero = PTHREAD_COND_INITIALIZER;
+static atomic_int      sumidero_durmiendo;
+static atomic_long     escrituras, bytes_escritos;
+
+static const struct timespec PAUSA = { 0, 50000L };   /* 50 µs: anillo lleno */
+
+/* Texto del evento con el formato de siempre para pantalla y log. */
+static void describir(const Evento *ev, char *dst, size_t n) {
+    const char *signo = ev->centimos < 0 ? "-" : "";
+    long long c = llabs(ev->centimos), euros = c / 100, cts = c % 100;
+    switch (ev->tipo) {
+    case OP_DEPOSITO:
+        snprintf(dst, n, "DEPOSITO %d %s%lld.%02lld", ev->cuenta[0], signo, euros, cts);
+        break;
+    case OP_RETIRO:
+        snprintf(dst, n, "RETIRO %d %s%lld.%02lld", ev->cuenta[0], signo, euros, cts);
+        break;
+    case OP_TRANSFERENCIA:
+        snprintf(dst, n, "TRANSFERENCIA %d %d %s%lld.%02lld",
+                 ev->cuenta[0], ev->cuenta[1], signo, euros, cts);
+        break;
+    case OP_LOTE:
+        snprintf(dst, n, "LOTE %d %d apuntes %s%lld.%02lld",
+                 ev->cuenta[0], ev->cuenta[1], signo, euros, cts);
+        break;
+    default:
+        snprintf(dst, n, "EVENTO %d desconocido", ev->tipo);
+    }
+}
+
+/*─────────────────────────────────────────────*/
+/*          ANILLOS Y AVISOS ENTRE HILOS       */
+/*─────────────────────────────────────────────*/
+
+static size_t ocupados(Indices *x) {
+    return atomic_load_explicit(&x->cabeza, memory_order_acquire) -
+           atomic_load_explicit(&x->cola, memory_order_acquire);
+}
+
+/* Mete un bloque en un anillo de BLOQUES_HILO huecos.  Nunca está lleno:
+ * cada trabajador sólo tiene BLOQUES_HILO bloques en total.               */
+static void meter_bloque(Bloque **anillo, Indices *x, Bloque *b) {
+    size_t c = atomic_load_explicit(&x->cabeza, memory_order_relaxed);
+    anillo[c & (BLOQUES_HILO - 1)] = b;
+    atomic_store_explicit(&x->cabeza, c + 1, memory_order_release);
+}
+
+static Bloque *sacar_bloque(Bloque **anillo, Indices *x) {
+    size_t c = atomic_load_explicit(&x->cola, memory_order_relaxed);
+    if (c == atomic_load_explicit(&x->cabeza, memory_order_acquire)) return NULL;
+    Bloque *b = anillo[c & (BLOQUES_HILO - 1)];
+    atomic_store_explicit(&x->cola, c + 1, memory_order_release);
+    return b;
+}
+
+static void despertar(atomic_int *durmiendo, pthread_mutex_t *m, pthread_cond_t *c) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(durmiendo, memory_order_relaxed)) {
+        pthread_mutex_lock(m);
+        pthread_cond_signal(c);
+        pthread_mutex_unlock(m);
+    }
+}
+
+/* Duerme hasta un aviso (o 100 ms) salvo que `hay_trabajo` ya sea cierto. */
+static void dormir(atomic_int *durmiendo, pthread_mutex_t *m, pthread_cond_t *c,
+                   int (*hay_trabajo)(void *), void *arg) {
+    struct timespec plazo;
+    clock_gettime(CLOCK_REALTIME, &plazo);
+    plazo.tv_nsec += 100000000L;
+    if (plazo.tv_nsec >= 1000000000L) { plazo.tv_sec++; plazo.tv_nsec -= 1000000000L; }
+
+    pthread_mutex_lock(m);
+    atomic_store(durmiendo, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!hay_trabajo(arg)) pthread_cond_timedwait(c, m, &plazo);
+    atomic_store(durmiendo, 0);
+    pthread_mutex_unlock(m);
+}
+
+/*─────────────────────────────────────────────*/
+/*                 TRABAJADORES                */
+/*─────────────────────────────────────────────*/
+
+static int trabajador_pendiente(void *arg) {
+    Trabajador *w = arg;
+    return ocupados(&w->ie) > 0 || atomic_load(&parar_trabajo);
+}
+
+static void entregar_bloque(Trabajador *w) {
+    if (w->actual->usados == 0) return;
+    meter_bloque(w->llenos, &w->il, w->actual);
+    despertar(&sumidero_durmiendo, &mutex_sumidero, &aviso_sumidero);
+    while ((w->actual = sacar_bloque(w->vacios, &w->iv)) == NULL) {
+        atomic_fetch_add_explicit(&w->esperas, 1, memory_order_relaxed);
+        nanosleep(&PAUSA, NULL);
+    }
+}
+
+static void escribir(Trabajador *w, int64_t ts_ns, const char *texto) {
+    time_t s = (time_t)(ts_ns / 1000000000);
+    if (s != w->segundo) {
+        struct tm tm;
+        localtime_r(&s, &tm);
+        strftime(w->marca, sizeof w->marca, "[%Y-%m-%d %H:%M:%S]", &tm);
+        w->segundo = s;
+    }
+    Bloque *b = w->actual;
+    int n = snprintf(b->datos + b->usados, TAM_BLOQUE - b->usados, "%s %s\n", w->marca, texto);
+    if (n > 0) b->usados += (size_t)n < TAM_BLOQUE - b->usados ? (size_t)n : TAM_BLOQUE - b->usados;
+}
+
+static void analizar(Trabajador *w, const Evento *ev) {
+    if (TAM_BLOQUE - w->actual->usados < HUECO_LINEAS) entregar_bloque(w);
+
+    char texto[160];
+    describir(ev, texto, sizeof texto);
+    escribir(w, ev->ts_ns, texto);
+
+    Alerta alertas[MAX_REGLAS];
+    int n = motor_evaluar(&w->motor, ev, alertas, MAX_REGLAS);
+    for (int i = 0; i < n; ++i) {
+        describir_alerta(&alertas[i], texto, sizeof texto);
+        escribir(w, ev->ts_ns, texto);
+    }
+    if (n) atomic_fetch_add_explicit(&w->alertas, n, memory_order_relaxed);
+}
+
+static void *bucle_trabajador(void *arg) {
+    Trabajador *w = arg;
+    for (;;) {
+        size_t cola = atomic_load_explicit(&w->ie.cola, memory_order_relaxed);
+        size_t fin  = atomic_load_explicit(&w->ie.cabeza, memory_order_acquire);
+        for (size_t i = cola; i != fin; ++i)
+            analizar(w, &w->entrada[i & (CAP_ENTRADA - 1)]);
+        atomic_store_explicit(&w->ie.cola, fin, memory_order_release);
+        atomic_fetch_add_explicit(&w->eventos, (long)(fin - cola), memory_order_relaxed);
+        if (fin != cola) continue;
+
+        /* Sin eventos: lo que haya en el bloque sale ya. */
+        entregar_bloque(w);
+        if (atomic_load(&parar_trabajo) && ocupados(&w->ie) == 0) break;
+        dormir(&w->durmiendo, &w->mutex, &w->aviso, trabajador_pendiente, w);
+    }
+    return NULL;
+}
+
+/*─────────────────────────────────────────────*/
+/*                  SUMIDERO                   */
+/*─────────────────────────────────────────────*/
+
+static int sumidero_pendiente(void *arg) {
+    (void)arg;
+    for (int i = 0; i < num_trabajadores; ++i)
+        if (ocupados(&trabajadores[i].il) > 0) return 1;
+    return atomic_load(&parar_sumidero);
+}
+
+/* writev completo aunque el núcleo escriba a trozos. */
+static void escribir_todo(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            perror("monitor: writev");
+            return;
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len) { w -= iov->iov_len; ++iov; --n; }
+        if (n > 0) { iov->iov_base = (char *)iov->iov_base + w; iov->iov_len -= w; }
+    }
+}
+
+static void *bucle_sumidero(void *arg) {
+    (void)arg;
+    int max = num_trabajadores * BLOQUES_HILO;
+    struct iovec *iov   = malloc(max * sizeof *iov);
+    struct iovec *copia = malloc(max * sizeof *copia);
+    Bloque **bloques    = malloc(max * sizeof *bloques);
+    int *duenos         = malloc(max * sizeof *duenos);
+    if (!iov || !copia || !bloques || !duenos) { perror("malloc sumidero"); exit(EXIT_FAILURE); }
+
+    for (;;) {
+        int n = 0;
+        size_t total = 0;
+        for (int i = 0; i < num_trabajadores; ++i) {
+            Bloque *b;
+            while ((b = sacar_bloque(trabajadores[i].llenos, &trabajadores[i].il)) != NULL) {
+                iov[n] = (struct iovec){ b->datos, b->usados };
+                bloques[n] = b;
+                duenos[n++] = i;
+                total += b->usados;
+            }
+        }
+        if (n > 0) {
+            if (eco) {
+                memcpy(copia, iov, n * sizeof *iov);
+                escribir_todo(STDOUT_FILENO, copia, n);
+            }
+            if (fd_log != -1) escribir_todo(fd_log, iov, n);
+            atomic_fetch_add_explicit(&escrituras, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&bytes_escritos, (long)total, memory_order_relaxed);
+            for (int k = 0; k < n; ++k) {
+                bloques[k]->usados = 0;
+                meter_bloque(trabajadores[duenos[k]].vacios, &trabajadores[duenos[k]].iv, bloques[k]);
+            }
+            continue;
+        }
+        if (atomic_load(&parar_sumidero)) break;
+        dormir(&sumidero_durmiendo, &mutex_sumidero, &aviso_sumidero, sumidero_pendiente, NULL);
+    }
+    free(iov); free(copia); free(bloques); free(duenos);
+    return NULL;
+}
+
+/*─────────────────────────────────────────────*/
+/*            ARRANQUE, INGESTA Y CIERRE       */
+/*─────────────────────────────────────────────*/
+
+/* Memoria de una tubería ya detenida.  No se libera en tuberia_detener():
+ * al salir con exit() la ingesta puede seguir usándola.                  */
+static void liberar(void) {
+    if (!trabajadores || activa) return;
+    for (int i = 0; i < num_trabajadores; ++i) {
+        Trabajador *w = &trabajadores[i];
+        Bloque *b;
+        free(w->actual);
+        while ((b = sacar_bloque(w->vacios, &w->iv)) != NULL) free(b);
+        motor_liberar(&w->motor);
+        pthread_mutex_destroy(&w->mutex);
+        pthread_cond_destroy(&w->aviso);
+    }
+    free(trabajadores);
+    trabajadores = NULL;
+    num_trabajadores = 0;
+}
+
+/* Arranca `hilos` trabajadores y el sumidero.  Las líneas se añaden a
+ * `ruta_log` (NULL = ninguna) y, con `con_eco`, salen también por stdout.
+ * Los almacenes de las reglas se reparten CAPACIDAD_CONTADORES.          */
+void tuberia_iniciar(const Config *cfg, int hilos, const char *ruta_log, int con_eco) {
+    liberar();
+    if (hilos < 1) hilos = 1;
+    if (hilos > MAX_HILOS_MONITOR) hilos = MAX_HILOS_MONITOR;
+
+    fd_log = -1;
+    if (ruta_log && (fd_log = open(ruta_log, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1)
+        perror(ruta_log);
+    eco = con_eco;
+    atomic_store(&parar_trabajo, 0);
+    atomic_store(&parar_sumidero, 0);
+    atomic_store(&escrituras, 0);
+    atomic_store(&bytes_escritos, 0);
+
+    Config parte = *cfg;
+    parte.capacidad_contadores = cfg->capacidad_contadores / hilos;
+
+    trabajadores = calloc(hilos, sizeof *trabajadores);
+    if (!trabajadores) { perror("calloc tubería"); exit(EXIT_FAILURE); }
+    num_trabajadores = hilos;
+    for (int i = 0; i < hilos; ++i) {
+        Trabajador *w = &trabajadores[i];
+        motor_iniciar(&w->motor, &parte);
+        for (int k = 0; k < BLOQUES_HILO; ++k) {
+            Bloque *b = malloc(sizeof *b);
+            if (!b) { perror("malloc bloque"); exit(EXIT_FAILURE); }
+            b->usados = 0;
+            if (k == 0) w->actual = b;
+            else        meter_bloque(w->vacios, &w->iv, b);
+        }
+        w->segundo = (time_t)-1;
+        pthread_mutex_init(&w->mutex, NULL);
+        pthread_cond_init(&w->aviso, NULL);
+    }
+    for (int i = 0; i < hilos; ++i)
+        if (pthread_create(&trabajadores[i].hilo, NULL, bucle_trabajador, &trabajadores[i]) != 0) {
+            perror("pthread_create trabajador"); exit(EXIT_FAILURE);
+        }
+    if (pthread_create(&sumidero, NULL, bucle_sumidero, NULL) != 0) {
+        perror("pthread_create sumidero"); exit(EXIT_FAILURE);
+    }
+    activa = 1;
+}
+
+static int trabajador_de(int cuenta) {
+    return (int)(((uint32_t)cuenta * 0x9E3779B1u) >> 16) % num_trabajadores;
+}
+
+/* Reparte un lote entre los trabajadores.  Sólo desde un hilo (ingesta):
+ * cada anillo de entrada tiene un único productor.                       */
+void tuberia_encolar(const Evento *lote, int n) {
+    static uint8_t destino[4096];
+    if (!activa || atomic_load(&parar_trabajo)) return;
+
+    for (int base = 0; base < n; base += (int)sizeof destino) {
+        int m = n - base < (int)sizeof destino ? n - base : (int)sizeof destino;
+        for (int k = 0; k < m; ++k) destino[k] = (uint8_t)trabajador_de(lote[base + k].cuenta[0]);
+
+        for (int i = 0; i < num_trabajadores; ++i) {
+            Trabajador *w = &trabajadores[i];
+            size_t cab = atomic_load_explicit(&w->ie.cabeza, memory_order_relaxed);
+            int metidos = 0;
+            for (int k = 0; k < m; ++k) {
+                if (destino[k] != i) continue;
+                while (cab - atomic_load_explicit(&w->ie.cola, memory_order_acquire) == CAP_ENTRADA) {
+                    atomic_store_explicit(&w->ie.cabeza, cab, memory_order_release);
+                    despertar(&w->durmiendo, &w->mutex, &w->aviso);
+                    nanosleep(&PAUSA, NULL);
+                }
+                w->entrada[cab++ & (CAP_ENTRADA - 1)] = lote[base + k];
+                ++metidos;
+            }
+            if (!metidos) continue;
+            atomic_store_explicit(&w->ie.cabeza, cab, memory_order_release);
+            despertar(&w->durmiendo, &w->mutex, &w->aviso);
+        }
+    }
+}
+
+/* Analiza y escribe todo lo encolado y para los hilos.  Las
+ * estadísticas siguen disponibles hasta el siguiente tuberia_iniciar().  */
+void tuberia_detener(void) {
+    if (!activa) return;
+    atomic_store(&parar_trabajo, 1);
+    for (int i = 0; i < num_trabajadores; ++i) {
+        Trabajador *w = &trabajadores[i];
+        pthread_mutex_lock(&w->mutex);
+        pthread_cond_signal(&w->aviso);
+        pthread_mutex_unlock(&w->mutex);
+    }
+    for (int i = 0; i < num_trabajadores; ++i) pthread_join(trabajadores[i].hilo, NULL);
+
+    pthread_mutex_lock(&mutex_sumidero);
+    atomic_store(&parar_sumidero, 1);
+    pthread_cond_signal(&aviso_sumidero);
+    pthread_mutex_unlock(&mutex_sumidero);
+    pthread_join(sumidero, NULL);
+
+    if (fd_log != -1) close(fd_log);
+    fd_log = -1;
+    activa = 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*                ESTADÍSTICAS                 */
+/*─────────────────────────────────────────────*/
+
+/* Totales de la tubería.  Con los hilos en marcha los de las reglas son
+ * aproximados: se leen sin parar a los trabajadores.                     */
+void tuberia_estadisticas(EstadisticasTuberia *e) {
+    memset(e, 0, sizeof *e);
+    e->hilos       = num_trabajadores;
+    e->escrituras  = atomic_load(&escrituras);
+    e->bytes       = atomic_load(&bytes_escritos);
+    for (int i = 0; i < num_trabajadores; ++i) {
+        Trabajador *w = &trabajadores[i];
+        e->eventos[i]  = atomic_load(&w->eventos);
+        e->esperas    += atomic_load(&w->esperas);
+        e->alertas    += atomic_load(&w->alertas);
+        e->num_reglas  = w->motor.num_reglas;
+        e->atrasados  += w->motor.atrasados;
+        for (int r = 0; r < w->motor.num_reglas; ++r) {
+            EstadisticasContadores s;
+            ac_estadisticas(&w->motor.estado[r], &s);
+            snprintf(e->regla[r].nombre, sizeof e->regla[r].nombre, "%s", w->motor.reglas[r].nombre);
+            e->regla[r].disparos  += w->motor.disparos[r];
+            e->regla[r].entradas  += s.entradas;
+            e->regla[r].capacidad += s.capacidad;
+            e->regla[r].bytes     += s.bytes;
+            e->regla[r].desalojos += s.desalojos;
+        }
+    }
+}
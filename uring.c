@@ -0,0 +1,272 @@
+/* uring.c — Envoltorio mínimo de io_uring sin liburing
+ *
+ *  ▸ io_uring_setup/io_uring_enter por syscall y las tres proyecciones del
+ *    anillo (SQ, CQ y SQEs) como describe linux/io_uring.h.
+ *  ▸ Quien lo usa prepara varias SQEs (uring_writev, uring_write,
+ *    uring_fdatasync; encadenables con IOSQE_IO_LINK) y las envía todas con
+ *    una sola llamada a uring_enviar(), que puede además esperar
+ *    completados.  uring_cosechar() recoge los completados sin bloquear.
+ *  ▸ Cada SQE recuerda su petición: una escritura corta se completa y una
+ *    que falla se rehace con pwritev/pwrite/write/fdatasync al cosecharla,
+ *    seguidas de un fdatasync (la cadena pudo sincronizar antes).  Sin
+ *    hueco en el anillo la petición se hace directamente con POSIX.
+ *  ▸ Cada Uring lo usa un único hilo: no hay cerrojos.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "utils.h"
+
+static int sys_setup(unsigned entradas, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entradas, p);
+}
+
+static int sys_enter(int fd, unsigned enviar, unsigned esperar, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, enviar, esperar, flags, NULL, 0);
+}
+
+/*─────────────────────────────────────────────*/
+/*            CREACIÓN Y CIERRE                */
+/*─────────────────────────────────────────────*/
+
+/* 0 si el anillo está listo; -1 si el núcleo no ofrece io_uring (quien
+ * llama debe seguir por el camino POSIX).                                */
+int uring_iniciar(Uring *u, unsigned entradas) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    memset(u, 0, sizeof *u);
+
+    u->fd = sys_setup(entradas, &p);
+    if (u->fd < 0) { u->fd = -1; return -1; }
+
+    u->tam_sq   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->tam_cq   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->tam_sqes = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->tam_sq = u->tam_cq = u->tam_sq > u->tam_cq ? u->tam_sq : u->tam_cq;
+
+    u->sq = mmap(NULL, u->tam_sq, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 u->fd, IORING_OFF_SQ_RING);
+    u->cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? u->sq
+          : mmap(NULL, u->tam_cq, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, u->tam_sqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sq == MAP_FAILED || u->cq == MAP_FAILED || u->sqes == MAP_FAILED) {
+        perror("mmap io_uring");
+        close(u->fd);
+        u->fd = -1;
+        return -1;
+    }
+
+    char *sq = u->sq, *cq = u->cq;
+    u->sq_cabeza  = (unsigned *)(sq + p.sq_off.head);
+    u->sq_cola    = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mascara = *(unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_indices = (unsigned *)(sq + p.sq_off.array);
+    u->cq_cabeza  = (unsigned *)(cq + p.cq_off.head);
+    u->cq_cola    = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mascara = *(unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    u->entradas   = p.sq_entries;
+
+    /* Nunca hay más en vuelo que huecos en la CQ. */
+    u->cap_peticiones = p.cq_entries;
+    u->peticiones     = malloc(u->cap_peticiones * sizeof(PeticionUring));
+    if (!u->peticiones) {
+        uring_cerrar(u);
+        return -1;
+    }
+    return 0;
+}
+
+void uring_cerrar(Uring *u) {
+    if (u->fd == -1) return;
+    munmap(u->sqes, u->tam_sqes);
+    if (u->cq != u->sq) munmap(u->cq, u->tam_cq);
+    munmap(u->sq, u->tam_sq);
+    close(u->fd);
+    u->fd = -1;
+    free(u->peticiones);
+    u->peticiones = NULL;
+}
+
+/*─────────────────────────────────────────────*/
+/*               PREPARAR SQEs                 */
+/*─────────────────────────────────────────────*/
+
+/*─────────────────────────────────────────────*/
+/*           CAMINO POSIX DE RESERVA           */
+/*─────────────────────────────────────────────*/
+
+/* Escribe lo que queda de la petición a partir de `hecho` bytes.  0 o -1. */
+static int completar(const PeticionUring *p, size_t hecho) {
+    if (p->opcode == IORING_OP_FSYNC) return fdatasync(p->fd);
+
+    struct iovec uno = { (void *)p->dir, p->n };
+    const struct iovec *iov = p->opcode == IORING_OP_WRITEV ? p->dir : &uno;
+    unsigned n = p->opcode == IORING_OP_WRITEV ? p->n : 1;
+    int64_t desp = p->desp;
+
+    for (unsigned i = 0; i < n; ++i) {
+        const char *b = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        if (hecho >= len) {
+            hecho -= len;
+            if (desp != -1) desp += (int64_t)len;
+            continue;
+        }
+        b += hecho; len -= hecho;
+        if (desp != -1) desp += (int64_t)hecho;
+        hecho = 0;
+        while (len > 0) {
+            ssize_t k = desp == -1 ? write(p->fd, b, len) : pwrite(p->fd, b, len, (off_t)desp);
+            if (k == -1 && errno == EINTR) continue;
+            if (k <= 0) return -1;
+            b += k; len -= (size_t)k;
+            if (desp != -1) desp += k;
+        }
+    }
+    return 0;
+}
+
+static size_t bytes_peticion(const PeticionUring *p) {
+    if (p->opcode == IORING_OP_FSYNC) return 0;
+    if (p->opcode == IORING_OP_WRITE) return p->n;
+    size_t total = 0;
+    const struct iovec *iov = p->dir;
+    for (unsigned i = 0; i < p->n; ++i) total += iov[i].iov_len;
+    return total;
+}
+
+/*─────────────────────────────────────────────*/
+/*               PREPARAR SQEs                 */
+/*─────────────────────────────────────────────*/
+
+/* Siguiente SQE libre para la petición `p`, o NULL si el anillo de envío
+ * (o la CQ) está lleno; entonces la petición ya se ha hecho con POSIX.   */
+static struct io_uring_sqe *siguiente_sqe(Uring *u, const PeticionUring *p) {
+    unsigned cabeza = __atomic_load_n(u->sq_cabeza, __ATOMIC_ACQUIRE);
+    unsigned cola   = *u->sq_cola + u->preparadas;
+    if (cola - cabeza >= u->entradas || u->en_vuelo + u->preparadas >= u->cap_peticiones) {
+        if (completar(p, 0) == -1) perror("io_uring lleno: escritura POSIX");
+        return NULL;
+    }
+
+    unsigned i = cola & u->sq_mascara;
+    struct io_uring_sqe *sqe = &u->sqes[i];
+    memset(sqe, 0, sizeof *sqe);
+    u->sq_indices[i] = i;
+    u->preparadas++;
+
+    unsigned k = u->siguiente++ % u->cap_peticiones;
+    u->peticiones[k] = *p;
+    sqe->user_data   = k;
+    sqe->opcode      = p->opcode;
+    sqe->fd          = p->fd;
+    return sqe;
+}
+
+int uring_writev(Uring *u, int fd, const struct iovec *iov, unsigned n,
+                 int64_t desp, unsigned flags) {
+    PeticionUring p = { IORING_OP_WRITEV, fd, iov, n, desp };
+    struct io_uring_sqe *sqe = siguiente_sqe(u, &p);
+    if (!sqe) return 0;
+    sqe->addr   = (uintptr_t)iov;
+    sqe->len    = n;
+    sqe->off    = (uint64_t)desp;
+    sqe->flags  = (uint8_t)flags;
+    return 0;
+}
+
+/* desp == -1: en la posición actual (con O_APPEND, al final). */
+int uring_write(Uring *u, int fd, const void *buf, size_t n, int64_t desp, unsigned flags) {
+    PeticionUring p = { IORING_OP_WRITE, fd, buf, (unsigned)n, desp };
+    struct io_uring_sqe *sqe = siguiente_sqe(u, &p);
+    if (!sqe) return 0;
+    sqe->addr   = (uintptr_t)buf;
+    sqe->len    = (unsigned)n;
+    sqe->off    = (uint64_t)desp;
+    sqe->flags  = (uint8_t)flags;
+    return 0;
+}
+
+int uring_fdatasync(Uring *u, int fd, unsigned flags) {
+    PeticionUring p = { IORING_OP_FSYNC, fd, NULL, 0, 0 };
+    struct io_uring_sqe *sqe = siguiente_sqe(u, &p);
+    if (!sqe) return 0;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->flags       = (uint8_t)flags;
+    return 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*           ENVIAR Y COSECHAR                 */
+/*─────────────────────────────────────────────*/
+
+/* Recoge los completados ya disponibles.  Devuelve cuántos.  Los que
+ * acabaron con error (también los cancelados de una cadena rota) se
+ * rehacen y las escrituras cortas se completan, con POSIX y un fdatasync
+ * detrás; se cuentan en u->errores y u->cortas.                          */
+int uring_cosechar(Uring *u) {
+    unsigned cabeza = *u->cq_cabeza, n = 0;
+    unsigned cola   = __atomic_load_n(u->cq_cola, __ATOMIC_ACQUIRE);
+
+    for (; cabeza != cola; ++cabeza, ++n) {
+        const struct io_uring_cqe *cqe = &u->cqes[cabeza & u->cq_mascara];
+        const PeticionUring *p = &u->peticiones[cqe->user_data % u->cap_peticiones];
+        size_t hecho;
+        if (cqe->res < 0) {
+            if (u->errores++ == 0)
+                fprintf(stderr, "io_uring: %s; se repite con POSIX\n", strerror(-cqe->res));
+            hecho = 0;
+        } else if ((size_t)cqe->res < bytes_peticion(p)) {
+            u->cortas++;
+            hecho = (size_t)cqe->res;
+        } else {
+            continue;
+        }
+        if (completar(p, hecho) == -1 || fdatasync(p->fd) == -1)
+            perror("io_uring: escritura POSIX de reserva");
+    }
+    __atomic_store_n(u->cq_cabeza, cabeza, __ATOMIC_RELEASE);
+    u->en_vuelo -= n;
+    return (int)n;
+}
+
+/* Publica las SQEs preparadas con una única llamada al núcleo y, si
+ * `esperar` > 0, bloquea hasta que haya al menos ese nº de completados.  */
+int uring_enviar(Uring *u, unsigned esperar) {
+    unsigned n = u->preparadas;
+    __atomic_store_n(u->sq_cola, *u->sq_cola + n, __ATOMIC_RELEASE);
+    u->preparadas = 0;
+    u->en_vuelo  += n;
+
+    if (n == 0 && esperar == 0) return 0;
+
+    /* Tras un EINTR se puede repetir: el núcleo sólo envía lo que siga
+     * pendiente en el anillo.                                            */
+    while (sys_enter(u->fd, n, esperar, esperar ? IORING_ENTER_GETEVENTS : 0) < 0) {
+        if (errno != EINTR) { perror("io_uring_enter"); return -1; }
+    }
+    return 0;
+}
+
+/* Espera a que termine todo lo enviado. */
+void uring_esperar_todo(Uring *u) {
+    uring_cosechar(u);
+    while (u->en_vuelo > 0) {
+        if (sys_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            return;
+        }
+        uring_cosechar(u);
+    }
+}
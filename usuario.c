@@ -2,8 +2,9 @@
  *
  *   • Recibe por argv[1] el shm_id que creó “banco”.
  *   • Hace shmat → obtiene puntero a TablaCuentas.
- *   • Todas las operaciones sobre la tabla se protegen con el
- *     mutex (PTHREAD_PROCESS_SHARED) que vive dentro de la SHM.
+ *   • Cada operación bloquea sólo la franja de cerrojos de las cuentas
+ *     que toca (ver operaciones.c); tabla->mutex queda para cambios
+ *     estructurales.
  *
  *   ¡Ya no usamos el semáforo POSIX “/cuentas_sem” ni tocamos
  *   cuentas.dat directamente!
@@ -11,8 +12,7 @@
 /* usuario.c — Terminal interactivo de SecureBank
  * - Accede a la tabla de cuentas en memoria compartida
  * - Protege la tabla con el mutex PTHREAD_PROCESS_SHARED (tabla->mutex)
- * - Registra cada operación en transacciones/<cuenta>/transacciones.log
- *   usando un semáforo POSIX nombrado (/log_<cuenta>)                    */
+ * - Registra cada operación en el historial de la cuenta (historial.c) */
 
 /*  usuario.c  — Productor de entradas en el buffer de E/S
  *  ▸ Actualiza la tabla de cuentas en SHM
@@ -23,7 +23,14 @@
 /* usuario.c — Proceso interactivo de SecureBank
  *   ● Accede a la tabla de cuentas en SHM
  *   ● Inserta cada operación en la cola de prioridad compartida
- *   ● Registra logs individuales y avisa al monitor
+ *   ● Anota cada movimiento en el historial de la cuenta (historial.c),
+ *     con sus dos patas en una transferencia, y avisa al monitor
+ *   ● "Historial" consulta los últimos N movimientos o los de un
+ *     intervalo de fechas sin leer más que los segmentos que lo cubren
+ *
+ *   ● Con `particiones` en lugar del shm_id se adjunta a todas las
+ *     particiones en marcha y cada operación va a la de su cuenta
+ *     (particiones.c)
  *
  *  Compilar:  gcc -D_POSIX_C_SOURCE=200809L usuario.c -o usuario -lrt -pthread
  */
@@ -34,157 +41,122 @@
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/shm.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <errno.h>
 #include <time.h>
-#include <semaphore.h>
 
 #include "utils.h"
 
 
 /* ──────────  Constantes  ────────── */
-#define MSG_KEY   1234
 #define TAM_MAX   128
-#define BUF_CAP   64                 /* igual que en banco.c          */
-
-
-/* ──────────  Mensaje a monitor  ────────── */
-struct msgbuf {
-    long tipo;
-    char texto[TAM_MAX];
-};
 
 /* ──────────  Variables globales  ────────── */
 static Config            cfg;
-static TablaCuentas     *tabla = NULL;     /* SHM                     */
-static pthread_mutex_t  *mtx   = NULL;     /* alias tabla->mutex      */
+static TablaCuentas     *tabla = NULL;     /* SHM de la cuenta de la sesión */
+static Enrutador         enr;
 static int               cuenta_sesion = -1;
-
-/* semáforo para el log del usuario */
-static sem_t            *sem_log = NULL;
-static char              sem_name[32];
+static Historial         historial;
+static int               historial_abierto;
 
 /* ───────────────────────────────────────────── */
 /*                 UTILIDADES                   */
 /* ───────────────────────────────────────────── */
 
-
-static void enviar_monitor(const char *txt)
+/* El aviso es un registro binario (ver eventos.c): no se formatea texto. */
+static void enviar_monitor(TipoOp tipo, int destino, int64_t cent)
 {
-    int q = msgget(MSG_KEY, 0666);
-    if (q == -1) { perror("msgget"); return; }
-    struct msgbuf m = { .tipo = 1 };
-    strncpy(m.texto, txt, TAM_MAX - 1);
-    msgsnd(q, &m, sizeof m.texto, 0);
+    evento_publicar(tabla, tipo, cuenta_sesion, destino, cent, 0);
 }
 
-static int buscar_cuenta(int num)
-{
-    for (int i = 0; i < tabla->num_cuentas; ++i)
-        if (tabla->cuentas[i].numero_cuenta == num)
-            return i;
-    return -1;
-}
-
-
-
-
 /* ───────────────────────────────────────────── */
 /*            OPERACIONES BANCARIAS              */
 /* ───────────────────────────────────────────── */
-static void deposito(float monto)
+/* banco está cerrando: lo que queda de sesión no podría cambiar nada. */
+static void cerrando(void)
 {
-    pthread_mutex_lock(mtx);
-
-    int idx = buscar_cuenta(cuenta_sesion);
-    tabla->cuentas[idx].saldo += monto;
-
-    buffer_push(&tabla->buffer, &tabla->cuentas[idx], P_ALTA);
-
-    pthread_mutex_unlock(mtx);
-
-    char buf[TAM_MAX];
-    snprintf(buf, sizeof buf, "Depósito: +%.2f", monto);
-    log_transaccion_individual(cuenta_sesion, buf);
-
-    snprintf(buf, sizeof buf, "DEPOSITO %d %.2f", cuenta_sesion, monto);
-    enviar_monitor(buf);
+    puts("El banco está cerrando; la operación no se ha hecho.");
+    exit(0);
 }
 
-static void retiro(float monto)
+static void deposito(int64_t cent)
 {
-    pthread_mutex_lock(mtx);
-
-    int idx = buscar_cuenta(cuenta_sesion);
-    if (tabla->cuentas[idx].saldo >= monto) {
-        tabla->cuentas[idx].saldo -= monto;
-
-        buffer_push(&tabla->buffer, &tabla->cuentas[idx], P_ALTA);
-
-        pthread_mutex_unlock(mtx);
-
-        char buf[TAM_MAX];
-        snprintf(buf, sizeof buf, "Retiro: -%.2f", monto);
-        log_transaccion_individual(cuenta_sesion, buf);
+    if (ruta_deposito(&enr, cuenta_sesion, cent) == OP_CERRANDO) cerrando();
+    anotar_historial(cuenta_sesion, OP_DEPOSITO, -1, cent);
 
+    enviar_monitor(OP_DEPOSITO, -1, cent);
+}
 
-        snprintf(buf, sizeof buf, "RETIRO %d %.2f", cuenta_sesion, monto);
-        enviar_monitor(buf);
+static void retiro(int64_t cent)
+{
+    ResultadoOp r = ruta_retiro(&enr, cuenta_sesion, cent);
+    if (r == OP_CERRANDO) cerrando();
+    if (r == OP_OK) {
+        anotar_historial(cuenta_sesion, OP_RETIRO, -1, -cent);
+        enviar_monitor(OP_RETIRO, -1, cent);
     } else {
-        pthread_mutex_unlock(mtx);
         puts("Saldo insuficiente.");
     }
 }
 
-static void transferencia(int destino, float monto)
+static void transferencia(int destino, int64_t cent)
 {
-    pthread_mutex_lock(mtx);
-
-    int idx_o = buscar_cuenta(cuenta_sesion);
-    int idx_d = buscar_cuenta(destino);
-    if (idx_d == -1) { pthread_mutex_unlock(mtx);
-                       puts("Cuenta destino no existe."); return; }
-
-    if (tabla->cuentas[idx_o].saldo >= monto) {
-        tabla->cuentas[idx_o].saldo -= monto;
-        tabla->cuentas[idx_d].saldo += monto;
-
-        buffer_push(&tabla->buffer, &tabla->cuentas[idx_o], P_ALTA);
-        buffer_push(&tabla->buffer, &tabla->cuentas[idx_d], P_ALTA);
-
-
-        pthread_mutex_unlock(mtx);
-
-        char buf[TAM_MAX];
-        snprintf(buf, sizeof buf, "Transferencia a %d: -%.2f", destino, monto);
-        log_transaccion_individual(cuenta_sesion, buf);
-
-
-        snprintf(buf, sizeof buf, "TRANSFERENCIA %d %d %.2f",
-                 cuenta_sesion, destino, monto);
-        enviar_monitor(buf);
+    ResultadoOp r = ruta_transferencia(&enr, cuenta_sesion, destino, cent);
+    if (r == OP_CERRANDO) cerrando();
+    if (r == OP_CUENTA_NO_EXISTE) { puts("Cuenta destino no existe."); return; }
+
+    if (r == OP_OK) {
+        anotar_historial(cuenta_sesion, OP_TRANSFERENCIA, destino, -cent);
+        anotar_historial(destino, OP_TRANSFERENCIA, cuenta_sesion, cent);
+        enviar_monitor(OP_TRANSFERENCIA, destino, cent);
     } else {
-        pthread_mutex_unlock(mtx);
         puts("Saldo insuficiente.");
     }
 }
 
 static void consultar_saldo(void)
 {
-    pthread_mutex_lock(mtx);
-    int idx = buscar_cuenta(cuenta_sesion);
-    float s = tabla->cuentas[idx].saldo;
-
-   buffer_push(&tabla->buffer, &tabla->cuentas[idx], P_ALTA);
+    int64_t s = 0;
+    ruta_saldo(&enr, cuenta_sesion, &s);
 
+    printf("Saldo actual = %s%lld.%02lld €\n", s < 0 ? "-" : "",
+           llabs(s) / 100, llabs(s) % 100);
+}
 
-    pthread_mutex_unlock(mtx);
+/* Los últimos `max` movimientos entre desde y hasta (ns). */
+static void consultar_historial(int64_t desde, int64_t hasta, int max)
+{
+    if (!historial_abierto) {
+        if (historial_abrir(&historial, &cfg, 0) == -1) return;
+        historial_abierto = 1;
+    }
+    if (max < 1 || max > MAX_HISTORIAL_CONSULTA) max = MAX_HISTORIAL_CONSULTA;
+    RegistroHistorial regs[MAX_HISTORIAL_CONSULTA];
+    int n = historial_consultar(&historial, cuenta_sesion, desde, hasta, regs, max);
+
+    char linea[TAM_MAX];
+    for (int i = 0; i < n; ++i) {
+        historial_describir(&regs[i], linea, sizeof linea);
+        puts(linea);
+    }
+    if (n == 0) puts("Sin movimientos.");
+}
 
-    printf("Saldo actual = %.2f €\n", s);
+static void menu_historial(void)
+{
+    int sub, n;
+    char d1[16], d2[16];
+    printf("1. Últimos N   2. Entre dos fechas: ");
+    if (scanf("%d", &sub) != 1) exit(0);
+    if (sub == 1) {
+        printf("N (hasta %d): ", MAX_HISTORIAL_CONSULTA); scanf("%d", &n);
+        consultar_historial(0, INT64_MAX, n);
+        return;
+    }
+    printf("Desde (AAAA-MM-DD): "); scanf("%15s", d1);
+    printf("Hasta (AAAA-MM-DD): "); scanf("%15s", d2);
+    int64_t desde = historial_fecha(d1, 0), hasta = historial_fecha(d2, 1);
+    if (desde == -1 || hasta == -1) { puts("Fecha no válida."); return; }
+    consultar_historial(desde, hasta, MAX_HISTORIAL_CONSULTA);
 }
 
 /* ───────────────────────────────────────────── */
@@ -200,34 +172,37 @@ static void menu_operaciones(void)
         printf("║ 2. Retiro                  ║\n");
         printf("║ 3. Transferencia           ║\n");
         printf("║ 4. Consultar saldo         ║\n");
-        printf("║ 5. Salir                   ║\n");
+        printf("║ 5. Historial               ║\n");
+        printf("║ 6. Salir                   ║\n");
         printf("╚════════════════════════════╝\n");
         printf("Seleccione: ");
 
         int op; if (scanf("%d",&op)!=1) exit(0);
-        if (op==5) break;
+        if (op==6) break;
 
-        float monto; int dest;
+        double monto; int dest;
         switch (op) {
         case 1:
-            printf("Monto a depositar: "); scanf("%f",&monto);
-            deposito(monto);                break;
+            printf("Monto a depositar: "); scanf("%lf",&monto);
+            deposito(a_centimos(monto));    break;
         case 2:
-            printf("Monto a retirar: ");   scanf("%f",&monto);
-            if (monto > cfg.limite_retiro)
+            printf("Monto a retirar: ");   scanf("%lf",&monto);
+            if (a_centimos(monto) > (int64_t)cfg.limite_retiro * 100)
                 printf("Límite de retiro: %d\n", cfg.limite_retiro);
-            else retiro(monto);
+            else retiro(a_centimos(monto));
             break;
         case 3:
             printf("Cuenta destino: ");     scanf("%d",&dest);
-            printf("Monto a transferir: "); scanf("%f",&monto);
-            if (monto > cfg.limite_transferencia)
+            printf("Monto a transferir: "); scanf("%lf",&monto);
+            if (a_centimos(monto) > (int64_t)cfg.limite_transferencia * 100)
                 printf("Límite de transferencia: %d\n",
                        cfg.limite_transferencia);
-            else transferencia(dest,monto);
+            else transferencia(dest, a_centimos(monto));
             break;
         case 4:
             consultar_saldo();              break;
+        case 5:
+            menu_historial();               break;
         default:
             puts("Opción inválida.");
         }
@@ -240,14 +215,19 @@ static void menu_operaciones(void)
 int main(int argc,char *argv[])
 {
 
-    if (argc<2){ fprintf(stderr,"Uso: %s <shm_id>\n",argv[0]); exit(EXIT_FAILURE); }
-    int shm_id = atoi(argv[1]);
-
-    /* 1. Conectar a la SHM */
-    tabla = adjuntar_shm(shm_id);
-    mtx = &tabla->mutex;
+    if (argc<2){ fprintf(stderr,"Uso: %s <shm_id>|particiones\n",argv[0]); exit(EXIT_FAILURE); }
 
+    registro_iniciar();          /* logs asíncronos, vaciados al salir */
     cfg = leer_config("config.txt");
+    registro_backend(cfg.backend_es);
+    registro_historial(&cfg);
+
+    /* 1. Conectar a la SHM (o a la de cada partición) */
+    if (strcmp(argv[1], "particiones") == 0)
+        enrutador_abrir(&enr, &cfg);
+    else
+        enrutador_unico(&enr, adjuntar_shm(atoi(argv[1])), &cfg);
+    metricas_registrar(enr.tablas[0], "usuario");
 
     /* 2. Autenticación simple */
     while (1) {
@@ -257,33 +237,25 @@ int main(int argc,char *argv[])
         printf("Introduce tu número de cuenta: ");
         if (scanf("%d",&cuenta_sesion)!=1) exit(0);
 
-        pthread_mutex_lock(mtx);
-        int idx = buscar_cuenta(cuenta_sesion);
-        int ok  = idx!=-1 && tabla->cuentas[idx].bloqueado==0;
-        pthread_mutex_unlock(mtx);
+        tabla   = tabla_de(&enr, cuenta_sesion);
+        int idx = buscar_cuenta(tabla, cuenta_sesion);
+        int ok  = 0;
+        if (idx != -1) {
+            bloquear_cuenta(tabla, idx);
+            ok = (estados_tabla(tabla)[idx] & ESTADO_BLOQUEADA) == 0;
+            desbloquear_cuenta(tabla, idx);
+        }
 
         if (ok) break;
         puts("Cuenta no válida o bloqueada.");
     }
 
-    /* 3. Directorio/semáforo del log */
-    if (mkdir("transacciones",0777)==-1 && errno!=EEXIST)
-        perror("mkdir transacciones");
-
-    char dir[128];
-    snprintf(dir,sizeof dir,"transacciones/%d",cuenta_sesion);
-    if (mkdir(dir,0777)==-1 && errno!=EEXIST)
-        perror("mkdir cuenta");
-
-    snprintf(sem_name,sizeof sem_name,"/log_%d",cuenta_sesion);
-    sem_log = sem_open(sem_name,O_CREAT,0644,1);
-    if (sem_log==SEM_FAILED){ perror("sem_open log"); exit(EXIT_FAILURE); }
-
-    /* 4. Operaciones */
+    /* 3. Operaciones */
     menu_operaciones();
 
-    /* 5. Limpieza */
-    sem_close(sem_log);
-    liberar_shm(tabla, -1);  // -1 indica que no liberamos shm_id (lo hace banco)
+    /* 4. Limpieza */
+    if (historial_abierto) historial_cerrar(&historial);
+    if (enr.propias) enrutador_cerrar(&enr);
+    else liberar_shm(tabla, -1);  // -1 indica que no liberamos shm_id (lo hace banco)
     return 0;
 }
@@ -2,16 +2,36 @@
 #define UTILS_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
 
-#define BUF_CAP 64
+#define CAPACIDAD_BUFFER_DEF 1024        /* si config.txt no la indica */
+#define CAPACIDAD_WAL_DEF    4096
+#define CAPACIDAD_CONTADORES_DEF 65536
+#define CAPACIDAD_EVENTOS_DEF 4096
+#define CLAVE_COLA_MONITOR   1234        /* cola SysV del modo CANAL_MONITOR=cola */
+
+/* Registro de cuentas.dat (y de lo que viaja al hilo IO).  En memoria la
+ * tabla no guarda Cuenta sino columnas separadas: ver TablaCuentas.
+ * `formato` ocupa el relleno que tenía el registro antiguo (saldo float,
+ * 64 bytes); migrar_cuentas() convierte un fichero de ese formato.       */
+#define TAM_TITULAR    50
+#define FORMATO_CUENTA 0xCE02    /* saldo en céntimos (int64) */
+#define TAM_CUENTA_V1  64        /* registro antiguo, con saldo float */
 
 typedef struct {
     int numero_cuenta;
-    char titular[50];
-    float saldo;
+    char titular[TAM_TITULAR];
+    uint16_t formato;            /* FORMATO_CUENTA */
+    int64_t saldo;               /* céntimos */
     int bloqueado;
 } Cuenta;
 
+typedef struct { char nombre[TAM_TITULAR]; } Titular;
+
 typedef enum { P_BAJA = 0, P_MEDIA = 1, P_ALTA = 2 } Prioridad;
 
 typedef struct {
@@ -19,46 +39,905 @@ typedef struct {
     Cuenta snapshot;
 } Operacion;
 
+/* Cola MPMC sin cerrojos (Vyukov) de capacidad potencia de 2.  Cada celda
+ * lleva un nº de secuencia que indica si está libre para el productor de la
+ * vuelta actual o lista para el consumidor.  Las celdas viven en el mismo
+ * segmento, a `desplazamiento` bytes de la propia cola.                    */
 typedef struct {
-    Operacion ops[BUF_CAP];
-    int n;
+    atomic_size_t secuencia;
+    Operacion op;
+} CeldaCola;
+
+typedef struct {
+    atomic_size_t cabeza __attribute__((aligned(64)));   /* productores  */
+    atomic_size_t cola   __attribute__((aligned(64)));   /* consumidores */
+    size_t mascara;
+    size_t desplazamiento;
+} ColaMPMC;
+
+/* Una cola por nivel de prioridad.  Si la cola está llena, buffer_push()
+ * espera a que el hilo IO libere hueco en lugar de descartar la escritura.
+ * Con las colas vacías el hilo IO duerme en `hay_datos`; los productores
+ * sólo lo despiertan si `durmiendo` está activo.                          */
+typedef struct {
+    ColaMPMC colas[3];
+    size_t capacidad;
+    atomic_long esperas;         /* veces que un productor halló la cola llena */
+    pthread_mutex_t mutex_aviso;
+    pthread_cond_t  hay_datos;
+    atomic_int durmiendo;
+    atomic_int parar;
 } BufferPrioridad;
 
+/* Política de fsync del volcado de cuentas (POLITICA_FSYNC en config.txt) */
+typedef enum { FSYNC_NUNCA = 0, FSYNC_VOLCADO = 1 } PoliticaFsync;
+
+/* Cómo escriben el hilo IO y el de logs (BACKEND_ES): pwritev/write de
+ * siempre o lotes por io_uring (uring.c), con vuelta a POSIX si el núcleo
+ * no lo ofrece.                                                          */
+typedef enum { ES_POSIX = 0, ES_URING = 1 } BackendES;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct iovec;
+
+/* Lo que se pidió en cada SQE (su user_data es la posición aquí), para
+ * completar a mano una escritura corta o fallida.                       */
+typedef struct {
+    uint8_t  opcode;
+    int      fd;
+    const void *dir;             /* buffer, o el vector de iovec */
+    unsigned n;                  /* bytes, o nº de iovec */
+    int64_t  desp;
+} PeticionUring;
+
+typedef struct {
+    int fd;
+    unsigned entradas;
+    unsigned *sq_cabeza, *sq_cola, *sq_indices, sq_mascara;
+    unsigned *cq_cabeza, *cq_cola, cq_mascara;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void  *sq, *cq;
+    size_t tam_sq, tam_cq, tam_sqes;
+    unsigned preparadas;         /* SQEs escritas y aún no enviadas */
+    unsigned en_vuelo;           /* enviadas sin completado recogido */
+    PeticionUring *peticiones;   /* cap_peticiones, por user_data */
+    unsigned cap_peticiones, siguiente;
+    long errores;                /* completados con error, rehechos con POSIX */
+    long cortas;                 /* escrituras cortas, completadas con POSIX */
+} Uring;
+
+/* Cerrojos por franja: la cuenta en la posición i se protege con
+ * cerrojos[i % num_cerrojos].  Cada cerrojo ocupa su propia línea de caché
+ * para que procesos que tocan franjas distintas no se estorben.           */
+#define MAX_CERROJOS 1024
+
+typedef struct {
+    pthread_mutex_t m;
+} __attribute__((aligned(64))) Cerrojo;
+
+/* Diario de escritura anticipada (WAL).  Cada operación que cambia saldos
+ * añade un registro con la post-imagen de las cuentas tocadas, así que
+ * reaplicarlo es idempotente.  Los registros se reservan sin cerrojos en un
+ * anillo de la SHM y un proceso "líder" escribe y sincroniza de una vez
+ * todos los que estén listos (commit en grupo).                           */
+typedef enum {
+    OP_DEPOSITO = 1, OP_RETIRO = 2, OP_TRANSFERENCIA = 3, OP_LOTE = 4,
+    OP_DOS_FASES = 5,            /* sólo en el diario: una rama de dosfases.c */
+    OP_ANULADO = 6,              /* sólo en el diario: hueco que nadie rellenó */
+    OP_INTERES = 7,              /* sólo en el historial: liquidar.c */
+    OP_COMISION = 8
+} TipoOp;
+
+typedef struct {
+    uint64_t lsn;
+    int32_t  tipo;               /* TipoOp */
+    int32_t  cuenta[2];          /* [1] = -1 si sólo toca una cuenta */
+    int32_t  resto;              /* OP_LOTE: registros que faltan del lote;
+                                    OP_DOS_FASES: xid de la transferencia */
+    int64_t  saldo[2];           /* céntimos tras la operación */
+    uint32_t sin_uso;            /* era el importe en float; nunca se leyó */
+    uint32_t suma;               /* FNV-1a de lo anterior: detecta colas rotas */
+} RegistroWAL;
+
+typedef struct {
+    atomic_uint_fast64_t listo;  /* lsn+1 cuando el registro está completo */
+    RegistroWAL r;
+} CeldaWAL;
+
+#define MAX_REPLICAS 4           /* réplicas de lectura (replicacion.c) */
+
+typedef struct {
+    int activo;
+    char archivo[64];
+    int ventana_us;              /* espera del líder para agrupar commits */
+    size_t mascara;
+    size_t desplazamiento;       /* celdas, relativo a esta estructura */
+    uint64_t max_registros;      /* recortar al pasar de aquí (0 = nunca) */
+    atomic_uint_fast64_t reservado;   /* siguiente lsn a repartir */
+    atomic_uint_fast64_t durable;     /* todo lsn < durable está en disco */
+    atomic_uint_fast64_t base;        /* lsn del primer registro del fichero */
+    atomic_uint generacion;           /* cambia con cada recorte */
+    atomic_uint_fast64_t retenido[MAX_REPLICAS];  /* lo que aún leen los emisores */
+    atomic_long commits, fsyncs, anulados;
+    pthread_mutex_t mutex;       /* robusto */
+    pthread_cond_t  volcado;
+    pid_t lider;                 /* proceso escribiendo, 0 = nadie (bajo mutex) */
+    uint64_t hueco, hueco_ns;    /* lsn+1 en el que está parado el líder y desde cuándo */
+} DiarioWAL;
+
+/* Eventos para el monitor.  Registro binario de tamaño fijo (importe en
+ * céntimos) que los usuarios publican en un anillo de la SHM con un único
+ * consumidor, el monitor, que los saca por lotes.  Si el anillo está lleno
+ * un depósito se descarta y se cuenta; el resto espera hueco mientras el
+ * monitor viva (eventos.c).  Con CANAL_MONITOR=cola viajan los mismos
+ * registros por la cola SysV.                                             */
+typedef enum { CANAL_SHM = 0, CANAL_COLA = 1 } CanalMonitor;
+
+typedef struct {
+    int32_t tipo;                /* TipoOp */
+    int32_t cuenta[2];           /* [1] = -1 salvo en transferencias;
+                                    OP_LOTE: [0] pagador, [1] nº de apuntes */
+    int32_t pid;
+    int32_t sesion;              /* conexión de servidor.c; 0 fuera de él */
+    int64_t centimos;
+    int64_t ts_ns;               /* CLOCK_REALTIME */
+} Evento;
+
+typedef struct {
+    atomic_size_t secuencia;
+    Evento ev;
+} CeldaEvento;
+
+typedef struct {
+    atomic_size_t cabeza __attribute__((aligned(64)));   /* productores */
+    size_t        cola   __attribute__((aligned(64)));   /* sólo el monitor */
+    size_t mascara;
+    size_t desplazamiento;       /* celdas, relativo a esta estructura */
+    atomic_long perdidos;        /* eventos descartados con el anillo lleno */
+    pthread_mutex_t mutex_aviso;
+    pthread_cond_t  hay_eventos;
+    atomic_int durmiendo;
+    atomic_int consumidor;       /* pid del monitor que los saca, 0 = ninguno */
+} AnilloEventos;
+
+/* Métricas de ejecución (metricas.c).  Cada proceso que se registra
+ * recibe su propia ranura en la SHM, alineada a línea de caché, con
+ * contadores y histogramas log2 (la cubeta c cuenta valores en
+ * [2^(c-1), 2^c); tiempos en ns).  Sólo escriben los hilos de ese proceso;
+ * ./estadisticas suma las ranuras.  La ranura 0 acumula lo de los
+ * procesos terminados cuyas ranuras se reutilizaron.                     */
+#define MAX_RANURAS   64
+#define CUBETAS_HIST  40
+
+typedef enum {
+    M_DEPOSITOS, M_RETIROS, M_TRANSFERENCIAS, M_SALDOS, M_LOTES,
+    M_CERROJOS,                  /* franjas tomadas */
+    M_CERROJOS_OCUPADOS,         /* … de ellas, tras esperar */
+    M_COLA_LLENA,                /* buffer_push esperó hueco */
+    M_EVENTOS_PERDIDOS,
+    M_FSYNCS_WAL,
+    M_VOLCADOS, M_CUENTAS_VOLCADAS, M_FSYNCS_VOLCADO,
+    M_BYTES_LOG,
+    M_APUNTES_PERDIDOS,          /* del historial, sin poder escribirlos */
+    NUM_METRICAS
+} Metrica;
+
+typedef enum {
+    H_ESPERA_CERROJO,            /* sólo las esperas de verdad */
+    H_OPERACION,                 /* op_*, incluida la espera del commit */
+    H_COLA,                      /* profundidad de la cola al encolar */
+    H_FSYNC_WAL,                 /* pwrite + fdatasync del líder */
+    H_VOLCADO,                   /* lo que el hilo IO pasa volcando un lote */
+    NUM_HISTOGRAMAS
+} Histograma;
+
+typedef struct {
+    atomic_int pid;              /* 0 = libre */
+    char nombre[16];
+    atomic_long valor[NUM_METRICAS];
+    atomic_long hist[NUM_HISTOGRAMAS][CUBETAS_HIST];
+} __attribute__((aligned(64))) RanuraMetricas;
+
+/* Dónde viven las cuentas: copiadas en la SHM (volcadas por el hilo IO) o
+ * en cuentas.dat proyectado con MAP_SHARED por cada proceso (MODO_CUENTAS). */
+typedef enum { MODO_SHM = 0, MODO_MMAP = 1 } ModoCuentas;
+
+/* Segmento de la tabla (memoria.c): SysV (shmget) o POSIX (shm_open y
+ * mmap, que puede crecer); páginas normales, huge pages transparentes
+ * (madvise) o reservadas (SHM_HUGETLB o un fichero en hugetlbfs); y
+ * dónde pone NUMA sus páginas: donde se tocan, repartidas entre todos
+ * los nodos o en uno.                                                    */
+typedef enum { SEG_SYSV = 0, SEG_POSIX = 1 } BackendSegmento;
+typedef enum { PAG_NORMALES = 0, PAG_THP, PAG_HUGETLB } PaginasSegmento;
+typedef enum { NUMA_LOCAL = 0, NUMA_ENTRELAZADA, NUMA_NODO } PoliticaNuma;
+
+#define DIRECTORIO_HUGETLB "/dev/hugepages"
+#define TAM_PAGINA_GRANDE  (2UL << 20)
+
+/* Tabla de cuentas en SHM.  El segmento se dimensiona al arrancar a partir
+ * de cuentas.dat: tras la cabecera van las celdas de las tres colas del
+ * buffer de E/S, los anillos del diario y de eventos y las ranuras de
+ * métricas, que no dependen del número de cuentas; después el índice hash
+ * (direccionamiento abierto, sondeo lineal) con `num_cubetas` enteros que
+ * guardan la posición de la cuenta o CUBETA_VACIA, una versión por cuenta
+ * y las cuentas por columnas: números, saldos en céntimos y estados
+ * contiguos (lo que recorren búsquedas, operaciones y auditoría), los
+ * titulares aparte y las copias de las instantáneas.  La posición de una
+ * cuenta es la misma en todas las columnas y en cuentas.dat.  Con
+ * SEGMENTO=posix el segmento puede crecer hasta `tam_reserva`
+ * (crecer_tabla): sólo se mueven el índice y las columnas.              */
+#define CUBETA_VACIA (-1)
+#define ESTADO_BLOQUEADA 1
+
 typedef struct {
-    Cuenta cuentas[100];
     int num_cuentas;
-    pthread_mutex_t mutex;
+    int capacidad;
+    int num_cubetas;             /* potencia de 2, ≥ 2·capacidad */
+    size_t tam_segmento;
+    size_t tam_reserva;          /* proyectado en cada proceso; > tam_segmento si puede crecer */
+    BackendSegmento segmento;
+    PaginasSegmento paginas;
+    int precargar;               /* páginas tocadas al crear y al crecer */
+    char nombre_segmento[64];    /* objeto POSIX o fichero de hugetlbfs */
+    size_t desp_metricas;        /* RanuraMetricas[MAX_RANURAS] */
+    size_t desp_indice;          /* int[num_cubetas] */
+    size_t desp_versiones;       /* seqlock de cada cuenta (leer_saldo) */
+    size_t desp_numeros;         /* int32_t[capacidad] */
+    size_t desp_saldos;          /* int64_t[capacidad], céntimos */
+    size_t desp_estados;         /* uint8_t[capacidad], ESTADO_* */
+    size_t desp_titulares;       /* Titular[capacidad] (frío) */
+    size_t desp_fotos;           /* int64_t[capacidad]: saldo al empezar la foto */
+    size_t desp_epocas;          /* atomic_uint[capacidad]: época de esa copia */
+    ModoCuentas modo;
+    char archivo_cuentas[64];
+    pthread_mutex_t mutex;       /* sólo cambios estructurales */
+    int num_cerrojos;
+    Cerrojo cerrojos[MAX_CERROJOS];
     BufferPrioridad buffer;
+    int intervalo_volcado_ms;    /* máx. retraso de una cuenta sucia */
+    PoliticaFsync politica_fsync;
+    BackendES backend_es;
+    atomic_long lotes_volcados;  /* estadísticas del hilo IO */
+    atomic_long cuentas_volcadas;
+    DiarioWAL wal;
+    CanalMonitor canal_monitor;
+    AnilloEventos eventos;
+    atomic_int foto_activa;      /* instantánea en curso (instantaneas.c) */
+    unsigned epoca_foto;         /* sólo cambia con todas las franjas tomadas */
+    atomic_int cerrando;         /* banco cierra: las operaciones se rechazan */
+    atomic_int en_curso;         /* operaciones que escriben, de la entrada al commit */
 } TablaCuentas;
 
+/* Regla de anomalía del monitor (reglas.c), una línea REGLA= de
+ * config.txt.  Salta cuando en los últimos `ventana_s` segundos la clave
+ * acumula `max_ops` operaciones de al menos `importe_min`, o su suma llega
+ * a `max_importe` (un límite a 0 no se mira).  En REGLA_SESIONES, cuando
+ * `max_ops` sesiones distintas (pid y conexión) han usado la cuenta
+ * dentro de la ventana.                                                  */
+#define MAX_REGLAS 16
+
+typedef enum { REGLA_CUENTA, REGLA_PAR, REGLA_SESIONES } ClaveRegla;
+
+typedef struct {
+    char       nombre[24];
+    int        tipo;             /* TipoOp, o 0 = cualquiera */
+    ClaveRegla clave;            /* cuenta de origen, par origen/destino o sesiones */
+    int        ventana_s;
+    int        max_ops;
+    int64_t    importe_min;      /* céntimos */
+    int64_t    max_importe;      /* céntimos */
+} ReglaAnomalia;
+
 typedef struct {
     int limite_retiro;
     int limite_transferencia;
     int umbral_retiros;
     int umbral_transferencias;
     int num_hilos;
+    int capacidad_buffer;
+    int intervalo_volcado_ms;
+    PoliticaFsync politica_fsync;
+    BackendES backend_es;
+    ModoCuentas modo_cuentas;
+    int capacidad_wal;
+    int ventana_grupo_us;
+    int punto_control_wal_mb;    /* recorte del diario en marcha, 0 = no */
+    int capacidad_contadores;    /* entradas por regla del monitor */
+    int hilos_monitor;           /* trabajadores de análisis */
+    ReglaAnomalia reglas[MAX_REGLAS];
+    int num_reglas;
+    CanalMonitor canal_monitor;
+    int capacidad_eventos;
     char archivo_cuentas[50];
     char archivo_log[50];
+    char archivo_wal[50];        /* vacío = sin diario */
+    char socket_banco[50];       /* vacío = terminales con ./usuario */
+    int hilos_servidor;
+    char directorio_fotos[50];   /* instantáneas versionadas de la tabla */
+    int intervalo_foto_s;        /* 0 = sólo a petición */
+    int conservar_fotos;
+    int particiones;             /* bancos que se reparten las cuentas */
+    char archivo_2pc[50];        /* decisiones de las transferencias entre ellos */
+    char socket_replica[50];     /* vacío = sin réplicas de lectura */
+    BackendSegmento segmento;
+    PaginasSegmento paginas;
+    int precargar;
+    PoliticaNuma numa;
+    int nodo_numa;               /* con NUMA_NODO */
+    int reserva_cuentas;         /* hasta dónde puede crecer un segmento POSIX */
+    int interes_pb;              /* liquidación: % anual en centésimas (150 = 1,50 %) */
+    int descubierto_pb;          /* el que se cobra a los saldos negativos */
+    int comision_diaria;         /* céntimos por cuenta y día... */
+    int saldo_exento;            /* ...salvo con saldo desde estos céntimos */
+    int hilos_liquidacion;       /* 0 = uno por CPU */
+    char directorio_extractos[50];
+    char directorio_historial[50];
+    int tam_segmento_historial;  /* MB de un segmento del historial antes de rotar */
+    int rotacion_historial_s;    /* o al cumplir estos segundos; 0 = sólo por tamaño */
+    int retencion_historial_dias;    /* se borran los sellados más viejos; 0 = nunca */
 } Config;
 
+/* Almacén acotado de contadores del monitor (contadores.c) */
+typedef struct {
+    uint64_t clave;
+    int      valor;
+    time_t   ts;                 /* última actualización; 0 = hueco libre */
+    uint64_t uso;                /* reloj lógico para el desalojo LRU */
+} EntradaContador;
+
+typedef struct {
+    EntradaContador *e;
+    unsigned char   *datos;      /* tam_dato bytes por entrada, o NULL */
+    size_t tam_dato;
+    size_t capacidad, mascara;
+    size_t usados, max_usados;
+    int ttl;
+    uint64_t reloj;
+    long desalojos;
+    long busquedas, sondeos;
+} AlmacenContadores;
+
+typedef struct {
+    size_t entradas, capacidad, bytes;
+    long desalojos;
+    size_t sondeo_max;
+    double sondeo_medio;             /* distancia media al hueco propio */
+    double sondeo_medio_busqueda;    /* huecos mirados por búsqueda */
+} EstadisticasContadores;
+
+/* Motor de reglas del monitor (reglas.c).  Un almacén de contadores por
+ * regla, con una ventana de cubetas por clave.                           */
+#define MAX_PIDS_SESION 8
+
+typedef struct {
+    const ReglaAnomalia *regla;
+    int     cuenta, destino;     /* destino sólo en REGLA_PAR */
+    int     ops;                 /* operaciones, o sesiones en REGLA_SESIONES */
+    int64_t suma;                /* céntimos */
+    int     pids[MAX_PIDS_SESION];
+    int     sesiones[MAX_PIDS_SESION];
+} Alerta;
+
+typedef struct {
+    int num_reglas;
+    ReglaAnomalia reglas[MAX_REGLAS];
+    AlmacenContadores estado[MAX_REGLAS];
+    long disparos[MAX_REGLAS];
+    long eventos, atrasados;     /* atrasados: más viejos que la ventana */
+} MotorReglas;
+
+/* Tubería de análisis del monitor (tuberia.c) */
+#define MAX_HILOS_MONITOR 16
+
+typedef struct {
+    int  hilos, num_reglas;
+    long eventos[MAX_HILOS_MONITOR];     /* por trabajador */
+    long alertas, atrasados;
+    long esperas;                        /* trabajador sin bloque libre */
+    long escrituras, bytes;              /* writev del sumidero */
+    struct {
+        char   nombre[24];
+        long   disparos, desalojos;
+        size_t entradas, capacidad, bytes;
+    } regla[MAX_REGLAS];
+} EstadisticasTuberia;
+
+/* Instantánea de la tabla (instantaneas.c): cabecera y después
+ * num_cuentas registros Cuenta en el orden de la tabla.  Recoge el estado
+ * exacto en un instante: todo lo del diario con lsn < `lsn` y nada más.
+ * Las de MAGIA_FOTO_V1 llevan registros del formato antiguo (float).     */
+#define MAGIA_FOTO    "SBFOTO2"
+#define MAGIA_FOTO_V1 "SBFOTO1"
+
+typedef struct {
+    char     magia[8];
+    uint32_t version;
+    int32_t  num_cuentas;
+    uint64_t lsn;
+    int64_t  ts;                 /* time() al empezar */
+    int64_t  total;              /* suma de saldos, céntimos */
+} CabeceraFoto;
+
+/* Réplica de lectura (replicacion.c).  banco atiende SOCKET_REPLICA: a
+ * cada réplica le manda una instantánea (REP_BASE y num_cuentas Cuenta)
+ * y después, en orden de lsn, los registros del diario que ya son
+ * durables (REP_REGISTROS y n RegistroWAL), con latidos cuando no hay
+ * nada.  Cada mensaje lleva el lsn durable del primario y la hora de
+ * envío, con lo que la réplica mide cuánto va por detrás.               */
+typedef enum { REP_BASE = 1, REP_REGISTROS, REP_LATIDO } TipoMensajeReplica;
+
+typedef struct {
+    int32_t  tipo;               /* TipoMensajeReplica */
+    int32_t  n;                  /* cuentas o registros que siguen */
+    uint64_t lsn;                /* de la foto, del primer registro o el siguiente a enviar */
+    uint64_t durable;            /* del primario al enviar */
+    int64_t  ts_ns;              /* CLOCK_REALTIME al enviar */
+} MensajeReplica;
+
+typedef struct {
+    TablaCuentas *tabla;         /* copia propia, en un segmento privado */
+    int shm_id;
+    int fd;
+    atomic_uint_fast64_t aplicado;       /* todo lsn < aplicado está en la tabla */
+    atomic_uint_fast64_t durable;        /* el del primario según el último mensaje */
+    atomic_llong ts_al_dia;              /* envío del último mensaje tras el que iba al día */
+    atomic_llong transito_ns;            /* de ese mensaje hasta aplicarlo */
+    atomic_long  registros;
+    RegistroWAL *lote;                   /* registros de un OP_LOTE a medias */
+    int en_lote;
+} Replica;
+
+/* Auditoría del libro mayor (auditoria.c): recorre las columnas de saldos
+ * y estados con AVX2, SSE2 o en escalar.                                 */
+typedef enum { AUD_AUTO = 0, AUD_ESCALAR, AUD_SSE2, AUD_AVX2 } ImplAuditoria;
+
+typedef struct {
+    int64_t total;               /* suma de saldos, céntimos */
+    long negativas;
+    long bloqueadas;
+    int *posiciones;             /* negativas o bloqueadas, en orden */
+    int max_posiciones;
+    int num_posiciones;
+} Auditoria;
+
+/* Liquidación de fin de día (liquidacion.c): intereses y comisiones de
+ * todas las cuentas, repartidas por tramos entre hilos.  El extracto es
+ * de líneas de LARGO_EXTRACTO caracteres, cabecera en la 0 y la cuenta de
+ * la posición i en la i + 1, así cada hilo escribe lo suyo con pwrite;
+ * los totales van en la línea siguiente a la última cuenta.             */
+#define LARGO_EXTRACTO 72
+
+typedef struct {
+    long cuentas, con_movimiento, bloqueadas, exentas;
+    int64_t total_antes, total_despues;  /* céntimos */
+    int64_t intereses;           /* abonados a saldos positivos */
+    int64_t descubiertos;        /* cobrados a saldos negativos */
+    int64_t comisiones;
+} ResumenLiquidacion;
+
+/* Historial por cuenta (historial.c).  Cada apunte es un registro fijo que
+ * se añade al segmento activo DIRECTORIO_HISTORIAL/<n>.act, compartido por
+ * todas las cuentas y procesos: un fichero de control proyectado por todos
+ * reparte los huecos sin cerrojos.  Al pasar de tamaño o de tiempo se abre
+ * el n + 1 y el n se sella en <n>.seg: registros ordenados por (cuenta,
+ * ts) tras un índice de cuentas.  Cada entrada del índice apunta al
+ * sellado anterior con la misma cuenta y DIRECTORIO_HISTORIAL/ultimos al
+ * más reciente, así "los últimos N" recorre sólo los segmentos de la
+ * cuenta, con una búsqueda binaria por cuenta y otra por tiempo en cada uno. */
+#define MAGIA_HISTORIAL     "SBHIST1"
+#define MAGIA_SEGMENTO_HIST "SBHSEG2"
+#define MAGIA_SEGMENTO_HIST1 "SBHSEG1"   /* sin `anterior`: se enlaza al abrir */
+#define MAGIA_ULTIMOS_HIST  "SBHULT1"
+#define MAX_HISTORIAL_CONSULTA 100   /* apuntes por consulta del menú */
+
+typedef struct {
+    int64_t  ts;                 /* ns desde 1970 */
+    int32_t  cuenta;
+    int32_t  otra;               /* contraparte de una transferencia, apuntes de un lote o -1 */
+    int64_t  centimos;           /* abono > 0, cargo < 0 */
+    uint8_t  tipo;               /* TipoOp */
+    uint8_t  relleno[3];
+    uint32_t suma;               /* FNV-1a de lo anterior: 0 en un hueco sin escribir */
+} RegistroHistorial;
+
+typedef struct {
+    char     magia[8];
+    uint32_t tam_registro;
+    uint32_t relleno;
+    atomic_uint_fast64_t cursor;      /* segmento activo << 32 | registros reservados */
+    atomic_int_fast64_t  inicio;      /* ns en que se abrió el segmento... */
+    atomic_uint          segmento_inicio;   /* ...con este número */
+    atomic_uint          primero_vivo;      /* los anteriores, borrados por retención */
+} ControlHistorial;
+
+typedef struct {
+    char     magia[8];
+    uint32_t num_cuentas;
+    uint32_t relleno;
+    uint64_t num_registros;
+    int64_t  ts_min, ts_max;
+} CabeceraSegmentoHist;
+
+typedef struct {
+    int32_t  cuenta;
+    uint32_t num;
+    uint32_t primero;            /* posición de su primer registro */
+    uint32_t anterior;           /* sellado anterior con la cuenta + 1; 0 = ninguno */
+} EntradaIndiceHist;
+
+/* DIRECTORIO_HISTORIAL/ultimos: tabla hash abierta, proyectada por todos,
+ * de cuenta → último sellado con ella.  La escribe quien sella, con flock;
+ * si crece se sustituye por otra con rename.                             */
+typedef struct {
+    char       magia[8];
+    uint32_t   cap;              /* potencia de 2 */
+    uint32_t   usadas;
+    atomic_int sucio;            /* un sellado a medias: hay que rehacerla */
+    atomic_int sustituida;       /* creció: hay que volver a abrirla */
+} CabeceraUltimosHist;
+
+typedef struct {
+    atomic_int  cuenta;
+    atomic_uint segmento;        /* + 1; 0 = entrada libre */
+} EntradaUltimosHist;
+
+/* Un segmento proyectado: sellado (índice y registros ordenados) o activo
+ * (registros en orden de llegada, con posibles huecos).                 */
+typedef struct {
+    uint32_t numero;
+    int      sellado;
+    void    *base;
+    size_t   tam;
+    const CabeceraSegmentoHist *cab;
+    const EntradaIndiceHist    *indice;
+    const RegistroHistorial    *registros;
+    size_t   num_registros;
+} MapaSegmentoHist;
+
+/* Índice en memoria del segmento activo: por cuenta, sus apuntes (ts y
+ * posición en el .act) ordenados por tiempo.  Tabla hash abierta.       */
+typedef struct {
+    int64_t  ts;
+    uint32_t pos;
+} PosicionHist;
+
+typedef struct {
+    int32_t       cuenta;
+    uint32_t      num, cap;      /* cap == 0: entrada libre */
+    PosicionHist *v;
+} CuentaActivaHist;
+
+typedef struct {
+    uint32_t          segmento;
+    uint32_t          escaneados;    /* registros del .act ya vistos */
+    uint32_t         *huecos;        /* posiciones vistas aún sin escribir */
+    uint32_t          num_huecos, cap_huecos;
+    CuentaActivaHist *cuentas;
+    uint32_t          cap_cuentas, usadas;
+} IndiceActivoHist;
+
+typedef struct {
+    ControlHistorial *ctl;
+    char     dir[64];
+    uint32_t max_registros;      /* por segmento */
+    int64_t  rotacion_ns;
+    int      fd;                 /* escritor: último segmento abierto */
+    uint32_t segmento_fd;
+    int64_t  retencion_ns;       /* 0: no se borra nada */
+    pthread_mutex_t  mutex;      /* consultas: caché de mapas y "ultimos" */
+    pthread_mutex_t  mutex_activo;   /* consultas: índice del activo */
+    pthread_rwlock_t uso;        /* consultas en curso frente a desproyectar */
+    MapaSegmentoHist **mapas;    /* sellados proyectados, por número */
+    uint32_t num_mapas, cap_mapas;
+    CabeceraUltimosHist *ultimos;
+    size_t   tam_ultimos;
+    IndiceActivoHist activo;
+} Historial;
+
+/* Particiones (particiones.c).  Con PARTICIONES=N corren N procesos
+ * `./banco particion=i`, cada uno con su segmento (clave SysV fija
+ * CLAVE_PARTICIONES + i), su cuentas.dat.i, su diario y su hilo IO.  La
+ * cuenta c vive en la partición c mod N.  Un Enrutador se adjunta a todas
+ * y lleva cada operación a la suya; una transferencia entre dos
+ * particiones va en dos fases (dosfases.c).                              */
+#define MAX_PARTICIONES   16
+#define CLAVE_PARTICIONES 0x53420
+
+typedef struct {
+    int num;
+    TablaCuentas *tablas[MAX_PARTICIONES];
+    int propias;                 /* las adjuntó enrutador_abrir() */
+    char archivo_2pc[50];
+} Enrutador;
+
+/* Rama de una transferencia entre particiones: la cuenta queda bloqueada
+ * entre op_preparar() y op_confirmar()/op_abortar().                     */
+typedef struct {
+    int     idx, cuenta;
+    int64_t despues;             /* post-imagen, céntimos */
+} Preparada;
+
+/* Registro del log de decisiones de dosfases.c (tamaño fijo, O_APPEND).
+ * El xid de una transferencia es la posición de su DF_CONFIRMADA en el
+ * fichero; sin ese registro en disco la transferencia no ocurrió.  Un log
+ * compactado empieza con un DF_BASE: su xid es el del registro siguiente
+ * y las posiciones cuentan desde ahí.                                    */
+typedef enum { DF_CONFIRMADA = 1, DF_TERMINADA, DF_RESUELTA, DF_BASE } EstadoDosFases;
+
+typedef struct {
+    int32_t  estado;             /* EstadoDosFases */
+    uint32_t xid;                /* TERMINADA y RESUELTA: a qué CONFIRMADA; BASE: el primero */
+    int32_t  particion[2];       /* origen, destino; RESUELTA: [0] la resuelta */
+    int32_t  cuenta[2];
+    int64_t  despues[2];         /* post-imágenes, céntimos */
+    uint32_t sin_uso;            /* era el importe en float; nunca se leyó */
+    uint32_t suma;               /* FNV-1a de lo anterior */
+} RegistroDosFases;
+
 /* Memoria */
-int crear_shm();
+size_t tam_tabla(int capacidad, const Config *cfg);
+int crear_shm(int capacidad, const Config *cfg);
+int crear_shm_clave(int clave, int capacidad, const Config *cfg);
 TablaCuentas* adjuntar_shm(int shm_id);
+int buscar_shm_clave(int clave, const Config *cfg);
+int crecer_tabla(TablaCuentas *t, int capacidad);
+void inicializar_tabla(TablaCuentas *t, int capacidad, const Config *cfg);
+void destruir_tabla(TablaCuentas *t);
+int *indice_tabla(TablaCuentas *t);
+int32_t *numeros_tabla(TablaCuentas *t);
+int64_t *saldos_tabla(TablaCuentas *t);
+uint8_t *estados_tabla(TablaCuentas *t);
+Titular *titulares_tabla(TablaCuentas *t);
+int64_t *fotos_tabla(TablaCuentas *t);
+atomic_uint *epocas_tabla(TablaCuentas *t);
+void leer_cuenta(TablaCuentas *t, int idx, Cuenta *c);
+void escribir_cuenta(TablaCuentas *t, int idx, const Cuenta *c);
+void cargar_proyeccion(TablaCuentas *t);
+int64_t a_centimos(double euros);
+int buscar_cuenta(TablaCuentas *t, int numero);
+int indexar_cuenta(TablaCuentas *t, int idx);
+int insertar_cuenta(TablaCuentas *t, const Cuenta *c);
+void mapear_cuentas(TablaCuentas *t);
+int sincronizar_cuentas(TablaCuentas *t);
+void bloquear_cuenta(TablaCuentas *t, int idx);
+void desbloquear_cuenta(TablaCuentas *t, int idx);
+void bloquear_par(TablaCuentas *t, int idx_a, int idx_b);
+void desbloquear_par(TablaCuentas *t, int idx_a, int idx_b);
+int bloquear_varias(TablaCuentas *t, const int *idx, int n, int *franjas);
+void desbloquear_varias(TablaCuentas *t, const int *franjas, int nf);
+void bloquear_todo(TablaCuentas *t);
+void desbloquear_todo(TablaCuentas *t);
+atomic_uint *versiones_tabla(TablaCuentas *t);
+void empezar_escritura(TablaCuentas *t, int idx);
+void terminar_escritura(TablaCuentas *t, int idx);
+int64_t leer_saldo(TablaCuentas *t, int idx);
 void liberar_shm(void *ptr, int shm_id);
 void inicializar_mutex_proceso_compartido(pthread_mutex_t *mutex);
+void inicializar_mutex_robusto(pthread_mutex_t *mutex);
+void inicializar_cond_proceso_compartido(pthread_cond_t *cond);
 void destruir_mutex(pthread_mutex_t *mutex);
 
+/* Métricas */
+RanuraMetricas *ranuras_tabla(TablaCuentas *t);
+void metricas_inicializar(TablaCuentas *t);
+void metricas_registrar(TablaCuentas *t, const char *nombre);
+int metricas_senalar(TablaCuentas *t, const char *nombre, int senal);
+void metricas_soltar(const TablaCuentas *t);
+uint64_t reloj_ns(void);
+uint64_t reloj_metricas(void);
+void metrica_sumar(Metrica m, long n);
+void metrica_observar(Histograma h, uint64_t valor);
+const char *nombre_metrica(Metrica m);
+const char *nombre_histograma(Histograma h);
+
 /* Ficheros */
 Config leer_config(const char *ruta);
-int cargar_cuentas(const char *ruta, Cuenta *cuentas);
-void volcar_cuentas(const char *ruta, Cuenta *cuentas, int n);
+void config_particion(Config *c, int p);
+int migrar_cuentas(const char *ruta);
+int reservar_cuentas(const char *ruta);
+void cuenta_desde_v1(const void *registro, Cuenta *c);
+int contar_cuentas(const char *ruta);
+int cargar_cuentas(const char *ruta, TablaCuentas *t);
+int volcar_cuentas(const char *ruta, TablaCuentas *t);
 void append_log(const char *ruta_log, const char *linea);
-void log_transaccion_individual(int cuenta, const char *linea);
+void anotar_historial(int cuenta, TipoOp tipo, int otra, int64_t centimos);
 void obtener_timestamp(char *dst, size_t n);
 
+/* Operaciones bancarias sobre la tabla (sin logs ni avisos al monitor).
+ * OP_DESCUADRE: los apuntes de un lote no suman cero.  OP_CERRANDO: banco
+ * está cerrando y no admite más cambios (operaciones_cerrar).            */
+typedef enum {
+    OP_OK = 0, OP_SALDO_INSUFICIENTE, OP_CUENTA_NO_EXISTE, OP_LIMITE, OP_DESCUADRE,
+    OP_CERRANDO
+} ResultadoOp;
+
+/* Apunte de un lote: abono si centimos > 0, cargo si < 0. */
+#define MAX_APUNTES 1024
+
+typedef struct {
+    int cuenta;
+    int64_t centimos;
+} Apunte;
+
+ResultadoOp op_deposito(TablaCuentas *t, int cuenta, int64_t centimos);
+ResultadoOp op_retiro(TablaCuentas *t, int cuenta, int64_t centimos);
+ResultadoOp op_transferencia(TablaCuentas *t, int origen, int destino, int64_t centimos);
+ResultadoOp op_saldo(TablaCuentas *t, int cuenta, int64_t *centimos);
+ResultadoOp op_lote(TablaCuentas *t, const Apunte *apuntes, int n, int64_t limite, int *fallo);
+ResultadoOp op_preparar(TablaCuentas *t, int cuenta, int64_t centimos, Preparada *p);
+uint64_t op_confirmar(TablaCuentas *t, const Preparada *p, uint32_t xid);
+void op_abortar(TablaCuentas *t, const Preparada *p);
+int operaciones_cerrar(TablaCuentas *t, int espera_ms);
+
+/* Protocolo cliente ↔ banco por el socket Unix (servidor.c, cliente.c).
+ * Mensajes binarios de 16 bytes; cada petición recibe una respuesta en el
+ * mismo orden.  Importes en céntimos.  La sesión queda ligada a la
+ * conexión tras un PET_SESION aceptado.  PET_HISTORIAL lleva en `cuenta`
+ * cuántos apuntes (hasta MAX_HISTORIAL_CONSULTA) y en `centimos` el
+ * intervalo en segundos desde 1970, desde << 32 | hasta (0 = sin límite);
+ * su respuesta trae en `reservado` cuántos RegistroHistorial la siguen. */
+typedef enum {
+    PET_SESION = 1, PET_DEPOSITO, PET_RETIRO, PET_TRANSFERENCIA, PET_SALDO,
+    PET_HISTORIAL
+} TipoPeticion;
+
+/* Los cuatro primeros valores coinciden con ResultadoOp. */
+typedef enum {
+    RES_OK = 0, RES_SALDO_INSUFICIENTE, RES_CUENTA_NO_EXISTE,
+    RES_LIMITE, RES_BLOQUEADA, RES_SIN_SESION, RES_INVALIDA, RES_CERRANDO
+} EstadoRespuesta;
+
+typedef struct {
+    int32_t tipo;                /* TipoPeticion */
+    int32_t cuenta;              /* PET_SESION: cuenta; PET_TRANSFERENCIA: destino */
+    int64_t centimos;
+} Peticion;
+
+typedef struct {
+    int32_t estado;              /* EstadoRespuesta */
+    int32_t reservado;           /* PET_HISTORIAL: apuntes que siguen */
+    int64_t centimos;            /* saldo tras la operación */
+} Respuesta;
+
+/* Particiones y enrutado */
+int particion_de(int cuenta, int num);
+int crear_shm_particion(int p, int capacidad, const Config *cfg);
+void enrutador_abrir(Enrutador *e, const Config *cfg);
+void enrutador_unico(Enrutador *e, TablaCuentas *t, const Config *cfg);
+void enrutador_cerrar(Enrutador *e);
+TablaCuentas *tabla_de(Enrutador *e, int cuenta);
+ResultadoOp ruta_deposito(Enrutador *e, int cuenta, int64_t centimos);
+ResultadoOp ruta_retiro(Enrutador *e, int cuenta, int64_t centimos);
+ResultadoOp ruta_transferencia(Enrutador *e, int origen, int destino, int64_t centimos);
+ResultadoOp ruta_saldo(Enrutador *e, int cuenta, int64_t *centimos);
+
+/* Transferencias entre particiones en dos fases */
+ResultadoOp dosfases_transferencia(Enrutador *e, int origen, int destino, int64_t centimos);
+int dosfases_resolver(TablaCuentas *t, const Config *cfg, int p);
+void dosfases_cerrar_resueltas(const Config *cfg);
+void dosfases_vigilar_diario(const Config *cfg, int p);
+
+/* Replicación: envío (banco) y réplica */
+void replicacion_iniciar(TablaCuentas *t, const Config *cfg);
+void replicacion_detener(void);
+int replica_conectar(Replica *r, const Config *cfg);
+int replica_recibir(Replica *r);
+void replica_retraso(Replica *r, uint64_t *registros, double *ms);
+void replica_cerrar(Replica *r);
+
+/* Servidor de sesiones */
+void servidor_iniciar(TablaCuentas *t, const Config *cfg);
+void servidor_detener(void);
+
+/* Registro asíncrono de logs */
+void registro_iniciar(void);
+void registro_cerrar(void);
+void seccion_entrar(void);
+void seccion_salir(void);
+void registro_global(const char *ruta_log, const char *linea);
+void registro_apunte(const RegistroHistorial *r);
+void registro_backend(BackendES b);
+void registro_historial(const Config *cfg);
+
+/* Diario (WAL) */
+void wal_inicializar(DiarioWAL *w, const Config *cfg, size_t capacidad, size_t desplazamiento);
+uint64_t wal_anotar(DiarioWAL *w, TipoOp tipo, const int cuenta[2], const int64_t saldo[2]);
+uint64_t wal_anotar_lote(DiarioWAL *w, const int *cuentas, const int64_t *saldos, int n);
+int wal_cabe_lote(const DiarioWAL *w, int n);
+void wal_confirmar(DiarioWAL *w, uint64_t lsn);
+uint64_t wal_anotar_rama(DiarioWAL *w, int cuenta, int64_t saldo, uint32_t xid);
+int wal_recuperar(TablaCuentas *t);
+uint32_t *wal_ramas(const DiarioWAL *w, int *n);
+int wal_sigue_lote(const RegistroWAL *previo, const RegistroWAL *r);
+void wal_truncar(DiarioWAL *w);
+int wal_crecido(const DiarioWAL *w);
+uint64_t wal_corte(const DiarioWAL *w, uint64_t corte);
+void wal_recortar(DiarioWAL *w, uint64_t hasta);
+void wal_al_recortar(void (*aviso)(const uint32_t *xids, int n));
+
+/* Contadores del monitor */
+void ac_iniciar(AlmacenContadores *a, size_t capacidad, int ttl_s);
+void ac_iniciar_datos(AlmacenContadores *a, size_t capacidad, int ttl_s, size_t tam_dato);
+void ac_liberar(AlmacenContadores *a);
+int *ac_contador(AlmacenContadores *a, uint64_t clave, time_t ahora);
+void *ac_datos(AlmacenContadores *a, uint64_t clave, time_t ahora);
+void ac_borrar(AlmacenContadores *a, uint64_t clave);
+void ac_estadisticas(const AlmacenContadores *a, EstadisticasContadores *s);
+
+/* Reglas de anomalía */
+void motor_iniciar(MotorReglas *m, const Config *cfg);
+void motor_liberar(MotorReglas *m);
+int motor_evaluar(MotorReglas *m, const Evento *ev, Alerta *alertas, int max);
+void describir_alerta(const Alerta *a, char *dst, size_t n);
+
+/* Tubería del monitor */
+void tuberia_iniciar(const Config *cfg, int hilos, const char *ruta_log, int con_eco);
+void tuberia_encolar(const Evento *lote, int n);
+void tuberia_detener(void);
+void tuberia_estadisticas(EstadisticasTuberia *e);
+
+/* Eventos para el monitor */
+void eventos_inicializar(AnilloEventos *a, size_t capacidad, size_t desplazamiento);
+void evento_publicar(TablaCuentas *t, TipoOp tipo, int origen, int destino, int64_t centimos, int sesion);
+int eventos_recibir(TablaCuentas *t, Evento *lote, int max);
+
+/* Instantáneas */
+int foto_tomar(TablaCuentas *t, const char *directorio, int conservar,
+               CabeceraFoto *cab, double *parada_ms);
+void foto_ruta(char *ruta, size_t tam, const char *directorio, int version);
+int foto_leer_cabecera(const char *ruta, CabeceraFoto *c);
+int foto_cargar(const char *ruta, TablaCuentas *t);
+void instantaneas_iniciar(TablaCuentas *t, const Config *cfg);
+void instantanea_pedir(void);
+void instantaneas_detener(void);
+
+/* Auditoría */
+ImplAuditoria auditoria_disponible(ImplAuditoria impl);
+const char *nombre_auditoria(ImplAuditoria impl);
+ImplAuditoria auditar_columnas(const int64_t *saldos, const uint8_t *estados, int n,
+                               Auditoria *a, ImplAuditoria impl);
+ImplAuditoria auditar_tabla(TablaCuentas *t, Auditoria *a, ImplAuditoria impl);
+
+/* Liquidación */
+int liquidar_tabla(TablaCuentas *t, const Config *cfg, int dias, int hilos,
+                   int fd_extracto, ResumenLiquidacion *r);
+void linea_extracto(char *linea, int numero, int64_t antes, int64_t interes,
+                    int64_t comision, int64_t despues);
+
+/* Historial por cuenta */
+int historial_abrir(Historial *h, const Config *cfg, int escritor);
+void historial_cerrar(Historial *h);
+int historial_escribir(Historial *h, RegistroHistorial *r, int n);
+int historial_consultar(Historial *h, int cuenta, int64_t desde, int64_t hasta,
+                        RegistroHistorial *out, int max);
+int historial_valido(const RegistroHistorial *r);
+int historial_listar(const char *dir, uint32_t **numeros);
+int historial_mapear(const char *dir, uint32_t numero, MapaSegmentoHist *m);
+void historial_desmapear(MapaSegmentoHist *m);
+int64_t historial_ahora(void);
+int64_t historial_fecha(const char *aaaa_mm_dd, int fin_de_dia);
+void historial_describir(const RegistroHistorial *r, char *dst, size_t n);
+void historial_preparar(Historial *h);
+int historial_migrar(const Config *cfg);
+
+/* io_uring */
+int uring_iniciar(Uring *u, unsigned entradas);
+void uring_cerrar(Uring *u);
+int uring_writev(Uring *u, int fd, const struct iovec *iov, unsigned n, int64_t desp, unsigned flags);
+int uring_write(Uring *u, int fd, const void *buf, size_t n, int64_t desp, unsigned flags);
+int uring_fdatasync(Uring *u, int fd, unsigned flags);
+int uring_enviar(Uring *u, unsigned esperar);
+int uring_cosechar(Uring *u);
+void uring_esperar_todo(Uring *u);
+
 /* Entrada/Salida */
+void buffer_inicializar(BufferPrioridad *b, size_t capacidad, size_t desplazamiento);
 void buffer_push(BufferPrioridad *b, const Cuenta *cta, Prioridad prio);
+int buffer_pop(BufferPrioridad *b, Operacion *op);
 void *gestionar_entrada_salida(void *arg);
+void detener_entrada_salida(TablaCuentas *t);
 
 
 #endif
@@ -0,0 +1,589 @@
+/* wal.c — Diario de escritura anticipada (WAL) con commit en grupo
+ *
+ *  ▸ op_deposito/op_retiro/op_transferencia reservan un lsn con un simple
+ *    fetch_add y copian el registro en el anillo de la SHM mientras tienen
+ *    la cuenta bloqueada, así el orden del diario respeta el de los cerrojos.
+ *  ▸ Fuera del cerrojo esperan en wal_confirmar() a que su lsn sea durable.
+ *    El primer proceso que llega se hace líder: espera `ventana_us` para
+ *    que se acumulen más registros, los escribe con pwrite y hace un único
+ *    fdatasync para todos.  El resto duerme en la condición compartida.
+ *  ▸ Un lote (op_lote) reserva de una vez lsn consecutivos, dos cuentas por
+ *    registro; al recuperar sólo se aplica si llegó entero a disco.
+ *  ▸ Al arrancar, banco reaplica el diario sobre cuentas.dat (los registros
+ *    llevan la post-imagen, así que reaplicar es idempotente), guarda un
+ *    punto de control y lo trunca.  Mientras corre, el hilo IO lo recorta
+ *    (wal_recortar) tras cada punto de control: el fichero empieza en el
+ *    lsn `base` y cada recorte cambia de `generacion`.
+ *  ▸ Un proceso que muere a medias no para a los demás: el mutex es
+ *    robusto, el líder se apunta con su pid y quien espera se queda con el
+ *    puesto si ese pid ya no existe; un hueco reservado que nadie rellena
+ *    en ESPERA_HUECO_NS se anula (OP_ANULADO) y su dueño, si vive,
+ *    reintenta con otro lsn.
+ *  ▸ Las ramas de una transferencia entre particiones (dosfases.c) llevan
+ *    su xid: al arrancar, wal_ramas() dice cuáles llegaron a este diario.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+#define ESPERA_LIDER_MS   100             /* entre comprobaciones del líder */
+#define ESPERA_HUECO_NS   1000000000ULL   /* antes de anular un hueco */
+
+/* Estado de una celda en `listo`: lsn+1 y, en los bits altos, si su dueño
+ * la está copiando o si se anuló.                                        */
+#define WAL_ESCRIBIENDO  (1ULL << 63)
+#define WAL_ANULADO      (1ULL << 62)
+#define LSN_CELDA(v)     ((v) & ~(WAL_ESCRIBIENDO | WAL_ANULADO))
+
+/* Descriptores de este proceso, uno por diario: un enrutador confirma en
+ * los de todas las particiones.  Se reabren al cambiar de generación.    */
+static struct { char archivo[64]; int fd; unsigned generacion; } fds_wal[MAX_PARTICIONES];
+static int num_fds_wal;
+static pthread_mutex_t mutex_fds = PTHREAD_MUTEX_INITIALIZER;
+
+/* banco en una partición: avisa de las ramas de dosfases.c que un recorte
+ * va a quitar del diario (dosfases_vigilar_diario).                       */
+static void (*aviso_ramas)(const uint32_t *xids, int n);
+
+static CeldaWAL *celdas_wal(DiarioWAL *w) {
+    return (CeldaWAL *)((char *)w + w->desplazamiento);
+}
+
+static uint32_t fnv1a(const void *p, size_t n) {
+    const unsigned char *b = p;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) { h ^= b[i]; h *= 16777619u; }
+    return h;
+}
+
+/* Sólo la llama el líder, así que la generación no cambia entretanto. */
+static int abrir_wal(DiarioWAL *w) {
+    unsigned gen = atomic_load(&w->generacion);
+    int fd = -1, i = 0;
+    pthread_mutex_lock(&mutex_fds);
+    while (i < num_fds_wal && strcmp(fds_wal[i].archivo, w->archivo) != 0) ++i;
+    if (i < num_fds_wal && fds_wal[i].generacion == gen) fd = fds_wal[i].fd;
+    else {
+        if (i < num_fds_wal) close(fds_wal[i].fd);
+        fd = open(w->archivo, O_WRONLY | O_CREAT, 0644);
+        if (fd == -1) {
+            perror(w->archivo);
+            if (i < num_fds_wal) fds_wal[i] = fds_wal[--num_fds_wal];
+        } else if (i < MAX_PARTICIONES) {
+            snprintf(fds_wal[i].archivo, sizeof fds_wal[0].archivo, "%s", w->archivo);
+            fds_wal[i].fd         = fd;
+            fds_wal[i].generacion = gen;
+            if (i == num_fds_wal) ++num_fds_wal;
+        }
+    }
+    pthread_mutex_unlock(&mutex_fds);
+    return fd;
+}
+
+/* fsync del directorio que contiene `ruta`, para que un rename persista. */
+static void sincronizar_directorio(const char *ruta) {
+    char copia[256];
+    snprintf(copia, sizeof copia, "%s", ruta);
+    int fd = open(dirname(copia), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return;
+    fsync(fd);
+    close(fd);
+}
+
+/* El mutex es robusto: si murió quien lo tenía, basta con darlo por bueno
+ * (lo que protege, `lider`, se revisa igualmente).                       */
+static void bloquear(DiarioWAL *w) {
+    if (pthread_mutex_lock(&w->mutex) == EOWNERDEAD)
+        pthread_mutex_consistent(&w->mutex);
+}
+
+/* Con el mutex tomado y un líder en marcha: espera a que acabe, como mucho
+ * ESPERA_LIDER_MS, y si para entonces su proceso ya no existe libera el
+ * puesto para que otro lo tome.                                          */
+static void esperar_lider(DiarioWAL *w) {
+    struct timespec plazo;
+    clock_gettime(CLOCK_MONOTONIC, &plazo);
+    plazo.tv_nsec += ESPERA_LIDER_MS * 1000000L;
+    if (plazo.tv_nsec >= 1000000000L) { plazo.tv_sec++; plazo.tv_nsec -= 1000000000L; }
+
+    int e = pthread_cond_timedwait(&w->volcado, &w->mutex, &plazo);
+    if (e == EOWNERDEAD) pthread_mutex_consistent(&w->mutex);
+    if (e == ETIMEDOUT && w->lider && kill(w->lider, 0) == -1 && errno == ESRCH) {
+        fprintf(stderr, "diario: el líder (pid %d) murió, se sigue sin él\n", (int)w->lider);
+        w->lider = 0;
+        pthread_cond_broadcast(&w->volcado);
+    }
+}
+
+/* Se hace líder (esperando al que haya) y vuelve sin el mutex. */
+static void tomar_liderazgo(DiarioWAL *w) {
+    bloquear(w);
+    while (w->lider) esperar_lider(w);
+    w->lider = getpid();
+    pthread_mutex_unlock(&w->mutex);
+}
+
+static void soltar_liderazgo(DiarioWAL *w) {
+    bloquear(w);
+    w->lider = 0;
+    pthread_cond_broadcast(&w->volcado);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+/*─────────────────────────────────────────────*/
+/*              INICIALIZACIÓN                 */
+/*─────────────────────────────────────────────*/
+
+/* `desplazamiento` es la distancia desde w hasta las `capacidad` celdas. */
+void wal_inicializar(DiarioWAL *w, const Config *cfg, size_t capacidad, size_t desplazamiento) {
+    w->activo = cfg->archivo_wal[0] != '\0';
+    snprintf(w->archivo, sizeof w->archivo, "%s", cfg->archivo_wal);
+    w->ventana_us     = cfg->ventana_grupo_us;
+    w->mascara        = capacidad - 1;
+    w->desplazamiento = desplazamiento;
+    w->max_registros  = (uint64_t)cfg->punto_control_wal_mb * 1024 * 1024 / sizeof(RegistroWAL);
+    w->lider          = 0;
+    w->hueco          = 0;
+    w->hueco_ns       = 0;
+    atomic_init(&w->reservado, 0);
+    atomic_init(&w->durable, 0);
+    atomic_init(&w->base, 0);
+    atomic_init(&w->generacion, 0);
+    atomic_init(&w->commits, 0);
+    atomic_init(&w->fsyncs, 0);
+    atomic_init(&w->anulados, 0);
+    for (int i = 0; i < MAX_REPLICAS; ++i) atomic_init(&w->retenido[i], UINT64_MAX);
+    inicializar_mutex_robusto(&w->mutex);
+    inicializar_cond_proceso_compartido(&w->volcado);
+
+    CeldaWAL *cs = celdas_wal(w);
+    for (size_t i = 0; i < capacidad; ++i) atomic_init(&cs[i].listo, 0);
+}
+
+/*─────────────────────────────────────────────*/
+/*            ANOTAR Y CONFIRMAR               */
+/*─────────────────────────────────────────────*/
+
+/* Copia `r` en la celda de su lsn.  Devuelve 0 si el líder ya la anuló
+ * (tardamos más de ESPERA_HUECO_NS): hay que reservar otro lsn.          */
+static int publicar(DiarioWAL *w, const RegistroWAL *r) {
+    CeldaWAL *c = &celdas_wal(w)[r->lsn & w->mascara];
+    uint64_t v = atomic_load(&c->listo);
+    if (LSN_CELDA(v) == r->lsn + 1 ||
+        !atomic_compare_exchange_strong(&c->listo, &v, (r->lsn + 1) | WAL_ESCRIBIENDO))
+        return 0;
+    c->r = *r;
+    uint64_t copiando = (r->lsn + 1) | WAL_ESCRIBIENDO;
+    return atomic_compare_exchange_strong_explicit(&c->listo, &copiando, r->lsn + 1,
+                                                   memory_order_release, memory_order_relaxed);
+}
+
+/* Da por nulo el hueco `lsn` si nadie lo ha completado. */
+static void anular(DiarioWAL *w, uint64_t lsn) {
+    CeldaWAL *c = &celdas_wal(w)[lsn & w->mascara];
+    uint64_t v = atomic_load(&c->listo);
+    while (LSN_CELDA(v) != lsn + 1 || (v & WAL_ESCRIBIENDO))
+        if (atomic_compare_exchange_weak(&c->listo, &v, (lsn + 1) | WAL_ANULADO)) {
+            atomic_fetch_add_explicit(&w->anulados, 1, memory_order_relaxed);
+            break;
+        }
+}
+
+/* Reserva el siguiente lsn y publica en su celda el registro `r`. */
+static uint64_t anotar(DiarioWAL *w, RegistroWAL *r) {
+    if (!w->activo) return 0;
+
+    for (;;) {
+        uint64_t lsn = atomic_fetch_add(&w->reservado, 1);
+
+        /* Anillo lleno: el hueco aún guarda un registro que no es durable. */
+        if (lsn > w->mascara) wal_confirmar(w, lsn - w->mascara - 1);
+
+        r->lsn  = lsn;
+        r->suma = fnv1a(r, offsetof(RegistroWAL, suma));
+        if (publicar(w, r)) {
+            atomic_fetch_add_explicit(&w->commits, 1, memory_order_relaxed);
+            return lsn;
+        }
+    }
+}
+
+/* Añade un registro con la post-imagen (céntimos) de cuenta[0] y, si
+ * cuenta[1] != -1, de cuenta[1].  Se llama con las cuentas bloqueadas.
+ * Devuelve el lsn a confirmar.                                           */
+uint64_t wal_anotar(DiarioWAL *w, TipoOp tipo, const int cuenta[2], const int64_t saldo[2]) {
+    RegistroWAL r = {
+        .tipo      = tipo,
+        .cuenta    = { cuenta[0], cuenta[1] },
+        .saldo     = { saldo[0],  cuenta[1] != -1 ? saldo[1] : 0 },
+    };
+    return anotar(w, &r);
+}
+
+/* Rama de la transferencia `xid` entre particiones (dosfases.c): se
+ * aplica como cualquier otro registro y además deja constancia de que la
+ * rama llegó a este diario.                                              */
+uint64_t wal_anotar_rama(DiarioWAL *w, int cuenta, int64_t saldo, uint32_t xid) {
+    RegistroWAL r = {
+        .tipo      = OP_DOS_FASES,
+        .cuenta    = { cuenta, -1 },
+        .resto     = (int32_t)xid,
+        .saldo     = { saldo, 0 },
+    };
+    return anotar(w, &r);
+}
+
+/* Post-imágenes de las n cuentas de un lote en ⌈n/2⌉ registros OP_LOTE
+ * de lsn consecutivos; `resto` cuenta hacia atrás hasta 0 en el último.
+ * Se llama con todas las cuentas bloqueadas.  Devuelve el último lsn.    */
+uint64_t wal_anotar_lote(DiarioWAL *w, const int *cuentas, const int64_t *saldos, int n) {
+    if (!w->activo) return 0;
+
+    int k = (n + 1) / 2;
+    for (;;) {
+        uint64_t lsn = atomic_fetch_add(&w->reservado, (uint64_t)k);
+        uint64_t ultimo = lsn + k - 1;
+        if (ultimo > w->mascara) wal_confirmar(w, ultimo - w->mascara - 1);
+
+        int j = 0;
+        for (; j < k; ++j) {
+            int b = 2 * j + 1 < n;
+            RegistroWAL r = {
+                .lsn    = lsn + j,
+                .tipo   = OP_LOTE,
+                .cuenta = { cuentas[2 * j], b ? cuentas[2 * j + 1] : -1 },
+                .resto  = k - 1 - j,
+                .saldo  = { saldos[2 * j],  b ? saldos[2 * j + 1]  : 0 },
+            };
+            r.suma = fnv1a(&r, offsetof(RegistroWAL, suma));
+            if (!publicar(w, &r)) break;
+        }
+        if (j == k) {
+            atomic_fetch_add_explicit(&w->commits, 1, memory_order_relaxed);
+            return ultimo;
+        }
+        /* Lote cortado por una anulación: lo que queda se anula también
+         * (al recuperar, un lote sin su último registro no se aplica) y
+         * se repite entero.                                              */
+        for (; j < k; ++j) anular(w, lsn + j);
+    }
+}
+
+/* ¿Caben los registros de un lote de n cuentas en el anillo?  Si no, el
+ * lote esperaría a sus propios registros para hacerse hueco.             */
+int wal_cabe_lote(const DiarioWAL *w, int n) {
+    return !w->activo || (size_t)(n + 1) / 2 <= w->mascara + 1;
+}
+
+/* ¿Está completa (o anulada) la celda de `lsn`? */
+static uint64_t celda_lista(DiarioWAL *w, uint64_t lsn) {
+    uint64_t v = atomic_load_explicit(&celdas_wal(w)[lsn & w->mascara].listo,
+                                      memory_order_acquire);
+    return LSN_CELDA(v) == lsn + 1 && !(v & WAL_ESCRIBIENDO) ? v : 0;
+}
+
+/* El líder no avanza porque `desde` está reservado y sin rellenar.  Si
+ * sigue así ESPERA_HUECO_NS (su dueño murió o está parado) se anula.     */
+static void vigilar_hueco(DiarioWAL *w, uint64_t desde) {
+    if (atomic_load(&w->reservado) <= desde) return;
+    uint64_t ahora = reloj_ns();
+    if (w->hueco != desde + 1) {
+        w->hueco    = desde + 1;
+        w->hueco_ns = ahora;
+    } else if (ahora - w->hueco_ns >= ESPERA_HUECO_NS) {
+        fprintf(stderr, "diario: lsn %llu sin rellenar, se anula\n", (unsigned long long)desde);
+        anular(w, desde);
+        w->hueco = 0;
+    }
+}
+
+/* Escribe los registros listos y consecutivos a partir de `desde` y los
+ * sincroniza con un único fdatasync.  Devuelve el nuevo lsn durable.     */
+static uint64_t volcar_listos(DiarioWAL *w, uint64_t desde) {
+    CeldaWAL *cs = celdas_wal(w);
+    uint64_t hasta = desde;
+    while (hasta - desde <= w->mascara && celda_lista(w, hasta)) ++hasta;
+    if (hasta == desde) {
+        vigilar_hueco(w, desde);
+        return desde;
+    }
+
+    int fd = abrir_wal(w);
+    if (fd == -1) return desde;
+    uint64_t base = atomic_load(&w->base);
+    uint64_t t0 = reloj_ns();
+
+    /* Los registros son contiguos en el anillo salvo al dar la vuelta. */
+    RegistroWAL lote[256];
+    uint64_t lsn = desde;
+    while (lsn < hasta) {
+        int n = 0;
+        while (lsn + n < hasta && n < 256) {
+            if (celda_lista(w, lsn + n) & WAL_ANULADO) {
+                RegistroWAL nulo = { .lsn = lsn + n, .tipo = OP_ANULADO, .cuenta = { -1, -1 } };
+                nulo.suma = fnv1a(&nulo, offsetof(RegistroWAL, suma));
+                lote[n] = nulo;
+            } else {
+                lote[n] = cs[(lsn + n) & w->mascara].r;
+            }
+            ++n;
+        }
+        if (pwrite(fd, lote, n * sizeof(RegistroWAL),
+                   (off_t)(lsn - base) * sizeof(RegistroWAL)) == -1) {
+            perror("pwrite wal");
+            return desde;
+        }
+        lsn += n;
+    }
+    if (fdatasync(fd) == -1) {
+        perror("fdatasync wal");
+        return desde;
+    }
+    atomic_fetch_add_explicit(&w->fsyncs, 1, memory_order_relaxed);
+    metrica_sumar(M_FSYNCS_WAL, 1);
+    metrica_observar(H_FSYNC_WAL, reloj_ns() - t0);
+    return hasta;
+}
+
+/* Bloquea hasta que el registro `lsn` esté en disco, actuando como líder
+ * del grupo si nadie lo está haciendo ya.                                */
+void wal_confirmar(DiarioWAL *w, uint64_t lsn) {
+    if (!w->activo) return;
+
+    bloquear(w);
+    while (atomic_load(&w->durable) <= lsn) {
+        if (w->lider) {
+            esperar_lider(w);
+            continue;
+        }
+        w->lider = getpid();
+        pthread_mutex_unlock(&w->mutex);
+
+        if (w->ventana_us > 0) {
+            struct timespec ventana = { 0, w->ventana_us * 1000L };
+            nanosleep(&ventana, NULL);
+        }
+        uint64_t desde = atomic_load(&w->durable);
+        uint64_t hasta = volcar_listos(w, desde);
+
+        bloquear(w);
+        atomic_store(&w->durable, hasta);
+        w->lider = 0;
+        pthread_cond_broadcast(&w->volcado);
+
+        if (hasta == desde) {            /* otro proceso aún rellena su hueco */
+            pthread_mutex_unlock(&w->mutex);
+            sched_yield();
+            bloquear(w);
+        }
+    }
+    pthread_mutex_unlock(&w->mutex);
+}
+
+/*─────────────────────────────────────────────*/
+/*             RECUPERACIÓN                    */
+/*─────────────────────────────────────────────*/
+
+static void aplicar_registro(TablaCuentas *t, const RegistroWAL *r) {
+    for (int k = 0; k < 2; ++k) {
+        if (r->cuenta[k] == -1) continue;
+        int idx = buscar_cuenta(t, r->cuenta[k]);
+        if (idx != -1) saldos_tabla(t)[idx] = r->saldo[k];
+    }
+}
+
+/* Siguiente registro válido del diario: el primero marca el lsn de
+ * partida (el fichero empieza en el `base` del último recorte) y los
+ * demás deben seguirle sin saltos.  0 en la cola o en el primer registro
+ * incompleto o corrupto (una escritura cortada).                         */
+static int leer_registro(FILE *f, RegistroWAL *r, uint64_t *siguiente) {
+    if (fread(r, sizeof *r, 1, f) != 1 ||
+        r->suma != fnv1a(r, offsetof(RegistroWAL, suma)) ||
+        (*siguiente != UINT64_MAX && r->lsn != *siguiente))
+        return 0;
+    *siguiente = r->lsn + 1;
+    return 1;
+}
+
+/* ¿Continúa `r` el lote a medias cuyo último registro es `previo`?  Un
+ * registro anulado en medio de un lote lo deja cortado para siempre.     */
+int wal_sigue_lote(const RegistroWAL *previo, const RegistroWAL *r) {
+    return r->tipo == OP_LOTE && r->resto == previo->resto - 1;
+}
+
+/* Reaplica el diario sobre la tabla recién cargada.  Se detiene en el
+ * primer registro incompleto o corrupto (cola de una escritura cortada);
+ * un lote cortado así, o por una anulación, no se aplica.  Devuelve
+ * cuántos registros se aplicaron.                                        */
+int wal_recuperar(TablaCuentas *t) {
+    DiarioWAL *w = &t->wal;
+    if (!w->activo) return 0;
+
+    FILE *f = fopen(w->archivo, "rb");
+    if (!f) return 0;
+
+    /* Los registros de un lote se guardan aparte hasta ver el último. */
+    RegistroWAL *lote = malloc((w->mascara + 1) * sizeof(RegistroWAL));
+    int en_lote = 0;
+
+    RegistroWAL r;
+    uint64_t siguiente = UINT64_MAX;
+    int n = 0;
+    while (leer_registro(f, &r, &siguiente)) {
+        if (en_lote > 0 && !wal_sigue_lote(&lote[en_lote - 1], &r)) en_lote = 0;
+
+        if (r.tipo == OP_LOTE) {
+            if ((size_t)en_lote > w->mascara) break;
+            lote[en_lote++] = r;
+            if (r.resto > 0) continue;
+            for (int j = 0; j < en_lote; ++j) aplicar_registro(t, &lote[j]);
+            n += en_lote;
+            en_lote = 0;
+        } else if (r.tipo != OP_ANULADO) {
+            aplicar_registro(t, &r);
+            ++n;
+        }
+    }
+    fclose(f);
+    free(lote);
+    return n;
+}
+
+/* xids de las ramas OP_DOS_FASES que hay en la parte válida del diario,
+ * en un vector nuevo (free) con *n elementos, o NULL si no hay ninguna.  */
+uint32_t *wal_ramas(const DiarioWAL *w, int *n) {
+    *n = 0;
+    if (!w->activo) return NULL;
+
+    FILE *f = fopen(w->archivo, "rb");
+    if (!f) return NULL;
+
+    uint32_t *xids = NULL;
+    int cap = 0;
+    RegistroWAL r;
+    uint64_t siguiente = UINT64_MAX;
+    while (leer_registro(f, &r, &siguiente)) {
+        if (r.tipo != OP_DOS_FASES) continue;
+        if (*n == cap) {
+            cap = cap ? 2 * cap : 256;
+            xids = realloc(xids, cap * sizeof *xids);
+        }
+        xids[(*n)++] = (uint32_t)r.resto;
+    }
+    fclose(f);
+    return xids;
+}
+
+/* Vacía el diario tras un punto de control.  Sólo con el resto de procesos
+ * parados (arranque y cierre de banco).                                  */
+void wal_truncar(DiarioWAL *w) {
+    if (!w->activo) return;
+
+    int fd = open(w->archivo, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { perror(w->archivo); return; }
+    fsync(fd);
+    close(fd);
+
+    CeldaWAL *cs = celdas_wal(w);
+    for (size_t i = 0; i <= w->mascara; ++i) atomic_store(&cs[i].listo, 0);
+    atomic_store(&w->reservado, 0);
+    atomic_store(&w->durable, 0);
+    atomic_store(&w->base, 0);
+    atomic_fetch_add(&w->generacion, 1);
+    w->lider = 0;
+    w->hueco = 0;
+}
+
+/*─────────────────────────────────────────────*/
+/*          RECORTE CON BANCO EN MARCHA        */
+/*─────────────────────────────────────────────*/
+
+/* ¿Ha crecido el diario por encima de PUNTO_CONTROL_WAL_MB? */
+int wal_crecido(const DiarioWAL *w) {
+    return w->activo && w->max_registros > 0 &&
+           atomic_load(&w->durable) - atomic_load(&w->base) >= w->max_registros;
+}
+
+/* Lsn hasta el que se puede recortar con un punto de control que cubre
+ * todo lo anterior a `corte`: no más allá de lo que aún lee una réplica. */
+uint64_t wal_corte(const DiarioWAL *w, uint64_t corte) {
+    for (int i = 0; i < MAX_REPLICAS; ++i) {
+        uint64_t r = atomic_load(&w->retenido[i]);
+        if (r < corte) corte = r;
+    }
+    return corte;
+}
+
+void wal_al_recortar(void (*aviso)(const uint32_t *xids, int n)) {
+    aviso_ramas = aviso;
+}
+
+/* Copia los registros [desde, hasta) del fichero `f` (que empieza en
+ * `base`) al final de `g`; con g == NULL sólo avisa de las ramas.        */
+static int copiar_registros(FILE *f, uint64_t base, uint64_t desde, uint64_t hasta, FILE *g) {
+    uint32_t *xids = NULL;
+    int n = 0, cap = 0;
+    RegistroWAL r;
+    fseek(f, (long)((desde - base) * sizeof r), SEEK_SET);
+    for (uint64_t lsn = desde; lsn < hasta; ++lsn) {
+        if (fread(&r, sizeof r, 1, f) != 1) { free(xids); return -1; }
+        if (g) { if (fwrite(&r, sizeof r, 1, g) != 1) { free(xids); return -1; } continue; }
+        if (r.tipo != OP_DOS_FASES) continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 64;
+            xids = realloc(xids, cap * sizeof *xids);
+        }
+        xids[n++] = (uint32_t)r.resto;
+    }
+    if (n > 0) aviso_ramas(xids, n);
+    free(xids);
+    return 0;
+}
+
+/* Quita del principio del diario los registros anteriores a `hasta`, cuyo
+ * efecto ya está sincronizado en cuentas.dat.  Lo llama el hilo IO con
+ * banco en marcha: como líder (nadie más escribe entretanto) copia lo que
+ * queda a un fichero nuevo y lo pone en su sitio con rename(), así que
+ * una caída deja el diario viejo o el nuevo, nunca uno a medias.         */
+void wal_recortar(DiarioWAL *w, uint64_t hasta) {
+    if (!w->activo) return;
+
+    tomar_liderazgo(w);
+    uint64_t base    = atomic_load(&w->base);
+    uint64_t durable = atomic_load(&w->durable);
+    if (hasta > durable) hasta = durable;
+    if (hasta <= base) { soltar_liderazgo(w); return; }
+
+    char tmp[80];
+    snprintf(tmp, sizeof tmp, "%s.tmp", w->archivo);
+    FILE *f = fopen(w->archivo, "rb");
+    FILE *g = fopen(tmp, "wb");
+    int error = !f || !g ||
+                (aviso_ramas && copiar_registros(f, base, base, hasta, NULL) == -1) ||
+                copiar_registros(f, base, hasta, durable, g) == -1 ||
+                fflush(g) != 0 || fsync(fileno(g)) == -1;
+    if (f) fclose(f);
+    if (g) fclose(g);
+    if (error || rename(tmp, w->archivo) == -1) {
+        perror("recortar diario");
+        unlink(tmp);
+        soltar_liderazgo(w);
+        return;
+    }
+    sincronizar_directorio(w->archivo);
+
+    atomic_store(&w->base, hasta);
+    atomic_fetch_add(&w->generacion, 1);
+    soltar_liderazgo(w);
+}